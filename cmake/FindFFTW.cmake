@@ -20,6 +20,8 @@ endif()
 
 find_library(_FFTW_SINGLE  NAMES fftw3f  PATHS ${LIB_PATHFFT} $ENV{FFTW_LIB} $ENV{FFTW_HOME} )
 find_library(_FFTW_DOUBLE  NAMES fftw3   PATHS ${LIB_PATHFFT} $ENV{FFTW_LIB} $ENV{FFTW_HOME} )
+find_library(_FFTW_SINGLE_THREADS  NAMES fftw3f_threads  PATHS ${LIB_PATHFFT} $ENV{FFTW_LIB} $ENV{FFTW_HOME} )
+find_library(_FFTW_DOUBLE_THREADS  NAMES fftw3_threads   PATHS ${LIB_PATHFFT} $ENV{FFTW_LIB} $ENV{FFTW_HOME} )
 
 if (FFTW_PATH AND FFTW_INCLUDES AND 
    (_FFTW_SINGLE OR NOT FFTW_FIND_REQUIRED_SINGLE) AND 
@@ -32,6 +34,18 @@ if (FFTW_PATH AND FFTW_INCLUDES AND
 	if (_FFTW_DOUBLE)
 		set(FFTW_LIBRARIES ${FFTW_LIBRARIES} ${_FFTW_DOUBLE})
 	endif()
+
+	# Optional multi-threaded transforms (they must be linked before the main libraries)
+	if ((_FFTW_SINGLE_THREADS OR NOT _FFTW_SINGLE) AND (_FFTW_DOUBLE_THREADS OR NOT _FFTW_DOUBLE))
+		set(FFTW_THREADS_FOUND TRUE)
+		if (_FFTW_DOUBLE_THREADS)
+			set(FFTW_LIBRARIES ${_FFTW_DOUBLE_THREADS} ${FFTW_LIBRARIES})
+		endif()
+		if (_FFTW_SINGLE_THREADS)
+			set(FFTW_LIBRARIES ${_FFTW_SINGLE_THREADS} ${FFTW_LIBRARIES})
+		endif()
+		message(STATUS "Found multi-threaded FFTW")
+	endif()
 	
 	message(STATUS "Found FFTW")
 	message(STATUS "FFTW_PATH: ${FFTW_PATH}")
@@ -0,0 +1,632 @@
+#!/usr/bin/env python3
+"""
+relion_benchmark
+----------------
+
+Synthetic end-to-end benchmarks for RELION.
+
+All input data are generated from a fixed random seed: a synthetic reference map,
+particles projected from it with relion_project (with CTFs and noise), micrographs
+with coordinates, and movies with a known drift. Then a number of fixed-seed
+scenarios are run and timed. For every scenario, the wall-clock time, the throughput
+and the peak memory use are written to a JSON file, which can be compared with the
+results of another build (e.g. from a different commit).
+
+Usage:
+    relion_benchmark.py --size small --j 8 --o Benchmark/
+    relion_benchmark.py --size medium --scenarios reconstruct,postprocess --bin_dir /path/to/relion/build/bin
+    relion_benchmark.py --compare old_results.json Benchmark/small_seed1993/results.json
+    relion_benchmark.py --size small --scenarios refine3d_mixed
+
+The refine3d_mixed scenario is not part of 'all': it repeats refine3d with --mixed_precision and
+validates it against the double-precision run by comparing the angular assignments and resolutions.
+
+The synthetic data are generated only once per size and seed and reused by subsequent runs.
+Generating the data requires numpy.
+"""
+
+import argparse
+import glob
+import json
+import math
+import os
+import platform
+import shutil
+import subprocess
+import sys
+import time
+
+# Parameters of the synthetic datasets
+SIZES = {
+    'small':  {'box': 64,  'angpix': 3.0, 'nr_particles': 1000,  'particles_per_mic': 100,
+               'nr_mics': 5,  'mic_size': 1024, 'nr_movies': 2, 'movie_size': 1024, 'nr_frames': 16,
+               'K': 10, 'class2d_iter': 5},
+    'medium': {'box': 128, 'angpix': 1.5, 'nr_particles': 5000,  'particles_per_mic': 100,
+               'nr_mics': 10, 'mic_size': 2048, 'nr_movies': 4, 'movie_size': 2048, 'nr_frames': 24,
+               'K': 20, 'class2d_iter': 10},
+    'large':  {'box': 256, 'angpix': 1.0, 'nr_particles': 20000, 'particles_per_mic': 100,
+               'nr_mics': 20, 'mic_size': 4096, 'nr_movies': 8, 'movie_size': 4096, 'nr_frames': 40,
+               'K': 50, 'class2d_iter': 25},
+}
+
+# Scenarios in the order in which they are run, and the scenarios whose output they need
+SCENARIOS = ['class2d', 'refine3d', 'refine3d_mixed', 'reconstruct', 'postprocess', 'extract', 'motioncorr', 'ctfrefine']
+REQUIRES = {'refine3d_mixed': ['refine3d'], 'postprocess': ['reconstruct'], 'ctfrefine': ['reconstruct', 'postprocess']}
+# Scenarios that are only run on request, because they validate another one rather than time a separate task
+VALIDATION_SCENARIOS = ['refine3d_mixed']
+OUT_DIRS = {'class2d': 'Class2D', 'refine3d': 'Refine3D', 'refine3d_mixed': 'Refine3D_mixed',
+            'reconstruct': 'Reconstruct', 'postprocess': 'PostProcess', 'extract': 'Extract',
+            'motioncorr': 'MotionCorr', 'ctfrefine': 'CtfRefine'}
+
+VOLTAGE = 300.
+CS = 2.7
+Q0 = 0.1
+SNR = 0.1
+DOSE_PER_FRAME = 1.
+
+
+def write_mrc(filename, data, angpix, mode=2, is_volume=False):
+    """ Write a 2D image, a 3D volume or a stack (z, y, x) in MRC format """
+    import numpy as np
+
+    if data.ndim == 2:
+        data = data[np.newaxis, :, :]
+    nz, ny, nx = data.shape
+    dtype = {0: np.int8, 1: np.int16, 2: np.float32}[mode]
+    data = np.ascontiguousarray(data, dtype=dtype)
+
+    header = np.zeros(256, dtype=np.int32)
+    fheader = header.view(np.float32)
+    header[0:3] = (nx, ny, nz)
+    header[3] = mode
+    header[7:10] = (nx, ny, nz)
+    fheader[10:13] = (nx * angpix, ny * angpix, nz * angpix)
+    fheader[13:16] = (90., 90., 90.)
+    header[16:19] = (1, 2, 3)
+    fheader[19] = data.min()
+    fheader[20] = data.max()
+    fheader[21] = data.mean()
+    header[22] = 1 if is_volume else 0
+    header[52] = int.from_bytes(b'MAP ', 'little')
+    header[53] = int.from_bytes(b'\x44\x44\x00\x00', 'little')
+    fheader[54] = data.std()
+
+    with open(filename, 'wb') as f:
+        header.tofile(f)
+        data.tofile(f)
+
+
+def write_star(filename, tables):
+    """ Write a STAR file from a list of (name, labels, rows) """
+    with open(filename, 'w') as f:
+        f.write('\n# version 30001\n')
+        for name, labels, rows in tables:
+            f.write('\ndata_{}\n\nloop_ \n'.format(name))
+            for i, label in enumerate(labels):
+                f.write('_rln{} #{} \n'.format(label, i + 1))
+            for row in rows:
+                f.write(' '.join(str(v) for v in row) + ' \n')
+            f.write('\n')
+
+
+def read_star(filename, block):
+    """ Read one data block of a STAR file into a dict of columns (for a loop) or of values """
+    columns, rows, values = [], [], {}
+    in_block, in_loop = False, False
+    with open(filename) as f:
+        for line in f:
+            words = line.split()
+            if not words or words[0].startswith('#'):
+                continue
+            if words[0].startswith('data_'):
+                if in_block:
+                    break
+                in_block = words[0] == 'data_' + block
+            elif not in_block:
+                continue
+            elif words[0] == 'loop_':
+                in_loop = True
+            elif words[0].startswith('_rln'):
+                if in_loop:
+                    columns.append(words[0][4:])
+                else:
+                    values[words[0][4:]] = words[1]
+            elif in_loop:
+                rows.append(words)
+
+    if not columns:
+        return values
+    return dict((label, [row[i] for row in rows]) for i, label in enumerate(columns))
+
+
+def optics_table(p, image_size=None):
+    labels = ['OpticsGroupName', 'OpticsGroup', 'MicrographOriginalPixelSize', 'Voltage', 'SphericalAberration',
+              'AmplitudeContrast']
+    row = ['opticsGroup1', 1, p['angpix'], VOLTAGE, CS, Q0]
+    if image_size is not None:
+        labels += ['ImagePixelSize', 'ImageSize', 'ImageDimensionality']
+        row += [p['angpix'], image_size, 2]
+    return ('optics', labels, [row])
+
+
+class SyntheticData(object):
+    """ Generates the inputs of all scenarios for one size and seed """
+
+    def __init__(self, args, p, relion):
+        self.args = args
+        self.p = p
+        self.relion = relion
+        self.dir = 'Synthetic/'
+
+    def generate(self):
+        if os.path.exists(self.dir + 'DONE'):
+            print(' + Using the synthetic data in {}{}'.format(os.getcwd() + '/', self.dir))
+            return
+
+        import numpy as np
+
+        print(' + Generating synthetic data in {}{} ...'.format(os.getcwd() + '/', self.dir))
+        if os.path.exists(self.dir):
+            shutil.rmtree(self.dir)
+        os.makedirs(self.dir + 'Micrographs')
+        os.makedirs(self.dir + 'Movies')
+        os.makedirs(self.dir + 'Coordinates/' + self.dir + 'Micrographs')
+
+        rng = np.random.RandomState(self.args.seed)
+
+        proj_stddev = self.make_map(rng)
+        self.make_particles(rng, proj_stddev)
+        self.make_micrographs(rng)
+        self.make_movies(rng)
+
+        # Ground-truth mask and initial reference for 3D auto-refine
+        self.relion.run('mask_create', ['--i', self.dir + 'map.mrc', '--o', self.dir + 'mask.mrc',
+                                        '--lowpass', '15', '--angpix', str(self.p['angpix']),
+                                        '--ini_threshold', '0.01', '--extend_inimask', '2',
+                                        '--width_soft_edge', '5', '--j', str(self.args.j)],
+                        self.dir + 'setup.log')
+        self.relion.run('image_handler', ['--i', self.dir + 'map.mrc', '--o', self.dir + 'ref_lp30.mrc',
+                                          '--lowpass', '30'],
+                        self.dir + 'setup.log')
+
+        open(self.dir + 'DONE', 'w').close()
+
+    def make_map(self, rng):
+        """ An asymmetric assembly of domains of Gaussian atoms; returns the stddev of its projections """
+        import numpy as np
+
+        box, angpix = self.p['box'], self.p['angpix']
+        vol = np.zeros((box, box, box), dtype=np.float32)
+
+        sigma = max(1.5 / angpix, 0.7)
+        half = int(math.ceil(3. * sigma))
+        offsets = np.arange(-half, half + 1)
+        nr_atoms = 50 * box
+
+        centres = rng.normal(0., 0.12 * box, size=(6, 3))
+        for c in rng.randint(0, len(centres), size=nr_atoms):
+            pos = centres[c] + rng.normal(0., 0.06 * box, size=3)
+            if np.linalg.norm(pos) > 0.3 * box:
+                continue
+            pos += box // 2
+            ip = np.floor(pos).astype(int)
+            zz, yy, xx = [ip[i] + offsets for i in range(3)]
+            if zz.min() < 0 or zz.max() >= box or yy.min() < 0 or yy.max() >= box or xx.min() < 0 or xx.max() >= box:
+                continue
+            dz, dy, dx = [(ip[i] + offsets - pos[i]) ** 2 for i in range(3)]
+            blob = np.exp(-(dz[:, None, None] + dy[None, :, None] + dx[None, None, :]) / (2. * sigma * sigma))
+            vol[zz[0]:zz[-1] + 1, yy[0]:yy[-1] + 1, xx[0]:xx[-1] + 1] += blob
+
+        vol /= vol.max()
+        write_mrc(self.dir + 'map.mrc', vol, angpix, is_volume=True)
+
+        return float(vol.sum(axis=0).std())
+
+    def make_particles(self, rng, proj_stddev):
+        """ Random orientations, offsets and CTFs, projected by relion_project with noise """
+        import numpy as np
+
+        p = self.p
+        n = p['nr_particles']
+        rot = rng.uniform(0., 360., n)
+        tilt = np.degrees(np.arccos(1. - 2. * rng.uniform(0., 1., n)))
+        psi = rng.uniform(0., 360., n)
+        xoff = rng.normal(0., 2. * p['angpix'], n)
+        yoff = rng.normal(0., 2. * p['angpix'], n)
+
+        rows = []
+        for i in range(n):
+            mic = i // p['particles_per_mic']
+            if i % p['particles_per_mic'] == 0:
+                defocus = rng.uniform(8000., 25000.)
+                astig = rng.uniform(0., 500.)
+                angle = rng.uniform(0., 180.)
+            rows.append(['Micrographs/mic{:04d}.mrc'.format(mic + 1),
+                         '{:.6f}'.format(rot[i]), '{:.6f}'.format(tilt[i]), '{:.6f}'.format(psi[i]),
+                         '{:.6f}'.format(xoff[i]), '{:.6f}'.format(yoff[i]),
+                         '{:.2f}'.format(defocus + astig), '{:.2f}'.format(defocus - astig), '{:.2f}'.format(angle),
+                         i % 2 + 1, 1])
+
+        labels = ['MicrographName', 'AngleRot', 'AngleTilt', 'AnglePsi', 'OriginXAngst', 'OriginYAngst',
+                  'DefocusU', 'DefocusV', 'DefocusAngle', 'RandomSubset', 'OpticsGroup']
+        write_star(self.dir + 'orientations.star',
+                   [optics_table(p, p['box']), ('particles', labels, rows)])
+
+        self.relion.run('project', ['--i', self.dir + 'map.mrc', '--ang', self.dir + 'orientations.star',
+                                    '--o', self.dir + 'particles', '--ctf', '--add_noise',
+                                    '--white_noise', '{:.6f}'.format(proj_stddev / math.sqrt(SNR)),
+                                    '--random_seed', str(self.args.seed)],
+                        self.dir + 'setup.log')
+
+    def make_micrographs(self, rng):
+        """ Noise micrographs with particle coordinates on a jittered grid """
+        import numpy as np
+
+        p = self.p
+        size, box = p['mic_size'], p['box']
+        spacing = int(1.5 * box)
+        grid = np.arange(box, size - box, spacing)
+
+        rows = []
+        for m in range(p['nr_mics']):
+            fn_mic = self.dir + 'Micrographs/mic{:04d}.mrc'.format(m + 1)
+            write_mrc(fn_mic, rng.normal(0., 1., (size, size)), p['angpix'])
+            rows.append([fn_mic, 1, '{:.2f}'.format(rng.uniform(8000., 25000.)),
+                         '{:.2f}'.format(rng.uniform(8000., 25000.)), '{:.2f}'.format(rng.uniform(0., 180.))])
+
+            coords = []
+            for y in grid:
+                for x in grid:
+                    jitter = rng.randint(-box // 4, box // 4 + 1, 2)
+                    coords.append([x + jitter[0], y + jitter[1]])
+            with open(self.dir + 'Coordinates/' + fn_mic[:-4] + '_pick.star', 'w') as f:
+                f.write('\ndata_\n\nloop_ \n_rlnCoordinateX #1 \n_rlnCoordinateY #2 \n')
+                for c in coords:
+                    f.write('{} {}\n'.format(c[0], c[1]))
+
+        optics = optics_table(p)
+        optics[1].append('MicrographPixelSize')
+        optics[2][0].append(p['angpix'])
+        write_star(self.dir + 'micrographs.star',
+                   [optics, ('micrographs', ['MicrographName', 'OpticsGroup', 'DefocusU', 'DefocusV', 'DefocusAngle'],
+                             rows)])
+
+    def make_movies(self, rng):
+        """ Poisson-distributed counts on a smooth random pattern that drifts by whole pixels """
+        import numpy as np
+
+        p = self.p
+        size, nr_frames = p['movie_size'], p['nr_frames']
+        dose_per_pixel = DOSE_PER_FRAME * p['angpix'] * p['angpix']
+
+        rows = []
+        for m in range(p['nr_movies']):
+            F = np.fft.rfft2(rng.normal(0., 1., (size, size)))
+            ky = np.fft.fftfreq(size)[:, None]
+            kx = np.fft.rfftfreq(size)[None, :]
+            F *= np.exp(-(kx * kx + ky * ky) * (size / 16.) ** 2)
+            pattern = np.fft.irfft2(F, s=(size, size))
+            pattern = 1. + 0.3 * pattern / pattern.std()
+            np.clip(pattern, 0., None, out=pattern)
+
+            drift = rng.normal(0., 0.5, 2)
+            frames = np.empty((nr_frames, size, size), dtype=np.int16)
+            for f in range(nr_frames):
+                shift = np.round(drift * f).astype(int)
+                frames[f] = rng.poisson(dose_per_pixel * np.roll(pattern, tuple(shift), axis=(0, 1)))
+
+            fn_movie = self.dir + 'Movies/movie{:04d}.mrcs'.format(m + 1)
+            write_mrc(fn_movie, frames, p['angpix'], mode=1)
+            rows.append([fn_movie, 1])
+
+        write_star(self.dir + 'movies.star',
+                   [optics_table(p), ('movies', ['MicrographMovieName', 'OpticsGroup'], rows)])
+
+
+class Relion(object):
+    """ Runs RELION programs and measures their time and peak memory """
+
+    def __init__(self, bin_dir):
+        self.bin_dir = bin_dir
+
+    def executable(self, program):
+        name = 'relion_' + program
+        return os.path.join(self.bin_dir, name) if self.bin_dir else name
+
+    def run(self, program, args, fn_log):
+        """ Returns the wall-clock time (s) and the maximum resident set size (MB) """
+        command = [self.executable(program)] + args
+        with open(fn_log, 'a') as log:
+            log.write(' '.join(command) + '\n')
+            log.flush()
+            start = time.time()
+            proc = subprocess.Popen(command, stdout=log, stderr=subprocess.STDOUT)
+            _, status, usage = os.wait4(proc.pid, 0)
+            wall_time = time.time() - start
+            proc.returncode = status
+
+        if status != 0:
+            sys.exit('ERROR: {} failed; see {}'.format(' '.join(command), fn_log))
+
+        # ru_maxrss is in kB on Linux and in bytes on macOS
+        peak_mb = usage.ru_maxrss / (1024. * 1024. if sys.platform == 'darwin' else 1024.)
+        return wall_time, peak_mb
+
+    def version(self):
+        try:
+            out = subprocess.check_output([self.executable('refine'), '--version'], stderr=subprocess.STDOUT)
+            return out.decode().strip().splitlines()[0]
+        except (OSError, subprocess.CalledProcessError, IndexError):
+            return 'unknown'
+
+
+def scenario_commands(name, p, args):
+    """ The commands of a scenario, the number of units it processes, and the name of those units """
+    box, angpix, seed, j = p['box'], p['angpix'], str(args.seed), str(args.j)
+    diameter = '{:.1f}'.format(0.75 * box * angpix)
+    particles = 'Synthetic/particles.star'
+
+    if name == 'class2d':
+        return ([('refine', ['--i', particles, '--o', 'Class2D/run', '--K', str(p['K']), '--iter', str(p['class2d_iter']),
+                             '--tau2_fudge', '2', '--particle_diameter', diameter, '--ctf', '--flatten_solvent',
+                             '--zero_mask', '--oversampling', '1', '--psi_step', '12', '--offset_range', '5',
+                             '--offset_step', '2', '--norm', '--scale', '--pad', '2', '--pool', '30',
+                             '--dont_combine_weights_via_disc', '--random_seed', seed, '--j', j])],
+                p['nr_particles'] * p['class2d_iter'], 'particle-iterations')
+
+    if name in ('refine3d', 'refine3d_mixed'):
+        # The number of iterations is only known afterwards
+        mixed = ['--mixed_precision'] if name == 'refine3d_mixed' else []
+        return ([('refine', ['--i', particles, '--o', OUT_DIRS[name] + '/run', '--auto_refine', '--split_random_halves',
+                             '--ref', 'Synthetic/ref_lp30.mrc', '--ini_high', '30', '--ctf', '--particle_diameter', diameter,
+                             '--flatten_solvent', '--zero_mask', '--oversampling', '1', '--healpix_order', '2',
+                             '--auto_local_healpix_order', '4', '--offset_range', '5', '--offset_step', '2',
+                             '--sym', 'C1', '--low_resol_join_halves', '40', '--norm', '--scale', '--pad', '2',
+                             '--pool', '30', '--dont_combine_weights_via_disc', '--random_seed', seed, '--j', j] + mixed)],
+                None, 'particle-iterations')
+
+    if name == 'reconstruct':
+        return ([('reconstruct', ['--i', particles, '--o', 'Reconstruct/half{}.mrc'.format(half),
+                                  '--subset', str(half), '--ctf'])
+                 for half in (1, 2)],
+                p['nr_particles'], 'particles')
+
+    if name == 'postprocess':
+        return ([('postprocess', ['--i', 'Reconstruct/half1.mrc', '--i2', 'Reconstruct/half2.mrc',
+                                  '--mask', 'Synthetic/mask.mrc', '--angpix', str(angpix), '--auto_bfac',
+                                  '--o', 'PostProcess/postprocess'])],
+                box ** 3, 'voxels')
+
+    if name == 'extract':
+        size, spacing = p['mic_size'], int(1.5 * box)
+        per_mic = len(range(box, size - box, spacing)) ** 2
+        return ([('preprocess', ['--i', 'Synthetic/micrographs.star', '--coord_dir', 'Synthetic/Coordinates/',
+                                 '--coord_suffix', '_pick.star', '--part_star', 'Extract/particles.star',
+                                 '--part_dir', 'Extract/', '--extract', '--extract_size', str(box), '--norm',
+                                 '--bg_radius', str(int(0.375 * box)), '--invert_contrast'])],
+                p['nr_mics'] * per_mic, 'particles')
+
+    if name == 'motioncorr':
+        return ([('run_motioncorr', ['--i', 'Synthetic/movies.star', '--o', 'MotionCorr/', '--use_own',
+                                     '--first_frame_sum', '1', '--last_frame_sum', '-1', '--bin_factor', '1',
+                                     '--bfactor', '150', '--dose_weighting', '--dose_per_frame', str(DOSE_PER_FRAME),
+                                     '--preexposure', '0', '--patch_x', '5', '--patch_y', '5',
+                                     '--grouping_for_ps', '4', '--ps_size', str(min(512, p['movie_size'] // 2)),
+                                     '--j', j])],
+                p['nr_movies'] * p['nr_frames'], 'frames')
+
+    if name == 'ctfrefine':
+        return ([('ctf_refine', ['--i', particles, '--o', 'CtfRefine/', '--f', 'PostProcess/postprocess.star',
+                                 '--m1', 'Reconstruct/half1.mrc', '--m2', 'Reconstruct/half2.mrc',
+                                 '--mask', 'Synthetic/mask.mrc', '--angpix_ref', str(angpix),
+                                 '--fit_defocus', '--kmin_defocus', '30', '--fit_mode', 'fpmfm', '--j', j])],
+                p['nr_particles'], 'particles')
+
+    raise ValueError('Unknown scenario: ' + name)
+
+
+def count_refine3d_iterations(out_dir):
+    return len(glob.glob(out_dir + '/run_it[0-9][0-9][0-9]_optimiser.star')) - 1
+
+
+def euler_matrix(rot, tilt, psi):
+    """ RELION's (ZYZ) rotation matrices for arrays of Euler angles in degrees, shape (n, 3, 3) """
+    import numpy as np
+    a, b, g = np.radians(rot), np.radians(tilt), np.radians(psi)
+    ca, sa, cb, sb, cg, sg = np.cos(a), np.sin(a), np.cos(b), np.sin(b), np.cos(g), np.sin(g)
+    cc, cs, sc, ss = cb * ca, cb * sa, sb * ca, sb * sa
+    return np.stack([np.stack([cg * cc - sg * sa, cg * cs + sg * ca, -cg * sb], axis=-1),
+                     np.stack([-sg * cc - cg * sa, -sg * cs + cg * ca, sg * sb], axis=-1),
+                     np.stack([sc, ss, cb], axis=-1)], axis=-2)
+
+
+def final_resolution(out_dir):
+    """ The resolution (in A) in the model.star file of the last iteration """
+    fn_models = sorted(glob.glob(out_dir + '/run_model.star'))
+    if not fn_models:
+        fn_models = sorted(glob.glob(out_dir + '/run_it[0-9][0-9][0-9]_half1_model.star'))
+    if not fn_models:
+        return None
+    return float(read_star(fn_models[-1], 'model_general')['CurrentResolution'])
+
+
+def validate_refinement(ref_dir, test_dir):
+    """ Compare the angular assignments, offsets and resolutions of two refinements of the same particles """
+    import numpy as np
+    ref = read_star(ref_dir + '/run_data.star', 'particles')
+    test = read_star(test_dir + '/run_data.star', 'particles')
+    order_ref = np.argsort(ref['ImageName'])
+    order_test = np.argsort(test['ImageName'])
+    if [ref['ImageName'][i] for i in order_ref] != [test['ImageName'][i] for i in order_test]:
+        sys.exit('ERROR: {} and {} contain different particles'.format(ref_dir, test_dir))
+
+    def column(table, label, order):
+        return np.array(table[label], dtype=float)[order]
+
+    angles = [euler_matrix(*[column(t, l, o) for l in ('AngleRot', 'AngleTilt', 'AnglePsi')])
+              for t, o in ((ref, order_ref), (test, order_test))]
+    # Angle of the rotation between the two assignments
+    trace = np.einsum('nij,nij->n', angles[0], angles[1])
+    angular_error = np.degrees(np.arccos(np.clip((trace - 1.) / 2., -1., 1.)))
+    offset_error = np.hypot(column(ref, 'OriginXAngst', order_ref) - column(test, 'OriginXAngst', order_test),
+                            column(ref, 'OriginYAngst', order_ref) - column(test, 'OriginYAngst', order_test))
+
+    resolution_ref, resolution_test = final_resolution(ref_dir), final_resolution(test_dir)
+    return {'reference': ref_dir,
+            'median_angular_difference': round(float(np.median(angular_error)), 3),
+            'p95_angular_difference': round(float(np.percentile(angular_error, 95)), 3),
+            'median_offset_difference': round(float(np.median(offset_error)), 3),
+            'p95_offset_difference': round(float(np.percentile(offset_error, 95)), 3),
+            'resolution_reference': resolution_ref,
+            'resolution': resolution_test}
+
+
+def run_scenario(name, p, args, relion):
+    commands, count, unit = scenario_commands(name, p, args)
+    out_dir = OUT_DIRS[name]
+
+    times = []
+    for _ in range(args.repeat):
+        if os.path.exists(out_dir):
+            shutil.rmtree(out_dir)
+        os.makedirs(out_dir)
+
+        wall_time, peak_mb = 0., 0.
+        for program, program_args in commands:
+            t, m = relion.run(program, program_args, out_dir + '/benchmark.log')
+            wall_time += t
+            peak_mb = max(peak_mb, m)
+        times.append(wall_time)
+
+    if name in ('refine3d', 'refine3d_mixed'):
+        count = p['nr_particles'] * count_refine3d_iterations(out_dir)
+
+    # The fastest repetition is the least disturbed by other processes
+    wall_time = min(times)
+
+    result = {'scenario': name, 'wall_time': round(wall_time, 3), 'all_wall_times': [round(t, 3) for t in times],
+              'count': count, 'unit': unit, 'throughput': count / wall_time if wall_time > 0. else 0.,
+              'peak_rss_mb': round(peak_mb, 1)}
+    if name == 'refine3d_mixed':
+        result['validation'] = validate_refinement(OUT_DIRS['refine3d'], out_dir)
+    return result
+
+
+def run_benchmarks(args):
+    p = SIZES[args.size]
+
+    scenarios = ([s for s in SCENARIOS if s not in VALIDATION_SCENARIOS] if args.scenarios == 'all'
+                 else args.scenarios.split(','))
+    for s in scenarios:
+        if s not in SCENARIOS:
+            sys.exit('ERROR: unknown scenario {}; choose from {}'.format(s, ', '.join(SCENARIOS)))
+
+    # Add the scenarios whose output is needed, and keep the order of SCENARIOS
+    needed = set(scenarios)
+    for s in scenarios:
+        needed.update(REQUIRES.get(s, []))
+    scenarios = [s for s in SCENARIOS if s in needed]
+
+    bin_dir = os.path.abspath(args.bin_dir) if args.bin_dir else ''
+    relion = Relion(bin_dir)
+
+    work_dir = os.path.join(args.o, '{}_seed{}'.format(args.size, args.seed))
+    if not os.path.exists(work_dir):
+        os.makedirs(work_dir)
+    fn_json = os.path.abspath(args.json if args.json else os.path.join(work_dir, 'results.json'))
+    os.chdir(work_dir)
+
+    SyntheticData(args, p, relion).generate()
+
+    results = []
+    for s in scenarios:
+        print(' + Running {} ...'.format(s))
+        r = run_scenario(s, p, args, relion)
+        print('   {:.1f} s, {:.4g} {}/s, peak memory {:.0f} MB'.format(r['wall_time'], r['throughput'], r['unit'],
+                                                                       r['peak_rss_mb']))
+        if 'validation' in r:
+            v = r['validation']
+            print('   compared with {}: median (95th percentile) angular difference {} ({}) deg, '
+                  'median (95th percentile) offset difference {} ({}) A, resolution {} A (was {} A)'.format(
+                      v['reference'], v['median_angular_difference'], v['p95_angular_difference'],
+                      v['median_offset_difference'], v['p95_offset_difference'], v['resolution'],
+                      v['resolution_reference']))
+        results.append(r)
+
+    report = {'relion_benchmark': 1,
+              'relion_version': relion.version(),
+              'date': time.strftime('%Y-%m-%d %H:%M:%S'),
+              'host': platform.node(),
+              'machine': platform.machine(),
+              'nr_cpus': os.cpu_count(),
+              'size': args.size,
+              'parameters': p,
+              'seed': args.seed,
+              'threads': args.j,
+              'repeat': args.repeat,
+              'results': results}
+
+    with open(fn_json, 'w') as f:
+        json.dump(report, f, indent=2)
+    print(' + Written results in ' + fn_json)
+
+
+def compare(fn_old, fn_new, tolerance):
+    """ Print the relative changes in throughput and memory; returns the number of regressions """
+    with open(fn_old) as f:
+        old = json.load(f)
+    with open(fn_new) as f:
+        new = json.load(f)
+
+    if old['size'] != new['size'] or old['seed'] != new['seed'] or old['threads'] != new['threads']:
+        print('WARNING: the results were obtained with different sizes, seeds or numbers of threads')
+
+    print('{:<12} {:>14} {:>14} {:>9} {:>10} {:>10} {:>9}'.format(
+        'scenario', 'old/s', 'new/s', 'speed', 'old MB', 'new MB', 'memory'))
+
+    old_results = dict((r['scenario'], r) for r in old['results'])
+    nr_regressions = 0
+    for r in new['results']:
+        o = old_results.get(r['scenario'])
+        if o is None or o['throughput'] <= 0. or o['peak_rss_mb'] <= 0.:
+            continue
+        speed = r['throughput'] / o['throughput']
+        memory = r['peak_rss_mb'] / o['peak_rss_mb']
+        flags = []
+        if speed < 1. - tolerance:
+            flags.append('SLOWER')
+        if memory > 1. + tolerance:
+            flags.append('MORE MEMORY')
+        nr_regressions += len(flags)
+        print('{:<12} {:>14.4g} {:>14.4g} {:>8.2f}x {:>10.0f} {:>10.0f} {:>8.2f}x  {}'.format(
+            r['scenario'], o['throughput'], r['throughput'], speed, o['peak_rss_mb'], r['peak_rss_mb'], memory,
+            ' '.join(flags)))
+
+    return nr_regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Synthetic end-to-end benchmarks for RELION')
+    parser.add_argument('--size', choices=sorted(SIZES.keys()), default='small', help='Size of the synthetic datasets')
+    parser.add_argument('--scenarios', default='all',
+                        help='Comma-separated list of scenarios ({}), or all (which excludes {})'.format(
+                            ', '.join(SCENARIOS), ', '.join(VALIDATION_SCENARIOS)))
+    parser.add_argument('--o', default='Benchmark/', help='Output directory')
+    parser.add_argument('--json', default='', help='Output JSON file (default: results.json in the output directory)')
+    parser.add_argument('--bin_dir', default='', help='Directory with the RELION executables (default: from the PATH)')
+    parser.add_argument('--j', type=int, default=1, help='Number of threads')
+    parser.add_argument('--seed', type=int, default=1993, help='Random seed for the data and all programs')
+    parser.add_argument('--repeat', type=int, default=1, help='Run each scenario this many times and report the fastest')
+    parser.add_argument('--compare', nargs=2, metavar=('OLD', 'NEW'), help='Compare two JSON result files')
+    parser.add_argument('--tolerance', type=float, default=0.1,
+                        help='Relative change in throughput or memory that counts as a regression (with --compare)')
+    args = parser.parse_args()
+
+    if args.compare:
+        sys.exit(1 if compare(args.compare[0], args.compare[1], args.tolerance) > 0 else 0)
+
+    run_benchmarks(args)
+
+
+if __name__ == '__main__':
+    main()
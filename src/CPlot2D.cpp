@@ -18,6 +18,11 @@
 //
 
 #include <math.h>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
 #include <iostream>
 #include <float.h>
 #include <fstream>
@@ -28,12 +33,7 @@
 
 void joinMultipleEPSIntoSinglePDF(FileName fn_pdf, std::vector<FileName> fn_eps)
 {
-
-    FileName fn_list = fn_pdf + ".lst";
-    std::string command = "gs -sDEVICE=pdfwrite -dNOPAUSE -dBATCH -dSAFER -dDEVICEWIDTHPOINTS=800 -dDEVICEHEIGHTPOINTS=800 -sOutputFile=";
-    command += fn_pdf + " @" + fn_list;
-    std::ofstream filelist(fn_pdf + ".lst");
-    bool have_at_least_one = false;
+    std::vector<FileName> fn_existing;
     for (int i = 0; i < fn_eps.size(); i++)
     {
         // fn_eps[i] could be a Linux wildcard...
@@ -42,38 +42,47 @@ void joinMultipleEPSIntoSinglePDF(FileName fn_pdf, std::vector<FileName> fn_eps)
         for (long int j= 0; j < all_eps_files.size(); j++)
         {
         	if (exists(all_eps_files[j]))
-        	{
-        		filelist << all_eps_files[j] << "\n";
-        		have_at_least_one = true;
-        	}
+        		fn_existing.push_back(all_eps_files[j]);
         }
     }
-    filelist.close();
 
-    bool have_error_in_gs = false;
-    if (have_at_least_one)
-    {
-		command += " > /dev/null";
-
-		if (system(command.c_str()))
-		{
-			std::cerr << " ERROR in executing: " << command << "\n";
-			have_error_in_gs = true;
-		}
-    }
-    else
+    if (fn_existing.size() == 0)
     {
     	std::cerr << " Did not find any of the expected EPS files to generate a PDF file" << "\n";
+    	std::cerr << " + Will make an empty PDF-file in " << fn_pdf << "\n";
+    	touch(fn_pdf);
+    	return;
     }
 
-    // std::remove(fn_list.c_str()); // don't know why but Ghostscript fails with this line.
-    // system() should wait the termination of the program, so this is very strange...
-    if (!have_at_least_one || have_error_in_gs)
+    // Our own plots do not need Ghostscript
+    bool is_all_cplot2d = true;
     {
-    	std::cerr << " + Will make an empty PDF-file in " << fn_pdf << "\n";
-    	touch(fn_pdf);
+        CPlot2DDocument document;
+        document.Open(fn_pdf);
+        for (long int i = 0; i < fn_existing.size() && is_all_cplot2d; i++)
+            is_all_cplot2d = document.AddPostScriptPage(fn_existing[i]);
+        document.Close();
     }
+    if (is_all_cplot2d)
+        return;
+
+    FileName fn_list = fn_pdf + ".lst";
+    std::string command = "gs -sDEVICE=pdfwrite -dNOPAUSE -dBATCH -dSAFER -dDEVICEWIDTHPOINTS=800 -dDEVICEHEIGHTPOINTS=800 -sOutputFile=";
+    command += fn_pdf + " @" + fn_list;
+    std::ofstream filelist(fn_pdf + ".lst");
+    for (long int i = 0; i < fn_existing.size(); i++)
+        filelist << fn_existing[i] << "\n";
+    filelist.close();
 
+    command += " > /dev/null";
+    if (system(command.c_str()))
+    {
+        std::cerr << " ERROR in executing: " << command << "\n";
+        std::cerr << " + Will make an empty PDF-file in " << fn_pdf << "\n";
+        touch(fn_pdf);
+    }
+    // std::remove(fn_list.c_str()); // don't know why but Ghostscript fails with this line.
+    // system() should wait the termination of the program, so this is very strange...
 }
 
 CPlot2D::CPlot2D(std::string title)
@@ -154,9 +163,28 @@ CPlot2D::~CPlot2D()
 
 void CPlot2D::OutputPostScriptPlot(std::string fileName)
 {
+    std::ofstream fh(fileName.c_str());
+    OutputPostScriptPlot(fh);
+}
 
-    outputFile.open(fileName.c_str());
+void CPlot2D::OutputPostScriptPlot(std::ostream &out)
+{
+    outputFile.str("");
+    DrawPostScript();
+    out << outputFile.str();
+    outputFile.str("");
+}
+
+void CPlot2D::OutputPDFPlot(std::string fileName)
+{
+    CPlot2DDocument document;
+    document.Open(fileName);
+    document.AddPage(*this);
+    document.Close();
+}
 
+void CPlot2D::DrawPostScript()
+{
     // precompute plot dimensions
     PrecomputeDimensions();
 
@@ -206,10 +234,6 @@ void CPlot2D::OutputPostScriptPlot(std::string fileName)
     if (m_bDrawLegend) {
         DrawLegendPostScript();
     }
-
-
-    outputFile.close();
-
 }
 
 void CPlot2D::DrawFramePostScript()
@@ -732,6 +756,7 @@ void CPlot2D::ComputeLabelTickSpacing(double dataMin, double dataMax, double *pl
     if (axis=="x") {
         sprintf(m_cXAxisLabelFormat,"%%.%df",nfrac);
         char temp[20];
+        m_strXAxisLabels.clear();
         m_iXAxisNumberOfLabels=0;
         for (double x=*plotMin; x<*plotMax+.5*d; x+=d) {
             sprintf(temp,m_cXAxisLabelFormat,x);
@@ -742,6 +767,7 @@ void CPlot2D::ComputeLabelTickSpacing(double dataMin, double dataMax, double *pl
     else if (axis=="y") {
         sprintf(m_cYAxisLabelFormat,"%%.%df",nfrac);
         char temp[20];
+        m_strYAxisLabels.clear();
         m_iYAxisNumberOfLabels=0;
         for (double x=*plotMin; x<*plotMax+.5*d; x+=d) {
             sprintf(temp,m_cYAxisLabelFormat,x);
@@ -1004,3 +1030,548 @@ void CPlot2D::DrawLegendPostScript()
     }
 
 }
+
+//
+//  PDF output
+//
+//  CPlot2D only uses a small part of PostScript, which is interpreted here
+//  and written out as the equivalent PDF drawing operators.
+//
+
+namespace
+{
+    const int NR_PDF_FONTS = 3;
+    const char *pdf_font_names[NR_PDF_FONTS] = {"Times-Roman", "Helvetica", "Courier"};
+
+    // Advance widths of the printable ASCII characters (32-126), in 1/1000 of the font size
+    const short times_widths[95] = {
+        250, 333, 408, 500, 500, 833, 778, 333, 333, 333, 500, 564, 250, 333, 250, 278,
+        500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 278, 278, 564, 564, 564, 444,
+        921, 722, 667, 667, 722, 611, 556, 722, 722, 333, 389, 722, 611, 889, 722, 722,
+        556, 722, 667, 556, 611, 722, 722, 944, 722, 722, 611, 333, 278, 333, 469, 500,
+        333, 444, 500, 444, 500, 444, 333, 500, 500, 278, 278, 500, 278, 778, 500, 500,
+        500, 500, 333, 389, 278, 500, 500, 722, 500, 500, 444, 480, 200, 480, 541};
+    const short helvetica_widths[95] = {
+        278, 278, 355, 556, 556, 889, 667, 222, 333, 333, 389, 584, 278, 333, 278, 278,
+        556, 556, 556, 556, 556, 556, 556, 556, 556, 556, 278, 278, 584, 584, 584, 556,
+        1015, 667, 667, 722, 722, 667, 611, 778, 722, 278, 500, 667, 556, 833, 722, 778,
+        667, 778, 722, 667, 611, 722, 667, 944, 667, 667, 611, 278, 278, 278, 469, 556,
+        222, 556, 556, 500, 556, 556, 278, 556, 556, 222, 222, 500, 222, 833, 556, 556,
+        556, 556, 333, 500, 278, 556, 500, 722, 500, 500, 500, 334, 260, 334, 584};
+
+    int pdfFontIndex(std::string font)
+    {
+        if (font.find("Helvetica") == 0 || font.find("Arial") == 0)
+            return 1;
+        if (font.find("Courier") == 0)
+            return 2;
+        return 0;
+    }
+
+    double pdfStringWidth(int font, double size, const std::string &str)
+    {
+        double width = 0.;
+        for (int i = 0; i < str.size(); i++)
+        {
+            int c = (unsigned char)str[i];
+            if (font == 2)
+                width += 600.;
+            else if (c < 32 || c > 126)
+                width += 500.;
+            else
+                width += (font == 1) ? helvetica_widths[c - 32] : times_widths[c - 32];
+        }
+        return width * size / 1000.;
+    }
+
+    // PDF does not accept exponents
+    std::string pdfNumber(double value)
+    {
+        char buf[64];
+        snprintf(buf, 64, "%.3f", value);
+        char *end = buf + strlen(buf) - 1;
+        while (*end == '0')
+            *end-- = '\0';
+        if (*end == '.')
+            *end = '\0';
+        if (strcmp(buf, "-0") == 0)
+            return "0";
+        return buf;
+    }
+
+    std::string pdfString(const std::string &str)
+    {
+        std::string result = "(";
+        for (int i = 0; i < str.size(); i++)
+        {
+            if (str[i] == '(' || str[i] == ')' || str[i] == '\\')
+                result += '\\';
+            result += str[i];
+        }
+        return result + ")";
+    }
+
+    class PostScriptToPDF
+    {
+    public:
+
+        std::ostringstream content; // the page content stream
+        double width, height; // from the bounding box
+        bool fonts_used[NR_PDF_FONTS];
+
+        PostScriptToPDF()
+        {
+            width = height = 0.;
+            angle = 0.;
+            has_point = false;
+            font = 0;
+            font_size = 10.;
+            for (int i = 0; i < NR_PDF_FONTS; i++)
+                fonts_used[i] = false;
+        }
+
+        // Returns false for anything CPlot2D does not write
+        bool convert(std::istream &in)
+        {
+            std::string ps((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            if (ps.compare(0, 11, "%!PS-Adobe-") != 0)
+                return false;
+
+            size_t i = 0;
+            while (i < ps.size())
+            {
+                char c = ps[i];
+                if (isspace(c))
+                {
+                    i++;
+                }
+                else if (c == '%')
+                {
+                    size_t eol = ps.find('\n', i);
+                    if (eol == std::string::npos)
+                        eol = ps.size();
+                    std::string comment = ps.substr(i, eol - i);
+                    if (comment.compare(0, 14, "%%BoundingBox:") == 0)
+                    {
+                        double x0, y0;
+                        std::istringstream bbox(comment.substr(14));
+                        if (!(bbox >> x0 >> y0 >> width >> height))
+                            return false;
+                    }
+                    i = eol;
+                }
+                else if (c == '(')
+                {
+                    Token token(STRING);
+                    int depth = 1;
+                    for (i++; i < ps.size() && depth > 0; i++)
+                    {
+                        if (ps[i] == '\\' && i + 1 < ps.size())
+                            i++;
+                        else if (ps[i] == '(')
+                            depth++;
+                        else if (ps[i] == ')' && --depth == 0)
+                            continue;
+                        token.str += ps[i];
+                    }
+                    if (depth > 0)
+                        return false;
+                    stack.push_back(token);
+                }
+                else
+                {
+                    size_t end = i;
+                    while (end < ps.size() && !isspace(ps[end]) && ps[end] != '(' && ps[end] != '%')
+                        end++;
+                    std::string word = ps.substr(i, end - i);
+                    i = end;
+
+                    if (word[0] == '/')
+                    {
+                        Token token(NAME);
+                        token.str = word.substr(1);
+                        stack.push_back(token);
+                        continue;
+                    }
+
+                    char *num_end;
+                    double value = strtod(word.c_str(), &num_end);
+                    if (*num_end == '\0')
+                    {
+                        if (!std::isfinite(value))
+                            return false;
+                        Token token(NUMBER);
+                        token.number = value;
+                        stack.push_back(token);
+                    }
+                    else if (!execute(word))
+                    {
+                        return false;
+                    }
+                }
+            }
+
+            flushState();
+            return width > 0. && height > 0.;
+        }
+
+    private:
+
+        enum TokenType {NUMBER, STRING, NAME, FONT};
+
+        struct Token
+        {
+            TokenType type;
+            double number;
+            std::string str;
+
+            Token(TokenType _type): type(_type), number(0.) {}
+        };
+
+        std::vector<Token> stack;
+        std::string path, state;
+        double angle; // rotation of the user space, in degrees
+        bool has_point;
+        double cur_x, cur_y, start_x, start_y; // in page coordinates
+        int font;
+        double font_size;
+
+        bool pop(double &value)
+        {
+            if (stack.size() == 0 || stack.back().type != NUMBER)
+                return false;
+            value = stack.back().number;
+            stack.pop_back();
+            return true;
+        }
+
+        bool pop(TokenType type, Token &token)
+        {
+            if (stack.size() == 0 || stack.back().type != type)
+                return false;
+            token = stack.back();
+            stack.pop_back();
+            return true;
+        }
+
+        void toPage(double x, double y, double &px, double &py)
+        {
+            double a = angle * M_PI / 180.;
+            px = cos(a) * x - sin(a) * y;
+            py = sin(a) * x + cos(a) * y;
+        }
+
+        void addPoint(double x, double y, const char *op)
+        {
+            path += pdfNumber(x) + " " + pdfNumber(y) + " " + op + "\n";
+            cur_x = x;
+            cur_y = y;
+            if (op[0] == 'm')
+            {
+                start_x = x;
+                start_y = y;
+            }
+            has_point = true;
+        }
+
+        // Colours and line widths cannot be set halfway a path, so they are written just before it is painted
+        void flushState()
+        {
+            content << state;
+            state.clear();
+        }
+
+        void paint(const char *op)
+        {
+            flushState();
+            if (path.size() > 0)
+                content << path << op << "\n";
+            path.clear();
+            has_point = false;
+        }
+
+        bool execute(const std::string &op)
+        {
+            double x, y, r, a1, a2;
+            Token token(NUMBER);
+
+            if (op == "newpath")
+            {
+                path.clear();
+                has_point = false;
+            }
+            else if (op == "moveto" || op == "lineto")
+            {
+                if (!pop(y) || !pop(x) || (op == "lineto" && !has_point))
+                    return false;
+                double px, py;
+                toPage(x, y, px, py);
+                addPoint(px, py, (op == "moveto") ? "m" : "l");
+            }
+            else if (op == "rmoveto" || op == "rlineto")
+            {
+                if (!pop(y) || !pop(x) || !has_point)
+                    return false;
+                double px, py;
+                toPage(x, y, px, py);
+                addPoint(cur_x + px, cur_y + py, (op == "rmoveto") ? "m" : "l");
+            }
+            else if (op == "arc")
+            {
+                if (!pop(a2) || !pop(a1) || !pop(r) || !pop(y) || !pop(x))
+                    return false;
+                while (a2 < a1)
+                    a2 += 360.;
+                double cx, cy;
+                toPage(x, y, cx, cy);
+                a1 = (a1 + angle) * M_PI / 180.;
+                a2 = (a2 + angle) * M_PI / 180.;
+
+                // As in PostScript, a line is drawn from the current point to the start of the arc
+                addPoint(cx + r * cos(a1), cy + r * sin(a1), has_point ? "l" : "m");
+
+                // Bezier curves of at most 90 degrees each
+                while (a1 < a2 - 1e-6)
+                {
+                    double a = std::min(a2, a1 + 0.5 * M_PI);
+                    double k = 4. / 3. * tan(0.25 * (a - a1)) * r;
+                    path += pdfNumber(cur_x - k * sin(a1)) + " " + pdfNumber(cur_y + k * cos(a1)) + " " +
+                            pdfNumber(cx + r * cos(a) + k * sin(a)) + " " + pdfNumber(cy + r * sin(a) - k * cos(a)) + " ";
+                    double sx = start_x, sy = start_y;
+                    addPoint(cx + r * cos(a), cy + r * sin(a), "c");
+                    start_x = sx;
+                    start_y = sy;
+                    a1 = a;
+                }
+            }
+            else if (op == "closepath")
+            {
+                if (has_point)
+                {
+                    path += "h\n";
+                    cur_x = start_x;
+                    cur_y = start_y;
+                }
+            }
+            else if (op == "stroke")
+            {
+                paint("S");
+            }
+            else if (op == "fill")
+            {
+                paint("f");
+            }
+            else if (op == "setlinewidth")
+            {
+                if (!pop(x))
+                    return false;
+                state += pdfNumber(x) + " w\n";
+            }
+            else if (op == "setrgbcolor")
+            {
+                double g, b;
+                if (!pop(b) || !pop(g) || !pop(r))
+                    return false;
+                std::string rgb = pdfNumber(r) + " " + pdfNumber(g) + " " + pdfNumber(b);
+                state += rgb + " RG " + rgb + " rg\n";
+            }
+            else if (op == "findfont")
+            {
+                if (!pop(NAME, token))
+                    return false;
+                token.type = FONT;
+                token.number = 1.;
+                stack.push_back(token);
+            }
+            else if (op == "scalefont")
+            {
+                if (!pop(x) || !pop(FONT, token))
+                    return false;
+                token.number *= x;
+                stack.push_back(token);
+            }
+            else if (op == "setfont")
+            {
+                if (!pop(FONT, token))
+                    return false;
+                font = pdfFontIndex(token.str);
+                font_size = token.number;
+            }
+            else if (op == "stringwidth")
+            {
+                if (!pop(STRING, token))
+                    return false;
+                token.type = NUMBER;
+                token.number = pdfStringWidth(font, font_size, token.str);
+                stack.push_back(token);
+                token.number = 0.;
+                stack.push_back(token);
+            }
+            else if (op == "show")
+            {
+                if (!pop(STRING, token) || !has_point)
+                    return false;
+                flushState();
+                double a = angle * M_PI / 180.;
+                content << "BT\n/F" << font << " " << pdfNumber(font_size) << " Tf\n"
+                        << pdfNumber(cos(a)) << " " << pdfNumber(sin(a)) << " " << pdfNumber(-sin(a)) << " "
+                        << pdfNumber(cos(a)) << " " << pdfNumber(cur_x) << " " << pdfNumber(cur_y) << " Tm\n"
+                        << pdfString(token.str) << " Tj\nET\n";
+                fonts_used[font] = true;
+                double px, py;
+                toPage(pdfStringWidth(font, font_size, token.str), 0., px, py);
+                cur_x += px;
+                cur_y += py;
+            }
+            else if (op == "rotate")
+            {
+                if (!pop(x))
+                    return false;
+                angle += x;
+            }
+            else if (op == "dup")
+            {
+                if (stack.size() == 0)
+                    return false;
+                stack.push_back(stack.back());
+            }
+            else if (op == "pop")
+            {
+                if (stack.size() == 0)
+                    return false;
+                stack.pop_back();
+            }
+            else if (op == "neg")
+            {
+                if (!pop(x))
+                    return false;
+                token.number = -x;
+                stack.push_back(token);
+            }
+            else if (op == "div")
+            {
+                if (!pop(y) || !pop(x) || y == 0.)
+                    return false;
+                token.number = x / y;
+                stack.push_back(token);
+            }
+            else if (op != "showpage")
+            {
+                return false;
+            }
+            return true;
+        }
+    };
+}
+
+CPlot2DDocument::CPlot2DDocument()
+{
+}
+
+CPlot2DDocument::~CPlot2DDocument()
+{
+    if (m_file.is_open())
+        Close();
+}
+
+void CPlot2DDocument::Open(std::string fileName)
+{
+    if (m_file.is_open())
+        Close();
+
+    m_file.open(fileName.c_str(), std::ios::out | std::ios::binary);
+    if (!m_file)
+        REPORT_ERROR("CPlot2DDocument::Open ERROR: cannot write to " + fileName);
+
+    m_file << "%PDF-1.4\n%\xE2\xE3\xCF\xD3\n";
+
+    // Objects 1 and 2 (the catalog and the page tree) are written by Close()
+    m_objectOffsets.assign(3, 0);
+    m_pageObjects.clear();
+    m_fontObjects.assign(NR_PDF_FONTS, 0);
+}
+
+int CPlot2DDocument::StartObject()
+{
+    m_objectOffsets.push_back(m_file.tellp());
+    int object = m_objectOffsets.size() - 1;
+    m_file << object << " 0 obj\n";
+    return object;
+}
+
+void CPlot2DDocument::AddPage(CPlot2D &plot)
+{
+    std::stringstream ps;
+    plot.OutputPostScriptPlot(ps);
+    if (!AddPostScriptPage(ps))
+        std::cerr << " WARNING: could not add a plot to the PDF file, it probably contains non-numeric values." << std::endl;
+}
+
+bool CPlot2DDocument::AddPostScriptPage(std::string fileName)
+{
+    std::ifstream in(fileName.c_str());
+    return in && AddPostScriptPage(in);
+}
+
+bool CPlot2DDocument::AddPostScriptPage(std::istream &in)
+{
+    if (!m_file.is_open())
+        REPORT_ERROR("CPlot2DDocument::AddPage BUG: the document has not been opened.");
+
+    PostScriptToPDF converter;
+    if (!converter.convert(in))
+        return false;
+
+    std::string content = converter.content.str();
+    int content_object = StartObject();
+    m_file << "<< /Length " << content.size() << " >>\nstream\n" << content << "\nendstream\nendobj\n";
+
+    for (int i = 0; i < NR_PDF_FONTS; i++)
+    {
+        if (converter.fonts_used[i] && m_fontObjects[i] == 0)
+        {
+            m_fontObjects[i] = StartObject();
+            m_file << "<< /Type /Font /Subtype /Type1 /BaseFont /" << pdf_font_names[i]
+                   << " /Encoding /WinAnsiEncoding >>\nendobj\n";
+        }
+    }
+
+    int page_object = StartObject();
+    m_file << "<< /Type /Page /Parent 2 0 R /MediaBox [0 0 " << pdfNumber(converter.width) << " "
+           << pdfNumber(converter.height) << "] /Resources << /Font <<";
+    for (int i = 0; i < NR_PDF_FONTS; i++)
+        if (converter.fonts_used[i])
+            m_file << " /F" << i << " " << m_fontObjects[i] << " 0 R";
+    m_file << " >> >> /Contents " << content_object << " 0 R >>\nendobj\n";
+    m_pageObjects.push_back(page_object);
+
+    return true;
+}
+
+void CPlot2DDocument::Close()
+{
+    if (!m_file.is_open())
+        return;
+
+    m_objectOffsets[2] = m_file.tellp();
+    m_file << "2 0 obj\n<< /Type /Pages /Kids [";
+    for (long int i = 0; i < m_pageObjects.size(); i++)
+        m_file << " " << m_pageObjects[i] << " 0 R";
+    m_file << " ] /Count " << m_pageObjects.size() << " >>\nendobj\n";
+
+    m_objectOffsets[1] = m_file.tellp();
+    m_file << "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n";
+
+    long int xref = m_file.tellp();
+    m_file << "xref\n0 " << m_objectOffsets.size() << "\n0000000000 65535 f \n";
+    for (long int i = 1; i < m_objectOffsets.size(); i++)
+        m_file << std::setw(10) << std::setfill('0') << m_objectOffsets[i] << " 00000 n \n";
+    m_file << "trailer\n<< /Size " << m_objectOffsets.size() << " /Root 1 0 R >>\nstartxref\n"
+           << xref << "\n%%EOF\n";
+    m_file.close();
+}
+
+int CPlot2DDocument::GetNumberOfPages()
+{
+    return m_pageObjects.size();
+}
@@ -34,6 +34,8 @@
 
 /* SHWS: join multiple eps files into a single pdf
  *
+ * EPS files written by CPlot2D are converted directly, Ghostscript is only
+ * called when some of the files come from elsewhere.
  */
 
 void joinMultipleEPSIntoSinglePDF(FileName fn_pdf, std::vector<FileName> fn_eps);
@@ -873,6 +875,12 @@ void joinMultipleEPSIntoSinglePDF(FileName fn_pdf, std::vector<FileName> fn_eps)
       The function, which is responsible for generating the PostScript output of the plot.
       */
      void OutputPostScriptPlot(std::string fileName);
+     void OutputPostScriptPlot(std::ostream &out);
+
+     /*!
+      Outputs the plot as a single-page PDF file. Use CPlot2DDocument to write several plots into one PDF.
+      */
+     void OutputPDFPlot(std::string fileName);
 
      // data set functions
      /*!
@@ -895,6 +903,11 @@ void joinMultipleEPSIntoSinglePDF(FileName fn_pdf, std::vector<FileName> fn_eps)
 
  protected:
 
+     /*!
+      Draws the complete plot as PostScript into outputFile.
+      */
+     void DrawPostScript();
+
      /*!
       A function, which precomputes parameters of the plot, such as the overal size of the plot,
       the spacing of tick marks and labels, the length of the dashes in a dashed line.
@@ -1054,7 +1067,7 @@ void joinMultipleEPSIntoSinglePDF(FileName fn_pdf, std::vector<FileName> fn_eps)
      bool m_bFlipY; /*!< Flag for flipping the Y axis. */
 
      // output
-     std::ofstream outputFile; /*!< The output stream. */
+     std::ostringstream outputFile; /*!< The output stream, which collects the PostScript before it is written out. */
 
      // data storage
      std::vector<CDataSet> m_dataSets; /*!< Storage for the datasets, implemented as a vector. */
@@ -1458,4 +1471,61 @@ void joinMultipleEPSIntoSinglePDF(FileName fn_pdf, std::vector<FileName> fn_eps)
      return (m_bFlipY);
  }
 
+ /*!
+  A multi-page PDF document. Every plot becomes one page, which is written to the file
+  as soon as it is added, so that thousands of plots can be collected without keeping them
+  in memory or writing intermediate files. The PostScript of a plot is translated into PDF
+  drawing operators; fonts are mapped onto the standard Times-Roman, Helvetica and Courier fonts.
+
+  CPlot2DDocument document;
+  document.Open("logfile.pdf");
+  document.AddPage(plot);
+  document.AddPostScriptPage("earlier_plot.eps");
+  document.Close();
+  */
+ class CPlot2DDocument
+ {
+ public:
+
+     CPlot2DDocument();
+
+     /*!
+      Closes the document if that has not been done yet.
+      */
+     ~CPlot2DDocument();
+
+     /*!
+      Starts writing a new document.
+      */
+     void Open(std::string fileName);
+
+     /*!
+      Renders the plot onto a new page.
+      */
+     void AddPage(CPlot2D &plot);
+
+     /*!
+      Adds an EPS file that was written by CPlot2D::OutputPostScriptPlot as a new page.
+      Returns false, and adds nothing, for EPS files that use other PostScript.
+      */
+     bool AddPostScriptPage(std::string fileName);
+
+     /*!
+      Writes the page tree and the cross-reference table and closes the file.
+      */
+     void Close();
+
+     int GetNumberOfPages();
+
+ protected:
+
+     bool AddPostScriptPage(std::istream &in);
+     int StartObject();
+
+     std::ofstream m_file; /*!< The PDF file. */
+     std::vector<long int> m_objectOffsets; /*!< Offset in the file of every object, object numbers start at 1. */
+     std::vector<int> m_pageObjects; /*!< Object numbers of the pages. */
+     std::vector<int> m_fontObjects; /*!< Object number of each standard font, 0 while it has not been written. */
+ };
+
  #endif /* defined(__CPlot2D__) */
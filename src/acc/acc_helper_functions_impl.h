@@ -188,61 +188,39 @@ void generateEulerMatrices(
 		Matrix2D<RFLOAT> &L,
 		Matrix2D<RFLOAT> &R)
 {
-	RFLOAT alpha, beta, gamma;
-    RFLOAT ca, sa, cb, sb, cg, sg;
-    RFLOAT cc, cs, sc, ss;
-
-    Matrix2D<RFLOAT> A(3,3);
-
-    bool doL = (L.mdimx == 3 && L.mdimy == 3);
-    bool doR = (R.mdimx == 3 && R.mdimy == 3);
+	bool doL = (L.mdimx == 3 && L.mdimy == 3);
+	bool doR = (R.mdimx == 3 && R.mdimy == 3);
+
+	// inv(L * A * R) = inv(R) * A^T * inv(L), so L and R only need to be inverted once,
+	// and the inverse of the rotation A is the conjugate of its quaternion
+	RFLOAT Lm[9] = {1., 0., 0., 0., 1., 0., 0., 0., 1.};
+	RFLOAT Rm[9] = {1., 0., 0., 0., 1., 0., 0., 0., 1.};
+	if (doL)
+	{
+		Matrix2D<RFLOAT> M = (inverse) ? L.inv() : L;
+		std::copy(MATRIX2D_ARRAY(M), MATRIX2D_ARRAY(M) + 9, (inverse) ? Rm : Lm);
+	}
+	if (doR)
+	{
+		Matrix2D<RFLOAT> M = (inverse) ? R.inv() : R;
+		std::copy(MATRIX2D_ARRAY(M), MATRIX2D_ARRAY(M) + 9, (inverse) ? Lm : Rm);
+	}
 
+	RFLOAT A[9], LA[9];
 	for (long int i = 0; i < ProjectionData.rots.size(); i++)
 	{
-	    //TODO In a sense we're doing RAD2DEG just to do DEG2RAD here.
-	    //The only place the degree value is actually used is in the metadata assignment.
-
-	    alpha = DEG2RAD(ProjectionData.rots[i]);
-	    beta  = DEG2RAD(ProjectionData.tilts[i]);
-	    gamma = DEG2RAD(ProjectionData.psis[i]);
-
-#ifdef RELION_SINGLE_PRECISION
-	    sincosf(alpha, &sa, &ca);
-	    sincosf(beta,  &sb, &cb);
-	    sincosf(gamma, &sg, &cg);
-#else
-	    sincos(alpha, &sa, &ca);
-	    sincos(beta,  &sb, &cb);
-	    sincos(gamma, &sg, &cg);
-#endif
-
-	    cc = cb * ca;
-	    cs = cb * sa;
-	    sc = sb * ca;
-	    ss = sb * sa;
-
-	    A(0, 0) =  cg * cc - sg * sa;
-	    A(0, 1) =  cg * cs + sg * ca;
-	    A(0, 2) = -cg * sb;
-	    A(1, 0) = -sg * cc - cg * sa;
-	    A(1, 1) = -sg * cs + cg * ca;
-	    A(1, 2) = sg * sb;
-	    A(2, 0) = sc;
-	    A(2, 1) = ss;
-	    A(2, 2) = cb;
-
-		if (doL)
-			A = L * A;
-
-		if (doR)
-			A = A * R;
-
-		if(inverse)
-			A = A.inv();
-
-		for (int m = 0; m < 3; m ++)
-			for (int n = 0; n < 3; n ++)
-				eulers[9 * i + (m*3 + n)] = A(m, n);
+		Quaternion q = Quaternion::fromEulerAngles(ProjectionData.rots[i], ProjectionData.tilts[i], ProjectionData.psis[i]);
+		if (inverse)
+			q = q.conjugate();
+		q.toMatrix(A);
+
+		for (int m = 0; m < 3; m++)
+			for (int n = 0; n < 3; n++)
+				LA[m*3 + n] = Lm[m*3] * A[n] + Lm[m*3 + 1] * A[3 + n] + Lm[m*3 + 2] * A[6 + n];
+
+		for (int m = 0; m < 3; m++)
+			for (int n = 0; n < 3; n++)
+				eulers[9 * i + (m*3 + n)] = LA[m*3] * Rm[n] + LA[m*3 + 1] * Rm[3 + n] + LA[m*3 + 2] * Rm[6 + n];
 	}
 
 }
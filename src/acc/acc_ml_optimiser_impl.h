@@ -1,6 +1,7 @@
 static pthread_mutex_t global_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 #include "src/ml_optimiser_mpi.h"
+#include "src/reduction.h"
 
 // ----------------------------------------------------------------------------
 // -------------------- getFourierTransformsAndCtfs ---------------------------
@@ -214,11 +215,11 @@ void getFourierTransformsAndCtfs(long int part_id,
 			if (baseMLO->do_preread_images)
 			{
 
-                img().reshape(baseMLO->mydata.particles[part_id].images[img_id].img);
+                img().reshape(baseMLO->mydata.getPrereadImage(part_id, img_id));
                 CTIC(accMLO->timer,"ParaReadPrereadImages");
-				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(baseMLO->mydata.particles[part_id].images[img_id].img)
+				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(baseMLO->mydata.getPrereadImage(part_id, img_id))
 				{
-                	DIRECT_MULTIDIM_ELEM(img(), n) = (RFLOAT)DIRECT_MULTIDIM_ELEM(baseMLO->mydata.particles[part_id].images[img_id].img, n);
+                	DIRECT_MULTIDIM_ELEM(img(), n) = (RFLOAT)DIRECT_MULTIDIM_ELEM(baseMLO->mydata.getPrereadImage(part_id, img_id), n);
 				}
 				CTOC(accMLO->timer,"ParaReadPrereadImages");
 			}
@@ -3001,39 +3002,40 @@ void storeWeightedSums(OptimisationParamters &op, SamplingParameters &sp,
 				int i_resam = ROUND(i * remap_image_sizes);
 				if (i_resam < XSIZE(baseMLO->wsum_model.sigma2_noise[igroup]))
 				{
-					DIRECT_A1D_ELEM(baseMLO->wsum_model.sigma2_noise[igroup], i_resam) += DIRECT_A1D_ELEM(thr_wsum_sigma2_noise[img_id], i);
+					compensatedAdd(DIRECT_A1D_ELEM(baseMLO->wsum_model.sigma2_noise[igroup], i_resam), DIRECT_A1D_ELEM(baseMLO->wsum_model.err.sigma2_noise[igroup], i_resam),
+					               DIRECT_A1D_ELEM(thr_wsum_sigma2_noise[img_id], i));
 				}
 			}
-			baseMLO->wsum_model.sumw_group[igroup] += thr_sumw_group[img_id];
+			compensatedAdd(baseMLO->wsum_model.sumw_group[igroup], baseMLO->wsum_model.err.sumw_group[igroup], thr_sumw_group[img_id]);
 			if (baseMLO->do_scale_correction)
 			{
-				baseMLO->wsum_model.wsum_signal_product[igroup] += thr_wsum_signal_product_spectra[img_id];
-				baseMLO->wsum_model.wsum_reference_power[igroup] += thr_wsum_reference_power_spectra[img_id];
+				compensatedAdd(baseMLO->wsum_model.wsum_signal_product[igroup], baseMLO->wsum_model.err.wsum_signal_product[igroup], thr_wsum_signal_product_spectra[img_id]);
+				compensatedAdd(baseMLO->wsum_model.wsum_reference_power[igroup], baseMLO->wsum_model.err.wsum_reference_power[igroup], thr_wsum_reference_power_spectra[img_id]);
 			}
 		}
 		for (int n = 0; n < baseMLO->mymodel.nr_classes; n++)
 		{
-			baseMLO->wsum_model.pdf_class[n] += thr_wsum_pdf_class[n];
+			compensatedAdd(baseMLO->wsum_model.pdf_class[n], baseMLO->wsum_model.err.pdf_class[n], thr_wsum_pdf_class[n]);
 			if (baseMLO->mymodel.ref_dim == 2)
 			{
-				XX(baseMLO->wsum_model.prior_offset_class[n]) += thr_wsum_prior_offsetx_class[n];
-				YY(baseMLO->wsum_model.prior_offset_class[n]) += thr_wsum_prior_offsety_class[n];
+				compensatedAdd(XX(baseMLO->wsum_model.prior_offset_class[n]), XX(baseMLO->wsum_model.err.prior_offset_class[n]), thr_wsum_prior_offsetx_class[n]);
+				compensatedAdd(YY(baseMLO->wsum_model.prior_offset_class[n]), YY(baseMLO->wsum_model.err.prior_offset_class[n]), thr_wsum_prior_offsety_class[n]);
 			}
 		}
 
 		for (int n = 0; n < baseMLO->mymodel.nr_classes * baseMLO->mymodel.nr_bodies; n++)
 		{
 			if (!(baseMLO->do_skip_align || baseMLO->do_skip_rotate) )
-				baseMLO->wsum_model.pdf_direction[n] += thr_wsum_pdf_direction[n];
+				compensatedAdd(baseMLO->wsum_model.pdf_direction[n], baseMLO->wsum_model.err.pdf_direction[n], thr_wsum_pdf_direction[n]);
 		}
 
-		baseMLO->wsum_model.sigma2_offset += thr_wsum_sigma2_offset;
+		compensatedAdd(baseMLO->wsum_model.sigma2_offset, baseMLO->wsum_model.err.sigma2_offset, thr_wsum_sigma2_offset);
 
 		if (baseMLO->do_norm_correction && baseMLO->mymodel.nr_bodies == 1)
-			baseMLO->wsum_model.avg_norm_correction += thr_avg_norm_correction;
+			compensatedAdd(baseMLO->wsum_model.avg_norm_correction, baseMLO->wsum_model.err.avg_norm_correction, thr_avg_norm_correction);
 
-		baseMLO->wsum_model.LL += thr_sum_dLL;
-		baseMLO->wsum_model.ave_Pmax += thr_sum_Pmax;
+		compensatedAdd(baseMLO->wsum_model.LL, baseMLO->wsum_model.err.LL, thr_sum_dLL);
+		compensatedAdd(baseMLO->wsum_model.ave_Pmax, baseMLO->wsum_model.err.ave_Pmax, thr_sum_Pmax);
 		pthread_mutex_unlock(&global_mutex);
 	} // end if !do_skip_maximization
 
@@ -99,25 +99,16 @@ AutoPickerCuda::AutoPickerCuda(AutoPickerMpi *basePicker, int dev_id, const char
 
 void AutoPickerCuda::run()
 {
-	long int my_first_micrograph, my_last_micrograph, my_nr_micrographs;
-	if(node!=NULL)
-	{
-		// Each node does part of the work
-		divide_equally(basePckr->fn_micrographs.size(), node->size, node->rank, my_first_micrograph, my_last_micrograph);
-	}
-	else
-	{
-		my_first_micrograph = 0;
-		my_last_micrograph = basePckr->fn_micrographs.size() - 1;
-	}
-	my_nr_micrographs = my_last_micrograph - my_first_micrograph + 1;
+	// With MPI, each node fetches chunks of micrographs dynamically
+	long int nr_micrographs = basePckr->fn_micrographs.size();
+	MpiTaskDistributor *distributor = (node != NULL) ? new MpiTaskDistributor(node, nr_micrographs) : NULL;
 
 	int barstep;
 	if (basePckr->verb > 0)
 	{
 		std::cout << " Autopicking ..." << std::endl;
-		init_progress_bar(my_nr_micrographs);
-		barstep = XMIPP_MAX(1, my_nr_micrographs / 60);
+		init_progress_bar(nr_micrographs);
+		barstep = XMIPP_MAX(1, nr_micrographs / 60);
 	}
 
 	if (!basePckr->do_read_fom_maps)
@@ -140,31 +131,43 @@ void AutoPickerCuda::run()
 
 	FileName fn_olddir="";
 
-	for (long int imic = my_first_micrograph; imic <= my_last_micrograph; imic++)
+	long int my_first_micrograph = 0, my_last_micrograph = nr_micrographs - 1;
+	bool have_micrographs = (distributor != NULL) ? distributor->getTasks(my_first_micrograph, my_last_micrograph) : (nr_micrographs > 0);
+	while (have_micrographs)
 	{
-		if (basePckr->verb > 0 && imic % barstep == 0)
-			progress_bar(imic);
+		for (long int imic = my_first_micrograph; imic <= my_last_micrograph; imic++)
+		{
+			if (basePckr->verb > 0 && imic % barstep == 0)
+				progress_bar(imic);
 
 
-		// Check new-style outputdirectory exists and make it if not!
-		FileName fn_dir = basePckr->getOutputRootName(basePckr->fn_micrographs[imic]);
-		fn_dir = fn_dir.beforeLastOf("/");
-		if (fn_dir != fn_olddir)
-		{
-			// Make a Particles directory
-			int res = system(("mkdir -p " + fn_dir).c_str());
-			fn_olddir = fn_dir;
-		}
+			// Check new-style outputdirectory exists and make it if not!
+			FileName fn_dir = basePckr->getOutputRootName(basePckr->fn_micrographs[imic]);
+			fn_dir = fn_dir.beforeLastOf("/");
+			if (fn_dir != fn_olddir)
+			{
+				// Make a Particles directory
+				int res = system(("mkdir -p " + fn_dir).c_str());
+				fn_olddir = fn_dir;
+			}
 #ifdef TIMING
-		basePckr->timer.tic(basePckr->TIMING_A5);
+			basePckr->timer.tic(basePckr->TIMING_A5);
 #endif
-		autoPickOneMicrograph(basePckr->fn_micrographs[imic], imic);
+			autoPickOneMicrograph(basePckr->fn_micrographs[imic], imic);
+		}
+		have_micrographs = (distributor != NULL) ? distributor->getTasks(my_first_micrograph, my_last_micrograph) : false;
 	}
 #ifdef TIMING
 		basePckr->timer.toc(basePckr->TIMING_A5);
 #endif
 	if (basePckr->verb > 0)
-		progress_bar(my_nr_micrographs);
+		progress_bar(nr_micrographs);
+
+	if (distributor != NULL)
+	{
+		distributor->reportUtilisation();
+		delete distributor;
+	}
 
 	cudaDeviceReset();
 
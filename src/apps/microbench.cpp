@@ -0,0 +1,790 @@
+/***************************************************************************
+ *
+ * Author: "Sjors H.W. Scheres"
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifdef ALTCPU
+// Make sure we build for CPU
+#include "src/acc/cpu/cuda_stubs.h"
+#endif
+
+#include <sys/time.h>
+#include <cstdio>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <complex>
+
+#include <src/args.h>
+#include <src/funcs.h>
+#include <src/euler.h>
+#include <src/image.h>
+#include <src/fftw.h>
+#include <src/ctf.h>
+#include <src/projector.h>
+#include <src/backprojector.h>
+#include <src/metadata_table.h>
+
+#ifdef ALTCPU
+#include "src/acc/acc_ptr.h"
+#include "src/acc/acc_projector.h"
+#include "src/acc/acc_backprojector.h"
+#include "src/acc/cpu/cpu_helper_functions.h"
+#include "src/acc/cpu/cpu_kernels/helper.h"
+#include "src/acc/cpu/cpu_kernels/diff2.h"
+#include "src/acc/cpu/cpu_kernels/wavg.h"
+#include "src/acc/cpu/cpu_kernels/BP.h"
+#include "src/acc/utilities.h"
+#include "src/acc/data_types.h"
+#include "src/acc/acc_helper_functions.h"
+#include "src/acc/cpu/cpu_settings.h"
+#endif
+
+/* Microbenchmarks for the kernels that dominate the run time of refinement,
+ * reconstruction and preprocessing. Each benchmark is run for a series of box
+ * sizes, repeating its inner loop until --min_time seconds have passed, and
+ * reports the time per iteration and the throughput in elements per second.
+ * Only the code inside the timed loop is measured; set-up is excluded.
+ */
+
+static double wallTime()
+{
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + 1e-6 * (double)tv.tv_usec;
+}
+
+class BenchmarkState
+{
+public:
+
+	long int iterations;
+	double elapsed, items_per_iteration;
+
+	BenchmarkState(double _min_time):
+		iterations(0), elapsed(0.), items_per_iteration(0.),
+		min_time(_min_time), started(false), paused(false), t_start(0.), sink(0.)
+	{}
+
+	// Use as "while (state.keepRunning()) { ... }": the first call starts the clock,
+	// and the loop always executes at least once.
+	bool keepRunning()
+	{
+		if (!started)
+		{
+			started = true;
+			t_start = wallTime();
+			return true;
+		}
+
+		iterations++;
+		return measured() < min_time;
+	}
+
+	// Exclude per-iteration set-up (e.g. restoring an input that the kernel overwrites)
+	void pauseTiming()
+	{
+		elapsed += wallTime() - t_start;
+		paused = true;
+	}
+
+	void resumeTiming()
+	{
+		paused = false;
+		t_start = wallTime();
+	}
+
+	void setItemsPerIteration(double items)
+	{
+		items_per_iteration = items;
+	}
+
+	// Keep the compiler from discarding the result of the benchmarked code
+	void consume(RFLOAT value)
+	{
+		sink += value;
+	}
+
+	double measured()
+	{
+		if (!paused)
+		{
+			double t = wallTime();
+			elapsed += t - t_start;
+			t_start = t;
+		}
+		return elapsed;
+	}
+
+private:
+
+	double min_time;
+	bool started, paused;
+	double t_start;
+	volatile RFLOAT sink;
+};
+
+class microbench_parameters;
+typedef void (microbench_parameters::*BenchmarkFunction)(BenchmarkState &state, int size);
+
+struct BenchmarkEntry
+{
+	std::string name;
+	BenchmarkFunction function;
+};
+
+class microbench_parameters
+{
+public:
+
+	IOParser parser;
+
+	FileName fn_csv, fn_tmp;
+	std::string filter, size_string;
+	std::vector<int> sizes;
+	RFLOAT min_time, angpix;
+	int nr_threads, random_seed, nr_images;
+	bool do_list;
+
+	std::vector<BenchmarkEntry> benchmarks;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		int general_section = parser.addSection("General options");
+		size_string = parser.getOption("--sizes", "Comma-separated list of box sizes to run each benchmark at", "64,128,256");
+		filter = parser.getOption("--filter", "Only run benchmarks whose name contains this string", "");
+		min_time = textToFloat(parser.getOption("--min_time", "Minimum measured time (in seconds) per benchmark and size", "0.5"));
+		nr_threads = textToInteger(parser.getOption("--j", "Number of threads for the kernels that are multi-threaded", "1"));
+		fn_csv = parser.getOption("--csv", "Also write the results to this CSV file", "");
+		do_list = parser.checkOption("--list", "Only list the available benchmarks");
+
+		int data_section = parser.addSection("Synthetic data options");
+		random_seed = textToInteger(parser.getOption("--random_seed", "Seed for the synthetic input data", "1993"));
+		angpix = textToFloat(parser.getOption("--angpix", "Pixel size (in A) of the synthetic data", "1.0"));
+		nr_images = textToInteger(parser.getOption("--nr_images", "Number of images (or orientations) per iteration for the stack, back-projection and accelerated kernels", "64"));
+		fn_tmp = parser.getOption("--tmp", "Prefix for the temporary files of the I/O benchmarks", "microbench_tmp");
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line (see above), exiting...");
+
+		std::vector<std::string> tokens;
+		tokenize(size_string, tokens, ",");
+		for (int i = 0; i < tokens.size(); i++)
+		{
+			int size = textToInteger(tokens[i]);
+			if (size < 8 || size % 2 != 0)
+				REPORT_ERROR("ERROR: box sizes should be even and at least 8, but got: " + tokens[i]);
+			sizes.push_back(size);
+		}
+		if (sizes.size() == 0)
+			REPORT_ERROR("ERROR: no box sizes given to --sizes");
+		if (min_time <= 0.)
+			REPORT_ERROR("ERROR: --min_time should be positive");
+		if (nr_images < 1)
+			REPORT_ERROR("ERROR: --nr_images should be at least 1");
+
+		registerBenchmarks();
+	}
+
+	void registerBenchmark(std::string name, BenchmarkFunction function)
+	{
+		BenchmarkEntry entry;
+		entry.name = name;
+		entry.function = function;
+		benchmarks.push_back(entry);
+	}
+
+	void registerBenchmarks()
+	{
+		registerBenchmark("fft_r2c_2D", &microbench_parameters::benchFFTForward2D);
+		registerBenchmark("fft_c2r_2D", &microbench_parameters::benchFFTInverse2D);
+		registerBenchmark("fft_r2c_3D", &microbench_parameters::benchFFTForward3D);
+		registerBenchmark("fft_c2r_3D", &microbench_parameters::benchFFTInverse3D);
+		registerBenchmark("projector_project", &microbench_parameters::benchProject);
+		registerBenchmark("projector_rotate2D", &microbench_parameters::benchRotate2D);
+		registerBenchmark("backprojector_backproject2Dto3D", &microbench_parameters::benchBackproject);
+		registerBenchmark("backprojector_reconstruct", &microbench_parameters::benchReconstruct);
+		registerBenchmark("ctf_getFftwImage", &microbench_parameters::benchCTF);
+		registerBenchmark("shiftImageInFourierTransform", &microbench_parameters::benchShift);
+		registerBenchmark("metadatatable_read", &microbench_parameters::benchReadSTAR);
+		registerBenchmark("image_read_mrcs", &microbench_parameters::benchReadStack);
+#ifdef ALTCPU
+		registerBenchmark("acc_diff2_coarse", &microbench_parameters::benchAccDiff2Coarse);
+		registerBenchmark("acc_wavg", &microbench_parameters::benchAccWavg);
+		registerBenchmark("acc_backproject", &microbench_parameters::benchAccBackproject);
+#endif
+	}
+
+	void run()
+	{
+		if (do_list)
+		{
+			for (int i = 0; i < benchmarks.size(); i++)
+				std::cout << benchmarks[i].name << std::endl;
+			return;
+		}
+
+		std::vector<int> selected;
+		for (int ibench = 0; ibench < benchmarks.size(); ibench++)
+			if (filter == "" || benchmarks[ibench].name.find(filter) != std::string::npos)
+				selected.push_back(ibench);
+		if (selected.size() == 0)
+			REPORT_ERROR("ERROR: no benchmark matches --filter " + filter + " (use --list to see them)");
+
+		std::ofstream fh_csv;
+		if (fn_csv != "")
+		{
+			fh_csv.open(fn_csv.c_str(), std::ios::out);
+			if (!fh_csv)
+				REPORT_ERROR("ERROR: cannot write to " + fn_csv);
+			fh_csv << "benchmark,size,iterations,seconds_per_iteration,items_per_second" << std::endl;
+		}
+
+		std::cout << std::left << std::setw(44) << "Benchmark"
+		          << std::right << std::setw(16) << "Time"
+		          << std::setw(14) << "Iterations"
+		          << std::setw(16) << "Items/s" << std::endl;
+		std::cout << std::string(90, '-') << std::endl;
+
+		for (int i = 0; i < selected.size(); i++)
+		{
+			const int ibench = selected[i];
+			for (int isize = 0; isize < sizes.size(); isize++)
+			{
+				// Every benchmark and size starts from the same synthetic data
+				init_random_generator(random_seed);
+
+				BenchmarkState state(min_time);
+				(this->*benchmarks[ibench].function)(state, sizes[isize]);
+
+				double per_iteration = state.elapsed / XMIPP_MAX(1, state.iterations);
+				double items_per_second = (state.elapsed > 0.) ? state.items_per_iteration * state.iterations / state.elapsed : 0.;
+
+				std::stringstream name;
+				name << benchmarks[ibench].name << "/" << sizes[isize];
+				std::cout << std::left << std::setw(44) << name.str()
+				          << std::right << std::setw(16) << formatTime(per_iteration)
+				          << std::setw(14) << state.iterations
+				          << std::setw(16) << formatRate(items_per_second) << std::endl;
+
+				if (fh_csv.is_open())
+					fh_csv << benchmarks[ibench].name << "," << sizes[isize] << "," << state.iterations << ","
+					       << per_iteration << "," << items_per_second << std::endl;
+			}
+		}
+	}
+
+	static std::string formatTime(double seconds)
+	{
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(2);
+		if (seconds >= 1.)
+			ss << seconds << " s";
+		else if (seconds >= 1e-3)
+			ss << seconds * 1e3 << " ms";
+		else
+			ss << seconds * 1e6 << " us";
+		return ss.str();
+	}
+
+	static std::string formatRate(double items_per_second)
+	{
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(2);
+		if (items_per_second >= 1e9)
+			ss << items_per_second * 1e-9 << "G/s";
+		else if (items_per_second >= 1e6)
+			ss << items_per_second * 1e-6 << "M/s";
+		else if (items_per_second >= 1e3)
+			ss << items_per_second * 1e-3 << "k/s";
+		else
+			ss << items_per_second << "/s";
+		return ss.str();
+	}
+
+	// Synthetic inputs
+
+	void randomRotation(Matrix2D<RFLOAT> &A)
+	{
+		Euler_angles2matrix(rnd_unif(0., 360.), rnd_unif(0., 180.), rnd_unif(0., 360.), A);
+	}
+
+	void makeRandomVolume(int size, MultidimArray<RFLOAT> &vol)
+	{
+		vol.initZeros(size, size, size);
+		vol.initRandom(0., 1., "gaussian");
+		vol.setXmippOrigin();
+	}
+
+	void makeProjector(int size, int data_dim, Projector &projector)
+	{
+		MultidimArray<RFLOAT> ref, power_spectrum;
+		if (data_dim == 3)
+			makeRandomVolume(size, ref);
+		else
+		{
+			ref.initZeros(size, size);
+			ref.initRandom(0., 1., "gaussian");
+			ref.setXmippOrigin();
+		}
+		projector = Projector(size, TRILINEAR, 2., 10, 2);
+		projector.computeFourierTransformMap(ref, power_spectrum, size, nr_threads);
+	}
+
+	void makeRandomFourierImage(int size, MultidimArray<Complex> &Fimg)
+	{
+		Fimg.initZeros(size, size / 2 + 1);
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fimg)
+		{
+			DIRECT_MULTIDIM_ELEM(Fimg, n).real = rnd_gaus(0., 1.);
+			DIRECT_MULTIDIM_ELEM(Fimg, n).imag = rnd_gaus(0., 1.);
+		}
+	}
+
+	// Fourier transforms
+
+	void benchFFT(BenchmarkState &state, int size, int dim, bool forward)
+	{
+		MultidimArray<RFLOAT> img;
+		MultidimArray<Complex> Fimg;
+		FourierTransformer transformer;
+
+		if (dim == 3)
+			img.initZeros(size, size, size);
+		else
+			img.initZeros(size, size);
+		img.initRandom(0., 1., "gaussian");
+
+		// Make the plans outside of the timed loop
+		transformer.FourierTransform(img, Fimg, false);
+		if (!forward)
+			Fimg = transformer.fFourier;
+
+		while (state.keepRunning())
+		{
+			if (forward)
+			{
+				transformer.FourierTransform(img, Fimg, false);
+				state.consume(DIRECT_MULTIDIM_ELEM(Fimg, 1).real);
+			}
+			else
+			{
+				transformer.inverseFourierTransform(Fimg, img);
+				state.consume(DIRECT_MULTIDIM_ELEM(img, 1));
+			}
+		}
+
+		state.setItemsPerIteration(MULTIDIM_SIZE(img));
+	}
+
+	void benchFFTForward2D(BenchmarkState &state, int size)
+	{
+		benchFFT(state, size, 2, true);
+	}
+
+	void benchFFTInverse2D(BenchmarkState &state, int size)
+	{
+		benchFFT(state, size, 2, false);
+	}
+
+	void benchFFTForward3D(BenchmarkState &state, int size)
+	{
+		benchFFT(state, size, 3, true);
+	}
+
+	void benchFFTInverse3D(BenchmarkState &state, int size)
+	{
+		benchFFT(state, size, 3, false);
+	}
+
+	// Projection and back-projection
+
+	void benchProject(BenchmarkState &state, int size)
+	{
+		Projector projector;
+		makeProjector(size, 3, projector);
+
+		std::vector<Matrix2D<RFLOAT> > As(nr_images);
+		for (int i = 0; i < nr_images; i++)
+			randomRotation(As[i]);
+
+		MultidimArray<Complex> f2d(size, size / 2 + 1);
+		while (state.keepRunning())
+		{
+			for (int i = 0; i < nr_images; i++)
+			{
+				f2d.initZeros();
+				projector.project(f2d, As[i]);
+				state.consume(DIRECT_MULTIDIM_ELEM(f2d, 1).real);
+			}
+		}
+
+		state.setItemsPerIteration((double)nr_images * MULTIDIM_SIZE(f2d));
+	}
+
+	void benchRotate2D(BenchmarkState &state, int size)
+	{
+		Projector projector;
+		makeProjector(size, 2, projector);
+
+		std::vector<Matrix2D<RFLOAT> > As(nr_images);
+		for (int i = 0; i < nr_images; i++)
+			Euler_angles2matrix(0., 0., rnd_unif(0., 360.), As[i]);
+
+		MultidimArray<Complex> f2d(size, size / 2 + 1);
+		while (state.keepRunning())
+		{
+			for (int i = 0; i < nr_images; i++)
+			{
+				f2d.initZeros();
+				projector.rotate2D(f2d, As[i]);
+				state.consume(DIRECT_MULTIDIM_ELEM(f2d, 1).real);
+			}
+		}
+
+		state.setItemsPerIteration((double)nr_images * MULTIDIM_SIZE(f2d));
+	}
+
+	void benchBackproject(BenchmarkState &state, int size)
+	{
+		BackProjector backprojector(size, 3, "C1", TRILINEAR, 2.);
+		backprojector.initZeros(size);
+
+		std::vector<Matrix2D<RFLOAT> > As(nr_images);
+		for (int i = 0; i < nr_images; i++)
+			randomRotation(As[i]);
+
+		MultidimArray<Complex> f2d;
+		MultidimArray<RFLOAT> Fctf(size, size / 2 + 1);
+		makeRandomFourierImage(size, f2d);
+		Fctf.initConstant(1.);
+
+		while (state.keepRunning())
+		{
+			for (int i = 0; i < nr_images; i++)
+				backprojector.backproject2Dto3D(f2d, As[i], &Fctf);
+		}
+		state.consume(DIRECT_MULTIDIM_ELEM(backprojector.weight, 1));
+
+		state.setItemsPerIteration((double)nr_images * MULTIDIM_SIZE(f2d));
+	}
+
+	void benchReconstruct(BenchmarkState &state, int size)
+	{
+		BackProjector filled(size, 3, "C1", TRILINEAR, 2.);
+		filled.initZeros(size);
+
+		// Enough random slices to cover Fourier space reasonably well
+		MultidimArray<Complex> f2d;
+		MultidimArray<RFLOAT> Fctf(size, size / 2 + 1);
+		Matrix2D<RFLOAT> A;
+		Fctf.initConstant(1.);
+		for (int i = 0; i < 2 * size; i++)
+		{
+			makeRandomFourierImage(size, f2d);
+			randomRotation(A);
+			filled.backproject2Dto3D(f2d, A, &Fctf);
+		}
+
+		MultidimArray<RFLOAT> vol, tau2;
+		while (state.keepRunning())
+		{
+			state.pauseTiming();
+			BackProjector backprojector(filled);
+			state.resumeTiming();
+
+			backprojector.reconstruct(vol, 10, false, tau2, 1., 1., -1, false, 0, nr_threads);
+			state.consume(DIRECT_MULTIDIM_ELEM(vol, 1));
+		}
+
+		state.setItemsPerIteration((double)size * size * size);
+	}
+
+	// CTF and phase shifts
+
+	void benchCTF(BenchmarkState &state, int size)
+	{
+		CTF ctf;
+		ctf.setValues(20000., 19000., 45., 300., 2.7, 0.1, 0., 1., 0.);
+
+		MultidimArray<RFLOAT> Fctf(size, size / 2 + 1);
+		while (state.keepRunning())
+		{
+			for (int i = 0; i < nr_images; i++)
+			{
+				ctf.getFftwImage(Fctf, size, size, angpix);
+				state.consume(DIRECT_MULTIDIM_ELEM(Fctf, 1));
+			}
+		}
+
+		state.setItemsPerIteration((double)nr_images * MULTIDIM_SIZE(Fctf));
+	}
+
+	void benchShift(BenchmarkState &state, int size)
+	{
+		MultidimArray<Complex> Fimg, Fshifted(size, size / 2 + 1);
+		makeRandomFourierImage(size, Fimg);
+
+		std::vector<RFLOAT> xshifts(nr_images), yshifts(nr_images);
+		for (int i = 0; i < nr_images; i++)
+		{
+			xshifts[i] = rnd_unif(-5., 5.);
+			yshifts[i] = rnd_unif(-5., 5.);
+		}
+
+		while (state.keepRunning())
+		{
+			for (int i = 0; i < nr_images; i++)
+			{
+				shiftImageInFourierTransform(Fimg, Fshifted, (RFLOAT)size, xshifts[i], yshifts[i]);
+				state.consume(DIRECT_MULTIDIM_ELEM(Fshifted, 1).real);
+			}
+		}
+
+		state.setItemsPerIteration((double)nr_images * MULTIDIM_SIZE(Fimg));
+	}
+
+	// I/O
+
+	void benchReadSTAR(BenchmarkState &state, int size)
+	{
+		// Scale the number of particles with the box size, so that the sizes give a useful range
+		const long int nr_particles = 100 * size;
+		const FileName fn_star = fn_tmp + "_particles.star";
+
+		MetaDataTable MDout;
+		MDout.setName("particles");
+		for (long int i = 0; i < nr_particles; i++)
+		{
+			FileName fn_img;
+			fn_img.compose(i % 1000 + 1, "Particles/mic" + integerToString(i / 1000, 4) + ".mrcs");
+			MDout.addObject();
+			MDout.setValue(EMDL_IMAGE_NAME, fn_img);
+			MDout.setValue(EMDL_MICROGRAPH_NAME, (FileName)("Micrographs/mic" + integerToString(i / 1000, 4) + ".mrc"));
+			MDout.setValue(EMDL_IMAGE_COORD_X, rnd_unif(0., 4096.));
+			MDout.setValue(EMDL_IMAGE_COORD_Y, rnd_unif(0., 4096.));
+			MDout.setValue(EMDL_ORIENT_ROT, rnd_unif(-180., 180.));
+			MDout.setValue(EMDL_ORIENT_TILT, rnd_unif(0., 180.));
+			MDout.setValue(EMDL_ORIENT_PSI, rnd_unif(-180., 180.));
+			MDout.setValue(EMDL_ORIENT_ORIGIN_X_ANGSTROM, rnd_unif(-5., 5.));
+			MDout.setValue(EMDL_ORIENT_ORIGIN_Y_ANGSTROM, rnd_unif(-5., 5.));
+			MDout.setValue(EMDL_CTF_DEFOCUSU, rnd_unif(5000., 30000.));
+			MDout.setValue(EMDL_CTF_DEFOCUSV, rnd_unif(5000., 30000.));
+			MDout.setValue(EMDL_CTF_DEFOCUS_ANGLE, rnd_unif(0., 180.));
+			MDout.setValue(EMDL_IMAGE_OPTICS_GROUP, 1);
+			MDout.setValue(EMDL_PARTICLE_CLASS, 1);
+		}
+		MDout.write(fn_star);
+
+		MetaDataTable MDin;
+		while (state.keepRunning())
+		{
+			MDin.read(fn_star, "particles");
+			state.consume(MDin.numberOfObjects());
+		}
+		std::remove(fn_star.c_str());
+
+		state.setItemsPerIteration(nr_particles);
+	}
+
+	void benchReadStack(BenchmarkState &state, int size)
+	{
+		const FileName fn_stack = fn_tmp + "_stack.mrcs";
+
+		Image<RFLOAT> Iout(size, size, 1, nr_images);
+		Iout().initRandom(0., 1., "gaussian");
+		Iout.setSamplingRateInHeader(angpix);
+		Iout.write(fn_stack);
+
+		Image<RFLOAT> Iin;
+		while (state.keepRunning())
+		{
+			Iin.read(fn_stack);
+			state.consume(DIRECT_MULTIDIM_ELEM(Iin(), 1));
+		}
+		std::remove(fn_stack.c_str());
+
+		state.setItemsPerIteration((double)nr_images * size * size);
+	}
+
+#ifdef ALTCPU
+	// Accelerated CPU kernels, fed with a model and images laid out as in the ALTCPU ml_optimiser
+
+	struct AccKernelData
+	{
+		std::vector<std::complex<XFLOAT> > mdlComplex;
+		std::vector<XFLOAT> eulers, trans_x, trans_y, trans_z;
+		std::vector<XFLOAT> Fimg_real, Fimg_imag, corr_img, ctfs;
+		int imgX, imgY;
+		unsigned long image_size, orientation_num, translation_num;
+	};
+
+	void makeAccKernelData(int size, Projector &projector, AccProjector &accProjector, AccKernelData &d)
+	{
+		makeProjector(size, 3, projector);
+
+		d.mdlComplex.resize(MULTIDIM_SIZE(projector.data));
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(projector.data)
+			d.mdlComplex[n] = std::complex<XFLOAT>(DIRECT_MULTIDIM_ELEM(projector.data, n).real,
+			                                      DIRECT_MULTIDIM_ELEM(projector.data, n).imag);
+
+		accProjector.setMdlDim(projector.data.xdim, projector.data.ydim, projector.data.zdim,
+		                       projector.data.yinit, projector.data.zinit,
+		                       projector.r_max, projector.padding_factor);
+		accProjector.initMdl(&d.mdlComplex[0]);
+
+		// Make the number of orientations a multiple of the coarse-kernel blocking
+		d.orientation_num = ((nr_images + D2C_EULERS_PER_BLOCK_REF3D - 1) / D2C_EULERS_PER_BLOCK_REF3D) * D2C_EULERS_PER_BLOCK_REF3D;
+		d.translation_num = 9;
+		d.imgX = size / 2 + 1;
+		d.imgY = size;
+		d.image_size = (unsigned long)d.imgX * d.imgY;
+
+		Matrix2D<RFLOAT> A;
+		d.eulers.resize(9 * d.orientation_num);
+		for (unsigned long i = 0; i < d.orientation_num; i++)
+		{
+			randomRotation(A);
+			for (int j = 0; j < 9; j++)
+				d.eulers[9 * i + j] = A.mdata[j];
+		}
+
+		d.trans_x.resize(d.translation_num);
+		d.trans_y.resize(d.translation_num);
+		d.trans_z.resize(d.translation_num, 0.);
+		for (unsigned long i = 0; i < d.translation_num; i++)
+		{
+			d.trans_x[i] = (XFLOAT)(i % 3) - 1.;
+			d.trans_y[i] = (XFLOAT)(i / 3) - 1.;
+		}
+
+		d.Fimg_real.resize(d.image_size);
+		d.Fimg_imag.resize(d.image_size);
+		d.corr_img.resize(d.image_size, 1.);
+		d.ctfs.resize(d.image_size, 1.);
+		for (unsigned long i = 0; i < d.image_size; i++)
+		{
+			d.Fimg_real[i] = rnd_gaus(0., 1.);
+			d.Fimg_imag[i] = rnd_gaus(0., 1.);
+		}
+	}
+
+	void benchAccDiff2Coarse(BenchmarkState &state, int size)
+	{
+		Projector projector;
+		AccProjector accProjector;
+		AccKernelData d;
+		makeAccKernelData(size, projector, accProjector, d);
+
+		AccProjectorKernel kernel = AccProjectorKernel::makeKernel(accProjector, d.imgX, d.imgY, 1, size / 2);
+		std::vector<XFLOAT> diff2s(d.orientation_num * d.translation_num);
+
+		while (state.keepRunning())
+		{
+			runDiff2KernelCoarse(kernel, &d.trans_x[0], &d.trans_y[0], &d.trans_z[0],
+			                     &d.corr_img[0], &d.Fimg_real[0], &d.Fimg_imag[0], &d.eulers[0], &diff2s[0],
+			                     0., d.orientation_num, d.translation_num, d.image_size, 0, false, false);
+			state.consume(diff2s[0]);
+		}
+
+		state.setItemsPerIteration((double)d.orientation_num * d.translation_num * d.image_size);
+	}
+
+	void benchAccWavg(BenchmarkState &state, int size)
+	{
+		Projector projector;
+		AccProjector accProjector;
+		AccKernelData d;
+		makeAccKernelData(size, projector, accProjector, d);
+
+		AccProjectorKernel kernel = AccProjectorKernel::makeKernel(accProjector, d.imgX, d.imgY, 1, size / 2);
+
+		// All weights significant, so that the kernel does its full amount of work
+		std::vector<XFLOAT> weights(d.orientation_num * d.translation_num, 1.);
+		std::vector<XFLOAT> wdiff2s_parts(d.image_size), wdiff2s_AA(d.image_size), wdiff2s_XA(d.image_size);
+
+		while (state.keepRunning())
+		{
+			AccUtilities::kernel_wavg<false,true,true,false,WAVG_BLOCK_SIZE>(
+				&d.eulers[0], kernel, d.image_size, d.orientation_num,
+				&d.Fimg_real[0], &d.Fimg_imag[0], &d.trans_x[0], &d.trans_y[0], &d.trans_z[0],
+				&weights[0], &d.ctfs[0], &wdiff2s_parts[0], &wdiff2s_AA[0], &wdiff2s_XA[0],
+				d.translation_num, (XFLOAT)(d.orientation_num * d.translation_num), (XFLOAT)0., (XFLOAT)1., 0);
+			state.consume(wdiff2s_parts[1]);
+		}
+
+		state.setItemsPerIteration((double)d.orientation_num * d.translation_num * d.image_size);
+	}
+
+	void benchAccBackproject(BenchmarkState &state, int size)
+	{
+		Projector projector;
+		AccProjector accProjector;
+		AccKernelData d;
+		makeAccKernelData(size, projector, accProjector, d);
+
+		AccProjectorKernel kernel = AccProjectorKernel::makeKernel(accProjector, d.imgX, d.imgY, 1, size / 2);
+
+		BackProjector backprojector(size, 3, "C1", TRILINEAR, 2.);
+		backprojector.initZeros(size);
+		AccBackprojector accBackprojector;
+		accBackprojector.setMdlDim(backprojector.data.xdim, backprojector.data.ydim, backprojector.data.zdim,
+		                           backprojector.data.yinit, backprojector.data.zinit,
+		                           backprojector.r_max, backprojector.padding_factor);
+		accBackprojector.initMdl();
+
+		std::vector<XFLOAT> weights(d.orientation_num * d.translation_num, 1.);
+		std::vector<XFLOAT> Minvsigma2s(d.image_size, 1.);
+
+		while (state.keepRunning())
+		{
+			runBackProjectKernel(accBackprojector, kernel, &d.Fimg_real[0], &d.Fimg_imag[0],
+			                     &d.trans_x[0], &d.trans_y[0], &d.trans_z[0],
+			                     &weights[0], &Minvsigma2s[0], &d.ctfs[0], d.translation_num,
+			                     (XFLOAT)0., (XFLOAT)(d.orientation_num * d.translation_num), &d.eulers[0],
+			                     d.imgX, d.imgY, 1, d.orientation_num, false, false, false, 0);
+		}
+		state.consume(accBackprojector.d_mdlWeight[0]);
+
+		state.setItemsPerIteration((double)d.orientation_num * d.translation_num * d.image_size);
+	}
+#endif
+};
+
+int main(int argc, char *argv[])
+{
+	microbench_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		//prm.usage();
+		std::cerr << XE;
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
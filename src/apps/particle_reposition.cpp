@@ -158,7 +158,7 @@ public:
 			bool found_one = false;
 			for (long int part_id = 0; part_id < optimiser.mydata.numberOfParticles(); part_id++)
 			{
-				long int ori_img_id = optimiser.mydata.particles[part_id].images[0].id;
+				long int ori_img_id = optimiser.mydata.getOriginalImageId(part_id, 0);
 				int optics_group = optimiser.mydata.getOpticsGroup(part_id, 0);
 				RFLOAT my_pixel_size = optimiser.mydata.getImagePixelSize(part_id, 0);
 				int my_image_size = optimiser.mydata.getOpticsImageSize(optics_group);
@@ -40,7 +40,7 @@ public:
 	FileName fn_map, fn_ang, fn_out, fn_img, fn_model, fn_sym, fn_mask, fn_ang_simulate;
 	RFLOAT rot, tilt, psi, xoff, yoff, zoff, angpix, maxres, stddev_white_noise, particle_diameter, ana_prob_range, ana_prob_step, sigma_offset;
 	int padding_factor;
-	int r_max, r_min_nn, interpolator, nr_uniform;
+	int r_max, r_min_nn, interpolator, nr_uniform, random_seed;
 	bool do_only_one, do_ctf, do_ctf2, ctf_phase_flipped, do_ctf_intact_1st_peak, do_timing, do_add_noise, do_subtract_exp, do_ignore_particle_name, do_3d_rot;
 	bool do_simulate;
 	RFLOAT simulate_SNR;
@@ -85,6 +85,7 @@ public:
 		do_simulate = parser.checkOption("--simulate", "Simulate data with known ground-truth by subtracting signal and adding projection in random orientation.");
 		simulate_SNR = textToFloat(parser.getOption("--adjust_simulation_SNR", "Relative SNR compared to input images for realistic simulation of data", "1."));
 		fn_ang_simulate = parser.getOption("--ang_simulate", "STAR file with orientations for projections of realistic simulations (random from --ang STAR file by default)", "");
+		random_seed = textToInteger(parser.getOption("--random_seed", "Seed for the random orientations and noise (default is to use the time, i.e. a different seed for every run)", "-1"));
 
 		maxres = textToFloat(parser.getOption("--maxres", "Maximum resolution (in Angstrom) to consider in Fourier space (default Nyquist)", "-1"));
 		padding_factor = textToInteger(parser.getOption("--pad", "Padding factor", "2"));
@@ -118,6 +119,10 @@ public:
 		Image<RFLOAT> vol, img, expimg;
 		FourierTransformer transformer, transformer_expimg;
 
+		// Reproducible simulations
+		if (random_seed >= 0)
+			init_random_generator(random_seed);
+
 		std::cout << " Reading map: " << fn_map << std::endl;
 		vol.read(fn_map);
 		std::cout << " Done reading map!" << std::endl;
@@ -136,7 +141,8 @@ public:
 		{
 			std::cout << " Generating " << nr_uniform << " projections taken randomly from a uniform angular distribution ..." << std::endl;
 			MDang.clear();
-			randomize_random_generator();
+			if (random_seed < 0)
+				randomize_random_generator();
 			for (long int i = 0; i < nr_uniform; i++)
 			{
 				RFLOAT rot, tilt, psi, xoff, yoff;
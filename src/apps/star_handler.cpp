@@ -25,6 +25,68 @@
 #include <src/jaz/obs_model.h>
 #include <src/pipeline_jobs.h>
 #include <cmath>
+#include <algorithm>
+
+// Writes a table in chunks, so that it never has to be in memory as a whole.
+// The output goes to a temporary file, that is renamed to fn_out upon close().
+class star_chunk_writer
+{
+	public:
+
+	FileName fn_out;
+	std::ofstream fh;
+	MetaDataTable MDheader;
+	bool has_header;
+	long int nr_objects;
+
+	// Start writing a table with the name and labels of MD, after the optics table if given
+	void open(FileName _fn_out, const MetaDataTable &MD, MetaDataTable *MDoptics = NULL)
+	{
+		fn_out = _fn_out;
+		fh.open((fn_out + ".tmp").c_str(), std::ios::out);
+		if (!fh)
+			REPORT_ERROR("ERROR: cannot write to file: " + fn_out + ".tmp");
+
+		MDheader.clear();
+		MDheader.addMissingLabels(&MD);
+		MDheader.setName(MD.getName());
+		has_header = false;
+		nr_objects = 0;
+
+		if (MDoptics != NULL)
+		{
+			MDoptics->setName("optics");
+			MDoptics->write(fh);
+		}
+	}
+
+	// Append the objects of MD, which should have (at least) the labels of the table given to open()
+	void write(MetaDataTable &MD)
+	{
+		if (MD.numberOfObjects() == 0)
+			return;
+
+		// Like MetaDataTable::write(), do not write a header for an empty table
+		if (!has_header)
+		{
+			MDheader.writeStarLoopHeader(fh);
+			has_header = true;
+		}
+		MD.writeStarLoopObjects(fh, &MDheader);
+		nr_objects += MD.numberOfObjects();
+	}
+
+	void close()
+	{
+		if (has_header)
+			MetaDataTable::writeStarLoopEnd(fh);
+		fh.close();
+		if (fh.fail())
+			REPORT_ERROR("ERROR: cannot write to file: " + fn_out + ".tmp");
+		if (std::rename((fn_out + ".tmp").c_str(), fn_out.c_str()) != 0)
+			REPORT_ERROR("ERROR: cannot rename " + fn_out + ".tmp to " + fn_out);
+	}
+};
 
 class star_handler_parameters
 {
@@ -38,7 +100,7 @@ class star_handler_parameters
 	std::string remove_col_label, add_col_label, add_col_value, add_col_from, hist_col_label, select_include_str, select_exclude_str;
 	RFLOAT eps, select_minval, select_maxval, multiply_by, add_to, center_X, center_Y, center_Z, hist_min, hist_max;
 	bool do_ignore_optics, do_combine, do_split, do_center, do_random_order, show_frac, show_cumulative, do_discard;
-	long int nr_split, size_split, nr_bin, random_seed;
+	long int nr_split, size_split, nr_bin, random_seed, chunk_size;
 	RFLOAT discard_sigma, duplicate_threshold, extract_angpix, cl_angpix;
 	ObservationModel obsModel;
 	// I/O Parser
@@ -60,6 +122,7 @@ class star_handler_parameters
 		do_ignore_optics = parser.checkOption("--ignore_optics", "Provide this option for relion-3.0 functionality, without optics groups");
 		cl_angpix = textToFloat(parser.getOption("--angpix", "Pixel size in Angstrom, for when ignoring the optics groups in the input star file", "1."));
 		tablename_in = parser.getOption("--i_tablename", "If ignoring optics, then read table with this name", "");
+		chunk_size = textToLongLong(parser.getOption("--chunk_size", "Number of lines to process at a time when streaming through large STAR files", "100000"));
 
 		int compare_section = parser.addSection("Compare options");
 		fn_compare = parser.getOption("--compare", "STAR file name to compare the input STAR file with", "");
@@ -193,6 +256,93 @@ class star_handler_parameters
 		else obsModel.save(MD, fn, tablename);
 	}
 
+	// Open a table to read it one chunk at a time with next_chunk(). Only its labels are read into MD.
+	// Tables that need conversion from relion-3.0 or renumbering of their optics groups are read
+	// entirely (like read_check_ignore_optics), in which case in is left closed.
+	void open_table(std::ifstream &in, FileName fn, MetaDataTable &MD, std::string tablename = "discover",
+	                ObservationModel *myobsModel = NULL)
+	{
+		FileName fn_read = fn.removeFileFormat();
+		in.open(fn_read.c_str(), std::ios_base::in);
+		if (in.fail())
+			REPORT_ERROR("ERROR: cannot read file: " + fn_read);
+
+		bool is_streamed = false;
+		if (do_ignore_optics)
+		{
+			is_streamed = MD.readStarLoopHeader(in, (tablename == "discover") ? tablename_in : tablename);
+		}
+		else
+		{
+			MetaDataTable MDoptics;
+			MDoptics.readStar(in, "optics");
+			if (MDoptics.numberOfObjects() > 0)
+			{
+				ObservationModel streamObsModel(MDoptics, myobsModel != NULL);
+				if (streamObsModel.opticsMdt.numberOfObjects() > 0 && streamObsModel.opticsGroupsSorted())
+				{
+					if (tablename == "discover")
+						is_streamed = MD.readStarLoopHeader(in, "particles") ||
+						              MD.readStarLoopHeader(in, "micrographs") ||
+						              MD.readStarLoopHeader(in, "movies");
+					else
+						is_streamed = MD.readStarLoopHeader(in, tablename);
+
+					// loadSafely() also fills in rlnMicrographPixelSize for these
+					if (MD.getName() != "particles" && streamObsModel.opticsMdt.containsLabel(EMDL_IMAGE_PIXEL_SIZE))
+						is_streamed = false;
+
+					if (is_streamed)
+					{
+						if (myobsModel == NULL) obsModel = streamObsModel;
+						else *myobsModel = streamObsModel;
+					}
+				}
+			}
+		}
+
+		if (!is_streamed)
+		{
+			in.close();
+			if (do_ignore_optics) MD.read(fn, (tablename == "discover") ? tablename_in : tablename);
+			else if (myobsModel == NULL) read_check_ignore_optics(MD, fn, tablename);
+			else ObservationModel::loadSafely(fn, *myobsModel, MD, tablename, 1);
+		}
+	}
+
+	// Read the next chunk of a table opened with open_table() into MD. Returns false at the end of the table.
+	// A table that was read entirely is returned as a single chunk.
+	bool next_chunk(std::ifstream &in, MetaDataTable &MD, bool &is_first, bool do_check_optics_groups = true)
+	{
+		bool has_objects = is_first;
+		is_first = false;
+
+		if (in.is_open())
+		{
+			has_objects = (MD.readStarLoopObjects(in, chunk_size) > 0);
+
+			// loadSafely() checks this for tables that are read entirely
+			if (has_objects && do_check_optics_groups && !do_ignore_optics && MD.containsLabel(EMDL_IMAGE_OPTICS_GROUP))
+			{
+				std::vector<int> undefinedOptGroups = obsModel.findUndefinedOptGroups(MD);
+				if (undefinedOptGroups.size() > 0)
+					REPORT_ERROR("ERROR: optics group " + integerToString(undefinedOptGroups[0]) + " is not defined in " + fn_in);
+			}
+		}
+
+		return has_objects;
+	}
+
+	// Go back to the first chunk of a table opened with open_table()
+	void rewind_table(std::ifstream &in, MetaDataTable &MD)
+	{
+		if (in.is_open())
+		{
+			std::string name = MD.getName();
+			MD.readStarLoopHeader(in, name);
+		}
+	}
+
 	void compare()
 	{
 	   	MetaDataTable MD1, MD2, MDonly1, MDonly2, MDboth;
@@ -228,13 +378,20 @@ class star_handler_parameters
 	void select()
 	{
 		MetaDataTable MDin, MDout;
+		std::ifstream in;
+		star_chunk_writer out;
 
-		read_check_ignore_optics(MDin, fn_in);
+		open_table(in, fn_in, MDin);
+		out.open(fn_out, MDin, (do_ignore_optics) ? NULL : &obsModel.opticsMdt);
 
-		MDout = subsetMetaDataTable(MDin, EMDL::str2Label(select_label), select_minval, select_maxval);
+		for (bool is_first = true; next_chunk(in, MDin, is_first); )
+		{
+			MDout = subsetMetaDataTable(MDin, EMDL::str2Label(select_label), select_minval, select_maxval);
+			out.write(MDout);
+		}
 
-		write_check_ignore_optics(MDout, fn_out, MDin.getName());
-		std::cout << " Written: " << fn_out << " with " << MDout.numberOfObjects() << " item(s)" << std::endl;
+		out.close();
+		std::cout << " Written: " << fn_out << " with " << out.nr_objects << " item(s)" << std::endl;
 	}
 
 	void select_by_str()
@@ -246,15 +403,22 @@ class star_handler_parameters
 			REPORT_ERROR("You must specify only and at least one of --select_include and --select_exclude");
 
 		MetaDataTable MDin, MDout;
+		std::ifstream in;
+		star_chunk_writer out;
 
-		read_check_ignore_optics(MDin, fn_in);
+		open_table(in, fn_in, MDin);
+		out.open(fn_out, MDin, (do_ignore_optics) ? NULL : &obsModel.opticsMdt);
 
-		if (select_include_str != "")
-			MDout = subsetMetaDataTable(MDin, EMDL::str2Label(select_str_label), select_include_str, false);
-		else
-			MDout = subsetMetaDataTable(MDin, EMDL::str2Label(select_str_label), select_exclude_str, true);
+		for (bool is_first = true; next_chunk(in, MDin, is_first); )
+		{
+			if (select_include_str != "")
+				MDout = subsetMetaDataTable(MDin, EMDL::str2Label(select_str_label), select_include_str, false);
+			else
+				MDout = subsetMetaDataTable(MDin, EMDL::str2Label(select_str_label), select_exclude_str, true);
+			out.write(MDout);
+		}
 
-		write_check_ignore_optics(MDout, fn_out, MDin.getName());
+		out.close();
 		std::cout << " Written: " << fn_out << std::endl;
 
 	}
@@ -341,22 +505,25 @@ class star_handler_parameters
 			fnt.globFiles(fns_in, false);
 		}
 
-		MetaDataTable MDin, MDout;
-		std::vector<MetaDataTable> MDsin, MDoptics;
-		std::vector<ObservationModel> obsModels;
-		// Read the first table into the global obsModel
-		read_check_ignore_optics(MDin, fns_in[0]);
-		MDsin.push_back(MDin);
-		// Read all the rest of the tables into local obsModels
-		for (int i = 1; i < fns_in.size(); i++)
+		if (fns_in.size() == 0)
+			REPORT_ERROR("ERROR: no input STAR files to combine.");
+
+		// Only read the labels and optics groups of all tables here, and stream through them when writing out
+		// Tables that cannot be streamed are read entirely
+		// The first table goes into the global obsModel, all the rest into local obsModels
+		std::vector<MetaDataTable> MDsin(fns_in.size()), MDoptics;
+		std::vector<ObservationModel> obsModels(fns_in.size() - 1);
+		std::vector<bool> is_streamed(fns_in.size());
+		for (int i = 0; i < fns_in.size(); i++)
 		{
-			ObservationModel myobsModel;
-			if (do_ignore_optics) MDin.read(fns_in[i], tablename_in);
-			else ObservationModel::loadSafely(fns_in[i], myobsModel, MDin, "discover", 1);
-			MDsin.push_back(MDin);
-			obsModels.push_back(myobsModel);
+			std::ifstream in;
+			open_table(in, fns_in[i], MDsin[i], "discover", (i == 0) ? NULL : &obsModels[i - 1]);
+			is_streamed[i] = in.is_open();
 		}
 
+		// The new optics group of each old one, for every input table
+		std::vector<std::map<int, int> > new_optics_groups(fns_in.size());
+
 		// Combine optics groups with the same EMDL_IMAGE_OPTICS_GROUP_NAME, make new ones for those with a different name
 		if (!do_ignore_optics)
 		{
@@ -366,8 +533,11 @@ class star_handler_parameters
 			FOR_ALL_OBJECTS_IN_METADATA_TABLE(obsModel.opticsMdt)
 			{
 				std::string myname;
+				int my_optics_group;
 				obsModel.opticsMdt.getValue(EMDL_IMAGE_OPTICS_GROUP_NAME, myname);
+				obsModel.opticsMdt.getValue(EMDL_IMAGE_OPTICS_GROUP, my_optics_group);
 				optics_group_uniq_names.push_back(myname);
+				new_optics_groups[0][my_optics_group] = my_optics_group;
 			}
 
 			// Now check uniqueness of the other tables
@@ -375,14 +545,6 @@ class star_handler_parameters
 			{
 				const int obs_id = MDs_id - 1;
 
-				std::vector<int> new_optics_groups;
-				FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDsin[MDs_id])
-				{
-					int tmp;
-					MDsin[MDs_id].getValue(EMDL_IMAGE_OPTICS_GROUP, tmp);
-					new_optics_groups.push_back(tmp);
-				}
-
 				MetaDataTable unique_opticsMdt;
 				unique_opticsMdt.addMissingLabels(&obsModels[obs_id].opticsMdt);
 
@@ -429,32 +591,11 @@ class star_handler_parameters
 						std::cout << " + Renumbering group " << myname << " from " << my_optics_group << " to " << new_group << std::endl;
 					}
 
-					// Update the optics_group entry for all particles in the MDsin
-					for (long int current_object2 = MDsin[MDs_id].firstObject();
-					     current_object2 < MDsin[MDs_id].numberOfObjects() && current_object2 >= 0;
-					     current_object2 = MDsin[MDs_id].nextObject())
-					{
-						int old_optics_group;
-						MDsin[MDs_id].getValue(EMDL_IMAGE_OPTICS_GROUP, old_optics_group, current_object2);
-						if (old_optics_group == my_optics_group)
-							new_optics_groups[current_object2] = new_group;
-					}
+					// The optics_group entry for all particles is updated when they are written out
+					new_optics_groups[MDs_id][my_optics_group] = new_group;
 				}
 
 				obsModels[obs_id].opticsMdt = unique_opticsMdt;
-
-				FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDsin[MDs_id])
-				{
-					MDsin[MDs_id].setValue(EMDL_IMAGE_OPTICS_GROUP, new_optics_groups[current_object]);
-
-					// Also rename the rlnGroupName to not have groups overlapping from different optics groups
-					std::string name;
-					if (MDsin[MDs_id].getValue(EMDL_MLMODEL_GROUP_NAME, name))
-					{
-						name = "optics"+integerToString(new_optics_groups[current_object])+"_"+name;
-						MDsin[MDs_id].setValue(EMDL_MLMODEL_GROUP_NAME, name);
-					}
-				}
 			}
 
 			// Make one vector for combination of the optics tables
@@ -599,53 +740,105 @@ class star_handler_parameters
 			obsModel.opticsMdt = MetaDataTable::combineMetaDataTables(MDoptics);
 		}
 
-		// Combine the particles tables
-		MDout = MetaDataTable::combineMetaDataTables(MDsin);
+		// Combine the particles tables: only labels that are present in all of them
+		MetaDataTable MDout = MetaDataTable::getCommonLabels(MDsin);
+		MDout.setName(MDsin[0].getName());
 
 		//Deactivate the group_name column
 		MDout.deactivateLabel(EMDL_MLMODEL_GROUP_NO);
 
+		EMDLabel check_label;
+		std::vector<std::string> check_values;
 		if (fn_check != "")
 		{
-			EMDLabel label = EMDL::str2Label(fn_check);
-			if (!MDout.containsLabel(label))
+			check_label = EMDL::str2Label(fn_check);
+			if (!MDout.containsLabel(check_label))
 				REPORT_ERROR("ERROR: the output file does not contain the label to check for duplicates. Is it present in all input files?");
+		}
 
-			/// Don't want to mess up original order, so make a MDsort with only that label...
-			FileName fn_this, fn_prev = "";
-			MetaDataTable MDsort;
-			FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDout)
+		star_chunk_writer out;
+		out.open(fn_out, MDout, (do_ignore_optics) ? NULL : &obsModel.opticsMdt);
+		for (int i = 0; i < fns_in.size(); i++)
+		{
+			std::ifstream in;
+			if (is_streamed[i])
 			{
-				MDout.getValue(label, fn_this);
-				MDsort.addObject();
-				MDsort.setValue(label, fn_this);
+				std::string name = MDsin[i].getName();
+				in.open(fns_in[i].removeFileFormat().c_str(), std::ios_base::in);
+				MDsin[i].readStarLoopHeader(in, name);
+			}
+
+			for (bool is_first = true; next_chunk(in, MDsin[i], is_first, false); )
+			{
+				if (!do_ignore_optics)
+				{
+					FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDsin[i])
+					{
+						int old_optics_group;
+						MDsin[i].getValue(EMDL_IMAGE_OPTICS_GROUP, old_optics_group);
+						std::map<int, int>::const_iterator it = new_optics_groups[i].find(old_optics_group);
+						if (it == new_optics_groups[i].end())
+							REPORT_ERROR("ERROR: optics group " + integerToString(old_optics_group) + " is not defined in " + fns_in[i]);
+
+						if (i == 0)
+							continue;
+
+						MDsin[i].setValue(EMDL_IMAGE_OPTICS_GROUP, it->second);
+
+						// Also rename the rlnGroupName to not have groups overlapping from different optics groups
+						std::string name;
+						if (MDsin[i].getValue(EMDL_MLMODEL_GROUP_NAME, name))
+						{
+							name = "optics"+integerToString(it->second)+"_"+name;
+							MDsin[i].setValue(EMDL_MLMODEL_GROUP_NAME, name);
+						}
+					}
+				}
+
+				if (fn_check != "")
+				{
+					FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDsin[i])
+					{
+						std::string value;
+						MDsin[i].getValue(check_label, value);
+						check_values.push_back(value);
+					}
+				}
+
+				out.write(MDsin[i]);
 			}
-			// sort on the label
-			MDsort.newSort(label);
+
+			// Free the tables that were read entirely
+			MDsin[i].clear();
+		}
+		out.close();
+
+		if (fn_check != "")
+		{
+			// Don't want to mess up original order, so only sort the values of that label
+			std::sort(check_values.begin(), check_values.end());
 			long int nr_duplicates = 0;
-			FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDsort)
+			for (long int i = 1; i < check_values.size(); i++)
 			{
-				MDsort.getValue(label, fn_this);
-				if (fn_this == fn_prev)
+				if (check_values[i] == check_values[i - 1])
 				{
 					nr_duplicates++;
-					std::cerr << " WARNING: duplicate entry: " << fn_this << std::endl;
+					std::cerr << " WARNING: duplicate entry: " << check_values[i] << std::endl;
 				}
-				fn_prev = fn_this;
 			}
 
 			if (nr_duplicates > 0)
 				std::cerr << " WARNING: Total number of duplicate "<< fn_check << " entries: " << nr_duplicates << std::endl;
 		}
 
-		write_check_ignore_optics(MDout, fn_out, MDin.getName());
 		std::cout << " Written: " << fn_out << std::endl;
 	}
 
 	void split()
 	{
 		MetaDataTable MD;
-		read_check_ignore_optics(MD, fn_in);
+		std::ifstream in;
+		long int n_obj;
 
 		// Randomise if neccesary
 		if (do_random_order)
@@ -655,10 +848,25 @@ class star_handler_parameters
 			else
 				init_random_generator(random_seed);
 
+			read_check_ignore_optics(MD, fn_in);
 			MD.randomiseOrder();
+			n_obj = MD.numberOfObjects();
+		}
+		else
+		{
+			// Count the objects first, without keeping them in memory
+			open_table(in, fn_in, MD);
+			if (in.is_open())
+			{
+				n_obj = MD.readStarLoopObjects(in, -1, true);
+				rewind_table(in, MD);
+			}
+			else
+			{
+				n_obj = MD.numberOfObjects();
+			}
 		}
 
-		long int n_obj = MD.numberOfObjects();
 		if (n_obj == 0)
 		{
 			REPORT_ERROR("ERROR: empty STAR file...");
@@ -677,37 +885,63 @@ class star_handler_parameters
 			size_split = CEIL(1. * n_obj / nr_split);
 		}
 
-		std::vector<MetaDataTable > MDouts;
-		MDouts.resize(nr_split);
+		// Sjors 19jun2019: write out a star file with the output nodes
+		MetaDataTable MDnodes;
+		MDnodes.setName("output_nodes");
 
+		// The splits are consecutive, so only one of them is open at a time
+		star_chunk_writer out;
+		MetaDataTable MDout;
+		int isplit = -1;
 		long int n = 0;
-		FOR_ALL_OBJECTS_IN_METADATA_TABLE(MD)
+		for (bool is_first = true; next_chunk(in, MD, is_first); )
 		{
-			int my_split = n / size_split;
-			if (my_split < nr_split)
-			{
-				MDouts[my_split].addObject(MD.getObject(current_object));
-			}
-			else
+			FOR_ALL_OBJECTS_IN_METADATA_TABLE(MD)
 			{
-				break;
+				int my_split = n / size_split;
+				if (my_split >= nr_split)
+				{
+					break;
+				}
+
+				while (isplit < my_split)
+				{
+					out.write(MDout);
+					MDout.clear();
+					next_split(out, isplit, MD, MDnodes);
+				}
+
+				MDout.addObject(MD.getObject(current_object));
+				n++;
 			}
-			n++;
+
+			out.write(MDout);
+			MDout.clear();
 		}
 
-		// Sjors 19jun2019: write out a star file with the output nodes
-		MetaDataTable MDnodes;
-		MDnodes.setName("output_nodes");
-		FileName fnt0;
-		fnt0 = integerToString(nr_split);
-		for (int isplit = 0; isplit < nr_split; isplit ++)
+		// Also write out any empty splits at the end
+		while (isplit < nr_split)
 		{
-			FileName fnt = fn_out.insertBeforeExtension("_split"+integerToString(isplit+1));
-			write_check_ignore_optics(MDouts[isplit], fnt, MD.getName());
-			std::cout << " Written: " <<fnt << " with " << MDouts[isplit].numberOfObjects() << " objects." << std::endl;
+			next_split(out, isplit, MD, MDnodes);
+		}
+
+		// write out the star file with the output nodes
+		FileName mydir = fn_out.beforeLastOf("/");
+		if (mydir == "") mydir = ".";
+		MDnodes.write(mydir + "/" + RELION_OUTPUT_NODES);
+
+	}
+
+	// Close split isplit (if it is open) and open the next one (if there is one)
+	void next_split(star_chunk_writer &out, int &isplit, MetaDataTable &MD, MetaDataTable &MDnodes)
+	{
+		if (isplit >= 0)
+		{
+			out.close();
+			std::cout << " Written: " << out.fn_out << " with " << out.nr_objects << " objects." << std::endl;
 
 			MDnodes.addObject();
-			MDnodes.setValue(EMDL_PIPELINE_NODE_NAME, fnt);
+			MDnodes.setValue(EMDL_PIPELINE_NODE_NAME, out.fn_out);
 			int type;
 			if (MD.getName() == "micrographs")
 			{
@@ -726,11 +960,12 @@ class star_handler_parameters
 			MDnodes.setValue(EMDL_PIPELINE_NODE_TYPE, type);
 		}
 
-		// write out the star file with the output nodes
-		FileName mydir = fn_out.beforeLastOf("/");
-		if (mydir == "") mydir = ".";
-		MDnodes.write(mydir + "/" + RELION_OUTPUT_NODES);
-
+		isplit++;
+		if (isplit < nr_split)
+		{
+			FileName fnt = fn_out.insertBeforeExtension("_split"+integerToString(isplit+1));
+			out.open(fnt, MD, (do_ignore_optics) ? NULL : &obsModel.opticsMdt);
+		}
 	}
 
 	void operate()
@@ -1014,7 +1249,8 @@ class star_handler_parameters
 			REPORT_ERROR("Duplicate removal is not compatible with --ignore_optics");
 
 		MetaDataTable MD;
-		read_check_ignore_optics(MD, fn_in, "particles");
+		std::ifstream in;
+		open_table(in, fn_in, MD, "particles");
 
 		EMDLabel mic_label;
 		if (MD.containsLabel(EMDL_MICROGRAPH_NAME)) mic_label = EMDL_MICROGRAPH_NAME;
@@ -1042,10 +1278,80 @@ class star_handler_parameters
 		std::cout << " + The particle shifts (rlnOriginXAngst, rlnOriginYAngst) are multiplied by " << scale << " to bring it to the same scale as rlnCoordinateX/Y." << std::endl;
 		FileName fn_removed = fn_out.withoutExtension() + "_removed.star";
 
+		// Same checks as in removeDuplicatedParticles()
+		if (!MD.containsLabel(EMDL_ORIENT_ORIGIN_X_ANGSTROM) || !MD.containsLabel(EMDL_ORIENT_ORIGIN_Y_ANGSTROM))
+			REPORT_ERROR("You need rlnOriginXAngst and rlnOriginYAngst to remove duplicated particles");
+		if (!MD.containsLabel(EMDL_IMAGE_COORD_X) || !MD.containsLabel(EMDL_IMAGE_COORD_Y))
+			REPORT_ERROR("You need rlnCoordinateX, rlnCoordinateY to remove duplicated particles");
+
+		bool dataIs3D = MD.containsLabel(EMDL_IMAGE_COORD_Z);
+		if (dataIs3D && !MD.containsLabel(EMDL_ORIENT_ORIGIN_Z_ANGSTROM))
+			REPORT_ERROR("You need rlnOriginZAngst to remove duplicated 3D particles");
+
+		// First pass: only keep the coordinates of all particles, grouped by micrograph
+		std::vector<RFLOAT> xs, ys, zs;
+		std::map<std::string, std::vector<long> > grouped;
+		long int n_obj = 0;
+		for (bool is_first = true; next_chunk(in, MD, is_first); )
+		{
+			FOR_ALL_OBJECTS_IN_METADATA_TABLE(MD)
+			{
+				std::string mic_name;
+				MD.getValue(mic_label, mic_name);
+
+				RFLOAT val1, val2;
+				MD.getValue(EMDL_ORIENT_ORIGIN_X_ANGSTROM, val1);
+				MD.getValue(EMDL_IMAGE_COORD_X, val2);
+				xs.push_back(-val1 * scale + val2);
+				MD.getValue(EMDL_ORIENT_ORIGIN_Y_ANGSTROM, val1);
+				MD.getValue(EMDL_IMAGE_COORD_Y, val2);
+				ys.push_back(-val1 * scale + val2);
+
+				if (dataIs3D)
+				{
+					MD.getValue(EMDL_ORIENT_ORIGIN_Z_ANGSTROM, val1);
+					MD.getValue(EMDL_IMAGE_COORD_Z, val2);
+					zs.push_back(-val1 * scale + val2);
+				}
+
+				grouped[mic_name].push_back(n_obj++);
+			}
+		}
+
+		std::vector<bool> valid(n_obj, true);
+		for (std::map<std::string, std::vector<long> >::iterator it = grouped.begin(); it != grouped.end(); ++it)
+			findDuplicatedParticles(it->second, xs, ys, zs, duplicate_threshold_in_px, valid);
+
+		// Second pass: write out the valid and the duplicated particles
+		rewind_table(in, MD);
+		MD.setName("particles");
+
+		star_chunk_writer out, removed;
+		out.open(fn_out, MD, &obsModel.opticsMdt);
+		removed.open(fn_removed, MD);
+
+		MetaDataTable MDout, MDremoved;
+		long int n = 0;
+		for (bool is_first = true; next_chunk(in, MD, is_first, false); )
+		{
+			FOR_ALL_OBJECTS_IN_METADATA_TABLE(MD)
+			{
+				if (valid[n++])
+					MDout.addObject(MD.getObject(current_object));
+				else
+					MDremoved.addObject(MD.getObject(current_object));
+			}
+
+			out.write(MDout);
+			removed.write(MDremoved);
+			MDout.clear();
+			MDremoved.clear();
+		}
 
-		MetaDataTable MDout = removeDuplicatedParticles(MD, mic_label, duplicate_threshold_in_px, scale, fn_removed, true);
+		out.close();
+		removed.close();
 
-		write_check_ignore_optics(MDout, fn_out, "particles");
+		std::cout << "Removed " << removed.nr_objects << " duplicated objects from " << n_obj << " objects." << std::endl;
 		std::cout << " Written: " << fn_out << std::endl;
 	}
 };
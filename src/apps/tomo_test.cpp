@@ -24,6 +24,17 @@ int main(int argc, char *argv[])
 	
 	const bool prescaled = true;
 	
+	// --bricked <depth>: reconstruct out of core, <depth> slices at a time
+	int slabDepth = 0;
+	
+	for (int i = 1; i+1 < argc; i++)
+	{
+		if (std::string(argv[i]) == "--bricked")
+		{
+			slabDepth = textToInteger(argv[i+1]);
+		}
+	}
+	
 	TomoStack ts;
 	
 	if (!prescaled)
@@ -71,7 +82,20 @@ int main(int argc, char *argv[])
 	
 	std::cout << "filling done.\n";
 		
-	BackprojectionHelper::backprojectRaw(ts, dest, maskDest, origin, spacing);
+	if (slabDepth > 0)
+	{
+		BrickedVolume<RFLOAT> bricked(w,h,d);
+		
+		BackprojectionHelper::backprojectRawBricked(ts, bricked, origin, spacing, slabDepth);
+		
+		std::cout << "backprojection done, " << bricked.storedBytes() << " bytes swapped out.\n";
+		
+		bricked.readSlab(0, dest);
+	}
+	else
+	{
+		BackprojectionHelper::backprojectRaw(ts, dest, maskDest, origin, spacing);
+	}
 	
 	// write clean tomogram into test00.vtk
 	
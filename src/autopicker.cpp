@@ -17,6 +17,7 @@
  * source code. Additional authorship citations may be added, but existing
  * author citations must be preserved.
  ***************************************************************************/
+#include <omp.h>
 #include "src/autopicker.h"
 
 //#define DEBUG
@@ -166,6 +167,7 @@ void AutoPicker::read(int argc, char **argv)
 	workFrac = textToFloat(parser.getOption("--shrink", "Reduce micrograph to this fraction size, during correlation calc (saves memory and time)", "1.0"));
 	LoG_max_search = textToFloat(parser.getOption("--Log_max_search", "Maximum diameter in LoG-picking multi-scale approach is this many times the min/max diameter", "5."));
 	extra_padding = textToInteger(parser.getOption("--extra_pad", "Number of pixels for additional padding of the original micrograph", "0"));
+	nr_threads = textToInteger(parser.getOption("--j", "Number of threads for the CPU template-matching (per MPI process)", "1"));
 
 	// Check for errors in the command-line option
 	if (parser.checkForErrors())
@@ -2624,37 +2626,67 @@ void AutoPicker::autoPickLoGOneMicrograph(FileName &fn_mic, long int imic)
 			}
 		}
 
-		Image<RFLOAT> Maux(workSize, workSize);
-
 //		transformer.inverseFourierTransform(Fmic, Maux());
 //		Maux.write("LoG-ctf-filtered.mrc");
 //		REPORT_ERROR("stop");
 
 		// Make the diameter of the LoG filter larger in steps of LoG_incr_search (=1.5)
 		// Search sizes from LoG_min_diameter to LoG_max_search (=5) * LoG_max_diameter
-		for (int i = 0; i < diams_LoG.size(); i++)
-		{
-			RFLOAT myd = diams_LoG[i];
+		// All scales are filtered from the same downsized Fmic, so they are independent and are distributed over the threads.
+		// Each thread keeps its own best maps (and FFTW plans); a static schedule gives each thread a contiguous block of
+		// increasing diameters, so merging the maps in thread order gives the same result as looping over the scales serially.
+		int my_nr_threads = XMIPP_MAX(1, XMIPP_MIN(nr_threads, (int)diams_LoG.size()));
+		std::vector<MultidimArray<float> > thread_best_size(my_nr_threads), thread_best_fom(my_nr_threads);
+		#pragma omp parallel num_threads(my_nr_threads)
+		{
+			int ithread = omp_get_thread_num();
+			FourierTransformer mytransformer;
+			MultidimArray<Complex > myFaux;
+			Image<RFLOAT> Maux(workSize, workSize);
+			MultidimArray<float> &mybest_size = thread_best_size[ithread];
+			MultidimArray<float> &mybest_fom = thread_best_fom[ithread];
+			mybest_size.resize(workSize, workSize);
+			mybest_size.initConstant(-999.);
+			mybest_fom.resize(workSize, workSize);
+			mybest_fom.initConstant(-999.);
+
+			#pragma omp for schedule(static)
+			for (int i = 0; i < diams_LoG.size(); i++)
+			{
+				RFLOAT myd = diams_LoG[i];
 
-			Faux = Fmic;
-			LoGFilterMap(Faux, micrograph_size, myd, angpix);
-			transformer.inverseFourierTransform(Faux, Maux());
+				myFaux = Fmic;
+				LoGFilterMap(myFaux, micrograph_size, myd, angpix);
+				mytransformer.inverseFourierTransform(myFaux, Maux());
 
-			if (do_write_fom_maps)
-			{
-				FileName fn_tmp=getOutputRootName(fn_mic)+"_"+fn_out+"_LoG"+integerToString(ROUND(myd))+".spi";
-				Maux.write(fn_tmp);
+				if (do_write_fom_maps)
+				{
+					FileName fn_tmp=getOutputRootName(fn_mic)+"_"+fn_out+"_LoG"+integerToString(ROUND(myd))+".spi";
+					#pragma omp critical(AutoPicker_write_LoG)
+					Maux.write(fn_tmp);
+				}
+
+				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Maux())
+				{
+					if (DIRECT_MULTIDIM_ELEM(Maux(), n) > DIRECT_MULTIDIM_ELEM(mybest_fom, n))
+					{
+						DIRECT_MULTIDIM_ELEM(mybest_fom, n) = DIRECT_MULTIDIM_ELEM(Maux(), n);
+						DIRECT_MULTIDIM_ELEM(mybest_size, n) = myd;
+					}
+				}
 			}
+		}
 
-			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Maux())
+		for (int ithread = 0; ithread < my_nr_threads; ithread++)
+		{
+			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Mbest_fom)
 			{
-				if (DIRECT_MULTIDIM_ELEM(Maux(), n) > DIRECT_MULTIDIM_ELEM(Mbest_fom, n))
+				if (DIRECT_MULTIDIM_ELEM(thread_best_fom[ithread], n) > DIRECT_MULTIDIM_ELEM(Mbest_fom, n))
 				{
-					DIRECT_MULTIDIM_ELEM(Mbest_fom, n) = DIRECT_MULTIDIM_ELEM(Maux(), n);
-					DIRECT_MULTIDIM_ELEM(Mbest_size, n) = myd;
+					DIRECT_MULTIDIM_ELEM(Mbest_fom, n) = DIRECT_MULTIDIM_ELEM(thread_best_fom[ithread], n);
+					DIRECT_MULTIDIM_ELEM(Mbest_size, n) = DIRECT_MULTIDIM_ELEM(thread_best_size[ithread], n);
 				}
 			}
-
 		}
 
 	} // end if !do_read_fom_maps
@@ -2830,6 +2862,26 @@ void AutoPicker::autoPickLoGOneMicrograph(FileName &fn_mic, long int imic)
 	MDout.write(fn_tmp);
 }
 
+void AutoPicker::getRotatedReference(int iref, RFLOAT psi, const MultidimArray<RFLOAT> &Fctf, MultidimArray<Complex> &Fref)
+{
+	// Get the Euler matrix
+	Matrix2D<RFLOAT> A(3,3);
+	Euler_angles2matrix(0., 0., psi, A);
+
+	// Now get the FT of the rotated (non-ctf-corrected) template
+	Fref.initZeros(downsize_mic, downsize_mic/2 + 1);
+	PPref[iref].get2DFourierTransform(Fref, A);
+
+	// Apply the CTF on-the-fly (so same PPref can be used for many different micrographs)
+	if (do_ctf)
+	{
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fref)
+		{
+			DIRECT_MULTIDIM_ELEM(Fref, n) *= DIRECT_MULTIDIM_ELEM(Fctf, n);
+		}
+	}
+}
+
 void AutoPicker::autoPickOneMicrograph(FileName &fn_mic, long int imic)
 {
 	Image<RFLOAT> Imic;
@@ -3127,176 +3179,136 @@ void AutoPicker::autoPickOneMicrograph(FileName &fn_mic, long int imic)
 			timer.tic(TIMING_B3);
 #endif
 			Mccf_best.initConstant(-LARGE_NUMBER);
-			bool is_first_psi = true;
-			for (RFLOAT psi = 0. ; psi < 360.; psi+=psi_sampling)
-			{
-				// Get the Euler matrix
-				Matrix2D<RFLOAT> A(3,3);
-				Euler_angles2matrix(0., 0., psi, A);
 
-				// Now get the FT of the rotated (non-ctf-corrected) template
-				Faux.initZeros(downsize_mic, downsize_mic/2 + 1);
-				PPref[iref].get2DFourierTransform(Faux, A);
-
-#ifdef DEBUG
-				std::cerr << " psi= " << psi << std::endl;
-				windowFourierTransform(Faux, Faux2, micrograph_size);
-				CenterFFTbySign(Faux2);
-				tt().resize(micrograph_size, micrograph_size);
-				transformer.inverseFourierTransform(Faux2, tt());
-				tt.write("Mref_rot.spi");
-
-				windowFourierTransform(Fmic, Faux2, micrograph_size);
-				CenterFFTbySign(Faux2);
-				transformer.inverseFourierTransform(Faux2, tt());
-				tt.write("Mmic.spi");
+			// Sample all in-plane rotations beforehand, so they can be distributed over the threads
+			std::vector<RFLOAT> psis;
+			for (RFLOAT psi = 0. ; psi < 360.; psi+=psi_sampling)
+				psis.push_back(psi);
 
-#endif
 #ifdef TIMING
-	timer.tic(TIMING_B4);
-#endif
-				// Apply the CTF on-the-fly (so same PPref can be used for many different micrographs)
-				if (do_ctf)
-				{
-					FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
-					{
-						DIRECT_MULTIDIM_ELEM(Faux, n) *= DIRECT_MULTIDIM_ELEM(Fctf, n);
-					}
-#ifdef TIMING
-	timer.toc(TIMING_B4);
+			timer.tic(TIMING_B5);
 #endif
+			// Calculate the expected ratio of probabilities for this CTF-corrected reference
+			// and the sum_ref_under_circ_mask and sum_ref_under_circ_mask2 from the first psi
+			// This calculation needs to be done on an "non-shrinked" micrograph, in order to get the correct I^2 statistics
+			// It uses the random number generator, so it is done before the threads are launched.
+			getRotatedReference(iref, psis[0], Fctf, Faux);
+			windowFourierTransform(Faux, Faux2, micrograph_size);
+			CenterFFTbySign(Faux2);
+			Maux.resize(micrograph_size, micrograph_size);
+			transformer.inverseFourierTransform(Faux2, Maux);
+			Maux.setXmippOrigin();
 #ifdef DEBUG
-				MultidimArray<RFLOAT> ttt(micrograph_size, micrograph_size);
-				windowFourierTransform(Faux, Faux2, micrograph_size);
-				CenterFFTbySign(Faux2);
-				transformer.inverseFourierTransform(Faux2, ttt);
-				ttt.setXmippOrigin();
-				tt().resize(particle_size, particle_size);
-				tt().setXmippOrigin();
-				FOR_ALL_ELEMENTS_IN_ARRAY2D(tt())
-				{
-					A2D_ELEM(tt(), i, j) = A2D_ELEM(ttt, i, j);
-				}
-				tt.write("Mref_rot_ctf.spi");
+			tt()=Maux;
+			tt.write("Maux.spi");
 #endif
-				}
-
-				if (is_first_psi)
+			sum_ref_under_circ_mask = 0.;
+			sum_ref2_under_circ_mask = 0.;
+			RFLOAT suma2 = 0.;
+			RFLOAT sumn = 1.;
+			for (long int i = -particle_size/2; i < particle_size - particle_size/2; i++) // only loop over particle box, but take values from large Maux!
+			{
+				for (long int j = -particle_size/2; j < particle_size - particle_size/2; j++)
 				{
-#ifdef TIMING
-	timer.tic(TIMING_B5);
-#endif
-					// Calculate the expected ratio of probabilities for this CTF-corrected reference
-					// and the sum_ref_under_circ_mask and sum_ref_under_circ_mask2
-					// Do this also if we're not recalculating the fom maps...
-					// This calculation needs to be done on an "non-shrinked" micrograph, in order to get the correct I^2 statistics
-					windowFourierTransform(Faux, Faux2, micrograph_size);
-					CenterFFTbySign(Faux2);
-					Maux.resize(micrograph_size, micrograph_size);
-					transformer.inverseFourierTransform(Faux2, Maux);
-					Maux.setXmippOrigin();
-#ifdef DEBUG
-					Image<RFLOAT> ttt;
-					ttt()=Maux;
-					ttt.write("Maux.spi");
-#endif
-					sum_ref_under_circ_mask = 0.;
-					sum_ref2_under_circ_mask = 0.;
-					RFLOAT suma2 = 0.;
-					RFLOAT sumn = 1.;
-					MultidimArray<RFLOAT> Mctfref(particle_size, particle_size);
-					Mctfref.setXmippOrigin();
-					FOR_ALL_ELEMENTS_IN_ARRAY2D(Mctfref) // only loop over smaller Mctfref, but take values from large Maux!
+					if (i*i + j*j < particle_radius2)
 					{
-						if (i*i + j*j < particle_radius2)
-						{
-							suma2 += A2D_ELEM(Maux, i, j) * A2D_ELEM(Maux, i, j);
-							suma2 += 2. * A2D_ELEM(Maux, i, j) * rnd_gaus(0., 1.);
-							sum_ref_under_circ_mask += A2D_ELEM(Maux, i, j);
-							sum_ref2_under_circ_mask += A2D_ELEM(Maux, i, j) * A2D_ELEM(Maux, i, j);
-							sumn += 1.;
-						}
-#ifdef DEBUG
-						A2D_ELEM(Mctfref, i, j) = A2D_ELEM(Maux, i, j);
-#endif
+						suma2 += A2D_ELEM(Maux, i, j) * A2D_ELEM(Maux, i, j);
+						suma2 += 2. * A2D_ELEM(Maux, i, j) * rnd_gaus(0., 1.);
+						sum_ref_under_circ_mask += A2D_ELEM(Maux, i, j);
+						sum_ref2_under_circ_mask += A2D_ELEM(Maux, i, j) * A2D_ELEM(Maux, i, j);
+						sumn += 1.;
 					}
-					sum_ref_under_circ_mask /= sumn;
-					sum_ref2_under_circ_mask /= sumn;
-					expected_Pratio = exp(suma2 / (2. * sumn));
+				}
+			}
+			sum_ref_under_circ_mask /= sumn;
+			sum_ref2_under_circ_mask /= sumn;
+			expected_Pratio = exp(suma2 / (2. * sumn));
 #ifdef DEBUG
-					std::cerr << " expected_Pratio["<<iref<<"]= " << expected_Pratio << std::endl;
-					tt()=Mctfref;
-					tt.write("Mctfref.spi");
-					std::cerr << "suma2 " << suma2<< " sumn " << sumn << " suma2/2sumn="<< suma2 / (2. * sumn) << std::endl;
-					std::cerr << " nr_pixels_under_mask= " << nr_pixels_circular_mask << " nr_pixels_under_invmask= " << nr_pixels_circular_invmask << std::endl;
-					std::cerr << "sum_ref_under_circ_mask " << sum_ref_under_circ_mask << std::endl;
-					std::cerr << "sum_ref2_under_circ_mask " << sum_ref2_under_circ_mask << std::endl;
-					std::cerr << "expected_Pratio " << expected_Pratio << std::endl;
+			std::cerr << " expected_Pratio["<<iref<<"]= " << expected_Pratio << std::endl;
+			std::cerr << "suma2 " << suma2<< " sumn " << sumn << " suma2/2sumn="<< suma2 / (2. * sumn) << std::endl;
+			std::cerr << "sum_ref_under_circ_mask " << sum_ref_under_circ_mask << std::endl;
+			std::cerr << "sum_ref2_under_circ_mask " << sum_ref2_under_circ_mask << std::endl;
 #endif
-
-					// Maux goes back to the workSize
-					Maux.resize(workSize, workSize);
 #ifdef TIMING
-					timer.toc(TIMING_B5);
+			timer.toc(TIMING_B5);
+			timer.tic(TIMING_B6);
 #endif
-				}
 
-#ifdef TIMING
-				timer.tic(TIMING_B6);
-#endif
-				// Now multiply template and micrograph to calculate the cross-correlation
-				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
+			// Distribute the psi angles over the threads. Each thread keeps its own best maps, with its own
+			// FourierTransformer (the FFTW plans are made once per thread and re-used for all its psi angles).
+			// With a static schedule, every thread gets a contiguous block of increasing psi angles, so reducing
+			// the maps in thread order with a strict comparison gives exactly the same result as a serial loop.
+			int my_nr_threads = XMIPP_MAX(1, XMIPP_MIN(nr_threads, (int)psis.size()));
+			std::vector<MultidimArray<RFLOAT> > thread_ccf_best(my_nr_threads), thread_psi_best(my_nr_threads);
+			#pragma omp parallel num_threads(my_nr_threads)
+			{
+				int ithread = omp_get_thread_num();
+				MultidimArray<Complex> myFaux, myFaux2;
+				MultidimArray<RFLOAT> myMaux(workSize, workSize);
+				FourierTransformer mytransformer;
+				MultidimArray<RFLOAT> &myccf_best = thread_ccf_best[ithread];
+				MultidimArray<RFLOAT> &mypsi_best = thread_psi_best[ithread];
+				myccf_best.resize(workSize, workSize);
+				myccf_best.initConstant(-LARGE_NUMBER);
+				mypsi_best.resize(workSize, workSize);
+
+				#pragma omp for schedule(static)
+				for (int ipsi = 0; ipsi < psis.size(); ipsi++)
 				{
-					DIRECT_MULTIDIM_ELEM(Faux, n) = conj(DIRECT_MULTIDIM_ELEM(Faux, n)) * DIRECT_MULTIDIM_ELEM(Fmic, n);
-				}
+					RFLOAT psi = psis[ipsi];
+					getRotatedReference(iref, psi, Fctf, myFaux);
 
-				// If we're not doing shrink, then Faux is bigger than Faux2!
-				windowFourierTransform(Faux, Faux2, workSize);
-				CenterFFTbySign(Faux2);
-				transformer.inverseFourierTransform(Faux2, Maux);
-#ifdef DEBUG
-				tt()=Maux*normfft;
-				tt.write("Mcc.spi");
-#endif
+					// Now multiply template and micrograph to calculate the cross-correlation
+					FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(myFaux)
+					{
+						DIRECT_MULTIDIM_ELEM(myFaux, n) = conj(DIRECT_MULTIDIM_ELEM(myFaux, n)) * DIRECT_MULTIDIM_ELEM(Fmic, n);
+					}
+
+					// If we're not doing shrink, then myFaux is bigger than myFaux2!
+					windowFourierTransform(myFaux, myFaux2, workSize);
+					CenterFFTbySign(myFaux2);
+					mytransformer.inverseFourierTransform(myFaux2, myMaux);
 
-				// Calculate ratio of prabilities P(ref)/P(zero)
-				// Keep track of the best values and their corresponding iref and psi
+					// Calculate ratio of prabilities P(ref)/P(zero)
+					// Keep track of the best values and their corresponding iref and psi
+
+					// So now we already had precalculated: Mdiff2 = 1/sig*Sum(X^2) - 2/sig*Sum(X) + mu^2/sig*Sum(1)
+					// Still to do (per reference): - 2/sig*Sum(AX) + 2*mu/sig*Sum(A) + Sum(A^2)
+					FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(myMaux)
+					{
+						RFLOAT diff2 = - 2. * normfft * DIRECT_MULTIDIM_ELEM(myMaux, n);
+						diff2 += 2. * DIRECT_MULTIDIM_ELEM(Mmean, n) * sum_ref_under_circ_mask;
+						if (DIRECT_MULTIDIM_ELEM(Mstddev, n) > 1E-10)
+							diff2 /= DIRECT_MULTIDIM_ELEM(Mstddev, n);
+						diff2 += sum_ref2_under_circ_mask;
+						diff2 = exp(- diff2 / 2.); // exponentiate to reflect the Gaussian error model. sigma=1 after normalization, 0.4=1/sqrt(2pi)
+
+						// Store fraction of (1 - probability-ratio) wrt  (1 - expected Pratio)
+						diff2 = (diff2 - 1.) / (expected_Pratio - 1.);
+						if (diff2 > DIRECT_MULTIDIM_ELEM(myccf_best, n))
+						{
+							DIRECT_MULTIDIM_ELEM(myccf_best, n) = diff2;
+							DIRECT_MULTIDIM_ELEM(mypsi_best, n) = psi;
+						}
+					}
+				} // end for psi
+			} // end omp parallel
 
-				// So now we already had precalculated: Mdiff2 = 1/sig*Sum(X^2) - 2/sig*Sum(X) + mu^2/sig*Sum(1)
-				// Still to do (per reference): - 2/sig*Sum(AX) + 2*mu/sig*Sum(A) + Sum(A^2)
-				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Maux)
+			// Combine the best maps of all threads
+			for (int ithread = 0; ithread < my_nr_threads; ithread++)
+			{
+				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Mccf_best)
 				{
-					RFLOAT diff2 = - 2. * normfft * DIRECT_MULTIDIM_ELEM(Maux, n);
-					diff2 += 2. * DIRECT_MULTIDIM_ELEM(Mmean, n) * sum_ref_under_circ_mask;
-					if (DIRECT_MULTIDIM_ELEM(Mstddev, n) > 1E-10)
-						diff2 /= DIRECT_MULTIDIM_ELEM(Mstddev, n);
-					diff2 += sum_ref2_under_circ_mask;
-					diff2 = exp(- diff2 / 2.); // exponentiate to reflect the Gaussian error model. sigma=1 after normalization, 0.4=1/sqrt(2pi)
-
-					// Store fraction of (1 - probability-ratio) wrt  (1 - expected Pratio)
-					diff2 = (diff2 - 1.) / (expected_Pratio - 1.);
-#ifdef DEBUG
-					DIRECT_MULTIDIM_ELEM(Maux, n) = diff2;
-#endif
-					if (diff2 > DIRECT_MULTIDIM_ELEM(Mccf_best, n))
+					if (DIRECT_MULTIDIM_ELEM(thread_ccf_best[ithread], n) > DIRECT_MULTIDIM_ELEM(Mccf_best, n))
 					{
-						DIRECT_MULTIDIM_ELEM(Mccf_best, n) = diff2;
-						DIRECT_MULTIDIM_ELEM(Mpsi_best, n) = psi;
+						DIRECT_MULTIDIM_ELEM(Mccf_best, n) = DIRECT_MULTIDIM_ELEM(thread_ccf_best[ithread], n);
+						DIRECT_MULTIDIM_ELEM(Mpsi_best, n) = DIRECT_MULTIDIM_ELEM(thread_psi_best[ithread], n);
 					}
 				}
-#ifdef DEBUG
-				std::cerr << " Maux.computeMax()= " << Maux.computeMax() << std::endl;
-				tt()=Maux;
-				tt.write("Mccf.spi");
-			    std::cerr << " Press any key to continue... "  << std::endl;
-			    char c;
-			    std::cin >> c;
-#endif
-			    is_first_psi = false;
+			}
 #ifdef TIMING
-	timer.toc(TIMING_B6);
+			timer.toc(TIMING_B6);
 #endif
-			} // end for psi
 #ifdef TIMING
 	timer.toc(TIMING_B3);
 #endif
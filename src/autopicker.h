@@ -233,6 +233,9 @@ public:
 	// Extra padding around the micrographs, of this many pixels
 	int extra_padding;
 
+	// Number of threads for the CPU template-matching
+	int nr_threads;
+
 	// In-plane rotational sampling (in degrees)
 	RFLOAT psi_sampling;
 
@@ -356,6 +359,10 @@ public:
 	void autoPickLoGOneMicrograph(FileName &fn_mic, long int imic);
 	void autoPickOneMicrograph(FileName &fn_mic, long int imic);
 
+	// Get the FT of reference iref, rotated in-plane by psi and (if do_ctf) multiplied with Fctf, at downsize_mic
+	// Only reads from PPref, so this may be called from multiple threads
+	void getRotatedReference(int iref, RFLOAT psi, const MultidimArray<RFLOAT> &Fctf, MultidimArray<Complex> &Fref);
+
 	// Get the output coordinate filename given the micrograph filename
 	FileName getOutputRootName(FileName fn_mic);
 	// Uses Roseman2003 formulae to calculate stddev under the mask through FFTs
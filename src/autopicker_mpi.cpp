@@ -77,44 +77,49 @@ int AutoPickerMpi::deviceInitialise()
 void AutoPickerMpi::run()
 {
 	// Each node does part of the work
-	long int my_first_micrograph, my_last_micrograph, my_nr_micrographs;
-	divide_equally(fn_micrographs.size(), node->size, node->rank, my_first_micrograph, my_last_micrograph);
-	my_nr_micrographs = my_last_micrograph - my_first_micrograph + 1;
+	long int nr_micrographs = fn_micrographs.size();
+	MpiTaskDistributor distributor(node, nr_micrographs);
 
 	int barstep;
 	if (verb > 0)
 	{
 		std::cout << " Autopicking ..." << std::endl;
-		init_progress_bar(my_nr_micrographs);
-		barstep = XMIPP_MAX(1, my_nr_micrographs / 60);
+		init_progress_bar(nr_micrographs);
+		barstep = XMIPP_MAX(1, nr_micrographs / 60);
 	}
 
 	FileName fn_olddir="";
-	for (long int imic = my_first_micrograph; imic <= my_last_micrograph; imic++)
+	long int my_first_micrograph, my_last_micrograph;
+	while (distributor.getTasks(my_first_micrograph, my_last_micrograph))
 	{
-		// Abort through the pipeline_control system
-		if (pipeline_control_check_abort_job())
-			MPI_Abort(MPI_COMM_WORLD, RELION_EXIT_ABORTED);
-
-		if (verb > 0 && imic % barstep == 0)
-			progress_bar(imic);
-
-		// Check new-style outputdirectory exists and make it if not!
-		FileName fn_dir = getOutputRootName(fn_micrographs[imic]);
-		fn_dir = fn_dir.beforeLastOf("/");
-		if (fn_dir != fn_olddir)
+		for (long int imic = my_first_micrograph; imic <= my_last_micrograph; imic++)
 		{
-			// Make a Particles directory
-			int res = system(("mkdir -p " + fn_dir).c_str());
-			fn_olddir = fn_dir;
+			// Abort through the pipeline_control system
+			if (pipeline_control_check_abort_job())
+				MPI_Abort(MPI_COMM_WORLD, RELION_EXIT_ABORTED);
+
+			if (verb > 0 && imic % barstep == 0)
+				progress_bar(imic);
+
+			// Check new-style outputdirectory exists and make it if not!
+			FileName fn_dir = getOutputRootName(fn_micrographs[imic]);
+			fn_dir = fn_dir.beforeLastOf("/");
+			if (fn_dir != fn_olddir)
+			{
+				// Make a Particles directory
+				int res = system(("mkdir -p " + fn_dir).c_str());
+				fn_olddir = fn_dir;
+			}
+
+			if (do_LoG)
+				autoPickLoGOneMicrograph(fn_micrographs[imic], imic);
+			else
+				autoPickOneMicrograph(fn_micrographs[imic], imic);
 		}
-
-		if (do_LoG)
-			autoPickLoGOneMicrograph(fn_micrographs[imic], imic);
-		else
-			autoPickOneMicrograph(fn_micrographs[imic], imic);
 	}
 
 	if (verb > 0)
-		progress_bar(my_nr_micrographs);
+		progress_bar(nr_micrographs);
+
+	distributor.reportUtilisation();
 }
@@ -50,6 +50,8 @@ void BackProjector::initZeros(int current_size)
 	initialiseDataAndWeight(current_size);
 	data.initZeros();
 	weight.initZeros();
+	last_gridding_iter = 0;
+	last_gridding_residual = 0.;
 }
 
 void BackProjector::backproject2Dto3D(const MultidimArray<Complex > &f2d,
@@ -1054,6 +1056,8 @@ void BackProjector::updateSSNRarrays(RFLOAT tau2_fudge,
 	MultidimArray<RFLOAT> counter;
 	const int max_r2 = ROUND(r_max * padding_factor) * ROUND(r_max * padding_factor);
 	RFLOAT oversampling_correction = (ref_dim == 3) ? (padding_factor * padding_factor * padding_factor) : (padding_factor * padding_factor);
+	SquaredRadiusShells::Ptr shells_ptr = SquaredRadiusShells::get(max_r2, padding_factor);
+	const SquaredRadiusShells &shells = *shells_ptr;
 
 	// First calculate the radial average of the (inverse of the) power of the noise in the reconstruction
 	// This is the left-hand side term in the nominator of the Wiener-filter-like update formula
@@ -1066,7 +1070,7 @@ void BackProjector::updateSSNRarrays(RFLOAT tau2_fudge,
 		const int r2 = k * k + i * i + j * j;
 		if (r2 < max_r2)
 		{
-			int ires = ROUND(sqrt((RFLOAT)r2) / padding_factor);
+			int ires = shells[r2];
 			RFLOAT invw = oversampling_correction * A3D_ELEM(weight, k, i, j);
 			DIRECT_A1D_ELEM(sigma2, ires) += invw;
 			DIRECT_A1D_ELEM(counter, ires) += 1.;
@@ -1129,7 +1133,7 @@ void BackProjector::updateSSNRarrays(RFLOAT tau2_fudge,
 		int r2 = k * k + i * i + j * j;
 		if (r2 < max_r2)
 		{
-			int ires = ROUND( sqrt((RFLOAT)r2) / padding_factor );
+			int ires = shells[r2];
 			RFLOAT invw = A3D_ELEM(weight, k, i, j);
 
 			RFLOAT invtau2;
@@ -1334,6 +1338,16 @@ void BackProjector::externalReconstruct(MultidimArray<RFLOAT> &vol_out,
 
 }
 
+size_t BackProjector::getReconstructionMemory() const
+{
+	size_t nr_voxels = (size_t)pad_size * pad_size;
+	if (ref_dim == 3)
+		nr_voxels *= pad_size;
+
+	// vol_out and Mconv in real space, Fconv, Fweight and Fnewweight in half-complex Fourier space
+	return nr_voxels * (2 * sizeof(RFLOAT) + sizeof(Complex) / 2 + sizeof(RFLOAT));
+}
+
 void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
                                 int max_iter_preweight,
                                 bool do_map,
@@ -1342,7 +1356,9 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
                                 RFLOAT normalise,
                                 int minres_map,
                                 bool printTimes,
-                                Image<RFLOAT>* weight_out)
+                                Image<RFLOAT>* weight_out,
+                                int threads,
+                                RFLOAT gridding_tol)
 {
 #ifdef TIMING
 	Timer ReconTimer;
@@ -1395,6 +1411,7 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
         vol_out.setDimensions(pad_size, pad_size, pad_size, 1);
 
 	FourierTransformer transformer;
+	transformer.setThreadsNumber(threads);
 	transformer.setReal(vol_out); // Fake set real. 1. Allocate space for Fconv 2. calculate plans.
 	MultidimArray<Complex>& Fconv = transformer.getFourierReference();
 	vol_out.clear(); // Reset dimensions to 0
@@ -1414,12 +1431,14 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 	if (do_map)
 	{
 		// Then, add the inverse of tau2-spectrum values to the weight
+		SquaredRadiusShells::Ptr shells_ptr = SquaredRadiusShells::get(max_r2, padding_factor);
+		const SquaredRadiusShells &shells = *shells_ptr;
 		FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Fconv)
  		{
 			int r2 = kp * kp + ip * ip + jp * jp;
 			if (r2 < max_r2)
 			{
-				int ires = ROUND(sqrt((RFLOAT)r2) / padding_factor);
+				int ires = shells[r2];
 				RFLOAT invw = DIRECT_A3D_ELEM(Fweight, k, i, j);
 
 				RFLOAT invtau2;
@@ -1529,10 +1548,12 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 #ifdef DEBUG_RECONSTRUCT
 		std::cerr << " normalise= " << normalise << std::endl;
 #endif
+		#pragma omp parallel for num_threads(threads)
 		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fweight)
 		{
 			DIRECT_MULTIDIM_ELEM(Fweight, n) /= normalise;
 		}
+		#pragma omp parallel for num_threads(threads)
 		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(data)
 		{
 			DIRECT_MULTIDIM_ELEM(data, n) /= normalise;
@@ -1557,55 +1578,96 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 		RCTOC(ReconTimer,ReconS_5);
 		// Iterative algorithm as in  Eq. [14] in Pipe & Menon (1999)
 		// or Eq. (4) in Matej (2001)
+
+		// Set Fnewweight * Fweight in the transformer
+		// In Matej et al (2001), weights w_P^i are convoluted with the kernel,
+		// and the initial w_P^0 are 1 at each sampling point
+		// Here the initial weights are also 1 (see initialisation Fnewweight above),
+		// but each "sampling point" counts "Fweight" times!
+		// That is why Fnewweight is multiplied by Fweight prior to the convolution
+		// For later iterations, this is done in the same pass as the division below
+		#pragma omp parallel for num_threads(threads)
+		for (long int n = 0; n < NZYXSIZE(Fconv); n++)
+		{
+			DIRECT_MULTIDIM_ELEM(Fconv, n) = DIRECT_MULTIDIM_ELEM(Fnewweight, n) * DIRECT_MULTIDIM_ELEM(Fweight, n);
+		}
+
+		// Keep the real-space array (and with it the FFTW plans) for all iterations
+		MultidimArray<RFLOAT> Mconv;
+
+		// Per-row sums of |w - 1| and counts, added up in a fixed order so the stopping point is reproducible
+		const long int nr_rows = ZSIZE(Fconv) * YSIZE(Fconv);
+		std::vector<double> row_residual(nr_rows), row_count(nr_rows);
+
+		last_gridding_iter = 0;
+		last_gridding_residual = 0.;
 		for (int iter = 0; iter < max_iter_preweight; iter++)
 		{
 			//std::cout << "    iteration " << (iter+1) << "/" << max_iter_preweight << "\n";
 			RCTIC(ReconTimer,ReconS_6);
-			// Set Fnewweight * Fweight in the transformer
-			// In Matej et al (2001), weights w_P^i are convoluted with the kernel,
-			// and the initial w_P^0 are 1 at each sampling point
-			// Here the initial weights are also 1 (see initialisation Fnewweight above),
-			// but each "sampling point" counts "Fweight" times!
-			// That is why Fnewweight is multiplied by Fweight prior to the convolution
-
-			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fconv)
-			{
-				DIRECT_MULTIDIM_ELEM(Fconv, n) = DIRECT_MULTIDIM_ELEM(Fnewweight, n) * DIRECT_MULTIDIM_ELEM(Fweight, n);
-			}
 
 			// convolute through Fourier-transform (as both grids are rectangular)
 			// Note that convoluteRealSpace acts on the complex array inside the transformer
-			convoluteBlobRealSpace(transformer, false);
+			convoluteBlobRealSpace(transformer, Mconv, false, threads);
 
-			RFLOAT w, corr_min = LARGE_NUMBER, corr_max = -LARGE_NUMBER, corr_avg=0., corr_nn=0.;
+			const bool last_iter = (iter == max_iter_preweight - 1);
+			RFLOAT corr_min = LARGE_NUMBER, corr_max = -LARGE_NUMBER;
 
-			FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Fconv)
+			#pragma omp parallel for num_threads(threads) reduction(min:corr_min) reduction(max:corr_max)
+			for (long int row = 0; row < nr_rows; row++)
 			{
-				if (kp * kp + ip * ip + jp * jp < max_r2)
+				long int k = row / YSIZE(Fconv);
+				long int i = row % YSIZE(Fconv);
+				long int kp = (k < XSIZE(Fconv)) ? k : k - ZSIZE(Fconv);
+				long int ip = (i < XSIZE(Fconv)) ? i : i - YSIZE(Fconv);
+				double residual = 0., count = 0.;
+				for (long int j = 0, jp = 0; j < XSIZE(Fconv); j++, jp = j)
 				{
+					if (kp * kp + ip * ip + jp * jp < max_r2)
+					{
+						// Make sure no division by zero can occur....
+						RFLOAT w = XMIPP_MAX(1e-6, abs(DIRECT_A3D_ELEM(Fconv, k, i, j)));
+						// Monitor min, max and avg conv_weight
+						corr_min = XMIPP_MIN(corr_min, w);
+						corr_max = XMIPP_MAX(corr_max, w);
+						residual += ABS(w - 1.);
+						count += 1.;
+						// Apply division of Eq. [14] in Pipe & Menon (1999)
+						DIRECT_A3D_ELEM(Fnewweight, k, i, j) /= w;
+					}
 
-					// Make sure no division by zero can occur....
-					w = XMIPP_MAX(1e-6, abs(DIRECT_A3D_ELEM(Fconv, k, i, j)));
-					// Monitor min, max and avg conv_weight
-					corr_min = XMIPP_MIN(corr_min, w);
-					corr_max = XMIPP_MAX(corr_max, w);
-					corr_avg += w;
-					corr_nn += 1.;
-					// Apply division of Eq. [14] in Pipe & Menon (1999)
-					DIRECT_A3D_ELEM(Fnewweight, k, i, j) /= w;
+					// Prepare the convolution of the next iteration
+					if (!last_iter)
+						DIRECT_A3D_ELEM(Fconv, k, i, j) = DIRECT_A3D_ELEM(Fnewweight, k, i, j) * DIRECT_A3D_ELEM(Fweight, k, i, j);
 				}
+				row_residual[row] = residual;
+				row_count[row] = count;
 			}
 
+			double sum_residual = 0., sum_count = 0.;
+			for (long int row = 0; row < nr_rows; row++)
+			{
+				sum_residual += row_residual[row];
+				sum_count += row_count[row];
+			}
+			last_gridding_iter = iter + 1;
+			last_gridding_residual = (sum_count > 0.) ? sum_residual / sum_count : 0.;
+
             RCTOC(ReconTimer,ReconS_6);
 
 #ifdef DEBUG_RECONSTRUCT
 			std::cerr << " PREWEIGHTING ITERATION: "<< iter + 1 << " OF " << max_iter_preweight << std::endl;
 			// report of maximum and minimum values of current conv_weight
-			std::cerr << " corr_avg= " << corr_avg / corr_nn << std::endl;
+			std::cerr << " residual= " << last_gridding_residual << std::endl;
 			std::cerr << " corr_min= " << corr_min << std::endl;
 			std::cerr << " corr_max= " << corr_max << std::endl;
 #endif
+
+			// Stop once the weights hardly change anymore
+			if (last_gridding_residual < gridding_tol)
+				break;
 		}
+		Mconv.clear();
 
 		RCTIC(ReconTimer,ReconS_7);
 
@@ -1630,6 +1692,7 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 		// Apply the iteratively determined weight
 		Fconv.initZeros(); // to remove any stuff from the input volume
 		Projector::decenter(data, Fconv, max_r2);
+		#pragma omp parallel for num_threads(threads)
 		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fconv)
 		{
 #ifdef  RELION_SINGLE_PRECISION
@@ -2167,10 +2230,15 @@ void BackProjector::applyPointGroupSymmetry(int threads)
 
 }
 
-void BackProjector::convoluteBlobRealSpace(FourierTransformer &transformer, bool do_mask)
+void BackProjector::convoluteBlobRealSpace(FourierTransformer &transformer, bool do_mask, int threads)
 {
-
 	MultidimArray<RFLOAT> Mconv;
+	convoluteBlobRealSpace(transformer, Mconv, do_mask, threads);
+}
+
+void BackProjector::convoluteBlobRealSpace(FourierTransformer &transformer, MultidimArray<RFLOAT> &Mconv, bool do_mask, int threads)
+{
+
 	int padhdim = pad_size / 2;
 
 	// Set up right dimension of real-space array
@@ -2181,6 +2249,7 @@ void BackProjector::convoluteBlobRealSpace(FourierTransformer &transformer, bool
 		Mconv.reshape(pad_size, pad_size, pad_size);
 
 	// inverse FFT
+	transformer.setThreadsNumber(threads);
 	transformer.setReal(Mconv);
 	transformer.inverseFourierTransform();
 
@@ -2193,25 +2262,30 @@ void BackProjector::convoluteBlobRealSpace(FourierTransformer &transformer, bool
 	//blob.radius = 1.9 * padding_factor;
 	//blob.alpha = 15;
 
-    // Multiply with FT of the blob kernel
-	FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(Mconv)
-    {
+	// Multiply with FT of the blob kernel, distributing the rows over the threads
+	const long int nr_rows = ZSIZE(Mconv) * YSIZE(Mconv);
+	#pragma omp parallel for num_threads(threads) schedule(static)
+	for (long int row = 0; row < nr_rows; row++)
+	{
+		long int k = row / YSIZE(Mconv);
+		long int i = row % YSIZE(Mconv);
 		int kp = (k < padhdim) ? k : k - pad_size;
 		int ip = (i < padhdim) ? i : i - pad_size;
-		int jp = (j < padhdim) ? j : j - pad_size;
-    	RFLOAT rval = sqrt ( (RFLOAT)(kp * kp + ip * ip + jp * jp) ) / (ori_size * padding_factor);
-    	//if (kp==0 && ip==0 && jp > 0)
-		//	std::cerr << " jp= " << jp << " rval= " << rval << " tab_ftblob(rval) / normftblob= " << tab_ftblob(rval) / normftblob << " ori_size/2= " << ori_size/2 << std::endl;
-    	// In the final reconstruction: mask the real-space map beyond its original size to prevent aliasing ghosts
-    	// Note that rval goes until 1/2 in the oversampled map
-    	if (do_mask && rval > 1./(2. * padding_factor))
-    		DIRECT_A3D_ELEM(Mconv, k, i, j) = 0.;
-    	else
-    		DIRECT_A3D_ELEM(Mconv, k, i, j) *= (tab_ftblob(rval) / normftblob);
-    }
-
-    // forward FFT to go back to Fourier-space
-    transformer.FourierTransform();
+		for (long int j = 0; j < XSIZE(Mconv); j++)
+		{
+			int jp = (j < padhdim) ? j : j - pad_size;
+			RFLOAT rval = sqrt ( (RFLOAT)(kp * kp + ip * ip + jp * jp) ) / (ori_size * padding_factor);
+			// In the final reconstruction: mask the real-space map beyond its original size to prevent aliasing ghosts
+			// Note that rval goes until 1/2 in the oversampled map
+			if (do_mask && rval > 1./(2. * padding_factor))
+				DIRECT_A3D_ELEM(Mconv, k, i, j) = 0.;
+			else
+				DIRECT_A3D_ELEM(Mconv, k, i, j) *= (tab_ftblob(rval) / normftblob);
+		}
+	}
+
+	// forward FFT to go back to Fourier-space
+	transformer.FourierTransform();
 }
 
 void BackProjector::windowToOridimRealSpace(FourierTransformer &transformer, MultidimArray<RFLOAT> &Mout, bool printTimes)
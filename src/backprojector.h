@@ -60,9 +60,16 @@ public:
 	// Skip the iterative gridding part of the reconstruction
 	bool skip_gridding;
 
+	// Number of gridding iterations and final weight residual of the last call to reconstruct()
+	int last_gridding_iter;
+	RFLOAT last_gridding_residual;
+
 public:
 
-	BackProjector(){}
+	BackProjector():
+		last_gridding_iter(0),
+		last_gridding_residual(0.)
+	{}
 
 	/** Empty constructor
 	 *
@@ -87,6 +94,8 @@ public:
 
 		// Skip gridding
 		skip_gridding = _skip_gridding;
+		last_gridding_iter = 0;
+		last_gridding_residual = 0.;
 
 		// Set the symmetry object
 		SL.read_sym_file(fn_sym);
@@ -144,6 +153,8 @@ public:
 			ref_dim = op.ref_dim;
 			data_dim = op.data_dim;
 			skip_gridding = op.skip_gridding;
+			last_gridding_iter = op.last_gridding_iter;
+			last_gridding_residual = op.last_gridding_residual;
 			// BackProjector stuff
 			weight = op.weight;
 			tab_ftblob = op.tab_ftblob;
@@ -302,6 +313,9 @@ public:
 	/* Get the 3D reconstruction
 		 * If do_map is true, 1 will be added to all weights
 		 * alpha will contain the noise-reduction spectrum
+		 * The gridding stops before max_iter_preweight iterations once the average |w - 1| of the
+		 * convoluted weights w inside r_max drops below gridding_tol (0 = always do all iterations).
+		 * Element-wise passes and, with FFTW_THREADS, the FFTs of the gridding use threads threads.
 	*/
 	void reconstruct(MultidimArray<RFLOAT> &vol_out,
 	                 int max_iter_preweight,
@@ -311,7 +325,13 @@ public:
 	                 RFLOAT normalise = 1.,
 	                 int minres_map = -1,
 	                 bool printTimes= false,
-	                 Image<RFLOAT>* weight_out = 0);
+	                 Image<RFLOAT>* weight_out = 0,
+	                 int threads = 1,
+	                 RFLOAT gridding_tol = 0.);
+
+	/* Approximate memory (in bytes) that reconstruct() allocates on top of data and weight
+	 */
+	size_t getReconstructionMemory() const;
 
 	/*	Enforce Hermitian symmetry, apply helical symmetry as well as point-group symmetry
 	 */
@@ -335,7 +355,11 @@ public:
 	/* Convolute in Fourier-space with the blob by multiplication in real-space
 	 * Note the convolution is done on the complex array inside the transformer object!!
 	 */
-	void convoluteBlobRealSpace(FourierTransformer &transformer, bool do_mask = false);
+	void convoluteBlobRealSpace(FourierTransformer &transformer, bool do_mask = false, int threads = 1);
+
+	/* The same, but re-using Mconv as real-space array, so that the FFTW plans can be kept between calls
+	 */
+	void convoluteBlobRealSpace(FourierTransformer &transformer, MultidimArray<RFLOAT> &Mconv, bool do_mask = false, int threads = 1);
 
 	/* Calculate the inverse FFT of Fin and windows the result to ori_size
 	 * Also pass the transformer, to prevent making and clearing a new one before clearing the one in reconstruct()
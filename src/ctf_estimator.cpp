@@ -0,0 +1,534 @@
+/***************************************************************************
+ *
+ * Author: "Sjors H.W. Scheres"
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include "src/ctf_estimator.h"
+#include "src/fftw.h"
+#include "src/jaz/new_ft.h"
+#include "src/jaz/optimization/nelder_mead.h"
+#include <omp.h>
+
+// The 2D fit is parameterised as the average defocus and the two components of the astigmatism
+// (in 10,000 A), so that the azimuthal angle is not degenerate for small astigmatism.
+class CtfFitProblem : public Optimization
+{
+public:
+
+	const CtfEstimator &estimator;
+	bool do_phaseshift;
+
+	CtfFitProblem(const CtfEstimator &_estimator, bool _do_phaseshift):
+		estimator(_estimator), do_phaseshift(_do_phaseshift)
+	{}
+
+	static void getParameters(const std::vector<double> &x, RFLOAT &defU, RFLOAT &defV, RFLOAT &defAng, RFLOAT &phase)
+	{
+		RFLOAT astig = sqrt(x[1] * x[1] + x[2] * x[2]);
+		defU = 1e4 * (x[0] + astig);
+		defV = 1e4 * (x[0] - astig);
+		defAng = (astig > 0.) ? RAD2DEG(0.5 * atan2(x[2], x[1])) : 0.;
+		phase = (x.size() > 3) ? 100. * x[3] : 0.;
+	}
+
+	double f(const std::vector<double> &x, void *tempStorage) const
+	{
+		RFLOAT defU, defV, defAng, phase;
+		getParameters(x, defU, defV, defAng, phase);
+		if (!do_phaseshift)
+			phase = estimator.phase_shift;
+
+		double cost = -estimator.getCorrelation(defU, defV, defAng, phase);
+
+		// Restraint on the astigmatism
+		if (estimator.amount_astigmatism > 0.)
+		{
+			RFLOAT excess = XMIPP_MAX(0., defU - defV - estimator.amount_astigmatism) / estimator.amount_astigmatism;
+			cost += excess * excess;
+		}
+
+		return cost;
+	}
+};
+
+void CtfEstimator::computeAmplitudeSpectrum(const MultidimArray<RFLOAT> &micrograph, MultidimArray<RFLOAT> &spectrum) const
+{
+	if (XSIZE(micrograph) < box_size || YSIZE(micrograph) < box_size)
+		REPORT_ERROR("CtfEstimator::computeAmplitudeSpectrum ERROR: the micrograph is smaller than the box size.");
+
+	// Boxes overlap by half their size
+	const int step = box_size / 2;
+	const int nr_boxes_x = (XSIZE(micrograph) - box_size) / step + 1;
+	const int nr_boxes_y = (YSIZE(micrograph) - box_size) / step + 1;
+	const int nr_boxes = nr_boxes_x * nr_boxes_y;
+
+	// All boxes are transformed with the same plan, each thread sums its own boxes
+	NewFFT::DoublePlan plan(box_size, box_size);
+	std::vector<MultidimArray<double> > thread_sums(nr_threads);
+	for (int ithread = 0; ithread < nr_threads; ithread++)
+		thread_sums[ithread].initZeros(box_size, box_size / 2 + 1);
+
+	#pragma omp parallel for num_threads(nr_threads)
+	for (int ibox = 0; ibox < nr_boxes; ibox++)
+	{
+		const int x0 = (ibox % nr_boxes_x) * step;
+		const int y0 = (ibox / nr_boxes_x) * step;
+		MultidimArray<double> box(box_size, box_size);
+		MultidimArray<dComplex> Fbox;
+
+		double mean = 0.;
+		FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(box)
+		{
+			DIRECT_A2D_ELEM(box, i, j) = DIRECT_A2D_ELEM(micrograph, y0 + i, x0 + j);
+			mean += DIRECT_A2D_ELEM(box, i, j);
+		}
+		mean /= box_size * box_size;
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(box)
+			DIRECT_MULTIDIM_ELEM(box, n) -= mean;
+
+		NewFFT::FourierTransform(box, Fbox, plan);
+
+		MultidimArray<double> &sum = thread_sums[omp_get_thread_num()];
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fbox)
+			DIRECT_MULTIDIM_ELEM(sum, n) += DIRECT_MULTIDIM_ELEM(Fbox, n).abs();
+	}
+
+	for (int ithread = 1; ithread < nr_threads; ithread++)
+		thread_sums[0] += thread_sums[ithread];
+
+	// Expand the half-complex sum into a centred, square spectrum
+	const MultidimArray<double> &sum = thread_sums[0];
+	spectrum.initZeros(box_size, box_size);
+	spectrum.setXmippOrigin();
+	FOR_ALL_ELEMENTS_IN_ARRAY2D(spectrum)
+	{
+		// F(i, j) = conj(F(-i, -j))
+		if (j >= 0)
+			A2D_ELEM(spectrum, i, j) = FFTW2D_ELEM(sum, i, j) / nr_boxes;
+		else
+			A2D_ELEM(spectrum, i, j) = FFTW2D_ELEM(sum, -i, -j) / nr_boxes;
+	}
+}
+
+void CtfEstimator::sumAmplitudeSpectra(const std::vector<MultidimArray<fComplex> > &Fframes, int nx, int grouping,
+                                       MultidimArray<float> &spectrum, int nr_threads)
+{
+	if (Fframes.size() == 0)
+		REPORT_ERROR("CtfEstimator::sumAmplitudeSpectra ERROR: no frames given.");
+
+	const int nr_frames = Fframes.size();
+	const int ny = YSIZE(Fframes[0]);
+	const int nfx = XSIZE(Fframes[0]);
+	if (nfx != nx / 2 + 1)
+		REPORT_ERROR("CtfEstimator::sumAmplitudeSpectra ERROR: the Fourier transforms do not match the width of the movie.");
+
+	// One row at a time, so that the sum of a group stays in the cache while its amplitudes are taken
+	MultidimArray<float> sum(ny, nfx);
+	#pragma omp parallel num_threads(nr_threads)
+	{
+		std::vector<fComplex> group_sum(nfx);
+
+		#pragma omp for
+		for (int i = 0; i < ny; i++)
+		{
+			float *sum_row = &DIRECT_A2D_ELEM(sum, i, 0);
+			for (int j = 0; j < nfx; j++)
+				sum_row[j] = 0.f;
+
+			for (int iframe = 0; iframe < nr_frames; iframe += grouping)
+			{
+				const fComplex *frame_row = &DIRECT_A2D_ELEM(Fframes[iframe], i, 0);
+				for (int j = 0; j < nfx; j++)
+					group_sum[j] = frame_row[j];
+				for (int k = 1; k < grouping && iframe + k < nr_frames; k++)
+				{
+					frame_row = &DIRECT_A2D_ELEM(Fframes[iframe + k], i, 0);
+					for (int j = 0; j < nfx; j++)
+						group_sum[j] += frame_row[j];
+				}
+				for (int j = 0; j < nfx; j++)
+					sum_row[j] += group_sum[j].abs();
+			}
+		}
+	}
+
+	// NOTE: Image(X, Y) has MultidimArray(Y, X)!! X is the fast axis.
+	spectrum.reshape(ny, nx);
+	spectrum.setXmippOrigin();
+	#pragma omp parallel for num_threads(nr_threads)
+	FOR_ALL_ELEMENTS_IN_ARRAY2D(spectrum) // logical 2D access, i = logical_y, j = logical_x
+	{
+		// F(i, j) = conj(F(-i, -j))
+		if (j > 0)
+			A2D_ELEM(spectrum, i, j) = FFTW2D_ELEM(sum, i, j);
+		else
+			A2D_ELEM(spectrum, i, j) = FFTW2D_ELEM(sum, -i, -j);
+	}
+}
+
+RFLOAT CtfEstimator::shrinkAmplitudeSpectrum(MultidimArray<float> &spectrum, RFLOAT angpix, int ps_size, RFLOAT target_angpix)
+{
+	MultidimArray<fComplex> F_ps, F_ps_small;
+
+	// 1. Make it square
+	int ps_size_square = XMIPP_MIN(XSIZE(spectrum), YSIZE(spectrum));
+	if (XSIZE(spectrum) != YSIZE(spectrum))
+	{
+		F_ps_small.resize(ps_size_square, ps_size_square / 2 + 1);
+		NewFFT::FourierTransform(spectrum, F_ps);
+		cropInFourierSpace(F_ps, F_ps_small);
+		NewFFT::inverseFourierTransform(F_ps_small, spectrum);
+	}
+
+	// 2. Crop the center
+	RFLOAT ps_angpix = angpix;
+	int nx_needed = XSIZE(spectrum);
+	if (ps_angpix < target_angpix)
+	{
+		nx_needed = CEIL(ps_size_square * ps_angpix / target_angpix);
+		nx_needed += nx_needed % 2;
+		ps_angpix = XSIZE(spectrum) * ps_angpix / nx_needed;
+	}
+	MultidimArray<float> cropped(nx_needed, nx_needed);
+	spectrum.setXmippOrigin();
+	cropped.setXmippOrigin();
+	FOR_ALL_ELEMENTS_IN_ARRAY2D(cropped)
+		A2D_ELEM(cropped, i, j) = A2D_ELEM(spectrum, i, j);
+
+	// 3. Downsample
+	F_ps_small.reshape(ps_size, ps_size / 2 + 1);
+	F_ps_small.initZeros();
+	NewFFT::FourierTransform(cropped, F_ps);
+	cropInFourierSpace(F_ps, F_ps_small);
+	NewFFT::inverseFourierTransform(F_ps_small, spectrum);
+
+	return ps_angpix;
+}
+
+CTF CtfEstimator::getCtf(RFLOAT defU, RFLOAT defV, RFLOAT defAng, RFLOAT phase) const
+{
+	CTF ctf;
+	ctf.setValues(defU, defV, defAng, voltage, Cs, Q0, 0., 1., phase);
+	return ctf;
+}
+
+RFLOAT CtfEstimator::getCorrelation(RFLOAT defU, RFLOAT defV, RFLOAT defAng, RFLOAT phase) const
+{
+	CTF ctf = getCtf(defU, defV, defAng, phase);
+
+	// The pixel values have zero mean, so their products with the model need no centering
+	double sum_m = 0., sum_mm = 0., sum_dm = 0.;
+	#pragma omp parallel for reduction(+:sum_m,sum_mm,sum_dm) num_threads(nr_threads)
+	for (long int ipix = 0; ipix < nr_fit_pixels; ipix++)
+	{
+		RFLOAT m = ctf.getCTF(pixel_x[ipix], pixel_y[ipix], false, false, false, false);
+		m *= m;
+		sum_m += m;
+		sum_mm += m * m;
+		sum_dm += pixel_value[ipix] * m;
+	}
+
+	double var_m = sum_mm - sum_m * sum_m / nr_fit_pixels;
+	if (var_m <= 0. || sum2_fit_pixels <= 0.)
+		return 0.;
+	return sum_dm / sqrt(var_m * sum2_fit_pixels);
+}
+
+void CtfEstimator::searchDefocus(RFLOAT &best_defocus, RFLOAT &best_phase) const
+{
+	const int nr_defoci = XMIPP_MAX(1, FLOOR((max_defocus - min_defocus) / step_defocus) + 1);
+	const int nr_phases = (do_phaseshift) ? XMIPP_MAX(1, FLOOR((phase_max - phase_min) / phase_step) + 1) : 1;
+
+	// Centre the rotational average over the fitted range
+	std::vector<RFLOAT> data(radial_value.begin() + radius_min, radial_value.begin() + radius_max + 1);
+	RFLOAT mean = 0., sum2 = 0.;
+	for (int r = 0; r < data.size(); r++)
+		mean += data[r];
+	mean /= data.size();
+	for (int r = 0; r < data.size(); r++)
+	{
+		data[r] -= mean;
+		sum2 += data[r] * data[r];
+	}
+
+	std::vector<RFLOAT> ccs(nr_defoci * nr_phases);
+	#pragma omp parallel for num_threads(nr_threads)
+	for (int itry = 0; itry < nr_defoci * nr_phases; itry++)
+	{
+		const RFLOAT defocus = min_defocus + (itry / nr_phases) * step_defocus;
+		const RFLOAT phase = (do_phaseshift) ? phase_min + (itry % nr_phases) * phase_step : 0.;
+		CTF ctf = getCtf(defocus, defocus, 0., phase);
+
+		double sum_m = 0., sum_mm = 0., sum_dm = 0.;
+		for (int r = 0; r < data.size(); r++)
+		{
+			RFLOAT m = ctf.getCTF((radius_min + r) * freq_step, 0., false, false, false, false);
+			m *= m;
+			sum_m += m;
+			sum_mm += m * m;
+			sum_dm += data[r] * m;
+		}
+		double var_m = sum_mm - sum_m * sum_m / data.size();
+		ccs[itry] = (var_m > 0. && sum2 > 0.) ? sum_dm / sqrt(var_m * sum2) : -1.;
+	}
+
+	int best = 0;
+	for (int itry = 1; itry < ccs.size(); itry++)
+		if (ccs[itry] > ccs[best])
+			best = itry;
+	best_defocus = min_defocus + (best / nr_phases) * step_defocus;
+	best_phase = (do_phaseshift) ? phase_min + (best % nr_phases) * phase_step : 0.;
+}
+
+void CtfEstimator::fit(const MultidimArray<RFLOAT> &spectrum, RFLOAT angpix)
+{
+	if (XSIZE(spectrum) != YSIZE(spectrum))
+		REPORT_ERROR("CtfEstimator::fit ERROR: the amplitude spectrum should be square.");
+	if (resol_max <= 2. * angpix)
+		REPORT_ERROR("CtfEstimator::fit ERROR: the maximum resolution for the fit should be below Nyquist.");
+
+	MultidimArray<RFLOAT> ps(spectrum);
+	ps.setXmippOrigin();
+	const int box = XSIZE(ps);
+	const int rmax = box / 2 - 1;
+	fit_angpix = angpix;
+	freq_step = 1. / (box * angpix);
+	radius_min = XMIPP_MAX(2, CEIL(1. / (resol_min * freq_step)));
+	radius_max = XMIPP_MIN(rmax, FLOOR(1. / (resol_max * freq_step)));
+	if (radius_max - radius_min < 4)
+		REPORT_ERROR("CtfEstimator::fit ERROR: the resolution range for the fit contains too few Fourier pixels.");
+
+	// Rotational average of the amplitude spectrum
+	std::vector<RFLOAT> radial(rmax + 2, 0.), counts(rmax + 2, 0.);
+	FOR_ALL_ELEMENTS_IN_ARRAY2D(ps)
+	{
+		int r = ROUND(sqrt((RFLOAT)(i * i + j * j)));
+		if (r <= rmax + 1)
+		{
+			radial[r] += A2D_ELEM(ps, i, j);
+			counts[r] += 1.;
+		}
+	}
+	for (int r = 0; r < radial.size(); r++)
+		if (counts[r] > 0.)
+			radial[r] /= counts[r];
+
+	// The background is a running average over a Thon ring at the smallest defocus, which removes the rings at all
+	// defoci of the search. The same running average of the squared remainder normalises the contrast of the rings.
+	CTF ctf_min = getCtf(XMIPP_MAX(1000., min_defocus), XMIPP_MAX(1000., min_defocus), 0., 0.);
+	std::vector<int> halfwidth(rmax + 2, 1);
+	for (int r = 1; r < halfwidth.size(); r++)
+	{
+		RFLOAT period = 1. / (2. * ctf_min.lambda * XMIPP_MAX(1000., min_defocus) * r * freq_step * freq_step);
+		halfwidth[r] = XMIPP_MIN(box / 16, XMIPP_MAX(1, ROUND(period / 2.)));
+	}
+	std::vector<RFLOAT> background(rmax + 2, 0.), contrast(rmax + 2, 0.), remainder2(rmax + 2, 0.);
+	for (int r = 1; r < background.size(); r++)
+	{
+		int rlo = XMIPP_MAX(1, r - halfwidth[r]), rhi = XMIPP_MIN(rmax + 1, r + halfwidth[r]);
+		for (int rr = rlo; rr <= rhi; rr++)
+			background[r] += radial[rr];
+		background[r] /= rhi - rlo + 1;
+	}
+	for (int r = 1; r < background.size(); r++)
+		remainder2[r] = (radial[r] - background[r]) * (radial[r] - background[r]);
+	for (int r = 1; r < contrast.size(); r++)
+	{
+		int rlo = XMIPP_MAX(1, r - halfwidth[r]), rhi = XMIPP_MIN(rmax + 1, r + halfwidth[r]);
+		for (int rr = rlo; rr <= rhi; rr++)
+			contrast[r] += remainder2[rr];
+		contrast[r] = sqrt(contrast[r] / (rhi - rlo + 1));
+		if (contrast[r] <= 0.)
+			contrast[r] = 1.;
+	}
+
+	radial_value.resize(rmax + 2);
+	for (int r = 0; r < radial_value.size(); r++)
+		radial_value[r] = (r > 0) ? (radial[r] - background[r]) / contrast[r] : 0.;
+
+	// Normalised 2D spectrum, interpolating background and contrast linearly in the radius
+	normalised_spectrum.initZeros(ps);
+	pixel_x.clear();
+	pixel_y.clear();
+	pixel_value.clear();
+	pixel_radius.clear();
+	std::vector<RFLOAT> outer_x, outer_y, outer_value;
+	std::vector<int> outer_radius;
+	double sum_fit = 0.;
+	FOR_ALL_ELEMENTS_IN_ARRAY2D(ps)
+	{
+		RFLOAT rf = sqrt((RFLOAT)(i * i + j * j));
+		int r0 = FLOOR(rf);
+		if (r0 < 1 || r0 > rmax)
+			continue;
+		RFLOAT w = rf - r0;
+		RFLOAT bg = (1. - w) * background[r0] + w * background[r0 + 1];
+		RFLOAT ct = (1. - w) * contrast[r0] + w * contrast[r0 + 1];
+		RFLOAT value = (A2D_ELEM(ps, i, j) - bg) / ct;
+		A2D_ELEM(normalised_spectrum, i, j) = value;
+
+		// Only use half of the (symmetric) spectrum
+		int r = ROUND(rf);
+		if (j < 0 || (j == 0 && i < 0) || r < radius_min)
+			continue;
+		if (r <= radius_max)
+		{
+			pixel_x.push_back(j * freq_step);
+			pixel_y.push_back(i * freq_step);
+			pixel_value.push_back(value);
+			pixel_radius.push_back(r);
+			sum_fit += value;
+		}
+		else
+		{
+			outer_x.push_back(j * freq_step);
+			outer_y.push_back(i * freq_step);
+			outer_value.push_back(value);
+			outer_radius.push_back(r);
+		}
+	}
+	nr_fit_pixels = pixel_value.size();
+	RFLOAT mean_fit = sum_fit / nr_fit_pixels;
+	sum2_fit_pixels = 0.;
+	for (long int ipix = 0; ipix < nr_fit_pixels; ipix++)
+	{
+		pixel_value[ipix] -= mean_fit;
+		sum2_fit_pixels += pixel_value[ipix] * pixel_value[ipix];
+	}
+	pixel_x.insert(pixel_x.end(), outer_x.begin(), outer_x.end());
+	pixel_y.insert(pixel_y.end(), outer_y.begin(), outer_y.end());
+	pixel_value.insert(pixel_value.end(), outer_value.begin(), outer_value.end());
+	pixel_radius.insert(pixel_radius.end(), outer_radius.begin(), outer_radius.end());
+
+	// 1D exhaustive search without astigmatism
+	RFLOAT best_defocus, best_phase;
+	searchDefocus(best_defocus, best_phase);
+	phase_shift = best_phase;
+
+	// 2D refinement of the defocus, astigmatism and phase shift, restarted once from its own solution
+	CtfFitProblem problem(*this, do_phaseshift);
+	std::vector<double> x(3, 0.);
+	x[0] = 1e-4 * best_defocus;
+	if (do_phaseshift)
+		x.push_back(0.01 * best_phase);
+	double min_cost;
+	for (int irestart = 0; irestart < 2; irestart++)
+		x = NelderMead::optimize(x, problem, 1e-4 * XMIPP_MAX(step_defocus, 100.), 1e-7, 500, 1., 2., 0.5, 0.5, false, &min_cost);
+
+	CtfFitProblem::getParameters(x, defocus_u, defocus_v, defocus_angle, best_phase);
+	if (do_phaseshift)
+		phase_shift = best_phase;
+
+	// Keep the angle in the same range as CTFFIND
+	if (defocus_angle < -90.)
+		defocus_angle += 180.;
+	if (defocus_angle > 90.)
+		defocus_angle -= 180.;
+
+	fom = getCorrelation(defocus_u, defocus_v, defocus_angle, phase_shift);
+	estimateMaxResolution();
+}
+
+void CtfEstimator::estimateMaxResolution()
+{
+	CTF ctf = getCtf(defocus_u, defocus_v, defocus_angle, phase_shift);
+
+	// Sums per radius for the correlation of the model with the spectrum in bands of radii
+	const int nr_radii = XSIZE(normalised_spectrum) / 2 + 1;
+	std::vector<double> sum_d(nr_radii, 0.), sum_dd(nr_radii, 0.), sum_m(nr_radii, 0.), sum_mm(nr_radii, 0.), sum_dm(nr_radii, 0.), counts(nr_radii, 0.);
+	for (long int ipix = 0; ipix < pixel_value.size(); ipix++)
+	{
+		int r = pixel_radius[ipix];
+		RFLOAT d = pixel_value[ipix];
+		RFLOAT m = ctf.getCTF(pixel_x[ipix], pixel_y[ipix], false, false, false, false);
+		m *= m;
+		sum_d[r] += d;
+		sum_dd[r] += d * d;
+		sum_m[r] += m;
+		sum_mm[r] += m * m;
+		sum_dm[r] += d * m;
+		counts[r] += 1.;
+	}
+
+	// Bands span two Thon rings of the fitted CTF; maxres is where their correlation first drops below 0.3
+	const RFLOAT threshold = 0.3;
+	const RFLOAT defocus = 0.5 * (defocus_u + defocus_v);
+	maxres = 1. / ((nr_radii - 1) * freq_step);
+	for (int r = radius_min; r < nr_radii; r++)
+	{
+		RFLOAT period = 1. / (2. * ctf.lambda * defocus * r * freq_step * freq_step);
+		int halfwidth = XMIPP_MAX(2, ROUND(period));
+		int rlo = XMIPP_MAX(radius_min, r - halfwidth), rhi = XMIPP_MIN(nr_radii - 1, r + halfwidth);
+		double n = 0., sd = 0., sdd = 0., sm = 0., smm = 0., sdm = 0.;
+		for (int rr = rlo; rr <= rhi; rr++)
+		{
+			n += counts[rr];
+			sd += sum_d[rr];
+			sdd += sum_dd[rr];
+			sm += sum_m[rr];
+			smm += sum_mm[rr];
+			sdm += sum_dm[rr];
+		}
+		if (n < 2.)
+			continue;
+		double var_d = sdd - sd * sd / n;
+		double var_m = smm - sm * sm / n;
+		double cc = (var_d > 0. && var_m > 0.) ? (sdm - sd * sm / n) / sqrt(var_d * var_m) : 0.;
+		if (cc < threshold)
+		{
+			maxres = 1. / (r * freq_step);
+			break;
+		}
+	}
+}
+
+void CtfEstimator::getDiagnosticImage(MultidimArray<RFLOAT> &image) const
+{
+	CTF ctf = getCtf(defocus_u, defocus_v, defocus_angle, phase_shift);
+
+	image.initZeros(normalised_spectrum);
+	image.setXmippOrigin();
+	FOR_ALL_ELEMENTS_IN_ARRAY2D(image)
+	{
+		if (j < 0)
+		{
+			// Clip the data to the range of the model
+			A2D_ELEM(image, i, j) = XMIPP_MIN(2., XMIPP_MAX(-2., A2D_ELEM(normalised_spectrum, i, j)));
+		}
+		else
+		{
+			RFLOAT m = ctf.getCTF(j * freq_step, i * freq_step, false, false, false, false);
+			A2D_ELEM(image, i, j) = 2. * m * m - 1.;
+		}
+	}
+}
+
+void CtfEstimator::writeResults(MetaDataTable &MD) const
+{
+	MD.setValue(EMDL_CTF_VOLTAGE, voltage);
+	MD.setValue(EMDL_CTF_CS, Cs);
+	MD.setValue(EMDL_CTF_Q0, Q0);
+	MD.setValue(EMDL_MICROGRAPH_PIXEL_SIZE, fit_angpix);
+	MD.setValue(EMDL_CTF_DEFOCUSU, defocus_u);
+	MD.setValue(EMDL_CTF_DEFOCUSV, defocus_v);
+	MD.setValue(EMDL_CTF_DEFOCUS_ANGLE, defocus_angle);
+	MD.setValue(EMDL_CTF_FOM, fom);
+	MD.setValue(EMDL_CTF_MAXRES, maxres);
+	if (do_phaseshift)
+		MD.setValue(EMDL_CTF_PHASESHIFT, phase_shift);
+}
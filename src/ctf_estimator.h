@@ -0,0 +1,136 @@
+/***************************************************************************
+ *
+ * Author: "Sjors H.W. Scheres"
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef CTF_ESTIMATOR_H_
+#define CTF_ESTIMATOR_H_
+
+#include <vector>
+#include "src/multidim_array.h"
+#include "src/metadata_table.h"
+#include "src/ctf.h"
+#include "src/jaz/t_complex.h"
+
+/** Estimation of the CTF parameters of a micrograph, without calling an external program.
+ *
+ * The amplitude spectra of overlapping boxes of the micrograph are averaged (periodogram averaging).
+ * After subtraction of a smooth background, the spectrum is compared to CTF^2 through their correlation
+ * coefficient: first in 1D (without astigmatism) over a grid of defoci (and phase shifts), and then in 2D
+ * with a Nelder-Mead optimisation of the defocus, astigmatism (and phase shift).
+ */
+class CtfEstimator
+{
+public:
+
+	// Voltage (kV), spherical aberration (mm) and amplitude contrast
+	RFLOAT voltage, Cs, Q0;
+
+	// Size of the boxes for the averaged amplitude spectrum (in pixels)
+	int box_size;
+
+	// Minimum and maximum resolution (in A) to be taken into account
+	RFLOAT resol_min, resol_max;
+
+	// Defocus search parameters (in A, positive is underfocus)
+	RFLOAT min_defocus, max_defocus, step_defocus;
+
+	// Astigmatism (in A) beyond which the fit is penalised (no restraint if <= 0)
+	RFLOAT amount_astigmatism;
+
+	// Estimate the phase shift (in degrees) from a phase plate?
+	bool do_phaseshift;
+	RFLOAT phase_min, phase_max, phase_step;
+
+	// Number of threads
+	int nr_threads;
+
+	// Fitted parameters: defoci (A), azimuthal angle and phase shift (degrees),
+	// correlation coefficient of the fit, and resolution (A) up to which the Thon rings are fitted well
+	RFLOAT defocus_u, defocus_v, defocus_angle, phase_shift, fom, maxres;
+
+	CtfEstimator():
+		voltage(300.), Cs(2.7), Q0(0.1), box_size(512), resol_min(30.), resol_max(5.),
+		min_defocus(5000.), max_defocus(50000.), step_defocus(500.), amount_astigmatism(-1.),
+		do_phaseshift(false), phase_min(0.), phase_max(180.), phase_step(10.), nr_threads(1),
+		defocus_u(0.), defocus_v(0.), defocus_angle(0.), phase_shift(0.), fom(0.), maxres(-1.)
+	{}
+
+	/** Average the amplitude spectra of boxes of box_size pixels that overlap by half a box.
+	 * The result is a box_size x box_size image with the origin in its centre, in the same
+	 * convention as the power spectra that relion_run_motioncorr writes for CTF estimation.
+	 */
+	void computeAmplitudeSpectrum(const MultidimArray<RFLOAT> &micrograph, MultidimArray<RFLOAT> &spectrum) const;
+
+	/** Sum the amplitude spectra of groups of movie frames in a single multithreaded pass.
+	 * Fframes are the (half-complex) Fourier transforms of the frames of a movie that is nx pixels wide.
+	 * Each group of grouping consecutive frames is summed before its amplitudes are taken.
+	 * The result is a centred, full-size image, in the same convention as computeAmplitudeSpectrum.
+	 */
+	static void sumAmplitudeSpectra(const std::vector<MultidimArray<fComplex> > &Fframes, int nx, int grouping,
+	                                MultidimArray<float> &spectrum, int nr_threads = 1);
+
+	/** Make a summed amplitude spectrum square, crop it to target_angpix if angpix is smaller,
+	 * and downsample it to ps_size x ps_size pixels. Returns the pixel size of the result.
+	 */
+	static RFLOAT shrinkAmplitudeSpectrum(MultidimArray<float> &spectrum, RFLOAT angpix, int ps_size,
+	                                      RFLOAT target_angpix = 1.4);
+
+	/** Fit the CTF to a centred, square amplitude spectrum.
+	 * angpix is the pixel size of the images the spectrum was calculated from.
+	 */
+	void fit(const MultidimArray<RFLOAT> &spectrum, RFLOAT angpix);
+
+	/** The background-subtracted spectrum of the last fit in the left half, and the fitted CTF^2 in the right half */
+	void getDiagnosticImage(MultidimArray<RFLOAT> &image) const;
+
+	/** Add the fitted parameters to the current object of the MetaDataTable */
+	void writeResults(MetaDataTable &MD) const;
+
+	/** Evaluate the correlation coefficient between CTF^2 and the spectrum of the last fit */
+	RFLOAT getCorrelation(RFLOAT defU, RFLOAT defV, RFLOAT defAng, RFLOAT phase) const;
+
+private:
+
+	// Pixel size of the last fit, and frequency step of its spectrum (1/A)
+	RFLOAT fit_angpix, freq_step;
+
+	// Background-subtracted and normalised spectrum of the last fit
+	MultidimArray<RFLOAT> normalised_spectrum;
+
+	// Frequencies (1/A), values and radii of the pixels in the normalised spectrum beyond resol_min.
+	// The first nr_fit_pixels (those up to resol_max) are used for the fit, their values have zero mean.
+	std::vector<RFLOAT> pixel_x, pixel_y, pixel_value;
+	std::vector<int> pixel_radius;
+	long int nr_fit_pixels;
+	RFLOAT sum2_fit_pixels;
+
+	// Rotational average of the normalised spectrum, and the range of radii (in pixels) used in the fit
+	std::vector<RFLOAT> radial_value;
+	int radius_min, radius_max;
+
+	CTF getCtf(RFLOAT defU, RFLOAT defV, RFLOAT defAng, RFLOAT phase) const;
+
+	// 1D exhaustive search over the defocus (and phase shift) without astigmatism
+	void searchDefocus(RFLOAT &best_defocus, RFLOAT &best_phase) const;
+
+	// Estimate maxres from the correlation of the fitted CTF with the spectrum in bands of resolution
+	void estimateMaxResolution();
+};
+
+#endif /* CTF_ESTIMATOR_H_ */
@@ -37,6 +37,7 @@ void CtffindRunner::read(int argc, char **argv, int rank)
 	do_at_most = textToInteger(parser.getOption("--do_at_most", "Only process up to this number of (unprocessed) micrographs.", "-1"));
 	// Use a smaller squared part of the micrograph to estimate CTF (e.g. to avoid film labels...)
 	ctf_win =  textToInteger(parser.getOption("--ctfWin", "Size (in pixels) of a centered, squared window to use for CTF-estimation", "-1"));
+	do_own = parser.checkOption("--use_own", "Use our own implementation of CTF estimation instead of CTFFIND or Gctf (uses the CTFFIND parameters)");
 
 	int mic_section = parser.addSection("Microscopy parameters");
 	// First parameter line in CTFFIND
@@ -67,7 +68,7 @@ void CtffindRunner::read(int argc, char **argv, int rank)
 	phase_min  = textToFloat(parser.getOption("--phase_min", "Minimum phase shift (in degrees)", "0."));
 	phase_max  = textToFloat(parser.getOption("--phase_max", "Maximum phase shift (in degrees)", "180."));
 	phase_step = textToFloat(parser.getOption("--phase_step", "Step in phase shift (in degrees)", "10."));
-	nr_threads = textToInteger(parser.getOption("--j", "Number of threads (for CTFIND4 only)", "1"));
+	nr_threads = textToInteger(parser.getOption("--j", "Number of threads (for CTFIND4 and --use_own only)", "1"));
 	do_fast_search = parser.checkOption("--fast_search", "Disable \"Slower, more exhaustive search\" in CTFFIND4.1 (faster but less accurate)");
 
 	int gctf_section = parser.addSection("Gctf parameters");
@@ -126,6 +127,12 @@ void CtffindRunner::initialise()
 	                       additional_gctf_options.find("--phase_shift_S") != std::string::npos))
 		REPORT_ERROR("ERROR: Please don't specify --phase_shift_L, H, S in 'Other Gctf options' (--extra_gctf_options). Use 'Estimate phase shifts' (--do_phaseshift) and 'Phase shift - Min, Max, Step' (--phase_min, --phase_max, --phase_step) instead.");
 
+	if (do_own && do_use_gctf)
+		REPORT_ERROR("ERROR: You cannot use --use_own and --use_gctf simultaneously");
+
+	if (do_own && do_movie_thon_rings)
+		REPORT_ERROR("ERROR: Our own implementation of CTF estimation cannot calculate Thon rings from movies (--do_movie_thon_rings)");
+
 	if (do_use_gctf && use_given_ps)
 		REPORT_ERROR("ERROR: --use_given_ps is available only with CTFFIND 4.1");
 
@@ -348,7 +355,9 @@ void CtffindRunner::initialise()
 
 	if (verb > 0)
 	{
-		if (do_use_gctf)
+		if (do_own)
+			std::cout << " Using our own implementation" << std::endl;
+		else if (do_use_gctf)
 			std::cout << " Using Gctf executable in: " << fn_gctf_exe << std::endl;
 		else
 			std::cout << " Using CTFFIND executable in: " << fn_ctffind_exe << std::endl;
@@ -368,7 +377,9 @@ void CtffindRunner::run()
 		int barstep;
 		if (verb > 0)
 		{
-			if (do_use_gctf)
+			if (do_own)
+				std::cout << " Estimating CTF parameters using our own implementation ..." << std::endl;
+			else if (do_use_gctf)
 				std::cout << " Estimating CTF parameters using Kai Zhang's Gctf ..." << std::endl;
 			else
 			{
@@ -395,7 +406,11 @@ void CtffindRunner::run()
 			obsModel.opticsMdt.getValue(EMDL_CTF_Q0, AmplitudeConstrast, optics_group_micrographs[imic]-1);
 			obsModel.opticsMdt.getValue(EMDL_MICROGRAPH_PIXEL_SIZE, angpix, optics_group_micrographs[imic]-1);
 
-			if (do_use_gctf)
+			if (do_own)
+			{
+				executeOwnCtfEstimation(imic);
+			}
+			else if (do_use_gctf)
 			{
 				executeGctf(imic, allmicnames, imic+1==fn_micrographs.size());
 			}
@@ -482,8 +497,8 @@ void CtffindRunner::joinCtffindResults()
 	plot_labels.push_back(EMDL_CTF_PHASESHIFT);
 	plot_labels.push_back(EMDL_CTF_FOM);
 	plot_labels.push_back(EMDL_CTF_VALIDATIONSCORE);
-	FileName fn_eps, fn_eps_root = fn_out+"micrographs_ctf";
-	std::vector<FileName> all_fn_eps;
+	CPlot2DDocument logfile;
+	logfile.Open(fn_out + "logfile.pdf");
 	for (int i = 0; i < plot_labels.size(); i++)
 	{
 		EMDLabel label = plot_labels[i];
@@ -493,9 +508,7 @@ void CtffindRunner::joinCtffindResults()
 			CPlot2D *plot2Db=new CPlot2D(EMDL::label2Str(label) + " for all micrographs");
 			MDctf.addToCPlot2D(plot2Db, EMDL_UNDEFINED, label, 1.);
 			plot2Db->SetDrawLegend(false);
-			fn_eps = fn_eps_root + "_all_" + EMDL::label2Str(label) + ".eps";
-			plot2Db->OutputPostScriptPlot(fn_eps);
-			all_fn_eps.push_back(fn_eps);
+			logfile.AddPage(*plot2Db);
 			delete plot2Db;
 			if (MDctf.numberOfObjects() > 3)
 			{
@@ -503,14 +516,12 @@ void CtffindRunner::joinCtffindResults()
 				std::vector<RFLOAT> histX, histY;
 				CPlot2D *plot2D=new CPlot2D("");
 				MDctf.columnHistogram(label,histX,histY,0, plot2D);
-				fn_eps = fn_eps_root + "_hist_" + EMDL::label2Str(label) + ".eps";
-				plot2D->OutputPostScriptPlot(fn_eps);
-				all_fn_eps.push_back(fn_eps);
+				logfile.AddPage(*plot2D);
 				delete plot2D;
 			}
 		}
 	}
-	joinMultipleEPSIntoSinglePDF(fn_out + "logfile.pdf", all_fn_eps);
+	logfile.Close();
 
 	if (verb > 0 )
 	{
@@ -807,11 +818,74 @@ void CtffindRunner::executeCtffind4(long int imic)
 	}
 }
 
+void CtffindRunner::executeOwnCtfEstimation(long int imic)
+{
+	FileName fn_mic = getOutputFileWithNewUniqueDate(fn_micrographs_ctf[imic], fn_out);
+	FileName fn_root = fn_mic.withoutExtension();
+
+	CtfEstimator estimator;
+	estimator.voltage = Voltage;
+	estimator.Cs = Cs;
+	estimator.Q0 = AmplitudeConstrast;
+	estimator.box_size = ROUND(box_size);
+	estimator.resol_min = resol_min;
+	estimator.resol_max = resol_max;
+	estimator.min_defocus = min_defocus;
+	estimator.max_defocus = max_defocus;
+	estimator.step_defocus = step_defocus;
+	estimator.amount_astigmatism = amount_astigmatism;
+	estimator.do_phaseshift = do_phaseshift;
+	estimator.phase_min = phase_min;
+	estimator.phase_max = phase_max;
+	estimator.phase_step = phase_step;
+	estimator.nr_threads = nr_threads;
+
+	Image<RFLOAT> I;
+	I.read(fn_mic);
+	MultidimArray<RFLOAT> spectrum;
+	RFLOAT ctf_angpix = angpix;
+	if (use_given_ps)
+	{
+		// Amplitude spectra from relion_run_motioncorr store the pixel size of the movie in their header
+		spectrum = I();
+		ctf_angpix = I.samplingRateX();
+	}
+	else
+	{
+		// If given, then put a square window of ctf_win on the micrograph for CTF estimation
+		if (ctf_win > 0)
+		{
+			I().setXmippOrigin();
+			I().window(FIRST_XMIPP_INDEX(ctf_win), FIRST_XMIPP_INDEX(ctf_win), LAST_XMIPP_INDEX(ctf_win), LAST_XMIPP_INDEX(ctf_win));
+		}
+		estimator.computeAmplitudeSpectrum(I(), spectrum);
+	}
+
+	estimator.fit(spectrum, ctf_angpix);
+
+	// Diagnostic image, and the fitted parameters in a STAR file that joinCtffindResults() reads back
+	Image<RFLOAT> Ictf;
+	estimator.getDiagnosticImage(Ictf());
+	Ictf.setSamplingRateInHeader(ctf_angpix);
+	Ictf.write(fn_root + ".ctf:mrc");
+
+	MetaDataTable MDctf;
+	MDctf.setName("ctf");
+	MDctf.addObject();
+	estimator.writeResults(MDctf);
+	MDctf.write(fn_root + "_ctf.star");
+}
+
 bool CtffindRunner::getCtffindResults(FileName fn_microot, RFLOAT &defU, RFLOAT &defV, RFLOAT &defAng, RFLOAT &CC,
 		RFLOAT &HT, RFLOAT &CS, RFLOAT &AmpCnst, RFLOAT &XMAG, RFLOAT &DStep,
 		RFLOAT &maxres, RFLOAT &valscore, RFLOAT &phaseshift, bool do_warn)
 {
-	if (is_ctffind4)
+	if (do_own)
+	{
+		return getOwnCtfResults(fn_microot, defU, defV, defAng, CC, HT, CS, AmpCnst, XMAG, DStep,
+		                        maxres, phaseshift, do_warn);
+	}
+	else if (is_ctffind4)
 	{
 		return getCtffind4Results(fn_microot, defU, defV, defAng, CC, HT, CS, AmpCnst, XMAG, DStep,
 		                          maxres, phaseshift, do_warn);
@@ -1009,3 +1083,37 @@ bool CtffindRunner::getCtffind4Results(FileName fn_microot, RFLOAT &defU, RFLOAT
 
 	return Final_is_found;
 }
+
+bool CtffindRunner::getOwnCtfResults(FileName fn_microot, RFLOAT &defU, RFLOAT &defV, RFLOAT &defAng, RFLOAT &CC,
+		RFLOAT &HT, RFLOAT &CS, RFLOAT &AmpCnst, RFLOAT &XMAG, RFLOAT &DStep,
+		RFLOAT &maxres, RFLOAT &phaseshift, bool do_warn)
+{
+	FileName fn_root = getOutputFileWithNewUniqueDate(fn_microot, fn_out);
+	FileName fn_star = fn_root + "_ctf.star";
+	if (!exists(fn_star))
+		return false;
+
+	MetaDataTable MDctf;
+	MDctf.read(fn_star, "ctf");
+	if (MDctf.numberOfObjects() < 1 || !MDctf.containsLabel(EMDL_CTF_DEFOCUSU))
+	{
+		if (do_warn)
+			std::cerr << "WARNING: cannot find the fitted CTF parameters in " << fn_star << std::endl;
+		return false;
+	}
+
+	MDctf.getValue(EMDL_CTF_DEFOCUSU, defU);
+	MDctf.getValue(EMDL_CTF_DEFOCUSV, defV);
+	MDctf.getValue(EMDL_CTF_DEFOCUS_ANGLE, defAng);
+	MDctf.getValue(EMDL_CTF_FOM, CC);
+	MDctf.getValue(EMDL_CTF_MAXRES, maxres);
+	MDctf.getValue(EMDL_CTF_VOLTAGE, HT);
+	MDctf.getValue(EMDL_CTF_CS, CS);
+	MDctf.getValue(EMDL_CTF_Q0, AmpCnst);
+	MDctf.getValue(EMDL_MICROGRAPH_PIXEL_SIZE, DStep);
+	XMAG = 10000.;
+	if (do_phaseshift)
+		MDctf.getValue(EMDL_CTF_PHASESHIFT, phaseshift);
+
+	return true;
+}
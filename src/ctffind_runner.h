@@ -31,6 +31,7 @@
 #include "src/image.h"
 #include <src/time.h>
 #include "src/jaz/obs_model.h"
+#include "src/ctf_estimator.h"
 
 class CtffindRunner
 {
@@ -66,7 +67,7 @@ public:
 	// Is this ctffind4?
 	bool is_ctffind4;
 
-	// Number of OMP threads for CTFFIND4
+	// Number of OMP threads for CTFFIND4 and our own implementation
 	int nr_threads;
 
 	// Use pre-calculated power spectra
@@ -90,6 +91,9 @@ public:
 	// use Kai Zhang's Gctf instead of CTFFIND?
 	bool do_use_gctf;
 
+	// Use our own implementation of CTF estimation instead of CTFFIND or Gctf?
+	bool do_own;
+
 	// When using Gctf, ignore CTFFIND parameters and use Gctf defaults instead?
 	bool do_ignore_ctffind_params;
 
@@ -175,6 +179,9 @@ public:
 	// Execute CTFFIND4.1+ for a single micrograph
 	void executeCtffind4(long int imic);
 
+	// Estimate the CTF of a single micrograph with our own implementation
+	void executeOwnCtfEstimation(long int imic);
+
 	// Check micrograph size and add name to the list of micrographs to run Gctf on
 	//void addToGctfJobList(long int imic, std::vector<std::string> &allmicnames);
 
@@ -192,6 +199,9 @@ public:
 	bool getCtffind4Results(FileName fn_mic, RFLOAT &defU, RFLOAT &defV, RFLOAT &defAng, RFLOAT &CC,
 			RFLOAT &HT, RFLOAT &CS, RFLOAT &AmpCnst, RFLOAT &XMAG, RFLOAT &DStep,
 			RFLOAT &maxres, RFLOAT &phaseshift, bool do_warn = true);
+	bool getOwnCtfResults(FileName fn_mic, RFLOAT &defU, RFLOAT &defV, RFLOAT &defAng, RFLOAT &CC,
+			RFLOAT &HT, RFLOAT &CS, RFLOAT &AmpCnst, RFLOAT &XMAG, RFLOAT &DStep,
+			RFLOAT &maxres, RFLOAT &phaseshift, bool do_warn = true);
 };
 
 
@@ -41,59 +41,67 @@ void CtffindRunnerMpi::run()
 	if (!do_only_join_results)
 	{
 		// Each node does part of the work
-		long int my_first_micrograph, my_last_micrograph, my_nr_micrographs;
-		divide_equally(fn_micrographs.size(), node->size, node->rank, my_first_micrograph, my_last_micrograph);
-		my_nr_micrographs = my_last_micrograph - my_first_micrograph + 1;
+		long int nr_micrographs = fn_micrographs.size();
+		MpiTaskDistributor distributor(node, nr_micrographs);
 
 		int barstep;
 		if (verb > 0)
 		{
-			if (do_use_gctf)
+			if (do_own)
+				std::cout << " Estimating CTF parameters using our own implementation ..." << std::endl;
+			else if (do_use_gctf)
 				std::cout << " Estimating CTF parameters using Kai Zhang's Gctf ..." << std::endl;
 			else
 				std::cout << " Estimating CTF parameters using Niko Grigorieff's CTFFIND ..." << std::endl;
-			init_progress_bar(my_nr_micrographs);
-			barstep = XMIPP_MAX(1, my_nr_micrographs / 60);
+			init_progress_bar(nr_micrographs);
+			barstep = XMIPP_MAX(1, nr_micrographs / 60);
 		}
 
 		std::vector<std::string> allmicnames;
-		for (long int imic = my_first_micrograph; imic <= my_last_micrograph; imic++)
+		long int my_first_micrograph, my_last_micrograph;
+		while (distributor.getTasks(my_first_micrograph, my_last_micrograph))
 		{
-
-			// Abort through the pipeline_control system
-			if (pipeline_control_check_abort_job())
-				MPI_Abort(MPI_COMM_WORLD, RELION_EXIT_ABORTED);
-
-			// Get angpix and voltage from the optics groups:
-			obsModel.opticsMdt.getValue(EMDL_CTF_CS, Cs, optics_group_micrographs[imic]-1);
-			obsModel.opticsMdt.getValue(EMDL_CTF_VOLTAGE, Voltage, optics_group_micrographs[imic]-1);
-			obsModel.opticsMdt.getValue(EMDL_CTF_Q0, AmplitudeConstrast, optics_group_micrographs[imic]-1);
-			obsModel.opticsMdt.getValue(EMDL_MICROGRAPH_PIXEL_SIZE, angpix, optics_group_micrographs[imic]-1);
-
-			if (do_use_gctf)
-			{
-				//addToGctfJobList(imic, allmicnames);
-				executeGctf(imic, allmicnames, imic == my_last_micrograph, node->rank);
-			}
-			else if (is_ctffind4)
-			{
-				executeCtffind4(imic);
-			}
-			else
+			for (long int imic = my_first_micrograph; imic <= my_last_micrograph; imic++)
 			{
-				executeCtffind3(imic);
-			}
 
-			if (verb > 0 && imic % barstep == 0)
-				progress_bar(imic);
+				// Abort through the pipeline_control system
+				if (pipeline_control_check_abort_job())
+					MPI_Abort(MPI_COMM_WORLD, RELION_EXIT_ABORTED);
+
+				// Get angpix and voltage from the optics groups:
+				obsModel.opticsMdt.getValue(EMDL_CTF_CS, Cs, optics_group_micrographs[imic]-1);
+				obsModel.opticsMdt.getValue(EMDL_CTF_VOLTAGE, Voltage, optics_group_micrographs[imic]-1);
+				obsModel.opticsMdt.getValue(EMDL_CTF_Q0, AmplitudeConstrast, optics_group_micrographs[imic]-1);
+				obsModel.opticsMdt.getValue(EMDL_MICROGRAPH_PIXEL_SIZE, angpix, optics_group_micrographs[imic]-1);
+
+				if (do_own)
+				{
+					executeOwnCtfEstimation(imic);
+				}
+				else if (do_use_gctf)
+				{
+					// Gctf runs on the collected micrographs at the end of each chunk
+					executeGctf(imic, allmicnames, imic == my_last_micrograph, node->rank);
+				}
+				else if (is_ctffind4)
+				{
+					executeCtffind4(imic);
+				}
+				else
+				{
+					executeCtffind3(imic);
+				}
+
+				if (verb > 0 && imic % barstep == 0)
+					progress_bar(imic);
 
+			}
 		}
 
-		//if (do_use_gctf && allmicnames.size() > 0)
-		//	executeGctf(allmicnames);
-
 		if (verb > 0)
-			progress_bar(my_nr_micrographs);
+			progress_bar(nr_micrographs);
+
+		distributor.reportUtilisation();
 	}
 
 	MPI_Barrier(MPI_COMM_WORLD);
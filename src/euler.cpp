@@ -148,38 +148,44 @@ void Euler_direction2angles(Matrix1D<RFLOAT> &v0,
 void Euler_matrix2angles(const Matrix2D<RFLOAT> &A, RFLOAT &alpha,
                          RFLOAT &beta, RFLOAT &gamma)
 {
-    RFLOAT abs_sb, sign_sb;
-
     if (MAT_XSIZE(A) != 3 || MAT_YSIZE(A) != 3)
         REPORT_ERROR( "Euler_matrix2angles: The Euler matrix is not 3x3");
 
-    abs_sb = sqrt(A(0, 2) * A(0, 2) + A(1, 2) * A(1, 2));
+    Euler_matrix2angles(MATRIX2D_ARRAY(A), alpha, beta, gamma);
+}
+
+void Euler_matrix2angles(const RFLOAT *A, RFLOAT &alpha,
+                         RFLOAT &beta, RFLOAT &gamma)
+{
+    RFLOAT abs_sb, sign_sb;
+
+    abs_sb = sqrt(A[2] * A[2] + A[5] * A[5]);
     if (abs_sb > 16*FLT_EPSILON)
     {
-        gamma = atan2(A(1, 2), -A(0, 2));
-        alpha = atan2(A(2, 1), A(2, 0));
+        gamma = atan2(A[5], -A[2]);
+        alpha = atan2(A[7], A[6]);
         if (ABS(sin(gamma)) < FLT_EPSILON)
-            sign_sb = SGN(-A(0, 2) / cos(gamma));
+            sign_sb = SGN(-A[2] / cos(gamma));
         // if (sin(alpha)<FLT_EPSILON) sign_sb=SGN(-A(0,2)/cos(gamma));
         // else sign_sb=(sin(alpha)>0) ? SGN(A(2,1)):-SGN(A(2,1));
         else
-            sign_sb = (sin(gamma) > 0) ? SGN(A(1, 2)) : -SGN(A(1, 2));
-        beta  = atan2(sign_sb * abs_sb, A(2, 2));
+            sign_sb = (sin(gamma) > 0) ? SGN(A[5]) : -SGN(A[5]);
+        beta  = atan2(sign_sb * abs_sb, A[8]);
     }
     else
     {
-        if (SGN(A(2, 2)) > 0)
+        if (SGN(A[8]) > 0)
         {
             // Let's consider the matrix as a rotation around Z
             alpha = 0;
             beta  = 0;
-            gamma = atan2(-A(1, 0), A(0, 0));
+            gamma = atan2(-A[3], A[0]);
         }
         else
         {
             alpha = 0;
             beta  = PI;
-            gamma = atan2(A(1, 0), -A(0, 0));
+            gamma = atan2(A[3], -A[0]);
         }
     }
 
@@ -189,11 +195,11 @@ void Euler_matrix2angles(const Matrix2D<RFLOAT> &A, RFLOAT &alpha,
 
 #ifdef DEBUG_EULER
     std::cout << "abs_sb " << abs_sb << std::endl;
-    std::cout << "A(1,2) " << A(1, 2) << " A(0,2) " << A(0, 2) << " gamma "
+    std::cout << "A(1,2) " << A[5] << " A(0,2) " << A[2] << " gamma "
     << gamma << std::endl;
-    std::cout << "A(2,1) " << A(2, 1) << " A(2,0) " << A(2, 0) << " alpha "
+    std::cout << "A(2,1) " << A[7] << " A(2,0) " << A[6] << " alpha "
     << alpha << std::endl;
-    std::cout << "sign sb " << sign_sb << " A(2,2) " << A(2, 2)
+    std::cout << "sign sb " << sign_sb << " A(2,2) " << A[8]
     << " beta " << beta << std::endl;
 #endif
 }
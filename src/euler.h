@@ -104,6 +104,13 @@ void Euler_matrix2angles(const Matrix2D< RFLOAT >& A,
                          RFLOAT& beta,
                          RFLOAT& gamma);
 
+/** "Euler" matrix --> angles, for a row-major 3x3 matrix in A[0] ... A[8]
+ */
+void Euler_matrix2angles(const RFLOAT *A,
+                         RFLOAT& alpha,
+                         RFLOAT& beta,
+                         RFLOAT& gamma);
+
 /** Up-Down projection equivalence
  *
  * As you know a projection view from a point has got its homologous from its
@@ -19,11 +19,12 @@
  ***************************************************************************/
 #include "src/exp_model.h"
 #include <sys/statvfs.h>
+#include <map>
 
 long int Experiment::numberOfParticles(int random_subset)
 {
 	if (random_subset == 0)
-		return particles.size();
+		return particle_random_subset.size();
 	else if (random_subset == 1)
 		return nr_particles_subset1;
 	else if (random_subset == 2)
@@ -32,20 +33,14 @@ long int Experiment::numberOfParticles(int random_subset)
 		REPORT_ERROR("ERROR: Experiment::numberOfParticles invalid random_subset: " + integerToString(random_subset));
 }
 
-// Get the total number of images in a given particle
-long int Experiment::numberOfImagesInParticle(long int part_id)
-{
-	return particles[part_id].images.size();
-}
-
 long int Experiment::numberOfMicrographs()
 {
-	return micrographs.size();
+	return micrograph_names.size();
 }
 
 long int Experiment::numberOfGroups()
 {
-	return groups.size();
+	return group_names.size();
 }
 
 int Experiment::numberOfOpticsGroups()
@@ -71,43 +66,32 @@ int Experiment::getOpticsImageSize(int optics_group)
 	return obsModel.getBoxSize(optics_group);
 }
 
-long int Experiment::getMicrographId(long int part_id, int img_id)
+FileName Experiment::getImageName(long int part_id, int img_id)
 {
-	return (particles[part_id].images[img_id]).micrograph_id;
+	FileName fn_img;
+	MDimg.getValue(EMDL_IMAGE_NAME, fn_img, getOriginalImageId(part_id, img_id));
+	return fn_img;
 }
 
-long int Experiment::getGroupId(long int part_id, int img_id)
+FileName Experiment::getParticleName(long int part_id)
 {
-	return (particles[part_id].images[img_id]).group_id;
+	FileName fn_part;
+	if (!MDimg.getValue(EMDL_PARTICLE_NAME, fn_part, getOriginalImageId(part_id, 0)))
+		fn_part = getImageName(part_id, 0);
+	return fn_part;
 }
 
-int Experiment::getOpticsGroup(long part_id, int img_id)
-{
-	return particles[part_id].images[img_id].optics_group;
-}
-
-int Experiment::getRandomSubset(long int part_id)
-{
-	return particles[part_id].random_subset;
-}
-
-int Experiment::getOriginalImageId(long part_id, int img_id)
-{
-	return particles[part_id].images[img_id].id;
-}
 RFLOAT Experiment::getImagePixelSize(long int part_id, int img_id)
 {
-	int optics_group = particles[part_id].images[img_id].optics_group;
-	return obsModel.getPixelSize(optics_group);
+	return obsModel.getPixelSize(getOpticsGroup(part_id, img_id));
 }
 
 void Experiment::getNumberOfImagesPerGroup(std::vector<long int> &nr_particles_per_group)
 {
-	nr_particles_per_group.resize(groups.size());
+	nr_particles_per_group.resize(group_names.size());
 
-	for (long int part_id = 0; part_id < particles.size(); part_id++)
-		for (int img_id = 0; img_id < particles[part_id].images.size(); img_id++)
-			nr_particles_per_group[particles[part_id].images[img_id].group_id] += 1;
+	for (long int i = 0; i < image_group_id.size(); i++)
+		nr_particles_per_group[image_group_id[i]] += 1;
 }
 
 MetaDataTable Experiment::getMetaDataImage(long int part_id, int img_id)
@@ -117,81 +101,118 @@ MetaDataTable Experiment::getMetaDataImage(long int part_id, int img_id)
 	return result;
 }
 
-long int Experiment::addParticle(std::string part_name, int random_subset)
+long int Experiment::addParticle(int random_subset)
 {
+	// Push back this particle and its sorted index in sorted_idx
+	sorted_idx.push_back(particle_random_subset.size());
+	particle_random_subset.push_back(random_subset);
+	part_image_start.push_back(part_image_start.back());
 
-	ExpParticle particle;
-	particle.name = part_name;
-	particle.random_subset = random_subset;
-
-	// Push back this particle in the particles vector and its sorted index in sorted_idx
-	sorted_idx.push_back(particles.size());
-	particles.push_back(particle);
-
-	// Return the current part_id in the particles vector
-	return particles.size() - 1;
+	// Return the current part_id
+	return particle_random_subset.size() - 1;
 }
 
-int Experiment::addImageToParticle(long int part_id, std::string img_name, long int ori_img_id, long int group_id, long int micrograph_id,
-                                   int optics_group, bool unique)
+void Experiment::addImageToParticle(long int part_id, long int ori_img_id, long int group_id, long int micrograph_id,
+                                    int optics_group, bool unique)
 {
-	if (group_id >= groups.size())
+	if (group_id >= group_names.size())
 		REPORT_ERROR("Experiment::addImageToParticle: group_id out of range");
 
-	if (micrograph_id >= micrographs.size())
+	if (micrograph_id >= micrograph_names.size())
 		REPORT_ERROR("Experiment::addImageToParticle: micrograph_id out of range");
 
 	if (optics_group >= obsModel.numberOfOpticsGroups())
 		REPORT_ERROR("Experiment::addImageToParticle: optics_group out of range");
 
-	ExpImage img;
-	img.name = img_name;
-	img.id = ori_img_id;
-	img.particle_id = part_id;
-	img.group_id = group_id;
-	img.micrograph_id = micrograph_id;
-	img.optics_group = optics_group;
 	if (unique)
 		nr_images_per_optics_group[optics_group]++;
-	img.optics_group_id = nr_images_per_optics_group[optics_group] - 1;
+	long int optics_group_id = nr_images_per_optics_group[optics_group] - 1;
 
-	if (img.optics_group_id < 0)
+	if (optics_group_id < 0)
 		REPORT_ERROR("Logic error in Experiment::addImageToParticle.");
 
-	// Push back this particle in the particles vector
-	particles[part_id].images.push_back(img);
-	(micrographs[micrograph_id].image_ids).push_back(img.id);
+	image_ori_id.push_back(ori_img_id);
+	image_particle_id.push_back(part_id);
+	image_micrograph_id.push_back(micrograph_id);
+	image_group_id.push_back(group_id);
+	image_optics_group.push_back(optics_group);
+	image_optics_group_id.push_back(optics_group_id);
+	part_image_start.back() = image_ori_id.size();
+}
 
-	return particles[part_id].images.size() - 1;
+void Experiment::reserve(long int nr_images)
+{
+	particle_random_subset.reserve(nr_images);
+	part_image_start.reserve(nr_images + 1);
+	sorted_idx.reserve(nr_images);
+	image_ori_id.reserve(nr_images);
+	image_particle_id.reserve(nr_images);
+	image_micrograph_id.reserve(nr_images);
+	image_group_id.reserve(nr_images);
+	image_optics_group.reserve(nr_images);
+	image_optics_group_id.reserve(nr_images);
 }
 
-long int Experiment::addGroup(std::string group_name, int _optics_group)
+void Experiment::groupImagesByParticle()
 {
-	// Add new group to this Experiment
-	ExpGroup group;
-	group.id = groups.size(); // start counting groups at 0!
-	group.optics_group = _optics_group;
-	group.name = group_name;
+	const long int nr_particles = particle_random_subset.size();
+	const long int nr_images = image_ori_id.size();
+
+	// Counting sort of the images on their particle, which keeps images of the same particle in order
+	part_image_start.assign(nr_particles + 1, 0);
+	for (long int i = 0; i < nr_images; i++)
+		part_image_start[image_particle_id[i] + 1]++;
+	for (long int part_id = 0; part_id < nr_particles; part_id++)
+		part_image_start[part_id + 1] += part_image_start[part_id];
+
+	// Usually all images of a particle were added one after the other
+	bool is_grouped = true;
+	for (long int i = 1; i < nr_images && is_grouped; i++)
+		is_grouped = (image_particle_id[i] >= image_particle_id[i - 1]);
+	if (is_grouped)
+		return;
 
-	// Push back this micrograph
-	groups.push_back(group);
+	if (image_data.size() > 0)
+		REPORT_ERROR("Experiment::groupImagesByParticle BUG: images were pre-read before grouping them.");
+
+	std::vector<long int> order(nr_images);
+	std::vector<long int> pos(part_image_start.begin(), part_image_start.end() - 1);
+	for (long int i = 0; i < nr_images; i++)
+		order[pos[image_particle_id[i]]++] = i;
+
+	std::vector<long int> new_long(nr_images);
+	std::vector<int> new_int(nr_images);
+	for (long int i = 0; i < nr_images; i++) new_long[i] = image_ori_id[order[i]];
+	image_ori_id.swap(new_long);
+	for (long int i = 0; i < nr_images; i++) new_long[i] = image_particle_id[order[i]];
+	image_particle_id.swap(new_long);
+	for (long int i = 0; i < nr_images; i++) new_long[i] = image_optics_group_id[order[i]];
+	image_optics_group_id.swap(new_long);
+	for (long int i = 0; i < nr_images; i++) new_int[i] = image_micrograph_id[order[i]];
+	image_micrograph_id.swap(new_int);
+	for (long int i = 0; i < nr_images; i++) new_int[i] = image_group_id[order[i]];
+	image_group_id.swap(new_int);
+	for (long int i = 0; i < nr_images; i++) new_int[i] = image_optics_group[order[i]];
+	image_optics_group.swap(new_int);
+}
 
-	// Return the id in the micrographs vector
-	return group.id;
+long int Experiment::addGroup(std::string group_name, int _optics_group)
+{
+	// Add new group to this Experiment, start counting groups at 0!
+	group_names.push_back(group_name);
+	group_optics_groups.push_back(_optics_group);
+
+	// Return the id of this group
+	return group_names.size() - 1;
 }
 
 long int Experiment::addMicrograph(std::string mic_name)
 {
 	// Add new micrograph to this Experiment
-	ExpMicrograph micrograph;
-	micrograph.id = micrographs.size();
-	micrograph.name = mic_name;
-
-	// Push back this micrograph
-	micrographs.push_back(micrograph);
+	micrograph_names.push_back(mic_name);
 
-	// Return the id in the micrographs vector
-	return micrograph.id;
+	// Return the id of this micrograph
+	return micrograph_names.size() - 1;
 }
 
 void Experiment::divideParticlesInRandomHalves(int seed, bool do_helical_refine)
@@ -201,9 +222,9 @@ void Experiment::divideParticlesInRandomHalves(int seed, bool do_helical_refine)
 	bool some_are_zero = false;
 	nr_particles_subset1 = 0;
 	nr_particles_subset2 = 0;
-	for (long int i = 0; i < particles.size(); i++)
+	for (long int i = 0; i < particle_random_subset.size(); i++)
 	{
-		int random_subset = particles[i].random_subset;
+		int random_subset = particle_random_subset[i];
 		if (random_subset != 0)
 		{
 			all_are_zero = false;
@@ -240,11 +261,10 @@ void Experiment::divideParticlesInRandomHalves(int seed, bool do_helical_refine)
 
 			// Count micrograph names
 			map_mics.clear();
-			for (long int part_id = 0; part_id < particles.size(); part_id++)
+			for (long int part_id = 0; part_id < particle_random_subset.size(); part_id++)
 			{
 				// Get name of micrograph of the first image in this particle
-				long int mic_id = particles[part_id].images[0].micrograph_id;
-				mic_name = micrographs[mic_id].name;
+				mic_name = micrograph_names[getMicrographId(part_id, 0)];
 				if (divide_according_to_helical_tube_id)
 				{
 					long int ori_img_id = getOriginalImageId(part_id, 0);
@@ -294,11 +314,10 @@ void Experiment::divideParticlesInRandomHalves(int seed, bool do_helical_refine)
 				map_mics.insert(vec_mics[ii]);
 			}
 
-			for (long int part_id = 0; part_id < particles.size(); part_id++)
+			for (long int part_id = 0; part_id < particle_random_subset.size(); part_id++)
 			{
 				// Get name of micrograph of the first image in this particle
-				long int mic_id = particles[part_id].images[0].micrograph_id;
-				mic_name = micrographs[mic_id].name;
+				mic_name = micrograph_names[getMicrographId(part_id, 0)];
 				if (divide_according_to_helical_tube_id)
 				{
 					long int ori_img_id = getOriginalImageId(part_id, 0);
@@ -308,20 +327,20 @@ void Experiment::divideParticlesInRandomHalves(int seed, bool do_helical_refine)
 					mic_name += std::string("_TUBEID_");
 					mic_name += std::string(integerToString(helical_tube_id));
 				}
-				particles[part_id].random_subset = map_mics[mic_name];
+				particle_random_subset[part_id] = map_mics[mic_name];
 			}
 		}
 		else
 		{
-			for (long int part_id = 0; part_id < particles.size(); part_id++)
+			for (long int part_id = 0; part_id < particle_random_subset.size(); part_id++)
 			{
 				int random_subset = rand() % 2 + 1;
-				particles[part_id].random_subset = random_subset; // randomly 1 or 2
+				particle_random_subset[part_id] = random_subset; // randomly 1 or 2
 			}
 		}
 
 		// Now that random subsets have been assigned, count the number of particles in each subset and set new labels in entire MDimg
-		for (long int part_id = 0; part_id < particles.size(); part_id++)
+		for (long int part_id = 0; part_id < particle_random_subset.size(); part_id++)
 		{
 			int random_subset = getRandomSubset(part_id);
 
@@ -343,11 +362,11 @@ void Experiment::divideParticlesInRandomHalves(int seed, bool do_helical_refine)
 	if (nr_particles_subset2 == 0 || nr_particles_subset1 == 0)
 		REPORT_ERROR("ERROR: one of your half sets has no segments. Is rlnRandomSubset set to 1 or 2 in your particles STAR file? Or in case you're doing helical, half-sets are always per-filament, so provide at least 2 filaments.");
 
-	std::stable_sort(sorted_idx.begin(), sorted_idx.end(), compareRandomSubsetParticles(particles));
+	std::stable_sort(sorted_idx.begin(), sorted_idx.end(), compareRandomSubsetParticles(*this));
 
 }
 
-void Experiment::randomiseParticlesOrder(int seed, bool do_split_random_halves, bool do_subsets)
+void Experiment::randomiseParticlesOrder(int seed, bool do_split_random_halves, bool do_subsets, int block_size)
 {
 	//This static flag is for only randomize once
 	static bool randomised = false;
@@ -355,15 +374,19 @@ void Experiment::randomiseParticlesOrder(int seed, bool do_split_random_halves,
 	{
 		srand(seed);
 
+		// Blocks are made from particles in their original order, which follows the micrographs
+		if (block_size > 0)
+			std::sort(sorted_idx.begin(), sorted_idx.end());
+
 		if (do_split_random_halves)
 		{
-			std::stable_sort(sorted_idx.begin(), sorted_idx.end(), compareRandomSubsetParticles(particles));
+			std::stable_sort(sorted_idx.begin(), sorted_idx.end(), compareRandomSubsetParticles(*this));
 
 			// sanity check
 			long int nr_half1 = 0, nr_half2 = 0;
-			for (long int i = 0; i < particles.size(); i++)
+			for (long int i = 0; i < particle_random_subset.size(); i++)
 			{
-				const int random_subset = particles[i].random_subset;
+				const int random_subset = particle_random_subset[i];
 				if (random_subset == 1)
 					nr_half1++;
 				else if (random_subset == 2)
@@ -378,29 +401,69 @@ void Experiment::randomiseParticlesOrder(int seed, bool do_split_random_halves,
 				REPORT_ERROR("ERROR Experiment::randomiseParticlesOrder: invalid half2 size:" + integerToString(nr_half2) + " != " + integerToString(nr_particles_subset2));
 
 			// Randomise the two particle lists
-			std::random_shuffle(sorted_idx.begin(), sorted_idx.begin() + nr_half1);
-			std::random_shuffle(sorted_idx.begin() + nr_half1, sorted_idx.end());
+			if (block_size > 0)
+			{
+				randomiseParticlesInBlocks(0, nr_half1, block_size);
+				randomiseParticlesInBlocks(nr_half1, sorted_idx.size(), block_size);
+			}
+			else
+			{
+				std::random_shuffle(sorted_idx.begin(), sorted_idx.begin() + nr_half1);
+				std::random_shuffle(sorted_idx.begin() + nr_half1, sorted_idx.end());
+			}
 
 			// Make sure the particles are sorted on their optics_group.
 			// Otherwise CudaFFT re-calculation of plans every time image size changes slows down things a lot!
-			std::stable_sort(sorted_idx.begin(), sorted_idx.begin() + nr_half1, compareOpticsGroupsParticles(particles));
-			std::stable_sort(sorted_idx.begin() + nr_half1, sorted_idx.end(), compareOpticsGroupsParticles(particles));
+			std::stable_sort(sorted_idx.begin(), sorted_idx.begin() + nr_half1, compareOpticsGroupsParticles(*this));
+			std::stable_sort(sorted_idx.begin() + nr_half1, sorted_idx.end(), compareOpticsGroupsParticles(*this));
 
 		}
 		else
 		{
 			// Just randomise the entire vector
-			std::random_shuffle(sorted_idx.begin(), sorted_idx.end());
+			if (block_size > 0)
+				randomiseParticlesInBlocks(0, sorted_idx.size(), block_size);
+			else
+				std::random_shuffle(sorted_idx.begin(), sorted_idx.end());
 
 			// Make sure the particles are sorted on their optics_group.
 			// Otherwise CudaFFT re-calculation of plans every time image size changes slows down things a lot!
- 			std::stable_sort(sorted_idx.begin(), sorted_idx.end(), compareOpticsGroupsParticles(particles));
+ 			std::stable_sort(sorted_idx.begin(), sorted_idx.end(), compareOpticsGroupsParticles(*this));
 		}
 
 		randomised = true;
 	}
 }
 
+void Experiment::randomiseParticlesInBlocks(long int first, long int last, int block_size)
+{
+	// Find the start of each block of consecutive particles from the same micrograph
+	std::vector<long int> block_start;
+	for (long int i = first; i < last; i++)
+	{
+		if (i == first || i - block_start.back() >= block_size ||
+		    getMicrographId(sorted_idx[i], 0) != getMicrographId(sorted_idx[i - 1], 0))
+			block_start.push_back(i);
+	}
+	long int nr_blocks = block_start.size();
+	block_start.push_back(last);
+
+	// Randomise the order of the blocks, but keep the order of the particles inside each block
+	std::vector<long int> block_order(nr_blocks);
+	for (long int iblock = 0; iblock < nr_blocks; iblock++)
+		block_order[iblock] = iblock;
+	std::random_shuffle(block_order.begin(), block_order.end());
+
+	std::vector<long int> new_idx;
+	new_idx.reserve(last - first);
+	for (long int iblock = 0; iblock < nr_blocks; iblock++)
+	{
+		long int b = block_order[iblock];
+		new_idx.insert(new_idx.end(), sorted_idx.begin() + block_start[b], sorted_idx.begin() + block_start[b + 1]);
+	}
+	std::copy(new_idx.begin(), new_idx.end(), sorted_idx.begin() + first);
+}
+
 void Experiment::initialiseBodies(int _nr_bodies)
 {
 	if (_nr_bodies < 2)
@@ -442,7 +505,7 @@ void Experiment::initialiseBodies(int _nr_bodies)
 bool Experiment::getImageNameOnScratch(long int part_id, int img_id, FileName &fn_img, bool is_ctf_image)
 {
 	int optics_group = getOpticsGroup(part_id, img_id);
-	long int my_id = particles[part_id].images[img_id].optics_group_id;
+	long int my_id = image_optics_group_id[part_image_start[part_id] + img_id];
 
 #ifdef DEBUG_SCRATCH
 	std::cerr << "part_id = " << part_id << " img_id = " << img_id << " my_id = " << my_id << " nr_parts_on_scratch[" << optics_group << "] = " << nr_parts_on_scratch[optics_group] << std::endl;
@@ -465,7 +528,7 @@ bool Experiment::getImageNameOnScratch(long int part_id, int img_id, FileName &f
 		}
 
 #ifdef DEBUG_SCRATCH
-		std::cerr << "getImageNameOnScratch: " << particles[part_id].name << " is cached at " << fn_img << std::endl;
+		std::cerr << "getImageNameOnScratch: " << getParticleName(part_id) << " is cached at " << fn_img << std::endl;
 #endif
 		return true;
 	}
@@ -745,6 +808,68 @@ void Experiment::copyParticlesToScratch(int verb, bool do_copy, bool also_do_ctf
 	}
 }
 
+long int Experiment::getPrereadImagesSize()
+{
+	long int result = 0;
+	for (long int i = 0; i < image_optics_group.size(); i++)
+	{
+		long int box = getOpticsImageSize(image_optics_group[i]);
+		result += (is_3D) ? box * box * box : box * box;
+	}
+	return result;
+}
+
+void Experiment::prereadImages(float *shared_data, bool do_read)
+{
+	// Only open stacks once and then read multiple images
+	fImageHandler hFile;
+	long int dump;
+	FileName fn_stack, fn_open_stack="";
+
+	image_data.clear();
+	image_data.resize(image_ori_id.size());
+	long int offset = 0;
+	for (long int i = 0; i < image_ori_id.size(); i++)
+	{
+		if (shared_data != NULL)
+		{
+			// Point into the shared block: the MultidimArray will never free this memory
+			long int box = getOpticsImageSize(image_optics_group[i]);
+			image_data[i].setDimensions(box, box, (is_3D) ? box : 1, 1);
+			image_data[i].data = shared_data + offset;
+			image_data[i].destroyData = false;
+			image_data[i].setXmippOrigin();
+			offset += MULTIDIM_SIZE(image_data[i]);
+		}
+
+		if (!do_read)
+			continue;
+
+		FileName fn_img;
+		Image<float> img;
+		MDimg.getValue(EMDL_IMAGE_NAME, fn_img, image_ori_id[i]);
+		fn_img.decompose(dump, fn_stack);
+		if (fn_stack != fn_open_stack)
+		{
+			hFile.openFile(fn_stack, WRITE_READONLY);
+			fn_open_stack = fn_stack;
+		}
+		img.readFromOpenFile(fn_img, hFile, -1, false);
+		img().setXmippOrigin();
+
+		if (shared_data != NULL)
+		{
+			if (!img().sameShape(image_data[i]))
+				REPORT_ERROR("Experiment::prereadImages: image " + fn_img + " does not have the box size of its optics group.");
+			memcpy(MULTIDIM_ARRAY(image_data[i]), MULTIDIM_ARRAY(img()), MULTIDIM_SIZE(img()) * sizeof(float));
+		}
+		else
+		{
+			image_data[i] = img();
+		}
+	}
+}
+
 // Read from file
 void Experiment::read(FileName fn_exp, bool do_ignore_particle_name, bool do_ignore_group_name, bool do_preread_images,
                       bool need_tiltpsipriors_for_helical_refine, int verb)
@@ -766,11 +891,6 @@ void Experiment::read(FileName fn_exp, bool do_ignore_particle_name, bool do_ign
 	timer.tic(tread);
 #endif
 
-	// Only open stacks once and then read multiple images
-	fImageHandler hFile;
-	long int dump;
-	FileName fn_stack, fn_open_stack="";
-
 	// Initialize by emptying everything
 	clear();
 	long int group_id = 0, mic_id = 0, part_id = 0;
@@ -792,7 +912,7 @@ void Experiment::read(FileName fn_exp, bool do_ignore_particle_name, bool do_ign
 		img.read(fn_exp, false); // false means skip data, only read header
 
 		// allocate 1 block of memory
-		particles.reserve(NSIZE(img()));
+		reserve(NSIZE(img()));
 		nr_images_per_optics_group.resize(1, 0);
 
 		for (long int n = 0; n <  NSIZE(img()); n++)
@@ -800,26 +920,12 @@ void Experiment::read(FileName fn_exp, bool do_ignore_particle_name, bool do_ign
 			FileName fn_img;
 			fn_img.compose(n+1, fn_exp); // fn_img = integerToString(n) + "@" + fn_exp;
 			// Add the particle to my_area = 0
-			part_id = addParticle(fn_img, 0);
+			part_id = addParticle(0);
 			// Just add a single image per particle
-			addImageToParticle(part_id, fn_img, n, 0, 0, 0, true);
+			addImageToParticle(part_id, n, 0, 0, 0, true);
 
 			MDimg.addObject();
 
-			if (do_preread_images)
-			{
-				Image<float> img;
-				fn_img.decompose(dump, fn_stack);
-				if (fn_stack != fn_open_stack)
-				{
-					hFile.openFile(fn_stack, WRITE_READONLY);
-					fn_open_stack = fn_stack;
-				}
-				img.readFromOpenFile(fn_img, hFile, -1, false);
-				img().setXmippOrigin();
-				particles[part_id].images[0].img = img();
-			}
-
 			// Set the filename and other metadata parameters
 			MDimg.setValue(EMDL_IMAGE_NAME, fn_img, part_id);
 			MDimg.setValue(EMDL_IMAGE_OPTICS_GROUP, 1, part_id);
@@ -876,10 +982,12 @@ void Experiment::read(FileName fn_exp, bool do_ignore_particle_name, bool do_ign
 		long nr_read = 0;
 #endif
 		// allocate 1 block of memory
-		particles.reserve(MDimg.numberOfObjects());
+		reserve(MDimg.numberOfObjects());
 
 		// Now Loop over all objects in the metadata file and fill the logical tree of the experiment
-		long int last_part_id = -1;
+		// Images with the same particle name are only searched for on the same micrograph
+		bool do_use_particle_name = MDimg.containsLabel(EMDL_PARTICLE_NAME) && !do_ignore_particle_name;
+		std::map<std::string, long int> part_ids_on_mic, group_ids;
 
 		FileName prev_img_name = "/Unlikely$filename$?*!";
 		int prev_optics_group = -999;
@@ -893,8 +1001,8 @@ void Experiment::read(FileName fn_exp, bool do_ignore_particle_name, bool do_ign
 			FileName mic_name=""; // Filename instead of string because will decompose below
 			if (star_contains_micname)
 			{
-				long int idx = micrographs.size();
-				std::string last_mic_name = (idx > 0) ? micrographs[idx-1].name : "";
+				long int idx = micrograph_names.size();
+				std::string last_mic_name = (idx > 0) ? micrograph_names[idx-1] : "";
 
 				MDimg.getValue(EMDL_MICROGRAPH_NAME, mic_name, ori_img_id);
 
@@ -906,12 +1014,12 @@ void Experiment::read(FileName fn_exp, bool do_ignore_particle_name, bool do_ign
 				if (last_mic_name == mic_name)
 				{
 					// This particle belongs to the previous micrograph
-					mic_id = micrographs[idx - 1].id;
+					mic_id = idx - 1;
 				}
 				else
 				{
 					// A new micrograph
-					last_part_id = particles.size();
+					part_ids_on_mic.clear();
 				}
 
 				// Make a new micrograph
@@ -939,18 +1047,15 @@ void Experiment::read(FileName fn_exp, bool do_ignore_particle_name, bool do_ign
 					}
 
 					// If this group did not exist yet, add it to the experiment
-					group_id = -1;
-					for (long int i = groups.size() - 1; i >= 0; i--) // search backwards to find match faster
+					std::map<std::string, long int>::iterator it = group_ids.find(group_name);
+					if (it != group_ids.end())
 					{
-						if (groups[i].name == group_name)
-						{
-							group_id = groups[i].id;
-							break;
-						}
+						group_id = it->second;
 					}
-					if (group_id < 0)
+					else
 					{
 						group_id = addGroup(group_name, optics_group);
+						group_ids[group_name] = group_id;
 					}
 				}
 
@@ -977,22 +1082,12 @@ void Experiment::read(FileName fn_exp, bool do_ignore_particle_name, bool do_ign
 			std::string part_name;
 			long int part_id = -1;
 
-			if (MDimg.containsLabel(EMDL_PARTICLE_NAME))
-				MDimg.getValue(EMDL_PARTICLE_NAME, part_name, ori_img_id);
-			else
-				MDimg.getValue(EMDL_IMAGE_NAME, part_name, ori_img_id);
-
-			if (MDimg.containsLabel(EMDL_PARTICLE_NAME) && !do_ignore_particle_name)
+			if (do_use_particle_name)
 			{
-				// Only search ori_particles for the last (original) micrograph
-				for (long int i = last_part_id; i < particles.size(); i++)
-				{
-					if (particles[i].name == part_name)
-					{
-						part_id = i;
-						break;
-					}
-				}
+				MDimg.getValue(EMDL_PARTICLE_NAME, part_name, ori_img_id);
+				std::map<std::string, long int>::iterator it = part_ids_on_mic.find(part_name);
+				if (it != part_ids_on_mic.end())
+					part_id = it->second;
 			}
 
 			// If no particles with this name was found,
@@ -1000,7 +1095,9 @@ void Experiment::read(FileName fn_exp, bool do_ignore_particle_name, bool do_ign
 			// then add a new particle
 			if (part_id < 0)
 			{
-				part_id = addParticle(part_name, my_random_subset);
+				part_id = addParticle(my_random_subset);
+				if (do_use_particle_name)
+					part_ids_on_mic[part_name] = part_id;
 			}
 
 			// Create a new image in this particle
@@ -1014,35 +1111,13 @@ void Experiment::read(FileName fn_exp, bool do_ignore_particle_name, bool do_ign
 			prev_img_name = img_name;
 			prev_optics_group = optics_group;
 
-			int img_id = addImageToParticle(part_id, img_name, ori_img_id, group_id, mic_id, optics_group, do_cache);
+			addImageToParticle(part_id, ori_img_id, group_id, mic_id, optics_group, do_cache);
 
 			// The group number is only set upon reading: it is not read from the STAR file itself,
 			// there the only thing that matters is the order of the micrograph_names
 			// Write igroup+1, to start numbering at one instead of at zero
 			MDimg.setValue(EMDL_MLMODEL_GROUP_NO, group_id + 1, ori_img_id);
 
-#ifdef DEBUG_READ
-			timer.tic(tori);
-#endif
-
-			if (do_preread_images)
-			{
-				Image<float> img;
-				img_name.decompose(dump, fn_stack);
-				if (fn_stack != fn_open_stack)
-				{
-					hFile.openFile(fn_stack, WRITE_READONLY);
-					fn_open_stack = fn_stack;
-				}
-				img.readFromOpenFile(img_name, hFile, -1, false);
-				img().setXmippOrigin();
-				particles[part_id].images[img_id].img = img();
-			}
-
-#ifdef DEBUG_READ
-			timer.toc(tori);
-#endif
-
 #ifdef DEBUG_READ
 			nr_read++;
 #endif
@@ -1051,7 +1126,7 @@ void Experiment::read(FileName fn_exp, bool do_ignore_particle_name, bool do_ign
 #ifdef DEBUG_READ
 		timer.toc(tfill);
 		timer.tic(tdef);
-		std::cerr << " nr_read= " << nr_read << " particles.size()= " << particles.size() << " micrographs.size()= " << micrographs.size() << " groups.size()= " << groups.size() << std::endl;
+		std::cerr << " nr_read= " << nr_read << " numberOfParticles()= " << numberOfParticles() << " numberOfMicrographs()= " << numberOfMicrographs() << " numberOfGroups()= " << numberOfGroups() << std::endl;
 #endif
 
 		// Check for the presence of multiple bodies (for multi-body refinement)
@@ -1081,6 +1156,8 @@ void Experiment::read(FileName fn_exp, bool do_ignore_particle_name, bool do_ign
 	//std::cin >> c;
 #endif
 
+	groupImagesByParticle();
+
 	// Make sure some things are always set in the MDimg
 	bool have_rot  = MDimg.containsLabel(EMDL_ORIENT_ROT);
 	bool have_tilt = MDimg.containsLabel(EMDL_ORIENT_TILT);
@@ -1146,6 +1223,9 @@ void Experiment::read(FileName fn_exp, bool do_ignore_particle_name, bool do_ign
 	obsModel.opticsMdt.getValue(EMDL_IMAGE_DIMENSIONALITY, mydim, 0);
 	is_3D = (mydim == 3);
 
+	if (do_preread_images)
+		prereadImages();
+
 #ifdef DEBUG_READ
 	timer.toc(tdef);
 	std::cerr << "Done setting defaults MDimg" << std::endl;
@@ -34,196 +34,42 @@
 #define MAX_NR_MICROGRAPHS 2000
 #define MAX_NR_FRAMES_PER_MOVIE 100
 
-////////////// Hierarchical metadata model
+////////////// Flat metadata model
+//
+// All particles and their images are kept as arrays of ids. The images of
+// particle p are the ones with index part_image_start[p] ... part_image_start[p+1]-1
+// in the image_* arrays. Image and particle names are not copied: they are in MDimg.
 
-class ExpImage
-{
-public:
-	// Position of the image in the original input STAR file
-	long int id;
-
-	// To which particle does this image belong
-	long int particle_id;
-
-	// This is the Nth image in this optics_group, for writing to scratch disk: filenames
-	long int optics_group_id;
-
-	// Name of this image (by this name it will be recognised upon reading)
-	std::string name;
-
-	// ID of the micrograph that this image comes from
-	long int micrograph_id;
-
-	// ID of the group that this image comes from
-	long int group_id;
-
-	// The optics group for this image
-	int optics_group;
-
-	// Pre-read array of the image in RAM
-	MultidimArray<float> img;
-
-	// Empty Constructor
-	ExpImage() {}
-
-	// Destructor needed for work with vectors
-	~ExpImage() {}
-
-	// Copy constructor needed for work with vectors
-	ExpImage(ExpImage const& copy)
-	{
-		id = copy.id;
-		particle_id = copy.particle_id;
-		optics_group_id = copy.optics_group_id;
-		name = copy.name;
-		micrograph_id = copy.micrograph_id;
-		group_id = copy.group_id;
-		optics_group = copy.optics_group;
-		img = copy.img;
-
-	}
-
-	// Define assignment operator in terms of the copy constructor
-	ExpImage& operator=(ExpImage const& copy)
-	{
-		id = copy.id;
-		particle_id = copy.particle_id;
-		optics_group_id = copy.optics_group_id;
-		name = copy.name;
-		micrograph_id = copy.micrograph_id;
-		group_id = copy.group_id;
-		optics_group = copy.optics_group;
-		img = copy.img;
-		return *this;
-	}
-};
-
-class ExpParticle
-{
-public:
-
-	// Name of this particle (by this name all the images inside it will be grouped)
-	std::string name;
-
-	// Random subset this particle belongs to
-	int random_subset;
-
-	// Vector of all the images for this particle
-	std::vector<ExpImage> images;
-
-	// Empty Constructor
-	ExpParticle() {}
-
-	// Destructor needed for work with vectors
-	~ExpParticle() {}
-
-	// Copy constructor needed for work with vectors
-	ExpParticle(ExpParticle const& copy)
-	{
-		name = copy.name;
-		random_subset = copy.random_subset;
-		images = copy.images;
-	}
-
-	// Define assignment operator in terms of the copy constructor
-	ExpParticle& operator=(ExpParticle const& copy)
-	{
-		name = copy.name;
-		random_subset = copy.random_subset;
-		images = copy.images;
-		return *this;
-	}
-
-	int numberOfImages()
-	{
-		return images.size();
-	}
-};
-
-class ExpMicrograph
-{
-public:
-	// ID of this micrograph, i.e. which number in the MDmic am I?
-	long int id;
-
-	// Name of this micrograph (by this name it will be recognised upon reading)
-	std::string name;
-
-	// All the original images that were recorded on this micrograph
-	std::vector<long int> image_ids;
-
-	// Empty Constructor
-	ExpMicrograph() {}
-
-	// Destructor needed for work with vectors
-	~ExpMicrograph() {}
-
-	// Copy constructor needed for work with vectors
-	ExpMicrograph(ExpMicrograph const& copy)
-	{
-		id = copy.id;
-		name = copy.name;
-		image_ids = copy.image_ids;
-
-	}
-
-	// Define assignment operator in terms of the copy constructor
-	ExpMicrograph& operator=(ExpMicrograph const& copy)
-	{
-		id = copy.id;
-		name = copy.name;
-		image_ids = copy.image_ids;
-		return *this;
-	}
-};
-
-class ExpGroup
+class Experiment
 {
 public:
-	// ID of this group
-	long int id;
+	// Names of all groups and their optics groups
+	std::vector<std::string> group_names;
+	std::vector<int> group_optics_groups;
 
-	// The optics_group for this group
-	int optics_group;
-
-	// Name of this group (by this name it will be recognised upon reading)
-	std::string name;
-
-	// Empty Constructor
-	ExpGroup() {}
+	// Names of all micrographs
+	std::vector<std::string> micrograph_names;
 
-	// Destructor needed for work with vectors
-	~ExpGroup() {}
+	// Random subset of every particle
+	std::vector<signed char> particle_random_subset;
 
-	// Copy constructor needed for work with vectors
-	ExpGroup(ExpGroup const& copy)
-	{
-		id = copy.id;
-		optics_group = copy.optics_group;
-		name = copy.name;
-	}
+	// Index of the first image of every particle in the image_* arrays, plus one entry for the end
+	std::vector<long int> part_image_start;
 
-	// Define assignment operator in terms of the copy constructor
-	ExpGroup& operator=(ExpGroup const& copy)
-	{
-		id = copy.id;
-		optics_group = copy.optics_group;
-		name = copy.name;
-		return *this;
-	}
-};
+	// Position of every image in the original input STAR file, i.e. its row in MDimg
+	std::vector<long int> image_ori_id;
 
-class Experiment
-{
-public:
-	// All groups in the experiment
-	std::vector<ExpGroup> groups;
+	// Particle, micrograph, group and optics group of every image
+	std::vector<long int> image_particle_id;
+	std::vector<int> image_micrograph_id, image_group_id, image_optics_group;
 
-	// All micrographs in the experiment
-	std::vector<ExpMicrograph> micrographs;
+	// This is the Nth image in its optics_group, for writing to scratch disk: filenames
+	std::vector<long int> image_optics_group_id;
 
-	// All particles in the experiment
-	std::vector<ExpParticle> particles;
+	// Pre-read arrays of the images in RAM (empty unless they were pre-read)
+	// These may point into a block of memory that is shared with other processes, see prereadImages()
+	// (only the pixel data: each process has its own metadata)
+	std::vector<MultidimArray<float> > image_data;
 
 	// Indices of the sorted particles
 	std::vector<long int> sorted_idx;
@@ -274,11 +120,19 @@ public:
 
 	void clear()
 	{
-		groups.clear();
-		groups.reserve(MAX_NR_MICROGRAPHS);
-		micrographs.clear();
-		micrographs.reserve(MAX_NR_MICROGRAPHS);
-		particles.clear(); // reserve upon reading
+		group_names.clear();
+		group_optics_groups.clear();
+		micrograph_names.clear();
+		particle_random_subset.clear(); // reserve upon reading
+		part_image_start.assign(1, 0);
+		image_ori_id.clear();
+		image_particle_id.clear();
+		image_micrograph_id.clear();
+		image_group_id.clear();
+		image_optics_group.clear();
+		image_optics_group_id.clear();
+		image_data.clear();
+		nr_images_per_optics_group.clear();
 		sorted_idx.clear();
 		nr_particles_subset1 = nr_particles_subset2 = 0;
 		nr_bodies = 1;
@@ -296,7 +150,10 @@ public:
 	long int numberOfParticles(int random_subset = 0);
 
 	// Get the total number of images in a given particle
-	long int numberOfImagesInParticle(long int part_id);
+	long int numberOfImagesInParticle(long int part_id)
+	{
+		return part_image_start[part_id + 1] - part_image_start[part_id];
+	}
 
 	// Calculate the total number of micrographs in this experiment
 	long int numberOfMicrographs();
@@ -317,19 +174,52 @@ public:
 	int getOpticsImageSize(int optics_group);
 
 	// Get the random_subset for this particle
-	int getRandomSubset(long int part_id);
+	int getRandomSubset(long int part_id)
+	{
+		return particle_random_subset[part_id];
+	}
 
 	// Get the micrograph_id for the N'th image for this particle
-	long int getMicrographId(long int part_id, int img_id);
+	long int getMicrographId(long int part_id, int img_id)
+	{
+		return image_micrograph_id[part_image_start[part_id] + img_id];
+	}
 
 	// Get the group_id for the N'th image for this particle
-	long int getGroupId(long int part_id, int img_id);
+	long int getGroupId(long int part_id, int img_id)
+	{
+		return image_group_id[part_image_start[part_id] + img_id];
+	}
 
 	// Get the optics group to which the N'th image for this particle belongs
-	int getOpticsGroup(long int part_id, int img_id);
+	int getOpticsGroup(long int part_id, int img_id)
+	{
+		return image_optics_group[part_image_start[part_id] + img_id];
+	}
 
 	// Get the original position in the input STAR file for the N'th image for this particle
-	int getOriginalImageId(long int part_id, int img_id);
+	long int getOriginalImageId(long int part_id, int img_id)
+	{
+		return image_ori_id[part_image_start[part_id] + img_id];
+	}
+
+	// Get the name of the N'th image for this particle
+	FileName getImageName(long int part_id, int img_id);
+
+	// Get the name of this particle (the image name if there are no particle names)
+	FileName getParticleName(long int part_id);
+
+	// Get the name of a group
+	std::string getGroupName(long int group_id)
+	{
+		return group_names[group_id];
+	}
+
+	// Get the pre-read array of the N'th image for this particle
+	MultidimArray<float>& getPrereadImage(long int part_id, int img_id)
+	{
+		return image_data[part_image_start[part_id] + img_id];
+	}
 
 	// Get the pixel size for the N-th image of this particle
 	RFLOAT getImagePixelSize(long int part_id, int img_id);
@@ -341,11 +231,16 @@ public:
 	MetaDataTable getMetaDataImage(long int part_id, int img_id);
 
 	// Add a particle
-	long int addParticle(std::string part_name, int random_subset = 0);
+	long int addParticle(int random_subset = 0);
+
+	// Add an image to the given particle
+	// Images may be added to any particle in any order, but the per-particle accessors
+	// only work after groupImagesByParticle()
+	void addImageToParticle(long int part_id, long int ori_img_id, long int group_id, long int micrograph_id,
+	                        int optics_group, bool unique);
 
- 	// Add an image to the given particle
-	int addImageToParticle(long int part_id, std::string img_name, long int ori_img_id, long int group_id, long int micrograph_id,
-	                       int optics_group, bool unique);
+	// Put the images of every particle next to each other, keeping the order in which they were added
+	void groupImagesByParticle();
 
 	// Add a group
 	long int addGroup(std::string mic_name, int optics_group);
@@ -357,10 +252,9 @@ public:
 	void divideParticlesInRandomHalves(int seed, bool do_helical_refine = false);
 
 	// Randomise the order of the particles
-	void randomiseParticlesOrder(int seed, bool do_split_random_halves = false, bool do_subsets = false);
-
-	// Make sure the images inside each particle are in the right order
-	void orderImagesInParticles();
+	// If block_size > 0, randomise blocks of up to this many consecutive particles from the same micrograph,
+	// so that images from the same stack are still read one after the other
+	void randomiseParticlesOrder(int seed, bool do_split_random_halves = false, bool do_subsets = false, int block_size = 0);
 
 	// Add a given number of new bodies (for multi-body refinement) to the Experiment,
 	// by copying the relevant entries from MDimg into MDbodies
@@ -388,6 +282,14 @@ public:
 	// in that case, stop copying, and keep reading particles from where they were...
 	void copyParticlesToScratch(int verb, bool do_copy = true, bool also_do_ctf_image = false, RFLOAT free_scratch_Gb = 10);
 
+	// Number of floats needed to keep all pre-read images in a single block of memory
+	long int getPrereadImagesSize();
+
+	// Read all images into image_data
+	// If shared_data is given, image_data points into that block of getPrereadImagesSize() floats, which is owned by the caller.
+	// Then the images are only read from disc if do_read, e.g. on the one process that fills a shared memory segment.
+	void prereadImages(float *shared_data = NULL, bool do_read = true);
+
 	// Read from file
 	void read(
 		FileName fn_in,
@@ -401,22 +303,29 @@ public:
 
 private:
 
+	// Reserve room for this many particles and images
+	void reserve(long int nr_images);
+
+	// Randomise the order of sorted_idx[first] ... sorted_idx[last-1] in blocks of particles from the same micrograph
+	void randomiseParticlesInBlocks(long int first, long int last, int block_size);
+
 	struct compareOpticsGroupsParticles
 	{
-	    const std::vector<ExpParticle>& particles;
-	    compareOpticsGroupsParticles(const std::vector<ExpParticle>& particles) : particles(particles) { }
-	    bool operator()(const long int i, const long int j) { return particles[i].images[0].optics_group < particles[j].images[0].optics_group;}
+	    const Experiment& exp;
+	    compareOpticsGroupsParticles(const Experiment& exp) : exp(exp) { }
+	    bool operator()(const long int i, const long int j)
+	    {
+	        return exp.image_optics_group[exp.part_image_start[i]] < exp.image_optics_group[exp.part_image_start[j]];
+	    }
 	};
 
 	struct compareRandomSubsetParticles
 	{
-	    const std::vector<ExpParticle>& particles;
-	    compareRandomSubsetParticles(const std::vector<ExpParticle>& particles) : particles(particles) { }
-	    bool operator()(const long int i, const long int j) { return particles[i].random_subset < particles[j].random_subset;}
+	    const Experiment& exp;
+	    compareRandomSubsetParticles(const Experiment& exp) : exp(exp) { }
+	    bool operator()(const long int i, const long int j) { return exp.particle_random_subset[i] < exp.particle_random_subset[j];}
 	};
 
-
-
 };
 
 #endif /* METADATA_MODEL_H_ */
@@ -46,6 +46,8 @@
 #include "src/macros.h"
 #include "src/fftw.h"
 #include "src/args.h"
+#include "src/spectral_statistics.h"
+#include "src/fourier_shells.h"
 #include <string.h>
 #include <math.h>
 
@@ -70,7 +72,7 @@ static pthread_mutex_t fftw_plan_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 // Constructors and destructors --------------------------------------------
 FourierTransformer::FourierTransformer():
-		plans_are_set(false)
+		plans_are_set(false), nr_threads(1), plan_nr_threads(1)
 {
 	init();
 
@@ -155,6 +157,34 @@ void FourierTransformer::destroyPlans()
 
 }
 
+// Make the next plans use nr_threads threads
+// Anything to do with plans has to be protected for threads: the caller must hold fftw_plan_mutex
+static void setPlanThreads(int nr_threads)
+{
+#ifdef FFTW_THREADS
+	static bool threads_initialised = false;
+	if (!threads_initialised)
+	{
+#ifdef RELION_SINGLE_PRECISION
+		fftwf_init_threads();
+#else
+		fftw_init_threads();
+#endif
+		threads_initialised = true;
+	}
+#ifdef RELION_SINGLE_PRECISION
+	fftwf_plan_with_nthreads(nr_threads);
+#else
+	fftw_plan_with_nthreads(nr_threads);
+#endif
+#endif
+}
+
+void FourierTransformer::setThreadsNumber(int _nr_threads)
+{
+	nr_threads = XMIPP_MAX(1, _nr_threads);
+}
+
 // Initialization ----------------------------------------------------------
 const MultidimArray<RFLOAT> &FourierTransformer::getReal() const
 {
@@ -175,7 +205,8 @@ void FourierTransformer::setReal(MultidimArray<RFLOAT> &input, bool force_new_pl
 	    || (dataPtr != MULTIDIM_ARRAY(input))
 	    || (!fReal->sameShape(input))
 		|| (XSIZE(fFourier) != XSIZE(input)/2+1)
-	    || (complexDataPtr != MULTIDIM_ARRAY(fFourier)) )
+	    || (complexDataPtr != MULTIDIM_ARRAY(fFourier))
+	    || (plan_nr_threads != nr_threads) )
 	{
 		recomputePlan = true;
 	}
@@ -217,6 +248,8 @@ void FourierTransformer::setReal(MultidimArray<RFLOAT> &input, bool force_new_pl
 
 		RCTIC(TIMING_FFTW_PLAN);
 		pthread_mutex_lock(&fftw_plan_mutex);
+		setPlanThreads(nr_threads);
+		plan_nr_threads = nr_threads;
 #ifdef RELION_SINGLE_PRECISION
 		fPlanForward = fftwf_plan_dft_r2c(ndim, N, MULTIDIM_ARRAY(*fReal),
 		                                  (fftwf_complex*) MULTIDIM_ARRAY(fFourier), FFTW_ESTIMATE);
@@ -230,6 +263,8 @@ void FourierTransformer::setReal(MultidimArray<RFLOAT> &input, bool force_new_pl
 		                                  (fftw_complex*) MULTIDIM_ARRAY(fFourier), MULTIDIM_ARRAY(*fReal),
 		                                  FFTW_ESTIMATE);
 #endif
+		// FFTW's thread count is global: do not leave it set for plans made elsewhere (NewFFT, ParFourierTransformer)
+		setPlanThreads(1);
 		pthread_mutex_unlock(&fftw_plan_mutex);
 		RCTOC(TIMING_FFTW_PLAN);
 
@@ -254,6 +289,8 @@ void FourierTransformer::setReal(MultidimArray<Complex > &input, bool force_new_
 		recomputePlan=true;
 	else if (complexDataPtr!=MULTIDIM_ARRAY(input))
 		recomputePlan=true;
+	else if (plan_nr_threads != nr_threads)
+		recomputePlan=true;
 	else
 		recomputePlan=!(fComplex->sameShape(input));
 
@@ -293,6 +330,8 @@ void FourierTransformer::setReal(MultidimArray<Complex > &input, bool force_new_
 
 		RCTIC(TIMING_FFTW_PLAN);
 		pthread_mutex_lock(&fftw_plan_mutex);
+		setPlanThreads(nr_threads);
+		plan_nr_threads = nr_threads;
 #ifdef RELION_SINGLE_PRECISION
 		fPlanForward = fftwf_plan_dft(ndim, N, (fftwf_complex*) MULTIDIM_ARRAY(*fComplex),
 		                              (fftwf_complex*) MULTIDIM_ARRAY(fFourier), FFTW_FORWARD, FFTW_ESTIMATE);
@@ -304,6 +343,8 @@ void FourierTransformer::setReal(MultidimArray<Complex > &input, bool force_new_
 		fPlanBackward = fftw_plan_dft(ndim, N, (fftw_complex*) MULTIDIM_ARRAY(fFourier),
 		                              (fftw_complex*) MULTIDIM_ARRAY(*fComplex), FFTW_BACKWARD, FFTW_ESTIMATE);
 #endif
+		// FFTW's thread count is global: do not leave it set for plans made elsewhere (NewFFT, ParFourierTransformer)
+		setPlanThreads(1);
 		pthread_mutex_unlock(&fftw_plan_mutex);
 		RCTOC(TIMING_FFTW_PLAN);
 
@@ -481,140 +522,58 @@ void randomizePhasesBeyond(MultidimArray<Complex> &v, int index)
 // from precalculated Fourier Transforms, and without sampling rate etc.
 void getFSC(MultidimArray< Complex > &FT1,
 			MultidimArray< Complex > &FT2,
-			MultidimArray< RFLOAT > &fsc)
+			MultidimArray< RFLOAT > &fsc,
+			int nr_threads)
 {
 	if (!FT1.sameShape(FT2))
 		REPORT_ERROR("fourierShellCorrelation ERROR: MultidimArrays have different shapes!");
 
-	MultidimArray<RFLOAT> num(XSIZE(FT1)), den1(XSIZE(FT1)), den2(XSIZE(FT1));
-	Matrix1D<RFLOAT> f(3);
-	num.initZeros();
-	den1.initZeros();
-	den2.initZeros();
-	fsc.initZeros(num);
-	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT1)
-	{
-		int idx = ROUND(sqrt(kp*kp + ip*ip + jp*jp));
-		if (idx >= XSIZE(FT1))
-			continue;
-		Complex z1=DIRECT_A3D_ELEM(FT1, k, i, j);
-		Complex z2=DIRECT_A3D_ELEM(FT2, k, i, j);
-		RFLOAT absz1=abs(z1);
-		RFLOAT absz2=abs(z2);
-		num(idx)+= (conj(z1) * z2).real;
-		den1(idx)+= absz1*absz1;
-		den2(idx)+= absz2*absz2;
-	}
-
-	FOR_ALL_ELEMENTS_IN_ARRAY1D(fsc)
-	{
-		fsc(i) = num(i)/sqrt(den1(i)*den2(i));
-	}
-
+	SpectralStatistics stats;
+	stats.compute(FT1, FT2, 0, nr_threads);
+	stats.getFSC(fsc);
 }
 
 
 void getFSC(MultidimArray< RFLOAT > &m1,
 			MultidimArray< RFLOAT > &m2,
-			MultidimArray< RFLOAT > &fsc)
+			MultidimArray< RFLOAT > &fsc,
+			int nr_threads)
 {
-	MultidimArray< Complex > FT1, FT2;
-	FourierTransformer transformer;
-	transformer.FourierTransform(m1, FT1);
-	transformer.FourierTransform(m2, FT2);
-	getFSC(FT1, FT2, fsc);
+	SpectralStatistics stats;
+	stats.compute(m1, m2, 0, nr_threads);
+	stats.getFSC(fsc);
 }
 
 void getAmplitudeCorrelationAndDifferentialPhaseResidual(MultidimArray< Complex > &FT1,
 			MultidimArray< Complex > &FT2,
 			MultidimArray< RFLOAT > &acorr,
-			MultidimArray< RFLOAT > &dpr)
+			MultidimArray< RFLOAT > &dpr,
+			int nr_threads)
 {
-
-	MultidimArray< int > radial_count(XSIZE(FT1));
-	MultidimArray<RFLOAT> num, mu1, mu2, sig1, sig2;
-	Matrix1D<RFLOAT> f(3);
-	mu1.initZeros(radial_count);
-	mu2.initZeros(radial_count);
-	sig1.initZeros(radial_count);
-	sig2.initZeros(radial_count);
-	acorr.initZeros(radial_count);
-	dpr.initZeros(radial_count);
-	num.initZeros(radial_count);
-	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT1)
-	{
-		// Amplitudes
-		int idx = ROUND(sqrt(kp*kp + ip*ip + jp*jp));
-		if (idx >= XSIZE(FT1))
-			continue;
-		RFLOAT abs1 = abs(DIRECT_A3D_ELEM(FT1, k, i, j));
-		RFLOAT abs2 = abs(DIRECT_A3D_ELEM(FT2, k, i, j));
-		mu1(idx)+= abs1;
-		mu2(idx)+= abs2;
-		radial_count(idx)++;
-
-		//phases
-		RFLOAT phas1 = RAD2DEG(atan2((DIRECT_A3D_ELEM(FT1, k, i, j)).imag, (DIRECT_A3D_ELEM(FT1, k, i, j)).real));
-		RFLOAT phas2 = RAD2DEG(atan2((DIRECT_A3D_ELEM(FT2, k, i, j)).imag, (DIRECT_A3D_ELEM(FT2, k, i, j)).real));
-		RFLOAT delta_phas = phas1 - phas2;
-		if (delta_phas > 180.)
-			delta_phas -= 360.;
-		else if (delta_phas < -180.)
-			delta_phas += 360.;
-		dpr(idx) += delta_phas*delta_phas*(abs1+abs2);
-		num(idx) += (abs1+abs2);
-	}
-
-	// Get average amplitudes in each shell for both maps
-	FOR_ALL_ELEMENTS_IN_ARRAY1D(mu1)
-	{
-		if (radial_count(i) > 0)
-		{
-			mu1(i) /= radial_count(i);
-			mu2(i) /= radial_count(i);
-			dpr(i) = sqrt(dpr(i)/num(i));
-		}
-	}
-
-	// Now calculate Pearson's correlation coefficient
-	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT1)
-	{
-		int idx = ROUND(sqrt(kp*kp + ip*ip + jp*jp));
-		if (idx >= XSIZE(FT1))
-			continue;
-		RFLOAT z1=abs(DIRECT_A3D_ELEM(FT1, k, i, j)) - mu1(idx);
-		RFLOAT z2=abs(DIRECT_A3D_ELEM(FT2, k, i, j)) - mu2(idx);
-		acorr(idx)	+= z1*z2;
-		sig1(idx) += z1*z1;
-		sig2(idx) += z2*z2;
-	}
-
-	FOR_ALL_ELEMENTS_IN_ARRAY1D(acorr)
-	{
-		RFLOAT aux = sqrt(sig1(i))*sqrt(sig2(i));
-		if (aux > 0.)
-			acorr(i) /= sqrt(sig1(i))*sqrt(sig2(i));
-		else
-			acorr(i) = 1.;
-	}
-
+	SpectralStatistics stats;
+	stats.compute(FT1, FT2, SPECTRAL_AMPLITUDES | SPECTRAL_PHASE_RESIDUAL, nr_threads);
+	stats.getAmplitudeCorrelation(acorr);
+	stats.getDifferentialPhaseResidual(dpr);
 }
 
 void getCosDeltaPhase(MultidimArray< Complex > &FT1,
 					  MultidimArray< Complex > &FT2,
 					  MultidimArray< RFLOAT > &cosPhi)
 {
-	MultidimArray< int > radial_count(XSIZE(FT1));
+	MultidimArray< int > radial_count;
+	radial_count.initZeros(XSIZE(FT1));
 	cosPhi.initZeros(XSIZE(FT1));
 
-	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT1)
+	FourierShells::Ptr shells_ptr = FourierShells::get(FT1);
+	const FourierShells &shells = *shells_ptr;
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(FT1)
 	{
-		int idx = ROUND(sqrt(kp*kp + ip*ip + jp*jp));
+		int idx = shells.shell[n];
 		if (idx >= XSIZE(FT1))
 			continue;
 
-		RFLOAT phas1 = RAD2DEG(atan2((DIRECT_A3D_ELEM(FT1, k, i, j)).imag, (DIRECT_A3D_ELEM(FT1, k, i, j)).real));
-		RFLOAT phas2 = RAD2DEG(atan2((DIRECT_A3D_ELEM(FT2, k, i, j)).imag, (DIRECT_A3D_ELEM(FT2, k, i, j)).real));
+		RFLOAT phas1 = RAD2DEG(atan2(FT1.data[n].imag, FT1.data[n].real));
+		RFLOAT phas2 = RAD2DEG(atan2(FT2.data[n].imag, FT2.data[n].real));
 		cosPhi(idx) += cos(phas1 - phas2);
 		radial_count(idx) ++;
 	}
@@ -629,13 +588,13 @@ void getCosDeltaPhase(MultidimArray< Complex > &FT1,
 void getAmplitudeCorrelationAndDifferentialPhaseResidual(MultidimArray< RFLOAT > &m1,
 			MultidimArray< RFLOAT > &m2,
 			MultidimArray< RFLOAT > &acorr,
-			MultidimArray< RFLOAT > &dpr)
+			MultidimArray< RFLOAT > &dpr,
+			int nr_threads)
 {
-	MultidimArray< Complex > FT1, FT2;
-	FourierTransformer transformer;
-	transformer.FourierTransform(m1, FT1);
-	transformer.FourierTransform(m2, FT2);
-	getAmplitudeCorrelationAndDifferentialPhaseResidual(FT1, FT2, acorr, dpr);
+	SpectralStatistics stats;
+	stats.compute(m1, m2, SPECTRAL_AMPLITUDES | SPECTRAL_PHASE_RESIDUAL, nr_threads);
+	stats.getAmplitudeCorrelation(acorr);
+	stats.getDifferentialPhaseResidual(dpr);
 }
 
 
@@ -960,33 +919,13 @@ void shiftImageInFourierTransform(MultidimArray<Complex > &in,
 
 void getSpectrum(MultidimArray<RFLOAT> &Min,
 				 MultidimArray<RFLOAT> &spectrum,
-				 int spectrum_type)
+				 int spectrum_type,
+				 int nr_threads)
 {
-
-	MultidimArray<Complex > Faux;
-	int xsize = XSIZE(Min);
-	// Takanori: The above line should be XSIZE(Min) / 2 + 1 but for compatibility reasons, I keep this as it is.
-	Matrix1D<RFLOAT> f(3);
-	MultidimArray<RFLOAT> count(xsize);
-	FourierTransformer transformer;
-
-	spectrum.initZeros(xsize);
-	count.initZeros();
-	transformer.FourierTransform(Min, Faux, false);
-	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Faux)
-	{
-		long int idx = ROUND(sqrt(kp*kp + ip*ip + jp*jp));
-		if (spectrum_type == AMPLITUDE_SPECTRUM)
-			spectrum(idx) += abs(dAkij(Faux, k, i, j));
-		else
-			spectrum(idx) += norm(dAkij(Faux, k, i, j));
-		count(idx) += 1.;
-	}
-
-	for (long int i = 0; i < xsize; i++)
-		if (count(i) > 0.)
-			spectrum(i) /= count(i);
-
+	// Takanori: The spectrum size should be XSIZE(Min) / 2 + 1 but for compatibility reasons, I keep this as XSIZE(Min).
+	SpectralStatistics stats;
+	stats.compute(Min, (spectrum_type == AMPLITUDE_SPECTRUM) ? SPECTRAL_AMPLITUDES : 0, nr_threads);
+	stats.getSpectrum(spectrum, XSIZE(Min), spectrum_type);
 }
 
 void divideBySpectrum(MultidimArray<RFLOAT> &Min,
@@ -1019,10 +958,11 @@ void multiplyBySpectrum(MultidimArray<RFLOAT> &Min,
 	lspectrum=spectrum;
 	if (leave_origin_intact)
 		lspectrum(0)=1.;
-	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Faux)
+	FourierShells::Ptr shells_ptr = FourierShells::get(Faux);
+	const FourierShells &shells = *shells_ptr;
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
 	{
-		long int idx = ROUND(sqrt(kp*kp + ip*ip + jp*jp));
-		dAkij(Faux, k, i, j) *=  lspectrum(idx);// * dim3;
+		Faux.data[n] *= lspectrum(shells.shell[n]);// * dim3;
 	}
 	transformer.inverseFourierTransform();
 
@@ -1088,14 +1028,16 @@ RFLOAT getKullbackLeiblerDivergence(MultidimArray<Complex > &Fimg,
 	histogram.initZeros(histogram_size);
 
 	// This way this will work in both 2D and 3D
-	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Fimg)
+	FourierShells::Ptr shells_ptr = FourierShells::get(Fimg);
+	const FourierShells &shells = *shells_ptr;
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fimg)
 	{
-		int ires = ROUND(sqrt(kp*kp + ip*ip + jp*jp));
+		int ires = shells.shell[n];
 		if (ires >= lowshell && ires <= highshell)
 		{
 			// Use FT of masked image for noise estimation!
-			RFLOAT diff_real = (DIRECT_A3D_ELEM(Fref, k, i, j)).real - (DIRECT_A3D_ELEM(Fimg, k, i, j)).real;
-			RFLOAT diff_imag = (DIRECT_A3D_ELEM(Fref, k, i, j)).imag - (DIRECT_A3D_ELEM(Fimg, k, i, j)).imag;
+			RFLOAT diff_real = Fref.data[n].real - Fimg.data[n].real;
+			RFLOAT diff_imag = Fref.data[n].imag - Fimg.data[n].imag;
 			RFLOAT sigma = sqrt(DIRECT_A1D_ELEM(sigma2, ires));
 
 			// Divide by standard deviation to normalise all the difference
@@ -1171,13 +1113,16 @@ void resizeMap(MultidimArray<RFLOAT > &img, int newsize)
 
 void applyBFactorToMap(MultidimArray<Complex > &FT, int ori_size, RFLOAT bfactor, RFLOAT angpix)
 {
+	// Only the squared resolution is needed, so skip the sqrt
+	const RFLOAT res2_per_r2 = 1. / ((RFLOAT)ori_size * angpix * ori_size * angpix);
+	const long int nyquist_r2 = ((long int)ori_size * ori_size) / 4;
 	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT)
 	{
-		int r2 = kp * kp + ip * ip + jp * jp;
-		RFLOAT res = sqrt((RFLOAT)r2)/(ori_size * angpix); // get resolution in 1/Angstrom
-		if (res <= 1. / (angpix * 2.) ) // Apply B-factor sharpening until Nyquist, then low-pass filter later on (with a soft edge)
+		long int r2 = kp * kp + ip * ip + jp * jp;
+		if (r2 <= nyquist_r2) // Apply B-factor sharpening until Nyquist, then low-pass filter later on (with a soft edge)
 		{
-			DIRECT_A3D_ELEM(FT, k, i, j) *= exp( -(bfactor / 4.)  * res * res);
+			RFLOAT res2 = r2 * res2_per_r2; // squared resolution in 1/Angstrom
+			DIRECT_A3D_ELEM(FT, k, i, j) *= exp( -(bfactor / 4.)  * res2);
 		}
 		else
 		{
@@ -1293,29 +1238,39 @@ void lowPassFilterMap(MultidimArray<Complex > &FT, int ori_size,
 	RFLOAT edge_high = XMIPP_MIN(XSIZE(FT), (ires_filter + filter_edge_halfwidth) / (RFLOAT)ori_size); // in 1/pix
 	RFLOAT edge_width = edge_high - edge_low;
 
+	// Compare squared radii, so that only the voxels on the soft edge need a sqrt
+	// (the raised cosine is 1 or 0 at both ends of the edge anyway)
+	RFLOAT edge_low_r2 = (edge_low * ori_size) * (edge_low * ori_size);
+	RFLOAT edge_high_r2 = (edge_high * ori_size) * (edge_high * ori_size);
+
 	// Put a raised cosine from edge_low to edge_high
 	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT)
 	{
 		RFLOAT r2 = (RFLOAT)kp * (RFLOAT)kp + (RFLOAT)ip * (RFLOAT)ip + (RFLOAT)jp * (RFLOAT)jp;
-		RFLOAT res = sqrt((RFLOAT)r2)/ori_size; // get resolution in 1/pixel
 
 		if (do_highpass_instead)
 		{
-			if (res < edge_low)
+			if (r2 < edge_low_r2)
 				DIRECT_A3D_ELEM(FT, k, i, j) = 0.;
-			else if (res > edge_high)
+			else if (r2 > edge_high_r2)
 				continue;
 			else
+			{
+				RFLOAT res = sqrt(r2)/ori_size; // get resolution in 1/pixel
 				DIRECT_A3D_ELEM(FT, k, i, j) *= 0.5 - 0.5 * cos( PI * (res-edge_low)/edge_width);
+			}
 		}
 		else
 		{
-			if (res < edge_low)
+			if (r2 < edge_low_r2)
 				continue;
-			else if (res > edge_high)
+			else if (r2 > edge_high_r2)
 				DIRECT_A3D_ELEM(FT, k, i, j) = 0.;
 			else
+			{
+				RFLOAT res = sqrt(r2)/ori_size; // get resolution in 1/pixel
 				DIRECT_A3D_ELEM(FT, k, i, j) *= 0.5 + 0.5 * cos( PI * (res-edge_low)/edge_width);
+			}
 		}
 	}
 
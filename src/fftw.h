@@ -170,6 +170,12 @@ public:
 
 	bool plans_are_set;
 
+	/* Number of threads for the FFTW plans (only used if compiled with FFTW_THREADS) */
+	int nr_threads;
+
+	/* Number of threads the current plans were made with */
+	int plan_nr_threads;
+
 // Public methods
 public:
 	/** Default constructor */
@@ -186,6 +192,11 @@ public:
 	 */
 	FourierTransformer(const FourierTransformer& op);
 
+	/** Use multiple threads for each transform.
+	    This requires FFTW to be compiled with threads (FFTW_THREADS), otherwise it is ignored.
+	    New plans are made at the next setReal. */
+	void setThreadsNumber(int _nr_threads);
+
 	/** Compute the Fourier transform of a MultidimArray, 2D and 3D.
 	    If getCopy is false, an alias to the transformed data is returned.
 	    This is a faster option since a copy of all the data is avoided,
@@ -886,7 +897,8 @@ void resizeFourierTransform(MultidimArray<T > &in, MultidimArray<T > &out, long
  */
 void getFSC(MultidimArray<Complex> &FT1,
             MultidimArray<Complex> &FT2,
-            MultidimArray<RFLOAT> &fsc);
+            MultidimArray<RFLOAT> &fsc,
+            int nr_threads = 1);
 
 /** Fourier-Ring-Correlation between two multidimArrays using FFT
  * @ingroup FourierOperations
@@ -894,13 +906,16 @@ void getFSC(MultidimArray<Complex> &FT1,
  */
 void getFSC(MultidimArray<RFLOAT> & m1,
             MultidimArray<RFLOAT> & m2,
-            MultidimArray<RFLOAT> &fsc);
+            MultidimArray<RFLOAT> &fsc,
+            int nr_threads = 1);
 
 void getAmplitudeCorrelationAndDifferentialPhaseResidual(MultidimArray<Complex> &FT1, MultidimArray<Complex> &FT2,
-                                                         MultidimArray<RFLOAT> &acorr, MultidimArray<RFLOAT> &dpr);
+                                                         MultidimArray<RFLOAT> &acorr, MultidimArray<RFLOAT> &dpr,
+                                                         int nr_threads = 1);
 
 void getAmplitudeCorrelationAndDifferentialPhaseResidual(MultidimArray<RFLOAT> &m1, MultidimArray<RFLOAT> &m2,
-                                                         MultidimArray<RFLOAT> &acorr, MultidimArray<RFLOAT> &dpr);
+                                                         MultidimArray<RFLOAT> &acorr, MultidimArray<RFLOAT> &dpr,
+                                                         int nr_threads = 1);
 
 void getCosDeltaPhase(MultidimArray<Complex> &FT1,
  MultidimArray<Complex> &FT2,
@@ -933,7 +948,8 @@ void shiftImageInFourierTransform(MultidimArray<Complex> &in, MultidimArray<Comp
 */
 void getSpectrum(MultidimArray<RFLOAT> &Min,
                  MultidimArray<RFLOAT> &spectrum,
-                 int spectrum_type=POWER_SPECTRUM);
+                 int spectrum_type=POWER_SPECTRUM,
+                 int nr_threads = 1);
 
 /** Divide the input map in Fourier-space by the spectrum provided.
  *  @ingroup FourierOperations
@@ -0,0 +1,224 @@
+/***************************************************************************
+ *
+ * Author: "Sjors H.W. Scheres"
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <map>
+#include <limits>
+#include "src/fourier_shells.h"
+#include "src/fftw.h"
+#include "src/parallel.h"
+
+namespace
+{
+	struct ShellKey
+	{
+		long int x, y, z;
+		RFLOAT padding;
+
+		bool operator < (const ShellKey &other) const
+		{
+			if (z != other.z) return z < other.z;
+			if (y != other.y) return y < other.y;
+			if (x != other.x) return x < other.x;
+			return padding < other.padding;
+		}
+	};
+
+	template <class T>
+	struct Cached
+	{
+		std::shared_ptr<T> shells;
+		long int last_used;
+	};
+
+	typedef std::pair<long int, RFLOAT> SquaredRadiusKey;
+
+	pthread_mutex_t shell_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+	std::map<ShellKey, Cached<FourierShells> > shell_cache;
+	std::map<SquaredRadiusKey, Cached<SquaredRadiusShells> > r2_cache;
+	long int shell_cache_clock = 0;
+
+	// Drop the least recently used entries until the cache fits in max_bytes.
+	// Caller must hold shell_cache_mutex
+	template <class Key, class T>
+	void evictLeastRecentlyUsed(std::map<Key, Cached<T> > &cache, size_t max_bytes)
+	{
+		size_t total = 0;
+		for (typename std::map<Key, Cached<T> >::iterator it = cache.begin(); it != cache.end(); it++)
+			total += it->second.shells->bytes();
+
+		while (total > max_bytes)
+		{
+			typename std::map<Key, Cached<T> >::iterator oldest = cache.begin();
+			for (typename std::map<Key, Cached<T> >::iterator it = cache.begin(); it != cache.end(); it++)
+				if (it->second.last_used < oldest->second.last_used)
+					oldest = it;
+
+			total -= oldest->second.shells->bytes();
+			cache.erase(oldest);
+		}
+	}
+
+	// Caller must hold shell_cache_mutex
+	SquaredRadiusShells::Ptr getSquaredRadiusShells(long int max_r2, RFLOAT padding)
+	{
+		SquaredRadiusKey key(max_r2, padding);
+		std::map<SquaredRadiusKey, Cached<SquaredRadiusShells> >::iterator it = r2_cache.find(key);
+		if (it != r2_cache.end())
+		{
+			it->second.last_used = ++shell_cache_clock;
+			return it->second.shells;
+		}
+
+		std::shared_ptr<SquaredRadiusShells> shells(new SquaredRadiusShells());
+		shells->max_r2 = max_r2;
+		shells->padding = padding;
+		shells->shell.resize(max_r2 + 1);
+		for (long int r2 = 0; r2 <= max_r2; r2++)
+		{
+			long int idx = ROUND(sqrt((RFLOAT)r2) / padding);
+			if (idx > std::numeric_limits<FourierShells::Index>::max())
+				REPORT_ERROR("SquaredRadiusShells::get ERROR: radius is too large for the shell index type.");
+			shells->shell[r2] = idx;
+		}
+
+		Cached<SquaredRadiusShells> &cached = r2_cache[key];
+		cached.shells = shells;
+		cached.last_used = ++shell_cache_clock;
+		evictLeastRecentlyUsed(r2_cache, SQUARED_RADIUS_SHELLS_CACHE_SIZE);
+
+		return shells;
+	}
+}
+
+FourierShells::Ptr FourierShells::get(long int xdim, long int ydim, long int zdim,
+                                      RFLOAT padding, bool group_by_shell)
+{
+	Lock lock(&shell_cache_mutex);
+
+	ShellKey key;
+	key.x = xdim;
+	key.y = ydim;
+	key.z = zdim;
+	key.padding = padding;
+
+	std::shared_ptr<FourierShells> shells;
+	std::map<ShellKey, Cached<FourierShells> >::iterator it = shell_cache.find(key);
+	if (it != shell_cache.end())
+	{
+		shells = it->second.shells;
+		it->second.last_used = ++shell_cache_clock;
+	}
+	else
+	{
+		shells.reset(new FourierShells());
+		shells->initialise(xdim, ydim, zdim, padding);
+		Cached<FourierShells> &cached = shell_cache[key];
+		cached.shells = shells;
+		cached.last_used = ++shell_cache_clock;
+	}
+
+	// Only the lists are added to an existing map, so other threads may keep reading shell
+	if (group_by_shell && shells->shell_start.size() == 0)
+		shells->groupByShell();
+
+	evictLeastRecentlyUsed(shell_cache, FOURIER_SHELLS_CACHE_SIZE);
+
+	return shells;
+}
+
+void FourierShells::clearCache()
+{
+	Lock lock(&shell_cache_mutex);
+
+	shell_cache.clear();
+	r2_cache.clear();
+}
+
+size_t FourierShells::bytes() const
+{
+	return shell.size() * sizeof(Index) + voxel.size() * sizeof(unsigned int)
+	       + shell_start.size() * sizeof(long int);
+}
+
+void FourierShells::initialise(long int _xdim, long int _ydim, long int _zdim, RFLOAT _padding)
+{
+	xdim = _xdim;
+	ydim = _ydim;
+	zdim = _zdim;
+	padding = _padding;
+
+	// Only used to loop over, no data are allocated
+	MultidimArray<Complex> FT;
+	FT.setDimensions(xdim, ydim, zdim, 1);
+
+	// Look up the rounded radii for the largest r2 in this transform
+	long int max_r2 = 0;
+	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT)
+	{
+		if (kp*kp + ip*ip + jp*jp > max_r2)
+			max_r2 = kp*kp + ip*ip + jp*jp;
+	}
+	SquaredRadiusShells::Ptr r2shells_ptr = getSquaredRadiusShells(max_r2, padding);
+	const SquaredRadiusShells &r2shells = *r2shells_ptr;
+
+	shell.resize(xdim * ydim * zdim);
+
+	long int max_idx = 0;
+	long int n = 0;
+	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT)
+	{
+		int idx = r2shells[kp*kp + ip*ip + jp*jp];
+		shell[n++] = idx;
+		if (idx > max_idx)
+			max_idx = idx;
+	}
+
+	nr_shells = max_idx + 1;
+}
+
+void FourierShells::groupByShell()
+{
+	if (shell.size() > std::numeric_limits<unsigned int>::max())
+		REPORT_ERROR("FourierShells::groupByShell ERROR: transform is too large to group its voxels by shell.");
+
+	// Counting sort of the voxels by shell
+	shell_start.assign(nr_shells + 1, 0);
+	for (long int n = 0; n < shell.size(); n++)
+		shell_start[shell[n] + 1]++;
+	for (int s = 0; s < nr_shells; s++)
+		shell_start[s + 1] += shell_start[s];
+
+	std::vector<long int> pos(shell_start.begin(), shell_start.end() - 1);
+	voxel.resize(shell.size());
+	for (long int n = 0; n < shell.size(); n++)
+		voxel[pos[shell[n]]++] = n;
+}
+
+SquaredRadiusShells::Ptr SquaredRadiusShells::get(long int max_r2, RFLOAT padding)
+{
+	Lock lock(&shell_cache_mutex);
+
+	return getSquaredRadiusShells(max_r2, padding);
+}
+
+size_t SquaredRadiusShells::bytes() const
+{
+	return shell.size() * sizeof(FourierShells::Index);
+}
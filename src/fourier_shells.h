@@ -0,0 +1,182 @@
+/***************************************************************************
+ *
+ * Author: "Sjors H.W. Scheres"
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef FOURIER_SHELLS_H_
+#define FOURIER_SHELLS_H_
+
+#include <vector>
+#include <memory>
+#include "src/multidim_array.h"
+
+/** Shell indices of a Fourier transform in FFTW format.
+ *
+ * For every voxel of a (half-complex) transform of the given size, shell[n]
+ * holds ROUND(sqrt(kp*kp + ip*ip + jp*jp) / padding), with n the direct (k,i,j)
+ * index and kp, ip and jp as in FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM. The maps
+ * are calculated once per size and padding factor and kept in a process-wide
+ * cache, so that loops over Fourier space can look the shell up instead of
+ * paying for a sqrt and a rounding on every voxel. The cache only keeps the
+ * most recently used maps, up to FOURIER_SHELLS_CACHE_SIZE bytes: a map for a
+ * large 3D box is dropped as soon as nobody uses it any more.
+ *
+ * Hold on to the returned pointer while using the map; get it outside of
+ * per-image or per-voxel loops, since every call takes a lock.
+ *
+ * @code
+ * FourierShells::Ptr shells_ptr = FourierShells::get(FT);
+ * const FourierShells &shells = *shells_ptr;
+ * FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(FT)
+ * {
+ *     int idx = shells.shell[n];
+ *     ...
+ * }
+ * @endcode
+ *
+ * When asked for, the voxels are also grouped by shell, to walk over one
+ * shell at a time:
+ *
+ * @code
+ * FourierShells::Ptr shells_ptr = FourierShells::get(FT, 1., true);
+ * const FourierShells &shells = *shells_ptr;
+ * for (int s = 0; s < shells.nr_shells; s++)
+ *     FOR_ALL_VOXELS_IN_FOURIER_SHELL(shells, s)
+ *         sum(s) += norm(FT.data[n]);
+ * @endcode
+ */
+// Bytes of shell maps kept in the FourierShells and SquaredRadiusShells caches
+#define FOURIER_SHELLS_CACHE_SIZE (128 * 1024 * 1024)
+#define SQUARED_RADIUS_SHELLS_CACHE_SIZE (16 * 1024 * 1024)
+
+class FourierShells
+{
+public:
+	typedef unsigned short Index;
+	typedef std::shared_ptr<const FourierShells> Ptr;
+
+	// Size of the Fourier transform
+	long int xdim, ydim, zdim;
+
+	// Radii are divided by this before rounding
+	RFLOAT padding;
+
+	// Number of shells, i.e. the largest shell index plus one
+	int nr_shells;
+
+	// Shell index for every voxel
+	std::vector<Index> shell;
+
+	// Direct indices of all voxels, sorted by shell (only when grouped)
+	std::vector<unsigned int> voxel;
+
+	// Voxels of shell s are voxel[shell_start[s]] ... voxel[shell_start[s+1] - 1] (only when grouped)
+	std::vector<long int> shell_start;
+
+	/** Shell of voxel (k, i, j), in direct indices */
+	inline int operator()(long int k, long int i, long int j) const
+	{
+		return shell[(k * ydim + i) * xdim + j];
+	}
+
+	/** Get the (cached) shells of a transform of size zdim x ydim x xdim
+	 *
+	 * This is thread-safe. The map stays valid for as long as the returned pointer
+	 * is held, also when it is evicted from the cache in the meantime.
+	 * If group_by_shell, voxel and shell_start are filled as well.
+	 */
+	static Ptr get(long int xdim, long int ydim, long int zdim = 1,
+	               RFLOAT padding = 1., bool group_by_shell = false);
+
+	template <typename T>
+	static Ptr get(const MultidimArray<T> &FT, RFLOAT padding = 1., bool group_by_shell = false)
+	{
+		return get(XSIZE(FT), YSIZE(FT), ZSIZE(FT), padding, group_by_shell);
+	}
+
+	/** Free all cached maps (including the SquaredRadiusShells tables)
+	 *
+	 * Maps that are still held by a caller are freed when it lets go of them.
+	 */
+	static void clearCache();
+
+	/** Memory used by this map, in bytes */
+	size_t bytes() const;
+
+private:
+
+	void initialise(long int _xdim, long int _ydim, long int _zdim, RFLOAT _padding);
+	void groupByShell();
+};
+
+/** Loop over the direct indices n of all voxels in shell s.
+ * The shells must have been obtained with group_by_shell.
+ */
+#define FOR_ALL_VOXELS_IN_FOURIER_SHELL(shells, s) \
+	for (long int m = (shells).shell_start[s], n = 0; \
+	     m < (shells).shell_start[(s) + 1] && ((n = (shells).voxel[m]), true); m++)
+
+/** Shell index as a function of the squared radius.
+ *
+ * shell[r2] holds ROUND(sqrt(r2) / padding) for all integer r2 <= max_r2.
+ * This serves loops that already calculate r2 = k*k + i*i + j*j, for example
+ * over the centred (and padded) arrays of the Projector and BackProjector,
+ * at the cost of a table that is much smaller than the arrays themselves.
+ * Tables are cached like FourierShells maps, up to SQUARED_RADIUS_SHELLS_CACHE_SIZE bytes.
+ *
+ * @code
+ * SquaredRadiusShells::Ptr shells_ptr = SquaredRadiusShells::get(max_r2, padding_factor);
+ * const SquaredRadiusShells &shells = *shells_ptr;
+ * FOR_ALL_ELEMENTS_IN_ARRAY3D(weight)
+ * {
+ *     int r2 = k * k + i * i + j * j;
+ *     if (r2 < max_r2)
+ *         sigma2(shells[r2]) += A3D_ELEM(weight, k, i, j);
+ * }
+ * @endcode
+ */
+class SquaredRadiusShells
+{
+public:
+	typedef std::shared_ptr<const SquaredRadiusShells> Ptr;
+
+	// Largest squared radius in the table
+	long int max_r2;
+
+	// Radii are divided by this before rounding
+	RFLOAT padding;
+
+	// Shell index for every squared radius
+	std::vector<FourierShells::Index> shell;
+
+	/** Get the (cached) table for squared radii up to max_r2
+	 *
+	 * This is thread-safe. The table stays valid for as long as the returned pointer is held.
+	 */
+	static Ptr get(long int max_r2, RFLOAT padding = 1.);
+
+	/** Memory used by this table, in bytes */
+	size_t bytes() const;
+
+	inline int operator[](long int r2) const
+	{
+		return shell[r2];
+	}
+};
+
+#endif /* FOURIER_SHELLS_H_ */
@@ -36,6 +36,9 @@ void HealpixSampling::clear()
 	rot_angles.clear();
 	tilt_angles.clear();
 	psi_angles.clear();
+	oversampled_directions_order = -1;
+	oversampled_rot_angles.clear();
+	oversampled_tilt_angles.clear();
 	translations_x.clear();
 	translations_y.clear();
 	translations_z.clear();
@@ -480,6 +483,7 @@ void HealpixSampling::setOrientations(int _order, RFLOAT _psi_step)
 	rot_angles.clear();
 	tilt_angles.clear();
 	psi_angles.clear();
+	oversampled_directions_order = -1;
 
 	if (_order >= 0)
 		healpix_order = _order;
@@ -565,6 +569,7 @@ void HealpixSampling::addOneOrientation(RFLOAT rot, RFLOAT tilt, RFLOAT psi, boo
 		tilt_angles.clear();
 		psi_angles.clear();
 	}
+	oversampled_directions_order = -1;
 
 	// 3D directions
 	if (is_3D)
@@ -1850,34 +1855,20 @@ void HealpixSampling::getOrientations(long int idir, long int ipsi, int oversamp
 		// for 2D sampling, only push back oversampled psi rotations
 		pushbackOversampledPsiAngles(my_ipsi, oversampling_order, 0., 0., my_rot, my_tilt, my_psi);
 	}
+	else if (oversampling_order == oversampled_directions_order)
+	{
+		// Look up the precalculated oversampled directions
+		long int nr_over = oversampled_rot_angles.size() / rot_angles.size();
+		for (long int iover = my_idir * nr_over; iover < (my_idir + 1) * nr_over; iover++)
+			pushbackOversampledPsiAngles(my_ipsi, oversampling_order, oversampled_rot_angles[iover], oversampled_tilt_angles[iover], my_rot, my_tilt, my_psi);
+	}
 	else
 	{
 		// Set up oversampled grid for 3D sampling
-		Healpix_Base HealPixOver(oversampling_order + healpix_order, NEST);
-		int fact = HealPixOver.Nside()/healpix_base.Nside();
-		int x, y, face;
-		RFLOAT rot, tilt;
-		// Get x, y and face for the original, coarse grid
-		long int ipix = directions_ipix[my_idir];
-		healpix_base.nest2xyf(ipix, x, y, face);
-		// Loop over the oversampled Healpix pixels on the fine grid
-		for (int j = fact * y; j < fact * (y+1); ++j)
-		{
-			for (int i = fact * x; i < fact * (x+1); ++i)
-			{
-				long int overpix = HealPixOver.xyf2nest(i, j, face);
-                                // this one always has to be double (also for SINGLE_PRECISION CALCULATIONS) for call to external library
-				double zz, phi;
-				HealPixOver.pix2ang_z_phi(overpix, zz, phi);
-				rot = RAD2DEG(phi);
-				tilt = ACOSD(zz);
-
-				// The geometrical considerations about the symmetry below require that rot = [-180,180] and tilt [0,180]
-				checkDirection(rot, tilt);
-
-				pushbackOversampledPsiAngles(my_ipsi, oversampling_order, rot, tilt, my_rot, my_tilt, my_psi);
-			}
-		}
+		std::vector<RFLOAT> over_rot, over_tilt;
+		getOversampledDirections(my_idir, oversampling_order, over_rot, over_tilt);
+		for (int iover = 0; iover < over_rot.size(); iover++)
+			pushbackOversampledPsiAngles(my_ipsi, oversampling_order, over_rot[iover], over_tilt[iover], my_rot, my_tilt, my_psi);
 	}
 
 
@@ -1885,21 +1876,13 @@ void HealpixSampling::getOrientations(long int idir, long int ipsi, int oversamp
 	if (ABS(random_perturbation) > 0.)
 	{
 		RFLOAT myperturb = random_perturbation * getAngularSampling();
+		Quaternion R = Quaternion::fromEulerAngles(myperturb, myperturb, myperturb);
 		for (int iover = 0; iover < my_rot.size(); iover++)
 		{
 			if (is_3D)
 			{
-				Matrix2D<RFLOAT> A(3,3), R(3,3);
-				Euler_angles2matrix(my_rot[iover],
-									my_tilt[iover],
-									my_psi[iover],
-									A);
-				Euler_angles2matrix(myperturb, myperturb, myperturb, R);
-				A = A * R;
-				Euler_matrix2angles(A,
-									my_rot[iover],
-									my_tilt[iover],
-									my_psi[iover]);
+				Quaternion A = Quaternion::fromEulerAngles(my_rot[iover], my_tilt[iover], my_psi[iover]) * R;
+				A.toEulerAngles(my_rot[iover], my_tilt[iover], my_psi[iover]);
 			}
 			else
 			{
@@ -1913,6 +1896,62 @@ void HealpixSampling::getOrientations(long int idir, long int ipsi, int oversamp
 }
 
 
+void HealpixSampling::precalculateOversampledDirections(int oversampling_order)
+{
+	if (oversampling_order == oversampled_directions_order)
+		return;
+
+	oversampled_rot_angles.clear();
+	oversampled_tilt_angles.clear();
+	oversampled_directions_order = -1;
+
+	// Only the 3D case with oversampling and proper HEALPix directions (i.e. not from addOneOrientation)
+	if (!is_3D || oversampling_order <= 0 || rot_angles.size() == 0)
+		return;
+	for (long int idir = 0; idir < directions_ipix.size(); idir++)
+		if (directions_ipix[idir] < 0)
+			return;
+
+	long int nr_over = ROUND(std::pow(4., oversampling_order));
+	oversampled_rot_angles.reserve(rot_angles.size() * nr_over);
+	oversampled_tilt_angles.reserve(rot_angles.size() * nr_over);
+	for (long int idir = 0; idir < rot_angles.size(); idir++)
+		getOversampledDirections(idir, oversampling_order, oversampled_rot_angles, oversampled_tilt_angles);
+
+	oversampled_directions_order = oversampling_order;
+}
+
+void HealpixSampling::getOversampledDirections(long int idir, int oversampling_order,
+		std::vector<RFLOAT> &oversampled_rot, std::vector<RFLOAT> &oversampled_tilt)
+{
+	Healpix_Base HealPixOver(oversampling_order + healpix_order, NEST);
+	int fact = HealPixOver.Nside()/healpix_base.Nside();
+	int x, y, face;
+	RFLOAT rot, tilt;
+	// Get x, y and face for the original, coarse grid
+	long int ipix = directions_ipix[idir];
+	healpix_base.nest2xyf(ipix, x, y, face);
+	// Loop over the oversampled Healpix pixels on the fine grid
+	for (int j = fact * y; j < fact * (y+1); ++j)
+	{
+		for (int i = fact * x; i < fact * (x+1); ++i)
+		{
+			long int overpix = HealPixOver.xyf2nest(i, j, face);
+			// this one always has to be double (also for SINGLE_PRECISION CALCULATIONS) for call to external library
+			double zz, phi;
+			HealPixOver.pix2ang_z_phi(overpix, zz, phi);
+			rot = RAD2DEG(phi);
+			tilt = ACOSD(zz);
+
+			// The geometrical considerations about the symmetry below require that rot = [-180,180] and tilt [0,180]
+			checkDirection(rot, tilt);
+
+			oversampled_rot.push_back(rot);
+			oversampled_tilt.push_back(tilt);
+		}
+	}
+}
+
 void HealpixSampling::pushbackOversampledPsiAngles(long int ipsi, int oversampling_order,
 		RFLOAT rot, RFLOAT tilt, std::vector<RFLOAT> &oversampled_rot,
 		std::vector<RFLOAT> &oversampled_tilt, std::vector<RFLOAT> &oversampled_psi)
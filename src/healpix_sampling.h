@@ -27,6 +27,7 @@
 #include "src/multidim_array.h"
 #include "src/symmetries.h"
 #include "src/euler.h"
+#include "src/quaternion.h"
 #include "src/transformations.h"
 #include "src/helix.h"
 
@@ -94,6 +95,12 @@ public:
     /** vector with the psi-samples */
     std::vector<RFLOAT> psi_angles;
 
+    /** Oversampled (rot, tilt) of all directions, precalculated for oversampled_directions_order (-1 if none)
+     *  The oversampled directions of idir start at idir * oversamplingFactorDirections(oversampled_directions_order)
+     */
+    int oversampled_directions_order;
+    std::vector<RFLOAT> oversampled_rot_angles, oversampled_tilt_angles;
+
     /** vector with the X,Y(,Z)-translations (as of v3.1 in Angstroms!) */
     std::vector<RFLOAT> translations_x, translations_y, translations_z;
 
@@ -114,7 +121,8 @@ public:
 		limit_tilt(0),
 		healpix_order(0),
 		pgOrder(0),
-		pgOrderRelaxSym(0)
+		pgOrderRelaxSym(0),
+		oversampled_directions_order(-1)
     {}
 
     // Destructor
@@ -124,6 +132,8 @@ public:
     	rot_angles.clear();
     	tilt_angles.clear();
     	psi_angles.clear();
+    	oversampled_rot_angles.clear();
+    	oversampled_tilt_angles.clear();
     	translations_x.clear();
     	translations_y.clear();
     	translations_z.clear();
@@ -360,6 +370,18 @@ public:
     		std::vector<int> &pointer_dir_nonzeroprior, std::vector<RFLOAT> &directions_prior,
     		std::vector<int> &pointer_psi_nonzeroprior, std::vector<RFLOAT> &psi_prior);
 
+    /* Precalculate the oversampled directions of all (coarse) directions for this oversampling_order,
+     * so that getOrientations only needs to look them up. Call this again after the directions have changed.
+     * This is not thread-safe: call it before getOrientations is used from multiple threads.
+     */
+    void precalculateOversampledDirections(int oversampling_order);
+
+    /* Gets the oversampled (rot, tilt) angles of the (coarse) direction idir in the 3D case
+     * An oversampling_order == 1 will give rise to 2*2 directions, etc.
+     */
+    void getOversampledDirections(long int idir, int oversampling_order,
+    		std::vector<RFLOAT> &oversampled_rot, std::vector<RFLOAT> &oversampled_tilt);
+
     /* Gets the vector of psi angles for a more finely (oversampled) sampling and
      * pushes each instance back into the oversampled_orientations vector with the given rot and tilt
      * The oversampling_order is the difference in order of the original (coarse) and the oversampled (fine) sampling
@@ -0,0 +1,460 @@
+/***************************************************************************
+ *
+ * Author: "Jasenko Zivanov"
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef JAZ_BRICKED_VOLUME_H
+#define JAZ_BRICKED_VOLUME_H
+
+#include <vector>
+#include <list>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <stddef.h>
+#include <src/error.h>
+#include <src/jaz/volume.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/* class BrickedVolume: an out-of-core grid of voxels of arbitrary (POD) type.
+
+   The volume is split into cubic bricks of brickSize^3 voxels. Only up to
+   maxResident bricks are held in memory; the least recently used brick is
+   evicted when another one is needed. Evicted bricks that have been modified
+   are written to an unlinked temporary file (zlib-compressed if available),
+   bricks that have never been written contain the fill value.
+
+   Algorithms stream over the volume either slab by slab (readSlab/writeSlab,
+   e.g. for masking, filtering or slab-wise tomographic backprojection) or brick
+   by brick (getBrick/setBrick). Single-voxel access through get/set is possible,
+   but slow.
+
+   A BrickedVolume is not thread-safe: parallelise over the voxels of a slab or
+   a brick instead.*/
+
+template <typename T>
+class BrickedVolume
+{
+    public:
+
+        BrickedVolume(size_t dimx, size_t dimy, size_t dimz,
+                      int brickSize = 64, size_t maxResident = 64,
+                      T fillValue = T(0), std::string tempDir = "");
+
+        ~BrickedVolume();
+
+        long int dimx, dimy, dimz;
+        int brickSize;
+        long int bricksX, bricksY, bricksZ;
+
+        size_t brickCount() const;
+        size_t brickIndex(long int bx, long int by, long int bz) const;
+
+        /* get(x,y,z)/set(x,y,z,v): single-voxel access.*/
+
+        T get(long int x, long int y, long int z);
+        void set(long int x, long int y, long int z, T v);
+
+        /* brickData(): returns a pointer to the resident voxels of brick b
+           (brickSize^3 values, x fastest). The pointer stays valid until
+           the next call that makes another brick resident.
+           If modify is true, the brick will be written back on eviction.*/
+
+        T* brickData(size_t b, bool modify);
+
+        /* Copies brick (bx,by,bz) into/from dest/src, cropped at the volume border.*/
+
+        void getBrick(long int bx, long int by, long int bz, Volume<T>& dest);
+        void setBrick(long int bx, long int by, long int bz, const Volume<T>& src);
+
+        /* Copies dest.dimz (src.dimz) slices starting at slice z0 into dest (from src).
+           The slab has to be as wide and as high as the volume.*/
+
+        void readSlab(long int z0, Volume<T>& dest);
+        void writeSlab(long int z0, const Volume<T>& src);
+
+        /* Bytes currently used by the on-disk store.*/
+
+        size_t storedBytes() const;
+
+
+    private:
+
+        struct Brick
+        {
+            Brick() : resident(false), dirty(false), stored(false), offset(0), size(0) {}
+
+            bool resident, dirty, stored;
+            off_t offset;
+            size_t size;
+            std::vector<T> voxels;
+            std::list<size_t>::iterator lruPos;
+        };
+
+        std::vector<Brick> bricks;
+        std::list<size_t> lru;
+        size_t maxResident, residentCount;
+        T fillValue;
+        int fd;
+        off_t fileEnd;
+
+        BrickedVolume(const BrickedVolume&);
+        BrickedVolume& operator = (const BrickedVolume&);
+
+        void makeResident(size_t b);
+        void evict(size_t b);
+        void store(Brick& brick);
+        void load(Brick& brick);
+};
+
+template <class T>
+BrickedVolume<T>::BrickedVolume(
+        size_t dimx, size_t dimy, size_t dimz,
+        int brickSize, size_t maxResident,
+        T fillValue, std::string tempDir)
+    :   dimx(dimx), dimy(dimy), dimz(dimz),
+        brickSize(brickSize),
+        maxResident(maxResident < 1? 1 : maxResident),
+        residentCount(0),
+        fillValue(fillValue),
+        fd(-1),
+        fileEnd(0)
+{
+    if (brickSize < 1)
+    {
+        REPORT_ERROR("BrickedVolume: brick size has to be positive.");
+    }
+
+    bricksX = (dimx + brickSize - 1) / brickSize;
+    bricksY = (dimy + brickSize - 1) / brickSize;
+    bricksZ = (dimz + brickSize - 1) / brickSize;
+
+    bricks.resize(bricksX * bricksY * bricksZ);
+
+    if (tempDir == "")
+    {
+        const char* env = getenv("TMPDIR");
+        tempDir = (env != NULL)? env : "/tmp";
+    }
+
+    std::string fnTemplate = tempDir + "/relion_bricks_XXXXXX";
+    std::vector<char> fn(fnTemplate.begin(), fnTemplate.end());
+    fn.push_back('\0');
+
+    fd = mkstemp(&fn[0]);
+
+    if (fd < 0)
+    {
+        REPORT_ERROR("BrickedVolume: unable to create a temporary file in " + tempDir);
+    }
+
+    // The file disappears as soon as it is closed (or the program dies).
+    unlink(&fn[0]);
+}
+
+template <class T>
+BrickedVolume<T>::~BrickedVolume()
+{
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+template <class T>
+inline size_t BrickedVolume<T>::brickCount() const
+{
+    return bricks.size();
+}
+
+template <class T>
+inline size_t BrickedVolume<T>::brickIndex(long int bx, long int by, long int bz) const
+{
+    return (bz * bricksY + by) * bricksX + bx;
+}
+
+template <class T>
+T BrickedVolume<T>::get(long int x, long int y, long int z)
+{
+    const size_t b = brickIndex(x / brickSize, y / brickSize, z / brickSize);
+    const T* data = brickData(b, false);
+
+    return data[((z % brickSize) * brickSize + y % brickSize) * brickSize + x % brickSize];
+}
+
+template <class T>
+void BrickedVolume<T>::set(long int x, long int y, long int z, T v)
+{
+    const size_t b = brickIndex(x / brickSize, y / brickSize, z / brickSize);
+    T* data = brickData(b, true);
+
+    data[((z % brickSize) * brickSize + y % brickSize) * brickSize + x % brickSize] = v;
+}
+
+template <class T>
+T* BrickedVolume<T>::brickData(size_t b, bool modify)
+{
+    makeResident(b);
+
+    if (modify)
+    {
+        bricks[b].dirty = true;
+    }
+
+    return &bricks[b].voxels[0];
+}
+
+template <class T>
+void BrickedVolume<T>::getBrick(long int bx, long int by, long int bz, Volume<T>& dest)
+{
+    const long int x0 = bx * brickSize, y0 = by * brickSize, z0 = bz * brickSize;
+    const long int w = std::min((long int)brickSize, dimx - x0);
+    const long int h = std::min((long int)brickSize, dimy - y0);
+    const long int d = std::min((long int)brickSize, dimz - z0);
+
+    dest.resize(w, h, d);
+
+    const T* data = brickData(brickIndex(bx, by, bz), false);
+
+    for (long int z = 0; z < d; z++)
+    for (long int y = 0; y < h; y++)
+    {
+        memcpy(&dest(0,y,z), data + (z * brickSize + y) * brickSize, w * sizeof(T));
+    }
+}
+
+template <class T>
+void BrickedVolume<T>::setBrick(long int bx, long int by, long int bz, const Volume<T>& src)
+{
+    const long int x0 = bx * brickSize, y0 = by * brickSize, z0 = bz * brickSize;
+    const long int w = std::min((long int)brickSize, dimx - x0);
+    const long int h = std::min((long int)brickSize, dimy - y0);
+    const long int d = std::min((long int)brickSize, dimz - z0);
+
+    if (src.dimx != w || src.dimy != h || src.dimz != d)
+    {
+        REPORT_ERROR("BrickedVolume::setBrick: wrong brick dimensions.");
+    }
+
+    T* data = brickData(brickIndex(bx, by, bz), true);
+
+    for (long int z = 0; z < d; z++)
+    for (long int y = 0; y < h; y++)
+    {
+        memcpy(data + (z * brickSize + y) * brickSize, &src(0,y,z), w * sizeof(T));
+    }
+}
+
+template <class T>
+void BrickedVolume<T>::readSlab(long int z0, Volume<T>& dest)
+{
+    if (dest.dimx != dimx || dest.dimy != dimy || z0 < 0 || z0 + dest.dimz > dimz)
+    {
+        REPORT_ERROR("BrickedVolume::readSlab: slab does not fit into the volume.");
+    }
+
+    // Visit one brick at a time, so that a slab only needs one layer of resident bricks.
+    for (long int bz = z0 / brickSize; bz * brickSize < z0 + dest.dimz; bz++)
+    for (long int by = 0; by < bricksY; by++)
+    for (long int bx = 0; bx < bricksX; bx++)
+    {
+        const T* data = brickData(brickIndex(bx, by, bz), false);
+
+        const long int x1 = std::min((bx + 1) * brickSize, dimx);
+        const long int y1 = std::min((by + 1) * brickSize, dimy);
+        const long int za = std::max(bz * brickSize, z0);
+        const long int zb = std::min((bz + 1) * brickSize, z0 + dest.dimz);
+
+        for (long int z = za; z < zb; z++)
+        for (long int y = by * brickSize; y < y1; y++)
+        {
+            memcpy(&dest(bx * brickSize, y, z - z0),
+                   data + ((z - bz * brickSize) * brickSize + y - by * brickSize) * brickSize,
+                   (x1 - bx * brickSize) * sizeof(T));
+        }
+    }
+}
+
+template <class T>
+void BrickedVolume<T>::writeSlab(long int z0, const Volume<T>& src)
+{
+    if (src.dimx != dimx || src.dimy != dimy || z0 < 0 || z0 + src.dimz > dimz)
+    {
+        REPORT_ERROR("BrickedVolume::writeSlab: slab does not fit into the volume.");
+    }
+
+    for (long int bz = z0 / brickSize; bz * brickSize < z0 + src.dimz; bz++)
+    for (long int by = 0; by < bricksY; by++)
+    for (long int bx = 0; bx < bricksX; bx++)
+    {
+        T* data = brickData(brickIndex(bx, by, bz), true);
+
+        const long int x1 = std::min((bx + 1) * brickSize, dimx);
+        const long int y1 = std::min((by + 1) * brickSize, dimy);
+        const long int za = std::max(bz * brickSize, z0);
+        const long int zb = std::min((bz + 1) * brickSize, z0 + src.dimz);
+
+        for (long int z = za; z < zb; z++)
+        for (long int y = by * brickSize; y < y1; y++)
+        {
+            memcpy(data + ((z - bz * brickSize) * brickSize + y - by * brickSize) * brickSize,
+                   &src(bx * brickSize, y, z - z0),
+                   (x1 - bx * brickSize) * sizeof(T));
+        }
+    }
+}
+
+template <class T>
+size_t BrickedVolume<T>::storedBytes() const
+{
+    return fileEnd;
+}
+
+template <class T>
+void BrickedVolume<T>::makeResident(size_t b)
+{
+    Brick& brick = bricks[b];
+
+    if (brick.resident)
+    {
+        lru.splice(lru.begin(), lru, brick.lruPos);
+        return;
+    }
+
+    if (residentCount >= maxResident)
+    {
+        evict(lru.back());
+    }
+
+    const size_t n = (size_t)brickSize * brickSize * brickSize;
+
+    if (brick.stored)
+    {
+        brick.voxels.resize(n);
+        load(brick);
+    }
+    else
+    {
+        brick.voxels.assign(n, fillValue);
+    }
+
+    lru.push_front(b);
+    brick.lruPos = lru.begin();
+    brick.resident = true;
+    brick.dirty = false;
+    residentCount++;
+}
+
+template <class T>
+void BrickedVolume<T>::evict(size_t b)
+{
+    Brick& brick = bricks[b];
+
+    if (brick.dirty)
+    {
+        store(brick);
+    }
+
+    lru.erase(brick.lruPos);
+    std::vector<T>().swap(brick.voxels);
+    brick.resident = false;
+    brick.dirty = false;
+    residentCount--;
+}
+
+template <class T>
+void BrickedVolume<T>::store(Brick& brick)
+{
+    const size_t rawSize = brick.voxels.size() * sizeof(T);
+    const unsigned char* raw = (const unsigned char*) &brick.voxels[0];
+
+    std::vector<unsigned char> buffer;
+    const unsigned char* out = raw;
+    size_t outSize = rawSize;
+
+    #ifdef HAVE_ZLIB
+    {
+        uLongf compSize = compressBound(rawSize);
+        buffer.resize(compSize);
+
+        if (compress2(&buffer[0], &compSize, raw, rawSize, 1) == Z_OK && compSize < rawSize)
+        {
+            out = &buffer[0];
+            outSize = compSize;
+        }
+    }
+    #endif
+
+    // Re-use the old slot if the new data fit, append otherwise.
+    if (!brick.stored || outSize > brick.size)
+    {
+        brick.offset = fileEnd;
+        fileEnd += outSize;
+    }
+
+    if (pwrite(fd, out, outSize, brick.offset) != (ssize_t)outSize)
+    {
+        REPORT_ERROR("BrickedVolume: unable to write to the temporary brick store.");
+    }
+
+    brick.size = outSize;
+    brick.stored = true;
+}
+
+template <class T>
+void BrickedVolume<T>::load(Brick& brick)
+{
+    const size_t rawSize = brick.voxels.size() * sizeof(T);
+    unsigned char* raw = (unsigned char*) &brick.voxels[0];
+
+    if (brick.size == rawSize)
+    {
+        if (pread(fd, raw, rawSize, brick.offset) != (ssize_t)rawSize)
+        {
+            REPORT_ERROR("BrickedVolume: unable to read from the temporary brick store.");
+        }
+
+        return;
+    }
+
+    #ifdef HAVE_ZLIB
+    {
+        std::vector<unsigned char> buffer(brick.size);
+
+        if (pread(fd, &buffer[0], brick.size, brick.offset) != (ssize_t)brick.size)
+        {
+            REPORT_ERROR("BrickedVolume: unable to read from the temporary brick store.");
+        }
+
+        uLongf destSize = rawSize;
+
+        if (uncompress(raw, &destSize, &buffer[0], brick.size) != Z_OK || destSize != rawSize)
+        {
+            REPORT_ERROR("BrickedVolume: corrupted brick in the temporary brick store.");
+        }
+    }
+    #else
+    REPORT_ERROR("BrickedVolume: compressed brick found, but RELION was compiled without zlib.");
+    #endif
+}
+
+#endif
@@ -239,12 +239,12 @@ void CtfRefiner::init()
 	}
 }
 
-void CtfRefiner::processSubsetMicrographs(long g_start, long g_end)
+void CtfRefiner::processSubsetMicrographs(long g_start, long g_end, bool show_progress)
 {
 	int barstep;
 	int my_nr_micrographs = g_end - g_start + 1;
 
-	if (verb > 0)
+	if (verb > 0 && show_progress)
 	{
 		std::cout << " + Performing loop over all micrographs ... " << std::endl;
 		init_progress_bar(my_nr_micrographs);
@@ -341,13 +341,13 @@ void CtfRefiner::processSubsetMicrographs(long g_start, long g_end)
 
 		nr_done++;
 
-		if (verb > 0 && nr_done % barstep == 0)
+		if (verb > 0 && show_progress && nr_done % barstep == 0)
 		{
 			progress_bar(nr_done);
 		}
 	}
 
-	if (verb > 0)
+	if (verb > 0 && show_progress)
 	{
 		progress_bar(my_nr_micrographs);
 	}
@@ -85,7 +85,7 @@ class CtfRefiner
 		std::vector<MetaDataTable> allMdts, unfinishedMdts;
 
 		// Fit CTF parameters for all particles on a subset of the micrographs micrograph
-		void processSubsetMicrographs(long g_start, long g_end);
+		void processSubsetMicrographs(long g_start, long g_end, bool show_progress = true);
 
 		// Combine all .stars and .eps files
 		std::vector<MetaDataTable> merge(const std::vector<MetaDataTable>& mdts, std::vector <FileName> &fn_eps);
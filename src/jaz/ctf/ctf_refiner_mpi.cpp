@@ -19,6 +19,7 @@
  ***************************************************************************/
 
 #include "ctf_refiner_mpi.h"
+#include <src/time.h>
 
 void CtfRefinerMpi::read(int argc, char **argv)
 {
@@ -48,13 +49,30 @@ void CtfRefinerMpi::run()
 
 	long int total_nr_micrographs = unfinishedMdts.size();
 
-	// Each node does part of the work
-	long int my_first_micrograph, my_last_micrograph;
-	divide_equally(total_nr_micrographs, node->size, node->rank, my_first_micrograph, my_last_micrograph);
-
 	if (do_defocus_fit || do_bfac_fit || do_tilt_fit || do_aberr_fit || do_mag_fit)
     {
-    	processSubsetMicrographs(my_first_micrograph, my_last_micrograph);
+		// Each node fetches chunks of micrographs to work on
+		MpiTaskDistributor distributor(node, total_nr_micrographs);
+
+		if (verb > 0)
+		{
+			std::cout << " + Performing loop over all micrographs ... " << std::endl;
+			init_progress_bar(total_nr_micrographs);
+		}
+
+		long int my_first_micrograph, my_last_micrograph;
+		while (distributor.getTasks(my_first_micrograph, my_last_micrograph))
+		{
+			processSubsetMicrographs(my_first_micrograph, my_last_micrograph, false);
+
+			if (verb > 0)
+				progress_bar(my_last_micrograph + 1);
+		}
+
+		if (verb > 0)
+			progress_bar(total_nr_micrographs);
+
+		distributor.reportUtilisation();
     }
 
     MPI_Barrier(MPI_COMM_WORLD);
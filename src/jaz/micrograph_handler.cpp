@@ -33,6 +33,8 @@ MicrographHandler::MicrographHandler()
 	  debug(false),
 	  saveMem(false),
 	  ready(false),
+	  cacheMovie(false),
+	  cachedMovieFn(""),
 	  last_gainFn(""),
 	  corrMicFn(""),
 	  eer_upsampling(-1),
@@ -460,7 +462,20 @@ std::vector<std::vector<Image<Complex>>> MicrographHandler::loadMovie(
 			mgHasGain = true;
 		}
 
-		if (!isEER)
+		if (!isEER && cacheMovie)
+		{
+			if (mgFn != cachedMovieFn)
+			{
+				cachedMovieFn = "";
+				loadFrames(mgFn, mgHasGain? &lastGainRef : 0, nr_omp_threads, cachedFrames);
+				cachedMovieFn = mgFn;
+			}
+
+			movie = StackHelper::extractMovieStackFS(&mdt, cachedFrames, angpix, coords_angpix, movie_angpix, data_angpix, s,
+			                                         nr_omp_threads, true,
+			                                         debug, offsets_in, offsets_out);
+		}
+		else if (!isEER)
 		{
 #define OLD_CODE
 #ifdef OLD_CODE
@@ -498,131 +513,142 @@ std::vector<std::vector<Image<Complex>>> MicrographHandler::loadMovie(
 		}
 		else
 		{
-			if (eer_upsampling < 0)
-				eer_upsampling = micrograph.getEERUpsampling();
-			if (eer_grouping < 0)
-				eer_grouping = micrograph.getEERGrouping();
+			std::vector<MultidimArray<float> > localFrames;
+			std::vector<MultidimArray<float> > &Iframes = cacheMovie? cachedFrames : localFrames;
 
-			EERRenderer renderer;
-			renderer.read(mgFn, eer_upsampling);
+			if (!cacheMovie || mgFn != cachedMovieFn)
+			{
+				cachedMovieFn = "";
 
-			// lastFrame and firstFrame is 0 indexed
-			int my_lastFrame = (lastFrame < 0) ? (renderer.getNFrames() / eer_grouping - 1) : lastFrame;
-			int n_frames = my_lastFrame - firstFrame + 1;
+				if (eer_upsampling < 0)
+					eer_upsampling = micrograph.getEERUpsampling();
+				if (eer_grouping < 0)
+					eer_grouping = micrograph.getEERGrouping();
 
-			std::vector<MultidimArray<float> > Iframes(n_frames);
+				EERRenderer renderer;
+				renderer.read(mgFn, eer_upsampling);
 
-			#pragma omp parallel for num_threads(nr_omp_threads)
-			for (int iframe = 0; iframe < n_frames; iframe++)
-			{
-				// this takes 1-indexed frame numbers
-//				std::cout << "EER: iframe = " << iframe << " start = " << ((firstFrame + iframe) * eer_grouping + 1) << " end = " << ((firstFrame + iframe + 1) * eer_grouping) << std::endl;
-				renderer.renderFrames((firstFrame + iframe) * eer_grouping + 1, (firstFrame + iframe + 1) * eer_grouping, Iframes[iframe]);
+				// lastFrame and firstFrame is 0 indexed
+				int my_lastFrame = (lastFrame < 0) ? (renderer.getNFrames() / eer_grouping - 1) : lastFrame;
+				int n_frames = my_lastFrame - firstFrame + 1;
 
-				if (mgHasGain)
+				Iframes.resize(n_frames);
+
+				#pragma omp parallel for num_threads(nr_omp_threads)
+				for (int iframe = 0; iframe < n_frames; iframe++)
 				{
-					FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(lastGainRef())
+					// this takes 1-indexed frame numbers
+	//				std::cout << "EER: iframe = " << iframe << " start = " << ((firstFrame + iframe) * eer_grouping + 1) << " end = " << ((firstFrame + iframe + 1) * eer_grouping) << std::endl;
+					renderer.renderFrames((firstFrame + iframe) * eer_grouping + 1, (firstFrame + iframe + 1) * eer_grouping, Iframes[iframe]);
+
+					if (mgHasGain)
 					{
-						DIRECT_MULTIDIM_ELEM(Iframes[iframe], n) *= DIRECT_MULTIDIM_ELEM(lastGainRef(), n);
+						FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(lastGainRef())
+						{
+							DIRECT_MULTIDIM_ELEM(Iframes[iframe], n) *= DIRECT_MULTIDIM_ELEM(lastGainRef(), n);
+						}
 					}
 				}
-			}
 
-			if (hasDefect) // TODO: TAKANORI: Refactor!! Code duplication from RelionCor
-			{
-				if (XSIZE(defectMask) != XSIZE(Iframes[0]) || YSIZE(defectMask) != YSIZE(Iframes[0]))
+				if (hasDefect) // TODO: TAKANORI: Refactor!! Code duplication from RelionCor
 				{
-					std::cerr << "X/YSIZE of defectMask = " << XSIZE(defectMask) << " x " << YSIZE(defectMask) << std::endl;
-					std::cerr << "X/YSIZE of Iframe[0] = " << XSIZE(Iframes[0]) << " x " << YSIZE(Iframes[0]) << std::endl;
-					REPORT_ERROR("Invalid dfefect mask size for " + mgFn0);
-				}
+					if (XSIZE(defectMask) != XSIZE(Iframes[0]) || YSIZE(defectMask) != YSIZE(Iframes[0]))
+					{
+						std::cerr << "X/YSIZE of defectMask = " << XSIZE(defectMask) << " x " << YSIZE(defectMask) << std::endl;
+						std::cerr << "X/YSIZE of Iframe[0] = " << XSIZE(Iframes[0]) << " x " << YSIZE(Iframes[0]) << std::endl;
+						REPORT_ERROR("Invalid dfefect mask size for " + mgFn0);
+					}
 
-				MultidimArray<float> Isum;
-				Isum.initZeros(Iframes[0]);
-				for (int iframe = 0; iframe < n_frames; iframe++)
-				{
-					#pragma omp parallel for num_threads(nr_omp_threads)
-					FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Isum)
+					MultidimArray<float> Isum;
+					Isum.initZeros(Iframes[0]);
+					for (int iframe = 0; iframe < n_frames; iframe++)
 					{
-						DIRECT_MULTIDIM_ELEM(Isum, n) += DIRECT_MULTIDIM_ELEM(Iframes[iframe], n);
+						#pragma omp parallel for num_threads(nr_omp_threads)
+						FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Isum)
+						{
+							DIRECT_MULTIDIM_ELEM(Isum, n) += DIRECT_MULTIDIM_ELEM(Iframes[iframe], n);
+						}
 					}
-				}
 #ifdef DEBUG
-				Image<float> tmp;
-				tmp() = Isum;
-				tmp.write("Isum.mrc");
+					Image<float> tmp;
+					tmp() = Isum;
+					tmp.write("Isum.mrc");
 #endif
 
-				RFLOAT mean = 0, std = 0;
-				#pragma omp parallel for reduction(+:mean) num_threads(nr_omp_threads)
-				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Isum) {
-					mean += DIRECT_MULTIDIM_ELEM(Isum, n);
-				}
-				mean /= YXSIZE(Isum);
-				#pragma omp parallel for reduction(+:std) num_threads(nr_omp_threads)
-				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Isum) {
-					RFLOAT d = (DIRECT_MULTIDIM_ELEM(Isum, n) - mean);
-					std += d * d;
-				}
-				std = std::sqrt(std / YXSIZE(Isum));
+					RFLOAT mean = 0, std = 0;
+					#pragma omp parallel for reduction(+:mean) num_threads(nr_omp_threads)
+					FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Isum) {
+						mean += DIRECT_MULTIDIM_ELEM(Isum, n);
+					}
+					mean /= YXSIZE(Isum);
+					#pragma omp parallel for reduction(+:std) num_threads(nr_omp_threads)
+					FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Isum) {
+						RFLOAT d = (DIRECT_MULTIDIM_ELEM(Isum, n) - mean);
+						std += d * d;
+					}
+					std = std::sqrt(std / YXSIZE(Isum));
 
-				mean /= n_frames;
-				std /= n_frames;
-				Isum.clear();
+					mean /= n_frames;
+					std /= n_frames;
+					Isum.clear();
 
-//				std::cout << "DEBUG: defect correction: mean = " << mean << " std = " << std << std::endl;
+	//				std::cout << "DEBUG: defect correction: mean = " << mean << " std = " << std << std::endl;
 
-		                const int NUM_MIN_OK = 6;
-		                const int D_MAX = isEER ? 4: 2;
-				const int PBUF_SIZE = 100;
-		                FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(defectMask)
-        		        {
-		                        if (!DIRECT_A2D_ELEM(defectMask, i, j) &&
-					    (!mgHasGain || DIRECT_A2D_ELEM(lastGainRef(), i, j) != 0)) continue;
+			                const int NUM_MIN_OK = 6;
+			                const int D_MAX = isEER ? 4: 2;
+					const int PBUF_SIZE = 100;
+			                FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(defectMask)
+	        		        {
+			                        if (!DIRECT_A2D_ELEM(defectMask, i, j) &&
+						    (!mgHasGain || DIRECT_A2D_ELEM(lastGainRef(), i, j) != 0)) continue;
 
-		                        #pragma omp parallel for num_threads(nr_omp_threads)
-					for (int iframe = 0; iframe < n_frames; iframe++)
-					{
-		 				int n_ok = 0;
-						RFLOAT pbuf[PBUF_SIZE];
-						for (int dy= -D_MAX; dy <= D_MAX; dy++)
+			                        #pragma omp parallel for num_threads(nr_omp_threads)
+						for (int iframe = 0; iframe < n_frames; iframe++)
 						{
-							int y = i + dy;
-							if (y < 0 || y >= YSIZE(defectMask)) continue;
-							for (int dx = -D_MAX; dx <= D_MAX; dx++)
+			 				int n_ok = 0;
+							RFLOAT pbuf[PBUF_SIZE];
+							for (int dy= -D_MAX; dy <= D_MAX; dy++)
 							{
-								int x = j + dx;
-								if (x < 0 || x >= XSIZE(defectMask)) continue;
-								if (DIRECT_A2D_ELEM(defectMask, y, x)) continue;
-								if (mgHasGain && DIRECT_A2D_ELEM(lastGainRef(), y, x) == 0) continue;
-
-								pbuf[n_ok] = DIRECT_A2D_ELEM(Iframes[iframe], y, x);
-								n_ok++;
+								int y = i + dy;
+								if (y < 0 || y >= YSIZE(defectMask)) continue;
+								for (int dx = -D_MAX; dx <= D_MAX; dx++)
+								{
+									int x = j + dx;
+									if (x < 0 || x >= XSIZE(defectMask)) continue;
+									if (DIRECT_A2D_ELEM(defectMask, y, x)) continue;
+									if (mgHasGain && DIRECT_A2D_ELEM(lastGainRef(), y, x) == 0) continue;
+
+									pbuf[n_ok] = DIRECT_A2D_ELEM(Iframes[iframe], y, x);
+									n_ok++;
+								}
 							}
+	//						std::cout << "n_ok = " << n_ok << std::endl;
+							if (n_ok > NUM_MIN_OK)
+								DIRECT_A2D_ELEM(Iframes[iframe], i, j) = pbuf[rand() % n_ok];
+							else
+								DIRECT_A2D_ELEM(Iframes[iframe], i, j) = rnd_gaus(mean, std);
 						}
-//						std::cout << "n_ok = " << n_ok << std::endl;
-						if (n_ok > NUM_MIN_OK)
-							DIRECT_A2D_ELEM(Iframes[iframe], i, j) = pbuf[rand() % n_ok];
-						else
-							DIRECT_A2D_ELEM(Iframes[iframe], i, j) = rnd_gaus(mean, std);
 					}
-				}
 
 #ifdef DEBUG
-				Isum.initZeros(Iframes[0]);
-				for (int iframe = 0; iframe < n_frames; iframe++)
-				{
-					#pragma omp parallel for num_threads(nr_omp_threads)
-					FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Isum)
+					Isum.initZeros(Iframes[0]);
+					for (int iframe = 0; iframe < n_frames; iframe++)
 					{
-						DIRECT_MULTIDIM_ELEM(Isum, n) += DIRECT_MULTIDIM_ELEM(Iframes[iframe], n);
+						#pragma omp parallel for num_threads(nr_omp_threads)
+						FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Isum)
+						{
+							DIRECT_MULTIDIM_ELEM(Isum, n) += DIRECT_MULTIDIM_ELEM(Iframes[iframe], n);
+						}
 					}
-				}
 
-				tmp() = Isum;
-				tmp.write("Isum-fix-defect.mrc");
-				exit(0);
+					tmp() = Isum;
+					tmp.write("Isum-fix-defect.mrc");
+					exit(0);
 #endif
+				}
+
+				if (cacheMovie)
+					cachedMovieFn = mgFn;
 			}
 
 			movie = StackHelper::extractMovieStackFS(&mdt, Iframes, angpix, coords_angpix, movie_angpix, data_angpix, s,
@@ -720,6 +746,55 @@ std::vector<std::vector<Image<Complex>>> MicrographHandler::loadMovie(
 	return out;
 }
 
+void MicrographHandler::loadFrames(
+		const std::string& mgFn, const Image<RFLOAT>* gainRef, int nr_omp_threads,
+		std::vector<MultidimArray<float> >& frames)
+{
+	Image<float> mgStack;
+	mgStack.read(mgFn, false);
+
+	const int w0 = mgStack.data.xdim;
+	const int h0 = mgStack.data.ydim;
+	const int fcM = (mgStack.data.zdim > 1)? mgStack.data.zdim : mgStack.data.ndim;
+	// lastFrame and firstFrame is 0 indexed, while fcM is 1-indexed
+	const int fc = lastFrame > 0? lastFrame - firstFrame + 1 : fcM - firstFrame;
+
+	if (fcM <= lastFrame)
+	{
+		REPORT_ERROR("MicrographHandler::loadFrames: insufficient number of frames in "+mgFn);
+	}
+
+	if (gainRef != 0 && (w0 != gainRef->data.xdim || h0 != gainRef->data.ydim))
+	{
+		REPORT_ERROR("MicrographHandler::loadFrames: incompatible gain reference - size is different from "+mgFn);
+	}
+
+	frames.resize(fc);
+
+	// Same gain and hot pixel correction as in StackHelper::extractMovieStackFS,
+	// except for the sign, which is flipped when the particles are extracted.
+	#pragma omp parallel for num_threads(nr_omp_threads)
+	for (int f = 0; f < fc; f++)
+	{
+		Image<float> muGraph;
+		muGraph.read(mgFn, true, f + firstFrame, false, true);
+
+		for (long int y = 0; y < h0; y++)
+		for (long int x = 0; x < w0; x++)
+		{
+			RFLOAT val = DIRECT_NZYX_ELEM(muGraph.data, 0, 0, y, x);
+			RFLOAT gain = 1.0;
+
+			if (gainRef != 0) gain = DIRECT_NZYX_ELEM(gainRef->data, 0, 0, y, x);
+			if (hotCutoff > 0.0 && val > hotCutoff) val = hotCutoff;
+
+			DIRECT_NZYX_ELEM(muGraph.data, 0, 0, y, x) = gain * val;
+		}
+
+		frames[f] = muGraph.data;
+	}
+}
+
 std::string MicrographHandler::getMetaName(std::string micName, bool die_on_error)
 {
 //	std::cout << "MicrographHandler::getMetaName " << micName << std::endl;
@@ -42,6 +42,10 @@ class MicrographHandler
 
 	bool debug, saveMem, ready;
 
+	// keep the frames of the last movie in memory, so that loading
+	// particles from the same movie again does not read it again
+	bool cacheMovie;
+
 	std::string corrMicFn;
 	std::string last_gainFn; // make protected
 
@@ -100,6 +104,14 @@ class MicrographHandler
 	Micrograph micrograph;
 	Image<RFLOAT> lastGainRef;
 
+	// gain-corrected frames of the last movie (only if cacheMovie)
+	std::string cachedMovieFn;
+	std::vector<MultidimArray<float> > cachedFrames;
+
+	// read frames firstFrame to lastFrame, clip hot pixels and apply the gain reference
+	void loadFrames(const std::string& mgFn, const Image<RFLOAT>* gainRef,
+		int nr_omp_threads, std::vector<MultidimArray<float> >& frames);
+
 	bool hasCorrMic;
 	std::map<std::string, std::string> mic2meta;
 
@@ -227,7 +227,7 @@ void FrameRecombiner::init(
 	}
 }
 
-void FrameRecombiner::process(const std::vector<MetaDataTable>& mdts, long g_start, long g_end)
+void FrameRecombiner::process(const std::vector<MetaDataTable>& mdts, long g_start, long g_end, bool show_progress)
 {
 	int barstep;
 	int my_nr_micrographs = g_end - g_start + 1;
@@ -235,7 +235,7 @@ void FrameRecombiner::process(const std::vector<MetaDataTable>& mdts, long g_sta
 	const RFLOAT coords_angpix = micrographHandler->coords_angpix;
 
 //	std::cout << "ref_angpix = " << ref_angpix << " coords_angpix = " << coords_angpix << std::endl;
-	if (verb > 0)
+	if (verb > 0 && show_progress)
 	{
 		std::cout << " + Combining frames for all micrographs ... " << std::endl;
 		init_progress_bar(my_nr_micrographs);
@@ -418,13 +418,13 @@ void FrameRecombiner::process(const std::vector<MetaDataTable>& mdts, long g_sta
 
 		nr_done++;
 
-		if (verb > 0 && nr_done % barstep == 0)
+		if (verb > 0 && show_progress && nr_done % barstep == 0)
 		{
 			progress_bar(nr_done);
 		}
 	}
 
-	if (verb > 0)
+	if (verb > 0 && show_progress)
 	{
 		progress_bar(my_nr_micrographs);
 	}
@@ -697,6 +697,16 @@ bool FrameRecombiner::outerFreqKnown()
 	return k1a > 0.0;
 }
 
+bool FrameRecombiner::bfactorsGiven()
+{
+	return bfacFn != "";
+}
+
+void FrameRecombiner::setBfactorFile(std::string fn)
+{
+	bfacFn = fn;
+}
+
 std::vector<MetaDataTable> FrameRecombiner::findUnfinishedJobs(
 		const std::vector<MetaDataTable> &mdts, std::string path)
 {
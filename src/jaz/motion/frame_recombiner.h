@@ -47,13 +47,19 @@ class FrameRecombiner
 		          ObservationModel* obsModel,
 		          MicrographHandler* micrographHandler);
 
-		void process(const std::vector<MetaDataTable>& mdts, long g_start, long g_end);
+		void process(const std::vector<MetaDataTable>& mdts, long g_start, long g_end, bool show_progress = true);
 
 		bool doingRecombination();
 		
 		// has a max. freq. parameter been supplied?
 		bool outerFreqKnown();
 
+		// have B/k-factors been supplied (--bfactors)?
+		bool bfactorsGiven();
+
+		// use B/k-factors from a STAR file instead of fitting them to the FCCs
+		void setBfactorFile(std::string fn);
+
 		std::vector<MetaDataTable> findUnfinishedJobs(const std::vector<MetaDataTable>& mdts,
 		                                              std::string path);
 		
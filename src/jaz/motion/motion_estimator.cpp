@@ -183,7 +183,7 @@ void MotionEstimator::init(
 	ready = true;
 }
 
-void MotionEstimator::process(const std::vector<MetaDataTable>& mdts, long g_start, long g_end)
+void MotionEstimator::process(const std::vector<MetaDataTable>& mdts, long g_start, long g_end, bool show_progress)
 {
 	if (!ready)
 	{
@@ -193,7 +193,7 @@ void MotionEstimator::process(const std::vector<MetaDataTable>& mdts, long g_sta
 	int barstep = 1;
 	int my_nr_micrographs = g_end - g_start + 1;
 
-	if (verb > 0)
+	if (verb > 0 && show_progress)
 	{
 		std::cout << " + Performing loop over micrographs ... " << std::endl;
 		if (!debug) init_progress_bar(my_nr_micrographs);
@@ -359,13 +359,13 @@ void MotionEstimator::process(const std::vector<MetaDataTable>& mdts, long g_sta
 
 		nr_done++;
 
-		if (!debug && verb > 0 && nr_done % barstep == 0)
+		if (!debug && verb > 0 && show_progress && nr_done % barstep == 0)
 		{
 			progress_bar(nr_done);
 		}
 	}
 
-	if (!debug && verb > 0)
+	if (!debug && verb > 0 && show_progress)
 	{
 		progress_bar(my_nr_micrographs);
 	}
@@ -46,7 +46,7 @@ class MotionEstimator
                   ObservationModel* obsModel,
                   MicrographHandler* micrographHandler);
 
-        void process(const std::vector<MetaDataTable> &mdts, long g_start, long g_end);
+        void process(const std::vector<MetaDataTable> &mdts, long g_start, long g_end, bool show_progress = true);
 
 
         // load micrograph from mdt and compute all data required for the optimization;
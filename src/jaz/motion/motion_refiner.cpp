@@ -38,6 +38,8 @@
 #include "gp_motion_fit.h"
 #include "motion_helper.h"
 
+#include <set>
+
 using namespace gravis;
 
 MotionRefiner::MotionRefiner()
@@ -76,6 +78,8 @@ void MotionRefiner::read(int argc, char **argv)
 	maxMG = textToInteger(parser.getOption("--max_MG", "Last micrograph index (default is to process all)", "-1"));
 	
 	micrographHandler.saveMem = parser.checkOption("--sbs", "Load movies slice-by-slice to save memory (slower)");
+	singlePass = parser.checkOption("--single_pass", "Estimate the motion and recombine the frames of each micrograph in one go, reading each movie only once (needs --combine_frames)");
+	bfacMG = textToInteger(parser.getOption("--bfac_micrographs", "Number of micrographs whose FCCs determine the B-factors before the single pass (ignored with --bfactors)", "100"));
 	
 	parser.addSection("Expert options");
 	
@@ -292,6 +296,31 @@ void MotionRefiner::init()
 		recombMdts = chosenMdts;
 	}
 	
+	if (singlePass)
+	{
+		if (!frameRecombiner.doingRecombination())
+		{
+			REPORT_ERROR("ERROR: --single_pass requires --combine_frames.");
+		}
+		
+		if (micrographHandler.saveMem)
+		{
+			REPORT_ERROR("ERROR: --single_pass keeps the frames of a movie in memory; it cannot be combined with --sbs.");
+		}
+		
+		if (motionParamEstimator.anythingToDo())
+		{
+			REPORT_ERROR("ERROR: --single_pass cannot be combined with parameter estimation.");
+		}
+		
+		if (bfacMG < 1 && !frameRecombiner.bfactorsGiven())
+		{
+			REPORT_ERROR("ERROR: --single_pass needs at least one micrograph for the B-factors (--bfac_micrographs), or --bfactors.");
+		}
+		
+		initSinglePass();
+	}
+	
 	estimateParams = motionParamEstimator.anythingToDo();
 	estimateMotion = motionMdts.size() > 0;
 	recombineFrames = frameRecombiner.doingRecombination() && 
@@ -344,18 +373,57 @@ void MotionRefiner::run()
 		// @TODO: apply the optimized parameters, then continue with motion estimation
 	}
 	
+	if (singlePass)
+	{
+		// first, estimate the FCCs on a subset of the movies
+		if (bfacMdts.size() > 0)
+		{
+			motionEstimator.process(bfacMdts, 0, bfacMdts.size()-1);
+		}
+		
+		// then process all other movies, simultaneously estimating tracks and recombining
+		if (recombineFrames)
+		{
+			double k_out_A = reference.pixToAng(reference.k_out);
+			
+			frameRecombiner.init(
+				allMdts, verb, reference.s, fc, k_out_A, reference.angpix,
+				nr_omp_threads, outPath, debug,
+				&reference, &obsModel, &micrographHandler);
+		}
+		
+		const long total_nr_micrographs = singlePassMdts.size();
+		
+		if (verb > 0 && total_nr_micrographs > 0)
+		{
+			std::cout << " + Estimating motion and combining frames for all micrographs ... " << std::endl;
+			init_progress_bar(total_nr_micrographs);
+		}
+		
+		for (long g = 0; g < total_nr_micrographs; g++)
+		{
+			processSinglePass(g, g);
+			
+			if (verb > 0)
+				progress_bar(g + 1);
+		}
+		
+		if (generateStar)
+		{
+			combineEPSAndSTARfiles();
+		}
+		
+		return;
+	}
+	
 	// The subsets will be used in openMPI parallelisation: instead of over g0->gc,
 	// they will be over smaller subsets
 	
-	// TODO: TAKANORI: first, estimate FCC on only a subset of movies here
 	if (estimateMotion)
 	{
 		motionEstimator.process(motionMdts, 0, motionMdts.size()-1);
 	}
 	
-	// TODO: TAKANORI: then process all movies, simultaneously estimating tracks and recombining.
-	//                 micrograph handler can cache movie frames to avoid reading movies twice.
-	//                 (if --sbs, don't cache to save memory)
 	if (recombineFrames)
 	{
 		double k_out_A = reference.pixToAng(reference.k_out);
@@ -374,6 +442,98 @@ void MotionRefiner::run()
 	}
 }
 
+void MotionRefiner::initSinglePass()
+{
+	micrographHandler.cacheMovie = true;
+	
+	bfacMdts.clear();
+	
+	// The B/k-factors are fitted to the FCCs of the micrographs whose motion has been
+	// estimated, so they have to be known before the first micrograph is recombined.
+	if (!frameRecombiner.bfactorsGiven())
+	{
+		if (only_do_unfinished && exists(outPath + "bfactors.star"))
+		{
+			// keep weighting the frames as in the micrographs that have already been recombined
+			frameRecombiner.setBfactorFile(outPath + "bfactors.star");
+			
+			if (verb > 0)
+			{
+				std::cout << "   - Will use the B-factors in " << outPath << "bfactors.star" << std::endl;
+			}
+		}
+		else
+		{
+			// micrographs with finished motion estimation already contribute their FCCs
+			long bfac_nr_micrographs = bfacMG - (long)(chosenMdts.size() - motionMdts.size());
+			
+			if (bfac_nr_micrographs < 0) bfac_nr_micrographs = 0;
+			if (bfac_nr_micrographs > motionMdts.size()) bfac_nr_micrographs = motionMdts.size();
+			
+			bfacMdts = std::vector<MetaDataTable>(motionMdts.begin(), motionMdts.begin() + bfac_nr_micrographs);
+		}
+	}
+	
+	std::set<std::string> motionToDo, recombToDo;
+	
+	for (long g = bfacMdts.size(); g < motionMdts.size(); g++)
+	{
+		motionToDo.insert(getOutputFileNameRoot(outPath, motionMdts[g]));
+	}
+	
+	for (long g = 0; g < recombMdts.size(); g++)
+	{
+		recombToDo.insert(getOutputFileNameRoot(outPath, recombMdts[g]));
+	}
+	
+	singlePassMdts.clear();
+	singlePassMotion.clear();
+	singlePassRecomb.clear();
+	
+	for (long g = 0; g < chosenMdts.size(); g++)
+	{
+		const std::string fn_root = getOutputFileNameRoot(outPath, chosenMdts[g]);
+		const bool doMotion = motionToDo.find(fn_root) != motionToDo.end();
+		const bool doRecomb = recombToDo.find(fn_root) != recombToDo.end();
+		
+		if (doMotion || doRecomb)
+		{
+			singlePassMdts.push_back(chosenMdts[g]);
+			singlePassMotion.push_back(doMotion);
+			singlePassRecomb.push_back(doRecomb);
+		}
+	}
+	
+	if (verb > 0)
+	{
+		if (bfacMdts.size() > 0)
+		{
+			std::cout << "   - Will estimate motion for " << bfacMdts.size()
+			          << " micrographs to determine the B-factors" << std::endl;
+		}
+		
+		std::cout << "   - Will process " << singlePassMdts.size()
+		          << " micrographs in a single pass" << std::endl;
+	}
+}
+
+void MotionRefiner::processSinglePass(long g_start, long g_end)
+{
+	for (long g = g_start; g <= g_end; g++)
+	{
+		// both steps load the same movie, which micrographHandler keeps in memory
+		if (singlePassMotion[g])
+		{
+			motionEstimator.process(singlePassMdts, g, g, false);
+		}
+		
+		if (singlePassRecomb[g])
+		{
+			frameRecombiner.process(singlePassMdts, g, g, false);
+		}
+	}
+}
+
 int MotionRefiner::getVerbosityLevel()
 {
 	return verb;
@@ -95,12 +95,28 @@ class MotionRefiner
 		
 		long maxMG, minMG;
 		
+		// Estimate the motion and recombine the frames of each micrograph in one go,
+		// after estimating the motion of bfacMG micrographs for the B/k-factors
+		bool singlePass;
+		long bfacMG;
+		
 		MetaDataTable mdt0;
 		
 		std::vector<MetaDataTable>
 			allMdts, // all micrographs (used for B-factor computation)
 			chosenMdts, // micrographs between minMG and maxMG
-			motionMdts, recombMdts; // unfinished micrographs
+			motionMdts, recombMdts, // unfinished micrographs
+			bfacMdts, // micrographs whose FCCs determine the B/k-factors (single pass)
+			singlePassMdts; // unfinished micrographs after bfacMdts (single pass)
+		
+		// what remains to be done for each of singlePassMdts
+		std::vector<bool> singlePassMotion, singlePassRecomb;
+		
+		// select bfacMdts and singlePassMdts
+		void initSinglePass();
+		
+		// estimate motion and/or recombine frames for singlePassMdts[g_start] to [g_end]
+		void processSinglePass(long g_start, long g_end);
 		
 		// combine all EPS files into one logfile.pdf
 		void combineEPSAndSTARfiles();
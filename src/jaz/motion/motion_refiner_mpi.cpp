@@ -57,16 +57,38 @@ void MotionRefinerMpi::run()
 
 	// Parallel loop over micrographs
 
+	if (singlePass)
+	{
+		runSinglePass();
+		return;
+	}
+
     if (estimateMotion)
 	{
         long int total_nr_micrographs = motionMdts.size();
 
-		// Each node does part of the work
-		long int my_first_micrograph, my_last_micrograph, my_nr_micrographs;
-		divide_equally(total_nr_micrographs, node->size, node->rank, my_first_micrograph, my_last_micrograph);
-		my_nr_micrographs = my_last_micrograph - my_first_micrograph + 1;
+		// Each node fetches chunks of micrographs to work on
+		MpiTaskDistributor distributor(node, total_nr_micrographs);
+
+		if (verb > 0)
+		{
+			std::cout << " + Performing loop over micrographs ... " << std::endl;
+			init_progress_bar(total_nr_micrographs);
+		}
+
+		long int my_first_micrograph, my_last_micrograph;
+		while (distributor.getTasks(my_first_micrograph, my_last_micrograph))
+		{
+			motionEstimator.process(motionMdts, my_first_micrograph, my_last_micrograph, false);
+
+			if (verb > 0)
+				progress_bar(my_last_micrograph + 1);
+		}
 
-        motionEstimator.process(motionMdts, my_first_micrograph, my_last_micrograph);
+		if (verb > 0)
+			progress_bar(total_nr_micrographs);
+
+		distributor.reportUtilisation();
 	}
 
 	MPI_Barrier(MPI_COMM_WORLD);
@@ -75,12 +97,6 @@ void MotionRefinerMpi::run()
     {
         long int total_nr_micrographs = recombMdts.size();
 
-        // Each node does part of the work
-        long int my_first_micrograph, my_last_micrograph, my_nr_micrographs;
-        divide_equally(total_nr_micrographs, node->size, node->rank,
-                       my_first_micrograph, my_last_micrograph);
-        my_nr_micrographs = my_last_micrograph - my_first_micrograph + 1;
-
 		double k_out_A = reference.pixToAng(reference.k_out);
 
         frameRecombiner.init(
@@ -89,7 +105,28 @@ void MotionRefinerMpi::run()
 			nr_omp_threads, outPath, debug,
             &reference, &obsModel, &micrographHandler);
 
-        frameRecombiner.process(recombMdts, my_first_micrograph, my_last_micrograph);
+		// Each node fetches chunks of micrographs to work on
+		MpiTaskDistributor distributor(node, total_nr_micrographs);
+
+		if (verb > 0)
+		{
+			std::cout << " + Combining frames for all micrographs ... " << std::endl;
+			init_progress_bar(total_nr_micrographs);
+		}
+
+		long int my_first_micrograph, my_last_micrograph;
+		while (distributor.getTasks(my_first_micrograph, my_last_micrograph))
+		{
+			frameRecombiner.process(recombMdts, my_first_micrograph, my_last_micrograph, false);
+
+			if (verb > 0)
+				progress_bar(my_last_micrograph + 1);
+		}
+
+		if (verb > 0)
+			progress_bar(total_nr_micrographs);
+
+		distributor.reportUtilisation();
 	}
 
 	MPI_Barrier(MPI_COMM_WORLD);
@@ -99,3 +136,83 @@ void MotionRefinerMpi::run()
 		combineEPSAndSTARfiles();
 	}
 }
+
+void MotionRefinerMpi::runSinglePass()
+{
+	// first, estimate the FCCs on a subset of the movies
+	if (bfacMdts.size() > 0)
+	{
+		long int total_nr_micrographs = bfacMdts.size();
+
+		MpiTaskDistributor distributor(node, total_nr_micrographs);
+
+		if (verb > 0)
+		{
+			std::cout << " + Estimating motion for the B-factors ... " << std::endl;
+			init_progress_bar(total_nr_micrographs);
+		}
+
+		long int my_first_micrograph, my_last_micrograph;
+		while (distributor.getTasks(my_first_micrograph, my_last_micrograph))
+		{
+			motionEstimator.process(bfacMdts, my_first_micrograph, my_last_micrograph, false);
+
+			if (verb > 0)
+				progress_bar(my_last_micrograph + 1);
+		}
+
+		if (verb > 0)
+			progress_bar(total_nr_micrographs);
+
+		distributor.reportUtilisation();
+	}
+
+	// all FCCs have to be written before the B-factors are fitted
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	// then process all other movies, simultaneously estimating tracks and recombining
+	if (recombineFrames)
+	{
+		double k_out_A = reference.pixToAng(reference.k_out);
+
+		frameRecombiner.init(
+			allMdts,
+			verb, reference.s, fc, k_out_A, reference.angpix,
+			nr_omp_threads, outPath, debug,
+			&reference, &obsModel, &micrographHandler);
+	}
+
+	if (singlePassMdts.size() > 0)
+	{
+		long int total_nr_micrographs = singlePassMdts.size();
+
+		MpiTaskDistributor distributor(node, total_nr_micrographs);
+
+		if (verb > 0)
+		{
+			std::cout << " + Estimating motion and combining frames for all micrographs ... " << std::endl;
+			init_progress_bar(total_nr_micrographs);
+		}
+
+		long int my_first_micrograph, my_last_micrograph;
+		while (distributor.getTasks(my_first_micrograph, my_last_micrograph))
+		{
+			processSinglePass(my_first_micrograph, my_last_micrograph);
+
+			if (verb > 0)
+				progress_bar(my_last_micrograph + 1);
+		}
+
+		if (verb > 0)
+			progress_bar(total_nr_micrographs);
+
+		distributor.reportUtilisation();
+	}
+
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	if (generateStar && node->isLeader())
+	{
+		combineEPSAndSTARfiles();
+	}
+}
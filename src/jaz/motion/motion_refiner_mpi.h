@@ -46,6 +46,9 @@ public:
 	// Parallelized run function
     void run();
 
+	// Parallelized run function for --single_pass
+	void runSinglePass();
+
 };
 
 
@@ -133,6 +133,36 @@ void BackprojectionHelper::backprojectRaw(
         gravis::d3Vector origin, double spacing, 
 		InterpolationType interpolation, double taperX, double taperY, 
 		double wMin, int frame0, int frames)
+{
+    const int ic = frames > 0? frames + frame0 : stack.images.size();
+
+    std::cout << frame0 << " - " << (ic-1) << "\n";
+
+    backprojectSlab(stack, dest, maskDest, origin, spacing, 0,
+                    interpolation, taperX, taperY, frame0, frames);
+
+    double mean = 0.0, sum = 0.0;
+
+    FOR_ALL_VOXELS(dest)
+    {
+        mean += maskDest(x,y,z)*dest(x,y,z);
+        sum += maskDest(x,y,z);
+    }
+
+	if (sum > 0.0)
+	{
+		mean /= sum;
+	}
+
+    fillLowWeightVoxels(dest, maskDest, mean, wMin);
+}
+
+void BackprojectionHelper::backprojectSlab(
+		const TomoStack& stack,
+        Volume<RFLOAT>& dest, Volume<RFLOAT>& maskDest,
+        gravis::d3Vector origin, double spacing, int z0,
+		InterpolationType interpolation, double taperX, double taperY,
+		int frame0, int frames)
 {
     d4Matrix vol2world;
 
@@ -141,17 +171,10 @@ void BackprojectionHelper::backprojectRaw(
     vol2world(2,2) = spacing;
     vol2world(0,3) = origin.x;
     vol2world(1,3) = origin.y;
-    vol2world(2,3) = origin.z;
-	
-	/*std::cout << "vol2world: \n" << vol2world << "\n";
-	std::cout << "stack.worldToImage[0]: \n" << stack.worldToImage[0] << "\n";
-	std::cout << "vol2img[0]: \n" << (stack.worldToImage[0] * vol2world) << "\n";*/
-	
+    vol2world(2,3) = origin.z + z0 * spacing;
 
     const int ic = frames > 0? frames + frame0 : stack.images.size();
 
-    std::cout << frame0 << " - " << (ic-1) << "\n";
-
     std::vector<d4Matrix> vol2img(ic);
 
     for (int im = 0; im < ic; im++)
@@ -159,65 +182,125 @@ void BackprojectionHelper::backprojectRaw(
         vol2img[im] = stack.worldToImage[im] * vol2world;
     }
 
-    /*#if JAZ_USE_OPENMP
-    #pragma omp parallel for
-    #endif*/
-	
-	/*std::vector<Image<RFLOAT>> debugImgs(ic);
-	for (int im = frame0; im < ic; im++)
-	{
-		debugImgs[im] = stack.images[im];
-	}*/
-	
-    FOR_ALL_VOXELS(dest)
-    {
-        double sum = 0.0;
-        double wgh = 0.0;
+    maskDest.resize(dest);
 
-        d4Vector pw(x,y,z,1.0);
+    const long int w = dest.dimx;
+    const long int rows = dest.dimy * dest.dimz;
 
-        for (int im = frame0; im < ic; im++)
+    /* Each row of voxels maps onto a straight line in every tilt image, so the image
+       position is stepped along x instead of multiplying every voxel with vol2img.
+       The rows are independent; the accumulators of one row stay in cache while all
+       the tilts are added to it. */
+
+    #if JAZ_USE_OPENMP
+    #pragma omp parallel
+    #endif
+    {
+        std::vector<double> sumRow(w), wghRow(w);
+
+        #if JAZ_USE_OPENMP
+        #pragma omp for
+        #endif
+        for (long int r = 0; r < rows; r++)
         {
-            d4Vector pi = vol2img[im] * pw;
+            const long int y = r % dest.dimy;
+            const long int z = r / dest.dimy;
 
-            if (Interpolation::isInSlice(stack.images[im], pi.x, pi.y))
+            for (long int x = 0; x < w; x++)
             {
-                double wghi = Interpolation::getTaperWeight(stack.images[im], pi.x, pi.y, taperX, taperY);
+                sumRow[x] = 0.0;
+                wghRow[x] = 0.0;
+            }
 
-                if (interpolation == Linear)
-                {
-                    sum += wghi * Interpolation::linearXY(stack.images[im], pi.x, pi.y, 0);
-                }
-                else
+            for (int im = frame0; im < ic; im++)
+            {
+                const d4Matrix& A = vol2img[im];
+                const Image<RFLOAT>& img = stack.images[im];
+
+                // image position of voxel (0,y,z) and its increment per voxel in x
+                const double px0 = A(0,1) * y + A(0,2) * z + A(0,3);
+                const double py0 = A(1,1) * y + A(1,2) * z + A(1,3);
+                const double dpx = A(0,0);
+                const double dpy = A(1,0);
+
+                const long int wi = img.data.xdim;
+                const long int hi = img.data.ydim;
+                const RFLOAT* data = MULTIDIM_ARRAY(img.data);
+
+                for (long int x = 0; x < w; x++)
                 {
-                    sum += wghi * Interpolation::cubicXY(stack.images[im], pi.x, pi.y, 0);
-                }
-				
-				//debugImgs[im]((int)(pi.y+0.5), (int)(pi.x+0.5)) += 1000.0;
+                    const double px = px0 + x * dpx;
+                    const double py = py0 + x * dpy;
+
+                    if (!(px >= 0.0 && px < wi-1 && py >= 0.0 && py < hi-1)) continue;
+
+                    const double wghi = Interpolation::getTaperWeight(img, px, py, taperX, taperY);
+
+                    double val;
 
-                wgh += wghi;
+                    if (interpolation == Linear)
+                    {
+                        const long int xi = (long int)px;
+                        const long int yi = (long int)py;
+
+                        const double xf = px - xi;
+                        const double yf = py - yi;
+
+                        const RFLOAT* row0 = data + yi * wi + xi;
+                        const RFLOAT* row1 = row0 + wi;
+
+                        const double f0 = xf * row0[1] + (1.0 - xf) * row0[0];
+                        const double f1 = xf * row1[1] + (1.0 - xf) * row1[0];
+
+                        val = yf * f1 + (1.0 - yf) * f0;
+                    }
+                    else
+                    {
+                        val = Interpolation::cubicXY(img, px, py, 0);
+                    }
+
+                    sumRow[x] += wghi * val;
+                    wghRow[x] += wghi;
+                }
             }
-        }
 
-        if (wgh > 0.0)
-        {
-            sum /= wgh;
+            for (long int x = 0; x < w; x++)
+            {
+                dest(x,y,z) = wghRow[x] > 0.0? sumRow[x] / wghRow[x] : sumRow[x];
+                maskDest(x,y,z) = wghRow[x];
+            }
         }
-
-        dest(x,y,z) = sum;
-        maskDest(x,y,z) = wgh;
     }
-	
-	/*JazConfig::writeMrc = false;
-	JazConfig::writeVtk = true;
-	ImageLog::write(debugImgs, "debug_imgs");*/
+}
+
+void BackprojectionHelper::backprojectRawBricked(
+		const TomoStack& stack,
+		BrickedVolume<RFLOAT>& dest,
+		gravis::d3Vector origin, double spacing, int slabDepth,
+		InterpolationType interpolation, double taperX, double taperY,
+		double wMin, int frame0, int frames)
+{
+    BrickedVolume<RFLOAT> weight(dest.dimx, dest.dimy, dest.dimz, dest.brickSize);
 
     double mean = 0.0, sum = 0.0;
 
-    FOR_ALL_VOXELS(dest)
+    for (long int z0 = 0; z0 < dest.dimz; z0 += slabDepth)
     {
-        mean += maskDest(x,y,z)*dest(x,y,z);
-        sum += maskDest(x,y,z);
+        const long int d = std::min((long int)slabDepth, dest.dimz - z0);
+
+        Volume<RFLOAT> slab(dest.dimx, dest.dimy, d), slabWeight(dest.dimx, dest.dimy, d);
+
+        backprojectSlab(stack, slab, slabWeight, origin, spacing, z0,
+                        interpolation, taperX, taperY, frame0, frames);
+
+        FOR_ALL_VOXELS(slab)
+        {
+            mean += slabWeight(x,y,z)*slab(x,y,z);
+            sum += slabWeight(x,y,z);
+        }
+
+        dest.writeSlab(z0, slab);
+        weight.writeSlab(z0, slabWeight);
     }
 
 	if (sum > 0.0)
@@ -225,6 +308,24 @@ void BackprojectionHelper::backprojectRaw(
 		mean /= sum;
 	}
 
+    for (long int z0 = 0; z0 < dest.dimz; z0 += slabDepth)
+    {
+        const long int d = std::min((long int)slabDepth, dest.dimz - z0);
+
+        Volume<RFLOAT> slab(dest.dimx, dest.dimy, d), slabWeight(dest.dimx, dest.dimy, d);
+
+        dest.readSlab(z0, slab);
+        weight.readSlab(z0, slabWeight);
+
+        fillLowWeightVoxels(slab, slabWeight, mean, wMin);
+
+        dest.writeSlab(z0, slab);
+    }
+}
+
+void BackprojectionHelper::fillLowWeightVoxels(
+		Volume<RFLOAT>& dest, const Volume<RFLOAT>& maskDest, double mean, double wMin)
+{
     #if JAZ_USE_OPENMP
     #pragma omp parallel for
     #endif
@@ -377,25 +478,39 @@ void BackprojectionHelper::backprojectDots(
     dest.fill(0.0);
     streakVol.fill(0.0);
 
+    /* As in backprojectSlab, the image position is stepped along each row of voxels
+       instead of multiplying every voxel with vol2img, and the rows are distributed
+       over the threads.*/
+
+    const long int rows = (long int)hv * dv;
+
     #if JAZ_USE_OPENMP
     #pragma omp parallel for
     #endif
-    FOR_ALL_VOXELS(streakVol)
+    for (long int r = 0; r < rows; r++)
     {
+        const long int y = r % hv;
+        const long int z = r / hv;
+
         for (int im = 0; im < ic; im++)
         {
-            d4Vector pw(x,y,z,1.0);
-            d4Vector pi = vol2img[im] * pw;
-            d4Vector d = pi - volOrigImg[im];
+            const d4Matrix& A = vol2img[im];
 
-            double dx, dy;
+            // offset from the projected origin of voxel (0,y,z) and its increment per voxel in x
+            const double dx0 = A(0,1) * y + A(0,2) * z + A(0,3) - volOrigImg[im].x;
+            const double dy0 = A(1,1) * y + A(1,2) * z + A(1,3) - volOrigImg[im].y;
+            const double ddx = A(0,0);
+            const double ddy = A(1,0);
 
-            if (d.x < -1 || d.x > 1) dx = 0.0;
-            else dx = 1.0 - std::abs(d.x);
-            if (d.y < -1 || d.y > 1) dy = 0.0;
-            else dy = 1.0 - std::abs(d.y);
+            for (long int x = 0; x < wv; x++)
+            {
+                const double ex = dx0 + x * ddx;
+                const double ey = dy0 + x * ddy;
 
-            streakVol(x,y,z) += dx*dy;
+                if (ex < -1 || ex > 1 || ey < -1 || ey > 1) continue;
+
+                streakVol(x,y,z) += (1.0 - std::abs(ex)) * (1.0 - std::abs(ey));
+            }
         }
     }
 
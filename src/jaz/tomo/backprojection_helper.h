@@ -23,6 +23,7 @@
 
 #include <src/image.h>
 #include <src/jaz/volume.h>
+#include <src/jaz/bricked_volume.h>
 #include "tomo_stack.h"
 #include <src/jaz/gravis/t3Vector.h>
 #include <string>
@@ -47,6 +48,34 @@ class BackprojectionHelper
 						double taperX = 20, double taperY = 20, 
 						double wMin = 3.0, int frame0 = 0, int frames = -1);
 
+        /* Backprojects the slab of dest.dimz slices starting at slice z0 of the volume
+           given by origin and spacing. dest receives the weighted average of the tilt images,
+           maskDest the sum of weights. A tomogram can be reconstructed slab by slab
+           to keep only a part of it in memory.*/
+        static void backprojectSlab(
+						const TomoStack& stack,
+						Volume<RFLOAT>& dest, Volume<RFLOAT>& maskDest,
+						gravis::d3Vector origin, double spacing, int z0,
+						InterpolationType interpolation = Linear,
+						double taperX = 20, double taperY = 20,
+						int frame0 = 0, int frames = -1);
+
+        /* Same as backprojectRaw, but into an out-of-core volume: only slabDepth slices
+           of the tomogram (and their weights) are held in memory at any time.*/
+        static void backprojectRawBricked(
+						const TomoStack& stack,
+						BrickedVolume<RFLOAT>& dest,
+						gravis::d3Vector origin, double spacing = 1.0,
+						int slabDepth = 16,
+						InterpolationType interpolation = Linear,
+						double taperX = 20, double taperY = 20,
+						double wMin = 3.0, int frame0 = 0, int frames = -1);
+
+        /* Blends voxels with a total weight below wMin towards mean.*/
+        static void fillLowWeightVoxels(
+						Volume<RFLOAT>& dest, const Volume<RFLOAT>& maskDest,
+						double mean, double wMin);
+
         static void backprojectExactWeights(const TomoStack& stack,
                                 Volume<RFLOAT>& dest,
                                 gravis::d3Vector origin, double spacing = 1.0,
@@ -295,13 +295,167 @@ void softMaskOutsideMap(MultidimArray<RFLOAT> &vol, MultidimArray<RFLOAT> &msk,
 
 }
 
+// 1D lower envelope of parabolas (Felzenszwalb & Huttenlocher, 2012)
+// f holds the squared distances along the line on input; d gets the squared distances on output
+// v and z are work buffers of size n and n+1
+static void squaredDistanceTransform1D(const RFLOAT *f, RFLOAT *d, int *v, RFLOAT *z, long int n)
+{
+	long int k = 0;
+	v[0] = 0;
+	z[0] = -DT_INFINITY;
+	z[1] = DT_INFINITY;
+	for (long int q = 1; q < n; q++)
+	{
+		// Lines without any feature up to here contribute nothing
+		if (f[q] >= DT_INFINITY)
+			continue;
+		if (f[v[k]] >= DT_INFINITY)
+		{
+			v[k] = q;
+			continue;
+		}
+		RFLOAT s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2. * (q - v[k]));
+		while (s <= z[k])
+		{
+			k--;
+			s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2. * (q - v[k]));
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = DT_INFINITY;
+	}
+
+	if (f[v[0]] >= DT_INFINITY)
+	{
+		for (long int q = 0; q < n; q++)
+			d[q] = DT_INFINITY;
+		return;
+	}
+
+	k = 0;
+	for (long int q = 0; q < n; q++)
+	{
+		while (z[k + 1] < q)
+			k++;
+		d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+	}
+}
+
+void squaredDistanceTransform(const MultidimArray<RFLOAT> &msk, MultidimArray<RFLOAT> &dist2,
+		RFLOAT threshold, bool features_above, int n_threads)
+{
+	dist2.resize(msk);
+
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(msk)
+	{
+		RFLOAT val = DIRECT_MULTIDIM_ELEM(msk, n);
+		bool is_feature = (features_above) ? (val > threshold) : (val < threshold);
+		DIRECT_MULTIDIM_ELEM(dist2, n) = (is_feature) ? 0. : DT_INFINITY;
+	}
+
+	const long int xdim = XSIZE(dist2), ydim = YSIZE(dist2), zdim = ZSIZE(dist2);
+	const long int maxdim = XMIPP_MAX(xdim, XMIPP_MAX(ydim, zdim));
+
+	// Three separable passes: along X, Y and Z. The lines within each pass are independent.
+	for (int axis = 0; axis < 3; axis++)
+	{
+		long int len, stride, nr_lines;
+		if (axis == 0)
+		{
+			len = xdim; stride = 1; nr_lines = ydim * zdim;
+		}
+		else if (axis == 1)
+		{
+			len = ydim; stride = xdim; nr_lines = xdim * zdim;
+		}
+		else
+		{
+			len = zdim; stride = xdim * ydim; nr_lines = xdim * ydim;
+		}
+		if (len < 2)
+			continue;
+
+		#pragma omp parallel num_threads(n_threads)
+		{
+			std::vector<RFLOAT> f(maxdim), d(maxdim), z(maxdim + 1);
+			std::vector<int> v(maxdim);
+
+			#pragma omp for
+			for (long int line = 0; line < nr_lines; line++)
+			{
+				long int first;
+				if (axis == 0)
+					first = line * xdim;
+				else if (axis == 1)
+					first = (line / xdim) * xdim * ydim + (line % xdim);
+				else
+					first = line;
+
+				RFLOAT *ptr = MULTIDIM_ARRAY(dist2) + first;
+				for (long int q = 0; q < len; q++)
+					f[q] = ptr[q * stride];
+				squaredDistanceTransform1D(&f[0], &d[0], &v[0], &z[0], len);
+				for (long int q = 0; q < len; q++)
+					ptr[q * stride] = d[q];
+			}
+		}
+	}
+}
+
+void extendBinaryMask(MultidimArray<RFLOAT> &msk, RFLOAT extend_by, int n_threads)
+{
+	if (extend_by == 0.)
+		return;
+
+	MultidimArray<RFLOAT> dist2;
+	RFLOAT extend_by2 = extend_by * extend_by;
+	if (extend_by > 0.)
+	{
+		// Set zero voxels to 1 if a voxel with value 1 is within distance extend_by
+		squaredDistanceTransform(msk, dist2, 0.999, true, n_threads);
+		#pragma omp parallel for num_threads(n_threads)
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(msk)
+		{
+			if (DIRECT_MULTIDIM_ELEM(msk, n) < 0.001 && DIRECT_MULTIDIM_ELEM(dist2, n) < extend_by2)
+				DIRECT_MULTIDIM_ELEM(msk, n) = 1.;
+		}
+	}
+	else
+	{
+		// Set one voxels to 0 if a voxel with value 0 is within distance -extend_by
+		squaredDistanceTransform(msk, dist2, 0.001, false, n_threads);
+		#pragma omp parallel for num_threads(n_threads)
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(msk)
+		{
+			if (DIRECT_MULTIDIM_ELEM(msk, n) > 0.999 && DIRECT_MULTIDIM_ELEM(dist2, n) < extend_by2)
+				DIRECT_MULTIDIM_ELEM(msk, n) = 0.;
+		}
+	}
+}
+
+void addSoftEdgeToBinaryMask(MultidimArray<RFLOAT> &msk, RFLOAT width_soft_edge, int n_threads)
+{
+	if (width_soft_edge <= 0.)
+		return;
+
+	MultidimArray<RFLOAT> dist2;
+	RFLOAT width_soft_edge2 = width_soft_edge * width_soft_edge;
+	squaredDistanceTransform(msk, dist2, 0.999, true, n_threads);
+
+	// only extend zero values to values between 0 and 1.
+	#pragma omp parallel for num_threads(n_threads)
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(msk)
+	{
+		if (DIRECT_MULTIDIM_ELEM(msk, n) < 0.001 && DIRECT_MULTIDIM_ELEM(dist2, n) < width_soft_edge2)
+			DIRECT_MULTIDIM_ELEM(msk, n) = 0.5 + 0.5 * cos(PI * sqrt(DIRECT_MULTIDIM_ELEM(dist2, n)) / width_soft_edge);
+	}
+}
+
 void autoMask(MultidimArray<RFLOAT> &img_in, MultidimArray<RFLOAT> &msk_out,
 		RFLOAT ini_mask_density_threshold, RFLOAT extend_ini_mask, RFLOAT width_soft_mask_edge, bool verb, int n_threads)
 
 {
-	MultidimArray<RFLOAT> msk_cp;
-	int barstep, update_bar, totalbar;
-
 	// Resize output mask
 	img_in.setXmippOrigin();
 	msk_out.clear();
@@ -316,7 +470,7 @@ void autoMask(MultidimArray<RFLOAT> &img_in, MultidimArray<RFLOAT> &msk_out,
 			DIRECT_MULTIDIM_ELEM(msk_out, n) = 0.;
 	}
 
-	// B. extend/shrink initial binary mask. To save memory store a temporary copy of Im in I1
+	// B. extend/shrink initial binary mask, using a distance transform to the nearest (non-)masked voxel
 	if (extend_ini_mask > 0. || extend_ini_mask < 0.)
 	{
 		if (verb)
@@ -325,182 +479,16 @@ void autoMask(MultidimArray<RFLOAT> &img_in, MultidimArray<RFLOAT> &msk_out,
 				std::cout << "== Extending initial binary mask ..." << std::endl;
 			else
 				std::cout << "== Shrinking initial binary mask ..." << std::endl;
-			init_progress_bar(MULTIDIM_SIZE(img_in) / n_threads);
-			barstep = MULTIDIM_SIZE(img_in) / 120 / n_threads;
-			update_bar = 0;
-			totalbar =0;
 		}
-
-		int extend_size = ABS(CEIL(extend_ini_mask));
-		RFLOAT extend_ini_mask2 = extend_ini_mask * extend_ini_mask;
-		msk_cp = msk_out;
-		if (extend_ini_mask > 0.)
-		{
-			#pragma omp parallel for num_threads(n_threads)
-			FOR_ALL_ELEMENTS_IN_ARRAY3D(msk_cp)
-			{
-				// only extend zero values to 1.
-				if (A3D_ELEM(msk_cp, k, i, j) < 0.001)
-				{
-					bool already_done = false;
-					for (long int kp = k - extend_size; kp <= k + extend_size; kp++)
-					{
-						for (long int ip = i - extend_size; ip <= i + extend_size; ip++)
-						{
-							for (long int jp = j - extend_size; jp <= j + extend_size; jp++)
-							{
-								if ((kp >= STARTINGZ(msk_cp) && kp <= FINISHINGZ(msk_cp)) &&
-									(ip >= STARTINGY(msk_cp) && ip <= FINISHINGY(msk_cp)) &&
-									(jp >= STARTINGX(msk_cp) && jp <= FINISHINGX(msk_cp)))
-								{
-									// only check distance if neighbouring Im() is one
-									if (A3D_ELEM(msk_cp, kp, ip, jp) > 0.999)
-									{
-										RFLOAT r2 = (RFLOAT)( (kp-k)*(kp-k) + (ip-i)*(ip-i)+ (jp-j)*(jp-j) );
-										// Set original voxel to 1 if a neghouring with Im()=1 is within distance extend_ini_mask
-										if (r2 < extend_ini_mask2)
-										{
-											A3D_ELEM(msk_out, k, i, j) = 1.;
-											already_done = true;
-										}
-									}
-								}
-								if (already_done) break;
-							}
-							if (already_done) break;
-						}
-						if (already_done) break;
-					}
-				}
-				if (verb && omp_get_thread_num() == 0)
-				{
-					if (update_bar > barstep)
-					{
-						update_bar = 0;
-						progress_bar(totalbar);
-					}
-					update_bar++;
-					totalbar++;
-				}
-			}
-		}
-		else
-		{
-			#pragma omp parallel for num_threads(n_threads)
-			FOR_ALL_ELEMENTS_IN_ARRAY3D(msk_cp)
-			{
-				// only extend one values to zero.
-				if (A3D_ELEM(msk_cp, k, i, j) > 0.999)
-				{
-					bool already_done = false;
-					for (long int kp = k - extend_size; kp <= k + extend_size; kp++)
-					{
-						for (long int ip = i - extend_size; ip <= i + extend_size; ip++)
-						{
-							for (long int jp = j - extend_size; jp <= j + extend_size; jp++)
-							{
-								if ((kp >= STARTINGZ(msk_cp) && kp <= FINISHINGZ(msk_cp)) &&
-									(ip >= STARTINGY(msk_cp) && ip <= FINISHINGY(msk_cp)) &&
-									(jp >= STARTINGX(msk_cp) && jp <= FINISHINGX(msk_cp)))
-								{
-									// only check distance if neighbouring Im() is one
-									if (A3D_ELEM(msk_cp, kp, ip, jp) < 0.001)
-									{
-										RFLOAT r2 = (RFLOAT)( (kp-k)*(kp-k) + (ip-i)*(ip-i)+ (jp-j)*(jp-j) );
-										// Set original voxel to 1 if a neghouring with Im()=1 is within distance extend_ini_mask
-										if (r2 < extend_ini_mask2)
-										{
-											A3D_ELEM(msk_out, k, i, j) = 0.;
-											already_done = true;
-										}
-									}
-								}
-								if (already_done) break;
-							}
-							if (already_done) break;
-						}
-						if (already_done) break;
-					}
-				}
-				if (verb && omp_get_thread_num() == 0)
-				{
-					if (update_bar > barstep)
-					{
-						update_bar = 0;
-						progress_bar(totalbar);
-					}
-					update_bar++;
-					totalbar++;
-				}
-			}
-		}
-		if (verb)
-			progress_bar(MULTIDIM_SIZE(msk_out) / n_threads);
+		extendBinaryMask(msk_out, extend_ini_mask, n_threads);
 	}
 
+	// C. Make a soft edge to the mask
 	if (width_soft_mask_edge > 0.)
 	{
 		if (verb)
-		{
 			std::cout << "== Making a soft edge on the extended mask ..." << std::endl;
-			init_progress_bar(MULTIDIM_SIZE(msk_out) / n_threads);
-			barstep = MULTIDIM_SIZE(msk_out) / 120 / n_threads;
-			update_bar = 0;
-			totalbar =0;
-		}
-		// C. Make a soft edge to the mask
-		// Note that the extended mask is now in I1, and we'll put the soft-edge mask again into Im
-
-		msk_cp = msk_out;
-		int extend_size = CEIL(width_soft_mask_edge);
-		RFLOAT width_soft_mask_edge2 = width_soft_mask_edge * width_soft_mask_edge;
-		#pragma omp parallel for num_threads(n_threads)
-		FOR_ALL_ELEMENTS_IN_ARRAY3D(msk_cp)
-		{
-			// only extend zero values to values between 0 and 1.
-			if (A3D_ELEM(msk_cp, k, i, j) < 0.001)
-			{
-				RFLOAT min_r2 = 9999.;
-				for (long int kp = k - extend_size; kp <= k + extend_size; kp++)
-				{
-					for (long int ip = i - extend_size; ip <= i + extend_size; ip++)
-					{
-						for (long int jp = j - extend_size; jp <= j + extend_size; jp++)
-						{
-							if ((kp >= STARTINGZ(msk_cp) && kp <= FINISHINGZ(msk_cp)) &&
-								(ip >= STARTINGY(msk_cp) && ip <= FINISHINGY(msk_cp)) &&
-								(jp >= STARTINGX(msk_cp) && jp <= FINISHINGX(msk_cp)))
-							{
-								// only update distance to a neighbouring msk_cp is one
-								if (A3D_ELEM(msk_cp, kp, ip, jp) > 0.999)
-								{
-									RFLOAT r2 = (RFLOAT)( (kp-k)*(kp-k) + (ip-i)*(ip-i)+ (jp-j)*(jp-j) );
-									// Set original voxel to 1 if a neghouring with Im()=1 is within distance extend_ini_mask
-									if (r2 < min_r2)
-										min_r2 = r2;
-								}
-							}
-						}
-					}
-				}
-				if (min_r2 < width_soft_mask_edge2)
-				{
-					A3D_ELEM(msk_out, k, i, j) = 0.5 + 0.5 * cos( PI * sqrt(min_r2) / width_soft_mask_edge);
-				}
-			}
-			if (verb && omp_get_thread_num() == 0)
-			{
-				if (update_bar > barstep)
-				{
-					update_bar = 0;
-					progress_bar(totalbar);
-				}
-				update_bar++;
-				totalbar++;
-			}
-		}
-		if (verb)
-			progress_bar(MULTIDIM_SIZE(msk_cp) / n_threads);
+		addSoftEdgeToBinaryMask(msk_out, width_soft_mask_edge, n_threads);
 	}
 
 }
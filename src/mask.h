@@ -48,6 +48,20 @@ void softMaskOutsideMapForHelix(
 // Apply a soft mask and set density outside the mask at the average value of those pixels in the original map
 void softMaskOutsideMap(MultidimArray<RFLOAT> &vol, MultidimArray<RFLOAT> &msk, bool invert_mask = false);
 
+// Exact squared Euclidean distance transform (separable algorithm of Felzenszwalb & Huttenlocher, 2012)
+// Upon return, dist2 holds for every voxel the squared distance (in pixels) to the nearest feature voxel inside the box.
+// Feature voxels are those with msk > threshold (or msk < threshold if features_above is false).
+// If the box has no feature voxels at all, all distances are set to DT_INFINITY.
+#define DT_INFINITY 1e20
+void squaredDistanceTransform(const MultidimArray<RFLOAT> &msk, MultidimArray<RFLOAT> &dist2,
+		RFLOAT threshold = 0.999, bool features_above = true, int n_threads = 1);
+
+// Extend (extend_by > 0) or shrink (extend_by < 0) a binary mask in-place by the given number of pixels
+void extendBinaryMask(MultidimArray<RFLOAT> &msk, RFLOAT extend_by, int n_threads = 1);
+
+// Put a raised-cosine edge of width_soft_edge pixels on the outside of a binary mask (in-place)
+void addSoftEdgeToBinaryMask(MultidimArray<RFLOAT> &msk, RFLOAT width_soft_edge, int n_threads = 1);
+
 // Make an automated mask, based on:
 // 1. initial binarization (based on ini_mask_density_threshold)
 // 2. Growing extend_ini_mask in all directions
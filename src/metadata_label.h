@@ -200,6 +200,8 @@ enum EMDLabel
 	EMDL_MICROGRAPH_END_FRAME,
 	EMDL_MICROGRAPH_SHIFT_X,
 	EMDL_MICROGRAPH_SHIFT_Y,
+	EMDL_MICROGRAPH_SHIFT_FIT_X,
+	EMDL_MICROGRAPH_SHIFT_FIT_Y,
 	EMDL_MICROGRAPH_MOTION_COEFFS_IDX,
 	EMDL_MICROGRAPH_MOTION_COEFF,
 	EMDL_MICROGRAPH_EER_UPSAMPLING,
@@ -742,6 +744,8 @@ private:
 		EMDL::addLabel(EMDL_MICROGRAPH_END_FRAME, EMDL_INT, "rlnMicrographEndFrame", "End frame of a motion model");
 		EMDL::addLabel(EMDL_MICROGRAPH_SHIFT_X, EMDL_DOUBLE, "rlnMicrographShiftX", "X shift of a (patch of) micrograph");
 		EMDL::addLabel(EMDL_MICROGRAPH_SHIFT_Y, EMDL_DOUBLE, "rlnMicrographShiftY", "Y shift of a (patch of) micrograph");
+		EMDL::addLabel(EMDL_MICROGRAPH_SHIFT_FIT_X, EMDL_DOUBLE, "rlnMicrographShiftFitX", "X shift of a patch of micrograph according to the fitted local motion");
+		EMDL::addLabel(EMDL_MICROGRAPH_SHIFT_FIT_Y, EMDL_DOUBLE, "rlnMicrographShiftFitY", "Y shift of a patch of micrograph according to the fitted local motion");
 		EMDL::addLabel(EMDL_MICROGRAPH_MOTION_COEFFS_IDX, EMDL_INT, "rlnMotionModelCoeffsIdx", "Index of a coefficient of a motion model");
 		EMDL::addLabel(EMDL_MICROGRAPH_MOTION_COEFF, EMDL_DOUBLE, "rlnMotionModelCoeff", "A coefficient of a motion model");
 		EMDL::addLabel(EMDL_MICROGRAPH_EER_UPSAMPLING, EMDL_INT, "rlnEERUpsampling", "EER upsampling ratio (1 = 4K, 2 = 8K)");
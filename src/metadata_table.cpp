@@ -907,6 +907,13 @@ long int MetaDataTable::goToObject(long int objectID)
 }
 
 long int MetaDataTable::readStarLoop(std::ifstream& in, bool do_only_count)
+{
+	readStarLoopLabels(in);
+
+	return readStarLoopObjects(in, -1, do_only_count);
+}
+
+void MetaDataTable::readStarLoopLabels(std::ifstream& in)
 {
 	setIsList(false);
 
@@ -914,13 +921,17 @@ long int MetaDataTable::readStarLoop(std::ifstream& in, bool do_only_count)
 	int labelPosition = 0;
 	std::string line, token;
 
-	// First read all the column labels
+	// Read all the column labels, remembering where the first data line starts
+	std::streampos first_row = in.tellg();
 	while (getline(in, line, '\n'))
 	{
 		line = simplify(line);
 		// TODO: handle comments...
 		if (line[0] == '#' || line[0] == '\0' || line[0] == ';')
+		{
+			first_row = in.tellg();
 			continue;
+		}
 
 		if (line[0] == '_') // label definition line
 		{
@@ -941,26 +952,96 @@ long int MetaDataTable::readStarLoop(std::ifstream& in, bool do_only_count)
 			addLabel(label, token);
 
 			labelPosition++;
+			first_row = in.tellg();
 		}
 		else // found first data line
 		{
-			break;
+			in.seekg(first_row);
+			return;
 		}
 	}
 
-	// Then fill the table (dont read another line until the one from above has been handled)
-	bool is_first = true;
+	// A loop without data lines at the end of the file
+	in.clear();
+}
+
+bool MetaDataTable::readStarLoopHeader(std::ifstream& in, const std::string &name)
+{
+	std::string line, token;
+	clear();
+
+	// Start reading the ifstream at the top
+	in.clear();
+	in.seekg(0);
+	version = 30000;
+
+	while (getline(in, line, '\n'))
+	{
+		trim(line);
+		if (line.find("# version ") != std::string::npos)
+		{
+			token = line.substr(line.find("# version ") + std::string("# version ").length());
+
+			std::istringstream sts(token);
+			sts >> version;
+		}
+
+		// Find data_ lines
+		if (line.find("data_") != std::string::npos)
+		{
+			token = line.substr(line.find("data_") + 5);
+			if (name == "" || name == token)
+			{
+				setName(token);
+				// Only a loop can be streamed, so stop at a list or at the next data block
+				while (getline(in, line, '\n'))
+				{
+					if (line.find("loop_") != std::string::npos)
+					{
+						readStarLoopLabels(in);
+						return true;
+					}
+					else if (line[0] == '_' || line.find("data_") != std::string::npos)
+					{
+						break;
+					}
+				}
+				clear();
+				in.clear();
+				return false;
+			}
+		}
+	}
+
+	in.clear();
+	return false;
+}
+
+long int MetaDataTable::readStarLoopObjects(std::ifstream& in, long int max_objects, bool do_only_count)
+{
+	for (long i = 0; i < objects.size(); i++)
+	{
+		delete objects[i];
+	}
+	objects.clear();
+	current_objectID = 0;
+
+	std::string line;
 	long int nr_objects = 0;
 	const int num_labels = activeLabels.size();
 
-	while (is_first || getline(in, line, '\n'))
+	// Stop at an empty line, or after max_objects lines
+	while ((max_objects < 0 || nr_objects < max_objects) && getline(in, line, '\n'))
 	{
-		is_first = false;
-
 		line = simplify(line);
 		// Stop at empty line
 		if (line[0] == '\0')
+		{
+			// When streaming, make sure the next call does not read into the next data block
+			if (max_objects >= 0)
+				in.seekg(0, std::ios::end);
 			break;
+		}
 
 		nr_objects++;
 		if (!do_only_count)
@@ -971,7 +1052,7 @@ long int MetaDataTable::readStarLoop(std::ifstream& in, bool do_only_count)
 			// Parse data values
 			int pos = 0;
 			std::string value;
-			labelPosition = 0;
+			int labelPosition = 0;
 			while (nextTokenInSTAR(line, pos, value))
 			{
 				if (labelPosition >= num_labels)
@@ -1151,14 +1232,8 @@ long int MetaDataTable::read(const FileName &filename, const std::string &name,
 	firstObject();
 }
 
-void MetaDataTable::write(std::ostream& out)
+void MetaDataTable::writeStarBlockStart(std::ostream& out)
 {
-	// Only write tables that have something in them
-	if (isEmpty())
-	{
-		return;
-	}
-
 	if (version >= 30000)
 	{
 		out << "\n";
@@ -1174,68 +1249,125 @@ void MetaDataTable::write(std::ostream& out)
 	}
 
 	out << "\n";
+}
 
-	if (!isList)
+void MetaDataTable::writeStarLoopHeader(std::ostream& out)
+{
+	writeStarBlockStart(out);
+
+	// Write loop header structure
+	out << "loop_ \n";
+
+	for (long i = 0, n_printed = 1; i < activeLabels.size(); i++)
 	{
-		// Write loop header structure
-		out << "loop_ \n";
+		EMDLabel l = activeLabels[i];
+		if (l == EMDL_UNKNOWN_LABEL)
+		{
+			const long offset = unknownLabelPosition2Offset[i];
+			out << "_" << unknownLabelNames[offset]<< " #" << (n_printed++) << " \n";
+		}
+		else if (l != EMDL_COMMENT && l != EMDL_SORTED_IDX) // EMDL_SORTED_IDX is only for internal use, never write it out!
+		{
+			out << "_" << EMDL::label2Str(l) << " #" << (n_printed++) << " \n";
+		}
+	}
+}
+
+void MetaDataTable::writeStarLoopObjects(std::ostream& out, const MetaDataTable *columns)
+{
+	if (objects.size() == 0)
+		return;
 
-		for (long i = 0, n_printed = 1; i < activeLabels.size(); i++)
+	const MetaDataTable &MDcol = (columns == NULL) ? *this : *columns;
+
+	// Where the values of the columns are in this table
+	std::vector<long> unknown_offsets(MDcol.activeLabels.size(), -1);
+	for (long i = 0; i < MDcol.activeLabels.size(); i++)
+	{
+		EMDLabel l = MDcol.activeLabels[i];
+		if (l == EMDL_UNKNOWN_LABEL && columns == NULL)
 		{
-			EMDLabel l = activeLabels[i];
-			if (l == EMDL_UNKNOWN_LABEL)
-			{
-				const long offset = unknownLabelPosition2Offset[i];
-				out << "_" << unknownLabelNames[offset]<< " #" << (n_printed++) << " \n";
-			}
-			else if (l != EMDL_COMMENT && l != EMDL_SORTED_IDX) // EMDL_SORTED_IDX is only for internal use, never write it out!
+			unknown_offsets[i] = unknownLabelPosition2Offset[i];
+		}
+		else if (l == EMDL_UNKNOWN_LABEL)
+		{
+			const std::string &unknownLabel = MDcol.unknownLabelNames[MDcol.unknownLabelPosition2Offset[i]];
+			for (long j = 0; j < unknownLabelNames.size(); j++)
 			{
-				out << "_" << EMDL::label2Str(l) << " #" << (n_printed++) << " \n";
+				if (unknownLabelNames[j] == unknownLabel)
+				{
+					unknown_offsets[i] = j;
+					break;
+				}
 			}
+			if (unknown_offsets[i] < 0)
+				REPORT_ERROR("MetaDataTable::writeStarLoopObjects ERROR: missing column " + unknownLabel);
+		}
+		else if (label2offset[l] < 0 && l != EMDL_SORTED_IDX)
+		{
+			REPORT_ERROR("MetaDataTable::writeStarLoopObjects ERROR: missing column " + EMDL::label2Str(l));
 		}
+	}
 
-		// Write actual data block
-		for (long int idx = 0; idx < objects.size(); idx++)
+	for (long int idx = 0; idx < objects.size(); idx++)
+	{
+		std::string entryComment = "";
+
+		for (long i = 0; i < MDcol.activeLabels.size(); i++)
 		{
-			std::string entryComment = "";
+			EMDLabel l = MDcol.activeLabels[i];
 
-			for (long i = 0; i < activeLabels.size(); i++)
+			if (l == EMDL_UNKNOWN_LABEL)
 			{
-				EMDLabel l = activeLabels[i];
-
-				if (l == EMDL_UNKNOWN_LABEL)
-				{
-					out.width(10);
-					std::string token, val;
-					long offset = unknownLabelPosition2Offset[i];
-					val = objects[idx]->unknowns[offset];
-					escapeStringForSTAR(val);
-					out << val << " ";
-				}
-				else if (l != EMDL_COMMENT && l != EMDL_SORTED_IDX)
-				{
-					out.width(10);
-					std::string val;
-					getValueToString(l, val, idx, true); // escape=true
-					out << val << " ";
-				}
-				if (l == EMDL_COMMENT)
-				{
-					getValue(EMDL_COMMENT, entryComment, idx);
-				}
+				out.width(10);
+				std::string val = objects[idx]->unknowns[unknown_offsets[i]];
+				escapeStringForSTAR(val);
+				out << val << " ";
 			}
-			if (entryComment != std::string(""))
+			else if (l != EMDL_COMMENT && l != EMDL_SORTED_IDX)
 			{
-				out << "# " << entryComment;
+				out.width(10);
+				std::string val;
+				getValueToString(l, val, idx, true); // escape=true
+				out << val << " ";
+			}
+			if (l == EMDL_COMMENT)
+			{
+				getValue(EMDL_COMMENT, entryComment, idx);
 			}
-			out << "\n";
 		}
-		// Finish table with a white-line
-		out << " \n";
+		if (entryComment != std::string(""))
+		{
+			out << "# " << entryComment;
+		}
+		out << "\n";
+	}
+}
+
+void MetaDataTable::writeStarLoopEnd(std::ostream& out)
+{
+	// Finish table with a white-line
+	out << " \n";
+}
 
+void MetaDataTable::write(std::ostream& out)
+{
+	// Only write tables that have something in them
+	if (isEmpty())
+	{
+		return;
+	}
+
+	if (!isList)
+	{
+		writeStarLoopHeader(out);
+		writeStarLoopObjects(out);
+		writeStarLoopEnd(out);
 	}
 	else // isList
 	{
+		writeStarBlockStart(out);
+
 		// Get first object. In this case (row format) there is a single object
 		std::string entryComment = "";
 		int maxWidth=10;
@@ -1301,8 +1433,11 @@ void MetaDataTable::write(const FileName &fn_out)
 //	fh << "# RELION; version " << g_RELION_VERSION << std::endl;
 	write(fh);
 	fh.close();
+	if (fh.fail())
+		REPORT_ERROR( (std::string)"MetaDataTable::write: cannot write to file: " + fn_tmp);
 	// Rename to prevent errors with programs in pipeliner reading in incomplete STAR files
-	std::rename(fn_tmp.c_str(), fn_out.c_str());
+	if (std::rename(fn_tmp.c_str(), fn_out.c_str()) != 0)
+		REPORT_ERROR( (std::string)"MetaDataTable::write: cannot rename " + fn_tmp + " to " + fn_out);
 
 }
 
@@ -1702,6 +1837,61 @@ void compareMetaDataTable(MetaDataTable &MD1, MetaDataTable &MD2,
 	}
 }
 
+MetaDataTable MetaDataTable::getCommonLabels(const std::vector<MetaDataTable> &MDin)
+{
+	// Find which labels are present in all tables
+	MetaDataTable commonLabels;
+
+	if (MDin.size() == 0)
+		return commonLabels;
+
+	// Loop over all labels in first
+	// activeLabels is private but accessible from other instances of the same class in C++.
+	for (size_t i = 0; i < MDin[0].activeLabels.size(); i++)
+	{
+		// Check their presence in each of the input files
+		bool is_present = true;
+
+		EMDLabel thisLabel = MDin[0].activeLabels[i];
+		std::string unknownLabel = "";
+		if (thisLabel == EMDL_UNKNOWN_LABEL)
+			unknownLabel = MDin[0].getUnknownLabelNameAt(i);
+
+		for (size_t j = 1; j < MDin.size(); j++)
+		{
+			is_present = MDin[j].containsLabel(thisLabel, unknownLabel);
+
+			if (!is_present)
+			{
+				std::cerr << " + WARNING: ignoring label " << (unknownLabel == "" ? EMDL::label2Str(thisLabel): unknownLabel) << " in " << j+1 << "th STAR file because it is not present in all STAR files to be combined." << std::endl;
+				break;
+			}
+		}
+
+		if (is_present)
+		{
+			commonLabels.addLabel(thisLabel, unknownLabel);
+		}
+	}
+
+	// Also warn about any labels of any of the input tables that do not occur in all input tables
+	for (int i = 0; i < MDin.size(); i++)
+	{
+		for (int j = 0; j < MDin[i].activeLabels.size(); j++)
+		{
+			EMDLabel thisLabel = MDin[i].activeLabels[j];
+			std::string unknownLabel = "";
+			if (thisLabel == EMDL_UNKNOWN_LABEL)
+				unknownLabel = MDin[i].getUnknownLabelNameAt(j);
+
+			if (!commonLabels.containsLabel(thisLabel, unknownLabel))
+				std::cerr << " + WARNING: ignoring label " << (unknownLabel == "" ? EMDL::label2Str(thisLabel) : unknownLabel) << " in " << i+1 << "th STAR file because it is not present in all STAR files to be combined." << std::endl;
+		}
+	}
+
+	return commonLabels;
+}
+
 MetaDataTable MetaDataTable::combineMetaDataTables(std::vector<MetaDataTable> &MDin)
 {
 	MetaDataTable MDc;
@@ -1716,42 +1906,12 @@ MetaDataTable MetaDataTable::combineMetaDataTables(std::vector<MetaDataTable> &M
 	}
 	else
 	{
-		// Find which taTable combineMetaDataTables
-		MetaDataTable commonLabels;
-
-		// Loop over all labels in first
-		// activeLabels is private but accessible from other instances of the same class in C++.
-		for (size_t i = 0; i < MDin[0].activeLabels.size(); i++)
-		{
-			// Check their presence in each of the input files
-			bool is_present = true;
-
-			EMDLabel thisLabel = MDin[0].activeLabels[i];
-			std::string unknownLabel = "";
-			if (thisLabel == EMDL_UNKNOWN_LABEL)
-				unknownLabel = MDin[0].getUnknownLabelNameAt(i);
+		MetaDataTable commonLabels = getCommonLabels(MDin);
 
-			for (size_t j = 1; j < MDin.size(); j++)
-			{
-				is_present = MDin[j].containsLabel(thisLabel, unknownLabel);
-
-				if (!is_present)
-				{
-					std::cerr << " + WARNING: ignoring label " << (unknownLabel == "" ? EMDL::label2Str(thisLabel): unknownLabel) << " in " << j+1 << "th STAR file because it is not present in all STAR files to be combined." << std::endl;
-					break;
-				}
-			}
-
-			if (is_present)
-			{
-				commonLabels.addLabel(thisLabel, unknownLabel);
-			}
-		}
-
-		// Also disable any labels of any of the input tables that do not occur in all input tables
+		// Disable any labels of any of the input tables that do not occur in all input tables
 		for (int i = 0; i < MDin.size(); i++)
 		{
-			for (int j = 0; j < MDin[i].activeLabels.size(); j++)
+			for (int j = MDin[i].activeLabels.size() - 1; j >= 0; j--)
 			{
 				EMDLabel thisLabel = MDin[i].activeLabels[j];
 				std::string unknownLabel = "";
@@ -1759,10 +1919,7 @@ MetaDataTable MetaDataTable::combineMetaDataTables(std::vector<MetaDataTable> &M
 					unknownLabel = MDin[i].getUnknownLabelNameAt(j);
 
 				if (!commonLabels.containsLabel(thisLabel, unknownLabel))
-				{
 					MDin[i].deactivateLabel(thisLabel, unknownLabel);
-					std::cerr << " + WARNING: ignoring label " << (unknownLabel == "" ? EMDL::label2Str(thisLabel) : unknownLabel) << " in " << i+1 << "th STAR file because it is not present in all STAR files to be combined." << std::endl;
-				}
 			}
 		}
 
@@ -1885,8 +2042,6 @@ MetaDataTable removeDuplicatedParticles(MetaDataTable &MDin, EMDLabel mic_label,
          zs.resize(MDin.numberOfObjects(), 0.0);
     }
 
-    RFLOAT threshold_sq = threshold * threshold;
-
 	// group by micrograph
 	std::map<std::string, std::vector<long> > grouped;
 	FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDin)
@@ -1914,30 +2069,7 @@ MetaDataTable removeDuplicatedParticles(MetaDataTable &MDin, EMDLabel mic_label,
 
 	// find duplicate
 	for (std::map<std::string, std::vector<long> >::iterator it = grouped.begin(); it != grouped.end(); ++it)
-	{
-		long n_particles = it->second.size();
-
-		for (long i = 0; i < n_particles; i++)
-		{
-			long part_id1 = it->second[i];
-
-			for (long j = i + 1; j < n_particles; j++)
-			{
-				long part_id2 = it->second[j];
-				RFLOAT dist_sq = (xs[part_id1] - xs[part_id2]) * (xs[part_id1] - xs[part_id2]) + (ys[part_id1] - ys[part_id2]) * (ys[part_id1] - ys[part_id2]);
-				if (dataIs3D)
-                    dist_sq += (zs[part_id1] - zs[part_id2]) * (zs[part_id1] - zs[part_id2]);
-
-				if (dist_sq <= threshold_sq)
-				{
-//					std::cout << it->first << " " << part_id1 << " " << part_id2 << " " << dist_sq << std::endl;
-					valid[part_id1] = false;
-					break;
-				}
-			}
-		}
-	}
-
+		findDuplicatedParticles(it->second, xs, ys, zs, threshold, valid);
 
 	MetaDataTable MDout, MDremoved;
 	long n_removed = 0;
@@ -1961,3 +2093,67 @@ MetaDataTable removeDuplicatedParticles(MetaDataTable &MDin, EMDLabel mic_label,
 
 	return MDout;
 }
+
+void findDuplicatedParticles(const std::vector<long> &ids, const std::vector<RFLOAT> &xs, const std::vector<RFLOAT> &ys,
+                             const std::vector<RFLOAT> &zs, RFLOAT threshold, std::vector<bool> &valid)
+{
+	const bool dataIs3D = (zs.size() > 0);
+	const RFLOAT threshold_sq = threshold * threshold;
+
+	// Particles within threshold of each other are in the same or in neighbouring cells
+	typedef std::vector<long> Cell;
+	std::map<Cell, std::vector<long> > cells;
+	std::vector<Cell> cell_of(ids.size(), Cell(3, 0));
+	for (long i = 0; i < ids.size(); i++)
+	{
+		long id = ids[i];
+		cell_of[i][0] = FLOOR(xs[id] / threshold);
+		cell_of[i][1] = FLOOR(ys[id] / threshold);
+		if (dataIs3D)
+			cell_of[i][2] = FLOOR(zs[id] / threshold);
+		cells[cell_of[i]].push_back(i);
+	}
+
+	const int dz = (dataIs3D) ? 1 : 0;
+	for (long i = 0; i < ids.size(); i++)
+	{
+		long part_id1 = ids[i];
+		bool is_duplicate = false;
+
+		Cell neighbour(3);
+		for (int kk = -dz; kk <= dz && !is_duplicate; kk++)
+		for (int ii = -1; ii <= 1 && !is_duplicate; ii++)
+		for (int jj = -1; jj <= 1 && !is_duplicate; jj++)
+		{
+			neighbour[0] = cell_of[i][0] + jj;
+			neighbour[1] = cell_of[i][1] + ii;
+			neighbour[2] = cell_of[i][2] + kk;
+
+			std::map<Cell, std::vector<long> >::const_iterator it = cells.find(neighbour);
+			if (it == cells.end())
+				continue;
+
+			// Only particles further down in the table count
+			for (long m = 0; m < it->second.size(); m++)
+			{
+				long j = it->second[m];
+				if (j <= i)
+					continue;
+
+				long part_id2 = ids[j];
+				RFLOAT dist_sq = (xs[part_id1] - xs[part_id2]) * (xs[part_id1] - xs[part_id2]) + (ys[part_id1] - ys[part_id2]) * (ys[part_id1] - ys[part_id2]);
+				if (dataIs3D)
+					dist_sq += (zs[part_id1] - zs[part_id2]) * (zs[part_id1] - zs[part_id2]);
+
+				if (dist_sq <= threshold_sq)
+				{
+					is_duplicate = true;
+					break;
+				}
+			}
+		}
+
+		if (is_duplicate)
+			valid[part_id1] = false;
+	}
+}
@@ -274,6 +274,25 @@ public:
 	// Read a STAR loop structure
 	long int readStarLoop(std::ifstream& in, bool do_only_count = false);
 
+	/* Streaming access to the loop of a large table, that does not need to fit in memory
+	 *
+	 * readStarLoopHeader() reads the labels of the loop in data block name (or in the first data block
+	 * if name is empty), but none of its rows. It returns false if there is no such loop.
+	 * Each call to readStarLoopObjects() then replaces the objects by the next (at most) max_objects
+	 * rows (all remaining rows for a negative max_objects), and returns how many rows it read (0 at the end).
+	 * Once the end of the loop has been reached, in is left at the end of the file.
+	 *
+	 * @code
+	 * std::ifstream in(fn_in.c_str());
+	 * MetaDataTable MD;
+	 * if (MD.readStarLoopHeader(in, "particles"))
+	 *     while (MD.readStarLoopObjects(in, 100000) > 0)
+	 *         FOR_ALL_OBJECTS_IN_METADATA_TABLE(MD) ...
+	 * @endcode
+	 */
+	bool readStarLoopHeader(std::ifstream& in, const std::string &name = "");
+	long int readStarLoopObjects(std::ifstream& in, long int max_objects = -1, bool do_only_count = false);
+
 	/* Read a STAR list
 	 * The function returns true if the list is followed by a loop, false otherwise */
 	bool readStarList(std::ifstream& in);
@@ -300,6 +319,14 @@ public:
 	// Write to a single file
 	void write(const FileName & fn_out);
 
+	/* Write a large table in chunks: the header (data_ and loop_ lines and labels), then the objects of
+	 * any number of tables, then the end of the table.
+	 * If columns is given, the objects are written in its columns, that must be present in this table.
+	 */
+	void writeStarLoopHeader(std::ostream& out);
+	void writeStarLoopObjects(std::ostream& out, const MetaDataTable *columns = NULL);
+	static void writeStarLoopEnd(std::ostream& out);
+
 	// Make a histogram of a column
 	void columnHistogram(EMDLabel label, std::vector<RFLOAT> &histX, std::vector<RFLOAT> &histY, int verb = 0, CPlot2D *plot2D = NULL,
 	                     long int nr_bin = -1, RFLOAT hist_min = -LARGE_NUMBER, RFLOAT hist_max = LARGE_NUMBER,
@@ -321,6 +348,9 @@ public:
 	// Feb14,2017 - Shaoda, Check whether the two MetaDataTables contain the same set of activeLabels
 	static bool compareLabels(const MetaDataTable &MD1, const MetaDataTable &MD2);
 
+	// An empty table with the labels of the first table that are present in all tables (with warnings about the others)
+	static MetaDataTable getCommonLabels(const std::vector<MetaDataTable> &MDin);
+
 	// Join 2 metadata tables. Only include labels that are present in both of them.
 	static MetaDataTable combineMetaDataTables(std::vector<MetaDataTable> &MDin);
 
@@ -348,6 +378,12 @@ private:
 	 *  Same as setObject, but assumes that all labels are present. */
 	void setObjectUnsafe(MetaDataContainer* data, long objId);
 
+	// Read the labels of a loop, and leave in at its first row
+	void readStarLoopLabels(std::ifstream& in);
+
+	// Write the version, data_ and comment lines that start a data block
+	void writeStarBlockStart(std::ostream& out);
+
 };
 
 void compareMetaDataTable(MetaDataTable &MD1, MetaDataTable &MD2,
@@ -364,6 +400,11 @@ MetaDataTable subsetMetaDataTable(MetaDataTable &MDin, EMDLabel label, std::stri
 // OriginX/Y are multiplied by origin_scale before added to CoordinateX/Y to compensate for down-sampling
 MetaDataTable removeDuplicatedParticles(MetaDataTable &MDin, EMDLabel mic_label, RFLOAT threshold, RFLOAT origin_scale=1.0, FileName fn_removed="", bool verb=true);
 
+// set valid[id] to false for all particles id (all from the same micrograph, in table order) that lie within threshold of a later one
+// zs is empty for 2D coordinates. Neighbours are found through a spatial hash with cells of size threshold.
+void findDuplicatedParticles(const std::vector<long> &ids, const std::vector<RFLOAT> &xs, const std::vector<RFLOAT> &ys,
+                             const std::vector<RFLOAT> &zs, RFLOAT threshold, std::vector<bool> &valid);
+
 #ifdef METADATA_TABLE_TYPE_CHECK
 //#pragma message("typecheck enabled")
 template<class T>
@@ -278,6 +278,7 @@ void Micrograph::write(FileName filename)
 	    n_local_trajectory != patchY.size() ||
 	    n_local_trajectory != patchZ.size())
 		REPORT_ERROR("Logic error: inconsistent local trajectory");
+	bool have_fit = (localFitX.size() == n_local_trajectory && localFitY.size() == n_local_trajectory);
 	for (int i = 0; i < n_local_trajectory; i++)
 	{
 		MD.addObject();
@@ -286,6 +287,11 @@ void Micrograph::write(FileName filename)
 		MD.setValue(EMDL_IMAGE_COORD_Y, patchY[i]);
 		MD.setValue(EMDL_MICROGRAPH_SHIFT_X, localShiftX[i]);
 		MD.setValue(EMDL_MICROGRAPH_SHIFT_Y, localShiftY[i]);
+		if (have_fit)
+		{
+			MD.setValue(EMDL_MICROGRAPH_SHIFT_FIT_X, localFitX[i]);
+			MD.setValue(EMDL_MICROGRAPH_SHIFT_FIT_Y, localFitY[i]);
+		}
 	}
 	MD.write(fh);
 
@@ -438,7 +444,7 @@ void Micrograph::read(FileName fn_in, bool read_hotpixels)
 		REPORT_ERROR("MicrographModel::read: File " + fn_in + " cannot be read.");
 	}
 
-	MetaDataTable MDglobal, MDhot;
+	MetaDataTable MDglobal, MDhot, MDlocal;
 
 	// Read Image metadata
 	MDglobal.readStar(in, "general");
@@ -548,6 +554,29 @@ void Micrograph::read(FileName fn_in, bool read_hotpixels)
 			hotpixelY.push_back((int)y);
 		}
 	}
+
+	// Read local trajectories
+	MDlocal.readStar(in, "local_shift");
+	FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDlocal)
+	{
+		RFLOAT x, y, fit_x = 0., fit_y = 0.;
+		if (!MDlocal.getValue(EMDL_MICROGRAPH_FRAME_NUMBER, frame) ||
+		    !MDlocal.getValue(EMDL_IMAGE_COORD_X, x) ||
+		    !MDlocal.getValue(EMDL_IMAGE_COORD_Y, y) ||
+		    !MDlocal.getValue(EMDL_MICROGRAPH_SHIFT_X, shiftX) ||
+		    !MDlocal.getValue(EMDL_MICROGRAPH_SHIFT_Y, shiftY))
+			REPORT_ERROR("MicrographModel::read: incorrect local_shift table in " + fn_in);
+		MDlocal.getValue(EMDL_MICROGRAPH_SHIFT_FIT_X, fit_x);
+		MDlocal.getValue(EMDL_MICROGRAPH_SHIFT_FIT_Y, fit_y);
+
+		patchZ.push_back(frame);
+		patchX.push_back(x);
+		patchY.push_back(y);
+		localShiftX.push_back(shiftX);
+		localShiftY.push_back(shiftY);
+		localFitX.push_back(fit_x);
+		localFitY.push_back(fit_y);
+	}
 }
 
 void Micrograph::setMovie(FileName fnMovie, FileName fnGain, RFLOAT binning)
@@ -87,7 +87,7 @@ public:
 	int first_frame; // First frame for local motion model. 1-indexed.
 	MotionModel *model;
 
-	// Local trajectories (not read from STAR files)
+	// Local trajectories (the fitted ones are zero when read from STAR files that do not have them)
 	std::vector<RFLOAT> localShiftX, localShiftY, localFitX, localFitY, patchX, patchY, patchZ, patchW, patchH;
 	std::vector<int> hotpixelX, hotpixelY;
 
@@ -19,6 +19,7 @@
  ***************************************************************************/
 
 #include "src/ml_model.h"
+#include "src/reduction.h"
 
 #ifdef MDL_TIMING
 	Timer mdl_timer;
@@ -895,7 +896,7 @@ void MlModel::initialiseFromImages(FileName fn_ref, bool _is_3d_model, Experimen
 
 
 	// Set some group stuff
-	nr_groups = _mydata.groups.size();
+	nr_groups = _mydata.numberOfGroups();
 	MultidimArray<RFLOAT> aux;
 	aux.initZeros(ori_size/2 + 1);
 	sigma2_noise.resize(nr_groups, aux);
@@ -904,7 +905,7 @@ void MlModel::initialiseFromImages(FileName fn_ref, bool _is_3d_model, Experimen
 
 	// Now set the group names from the Experiment groups list
 	for (int i=0; i< nr_groups; i++)
-		group_names[i] = _mydata.groups[i].name;
+		group_names[i] = _mydata.getGroupName(i);
 
 }
 
@@ -1503,6 +1504,7 @@ void MlWsumModel::initialise(MlModel &_model, FileName fn_sym, bool asymmetric_p
 	BPref.resize(nr_classes * nr_bodies, BP); // also set multiple bodies
 	sumw_group.resize(nr_groups);
 
+	initZerosErrors();
 }
 
 void MlWsumModel::initZeros()
@@ -1540,6 +1542,113 @@ void MlWsumModel::initZeros()
 		wsum_signal_product[igroup] = 0.;
 		wsum_reference_power[igroup] = 0.;
 	}
+
+	initZerosErrors();
+}
+
+void MlWsumModel::initZerosErrors()
+{
+	err.LL = 0.;
+	err.ave_Pmax = 0.;
+	err.sigma2_offset = 0.;
+	err.avg_norm_correction = 0.;
+
+	err.pdf_direction.resize(nr_classes * nr_bodies);
+	for (int iclass = 0; iclass < nr_classes * nr_bodies; iclass++)
+		err.pdf_direction[iclass].initZeros(pdf_direction[iclass]);
+
+	err.pdf_class.assign(nr_classes, 0.);
+	err.prior_offset_class.resize(nr_classes);
+	for (int iclass = 0; iclass < nr_classes; iclass++)
+		err.prior_offset_class[iclass].initZeros(2);
+
+	err.sumw_group.assign(nr_groups, 0.);
+	err.wsum_signal_product.assign(nr_groups, 0.);
+	err.wsum_reference_power.assign(nr_groups, 0.);
+	err.sigma2_noise.resize(nr_groups);
+	for (int igroup = 0; igroup < nr_groups; igroup++)
+		err.sigma2_noise[igroup].initZeros(sigma2_noise[igroup]);
+}
+
+void MlWsumModel::getCompensatedSums(std::vector<RFLOAT*> &sums, std::vector<RFLOAT*> &errors)
+{
+	sums.clear();
+	errors.clear();
+
+	// The rounding errors should have been sized by initZerosErrors
+	bool is_sized = (err.sigma2_noise.size() == nr_groups && err.sumw_group.size() == nr_groups &&
+	                 err.pdf_direction.size() == nr_classes * nr_bodies && err.pdf_class.size() == nr_classes);
+	for (int igroup = 0; is_sized && igroup < nr_groups; igroup++)
+		is_sized = err.sigma2_noise[igroup].sameShape(sigma2_noise[igroup]);
+	for (int iclass = 0; is_sized && iclass < nr_classes * nr_bodies; iclass++)
+		is_sized = err.pdf_direction[iclass].sameShape(pdf_direction[iclass]);
+	if (!is_sized)
+		REPORT_ERROR("MlWsumModel::getCompensatedSums BUG: rounding errors do not match the size of the weighted sums");
+
+	sums.push_back(&LL);                  errors.push_back(&err.LL);
+	sums.push_back(&ave_Pmax);            errors.push_back(&err.ave_Pmax);
+	sums.push_back(&sigma2_offset);       errors.push_back(&err.sigma2_offset);
+	sums.push_back(&avg_norm_correction); errors.push_back(&err.avg_norm_correction);
+
+	for (int igroup = 0; igroup < nr_groups; igroup++)
+	{
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(sigma2_noise[igroup])
+		{
+			sums.push_back(&DIRECT_MULTIDIM_ELEM(sigma2_noise[igroup], n));
+			errors.push_back(&DIRECT_MULTIDIM_ELEM(err.sigma2_noise[igroup], n));
+		}
+		sums.push_back(&wsum_signal_product[igroup]);  errors.push_back(&err.wsum_signal_product[igroup]);
+		sums.push_back(&wsum_reference_power[igroup]); errors.push_back(&err.wsum_reference_power[igroup]);
+		sums.push_back(&sumw_group[igroup]);           errors.push_back(&err.sumw_group[igroup]);
+	}
+
+	for (int iclass = 0; iclass < nr_classes * nr_bodies; iclass++)
+	{
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(pdf_direction[iclass])
+		{
+			sums.push_back(&DIRECT_MULTIDIM_ELEM(pdf_direction[iclass], n));
+			errors.push_back(&DIRECT_MULTIDIM_ELEM(err.pdf_direction[iclass], n));
+		}
+	}
+
+	for (int iclass = 0; iclass < nr_classes; iclass++)
+	{
+		sums.push_back(&pdf_class[iclass]); errors.push_back(&err.pdf_class[iclass]);
+		if (ref_dim == 2)
+		{
+			sums.push_back(&XX(prior_offset_class[iclass])); errors.push_back(&XX(err.prior_offset_class[iclass]));
+			sums.push_back(&YY(prior_offset_class[iclass])); errors.push_back(&YY(err.prior_offset_class[iclass]));
+		}
+	}
+}
+
+void MlWsumModel::packCompensatedSums(MultidimArray<RFLOAT> &packed)
+{
+	std::vector<RFLOAT*> sums, errors;
+	getCompensatedSums(sums, errors);
+
+	packed.clear();
+	packed.resize(2 * sums.size());
+	for (long int i = 0; i < sums.size(); i++)
+	{
+		DIRECT_MULTIDIM_ELEM(packed, 2 * i) = *sums[i];
+		DIRECT_MULTIDIM_ELEM(packed, 2 * i + 1) = *errors[i];
+	}
+}
+
+void MlWsumModel::unpackCompensatedSums(MultidimArray<RFLOAT> &packed)
+{
+	std::vector<RFLOAT*> sums, errors;
+	getCompensatedSums(sums, errors);
+
+	if (MULTIDIM_SIZE(packed) != 2 * sums.size())
+		REPORT_ERROR("MlWsumModel::unpackCompensatedSums: packed array does not match the size of the weighted sums");
+
+	for (long int i = 0; i < sums.size(); i++)
+	{
+		*sums[i] = DIRECT_MULTIDIM_ELEM(packed, 2 * i);
+		*errors[i] = DIRECT_MULTIDIM_ELEM(packed, 2 * i + 1);
+	}
 }
 
 //#define DEBUG_PACK
@@ -440,6 +440,18 @@ public:
 	void calculateTotalFourierCoverage();
 };
 
+// Rounding errors of the scalar and spectral weighted sums of an MlWsumModel
+// Each of these is accumulated together with the corresponding sum by compensatedAdd (see src/reduction.h),
+// so that the sums are much less sensitive to the order in which threads and MPI processes add their contributions
+class MlWsumErrors
+{
+public:
+	RFLOAT LL, ave_Pmax, sigma2_offset, avg_norm_correction;
+	std::vector<RFLOAT> sumw_group, wsum_signal_product, wsum_reference_power, pdf_class;
+	std::vector<Matrix1D<RFLOAT> > prior_offset_class;
+	std::vector<MultidimArray<RFLOAT> > sigma2_noise, pdf_direction;
+};
+
 class MlWsumModel: public MlModel
 {
 public:
@@ -457,6 +469,9 @@ public:
 	// For each group store weighted sums of squared reference as a function of resolution
 	std::vector<RFLOAT > wsum_reference_power;
 
+	// Rounding errors of the compensated scalar and spectral sums
+	MlWsumErrors err;
+
 	// Constructor
 	MlWsumModel()
 	{
@@ -499,6 +514,20 @@ public:
 	// Fill the model again using unpack (this is the inverse operation from pack)
 	void unpack(MultidimArray<RFLOAT> &packed, int piece, bool do_clear=true);
 
+	// Pack all compensated scalar and spectral sums as (sum, error) pairs, which can be added with compensatedAddPairs
+	// This is small compared to the full pack above and leaves the model untouched
+	void packCompensatedSums(MultidimArray<RFLOAT> &packed);
+
+	// Overwrite the compensated sums again (this is the inverse operation from packCompensatedSums)
+	void unpackCompensatedSums(MultidimArray<RFLOAT> &packed);
+
+private:
+	// Set all rounding errors to zero (and resize them to the corresponding sums)
+	void initZerosErrors();
+
+	// Pointers to all compensated sums and their rounding errors, in the order used by packCompensatedSums
+	void getCompensatedSums(std::vector<RFLOAT*> &sums, std::vector<RFLOAT*> &errors);
+
 };
 
 #endif /* ML_MODEL_H_ */
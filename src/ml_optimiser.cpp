@@ -32,6 +32,7 @@
 #endif
 
 #include <sys/time.h>
+#include <unistd.h>
 #include <stdio.h>
 #include <time.h>
 #include <math.h>
@@ -42,6 +43,7 @@
 #include "src/macros.h"
 #include "src/error.h"
 #include "src/ml_optimiser.h"
+#include "src/reduction.h"
 #ifdef CUDA
 #include "src/acc/cuda/cuda_ml_optimiser.h"
 #include <nvToolsExt.h>
@@ -87,6 +89,83 @@ void globalThreadExpectationSomeParticles(ThreadArgument &thArg)
 	}
 }
 
+/** ========================== Threaded parallelization of maximization === */
+
+void globalThreadMaximizationSomeClasses(ThreadArgument &thArg)
+{
+	MlOptimiser *MLO = (MlOptimiser*) thArg.workClass;
+
+	try
+	{
+		MLO->doThreadMaximizationSomeClasses(thArg.thread_id);
+	}
+	catch (RelionError XE)
+	{
+		RelionError *gE = new RelionError(XE.msg, XE.file, XE.line);
+		gE->msg = XE.msg;
+		MLO->threadException = gE;
+	}
+}
+
+/** ========================== Writing output files in the background === */
+
+void *globalThreadWriteSnapshot(void *self)
+{
+	MlWriteSnapshot *snapshot = (MlWriteSnapshot*) self;
+
+	try
+	{
+		snapshot->write();
+	}
+	catch (RelionError XE)
+	{
+		snapshot->exception.reset(new RelionError(XE));
+	}
+	catch (std::exception &e)
+	{
+		snapshot->exception.reset(new RelionError((std::string)"Writing " + snapshot->fn_data + " or " + snapshot->fn_optimiser + " failed: " + e.what(), __FILE__, __LINE__));
+	}
+
+	return NULL;
+}
+
+void MlWriteSnapshot::write()
+{
+	if (fn_data != "")
+	{
+		FileName fn_tmp = fn_data + ".tmp";
+		std::ofstream fh(fn_tmp.c_str(), std::ios::out);
+		if (!fh)
+			REPORT_ERROR( (std::string)"MlWriteSnapshot::write: Cannot write file: " + fn_tmp);
+
+		// Same tables as Experiment::write()
+		MDoptics.setName("optics");
+		MDoptics.write(fh);
+		MDimg.setName("particles");
+		MDimg.write(fh);
+		for (int ibody = 0; ibody < MDbodies.size(); ibody++)
+			MDbodies[ibody].write(fh);
+
+		fh.close();
+		if (fh.fail() || std::rename(fn_tmp.c_str(), fn_data.c_str()) != 0)
+			REPORT_ERROR( (std::string)"MlWriteSnapshot::write: Cannot write file: " + fn_data);
+	}
+
+	if (fn_optimiser != "")
+	{
+		FileName fn_tmp = fn_optimiser + ".tmp";
+		std::ofstream fh(fn_tmp.c_str(), std::ios::out);
+		if (!fh)
+			REPORT_ERROR( (std::string)"MlWriteSnapshot::write: Cannot write file: " + fn_tmp);
+
+		fh << optimiser_star;
+
+		fh.close();
+		if (fh.fail() || std::rename(fn_tmp.c_str(), fn_optimiser.c_str()) != 0)
+			REPORT_ERROR( (std::string)"MlWriteSnapshot::write: Cannot write file: " + fn_optimiser);
+	}
+}
+
 
 /** ========================== I/O operations  =========================== */
 
@@ -402,7 +481,9 @@ void MlOptimiser::parseContinue(int argc, char **argv)
 	do_parallel_disc_io = !parser.checkOption("--no_parallel_disc_io", "Do NOT let parallel (MPI) processes access the disc simultaneously (use this option with NFS)");
 	combine_weights_thru_disc = !parser.checkOption("--dont_combine_weights_via_disc", "Send the large arrays of summed weights through the MPI network, instead of writing large files to disc");
 	do_shifts_onthefly = parser.checkOption("--onthefly_shifts", "Calculate shifted images on-the-fly, do not store precalculated ones in memory");
+	do_mixed_precision = parser.checkOption("--mixed_precision", "Calculate the squared differences of the (non-accelerated) CPU code in single precision; weights and sums are still accumulated in double precision");
 	do_preread_images  = parser.checkOption("--preread_images", "Use this to let the leader process read all particles into memory. Be careful you have enough RAM for large data sets!");
+	random_order_block_size = textToInteger(parser.getOption("--random_order_block_size", "Randomise the particle order in blocks of up to this many particles from the same micrograph, for more contiguous reading of particle stacks (0 = randomise individual particles)", "0"));
 	fn_scratch = parser.getOption("--scratch_dir", "If provided, particle stacks will be copied to this local scratch disk prior to refinement.", "");
 	keep_free_scratch_Gb = textToFloat(parser.getOption("--keep_free_scratch", "Space available for copying particle stacks (in Gb)", "10"));
 	do_reuse_scratch = parser.checkOption("--reuse_scratch", "Re-use data on scratchdir, instead of wiping it and re-copying all data. This works only when ALL particles have already been cached.");
@@ -451,6 +532,9 @@ void MlOptimiser::parseContinue(int argc, char **argv)
 	do_map = !checkParameter(argc, argv, "--no_map");
 	minres_map = textToInteger(getParameter(argc, argv, "--minres_map", "5"));
 	gridding_nr_iter = textToInteger(getParameter(argc, argv, "--gridding_iter", "10"));
+	gridding_tol = textToFloat(getParameter(argc, argv, "--gridding_tol", "0."));
+	recons_ram = textToFloat(getParameter(argc, argv, "--recons_ram", "-1"));
+	do_async_write = !checkParameter(argc, argv, "--no_async_write");
 	debug1 = textToFloat(getParameter(argc, argv, "--debug1", "0."));
 	debug2 = textToFloat(getParameter(argc, argv, "--debug2", "0."));
 	debug3 = textToFloat(getParameter(argc, argv, "--debug3", "0."));
@@ -685,8 +769,10 @@ void MlOptimiser::parseInitial(int argc, char **argv)
 	nr_threads = textToInteger(parser.getOption("--j", "Number of threads to run in parallel (only useful on multi-core machines)", "1"));
 	combine_weights_thru_disc = !parser.checkOption("--dont_combine_weights_via_disc", "Send the large arrays of summed weights through the MPI network, instead of writing large files to disc");
 	do_shifts_onthefly = parser.checkOption("--onthefly_shifts", "Calculate shifted images on-the-fly, do not store precalculated ones in memory");
+	do_mixed_precision = parser.checkOption("--mixed_precision", "Calculate the squared differences of the (non-accelerated) CPU code in single precision; weights and sums are still accumulated in double precision");
 	do_parallel_disc_io = !parser.checkOption("--no_parallel_disc_io", "Do NOT let parallel (MPI) processes access the disc simultaneously (use this option with NFS)");
 	do_preread_images  = parser.checkOption("--preread_images", "Use this to let the leader process read all particles into memory. Be careful you have enough RAM for large data sets!");
+	random_order_block_size = textToInteger(parser.getOption("--random_order_block_size", "Randomise the particle order in blocks of up to this many particles from the same micrograph, for more contiguous reading of particle stacks (0 = randomise individual particles)", "0"));
 	fn_scratch = parser.getOption("--scratch_dir", "If provided, particle stacks will be copied to this local scratch disk prior to refinement.", "");
 	keep_free_scratch_Gb = textToFloat(parser.getOption("--keep_free_scratch", "Space available for copying particle stacks (in Gb)", "10"));
 	do_reuse_scratch = parser.checkOption("--reuse_scratch", "Re-use data on scratchdir, instead of wiping it and re-copying all data.");
@@ -785,6 +871,9 @@ void MlOptimiser::parseInitial(int argc, char **argv)
 	minres_map = textToInteger(getParameter(argc, argv, "--minres_map", "5"));
 	do_bfactor = checkParameter(argc, argv, "--bfactor");
 	gridding_nr_iter = textToInteger(getParameter(argc, argv, "--gridding_iter", "10"));
+	gridding_tol = textToFloat(getParameter(argc, argv, "--gridding_tol", "0."));
+	recons_ram = textToFloat(getParameter(argc, argv, "--recons_ram", "-1"));
+	do_async_write = !checkParameter(argc, argv, "--no_async_write");
 	debug1 = textToFloat(getParameter(argc, argv, "--debug1", "0"));
 	debug2 = textToFloat(getParameter(argc, argv, "--debug2", "0"));
 	debug3 = textToFloat(getParameter(argc, argv, "--debug3", "0"));
@@ -976,6 +1065,9 @@ void MlOptimiser::read(FileName fn_in, int rank, bool do_prevent_preread)
 	minres_map = 5;
 	do_bfactor = false;
 	gridding_nr_iter = 10;
+	gridding_tol = 0.;
+	recons_ram = -1.;
+	do_async_write = true;
 	debug1 = debug2 = debug3 = 0.;
 
 	// Then read in sampling, mydata and mymodel stuff
@@ -984,7 +1076,7 @@ void MlOptimiser::read(FileName fn_in, int rank, bool do_prevent_preread)
 	std::cerr<<"MlOptimiser::readStar before data."<<std::endl;
 #endif
 	bool do_preread = (do_preread_images) ? (do_parallel_disc_io || rank == 0) : false;
-	if (do_prevent_preread) do_preread = false;
+	if (do_prevent_preread || (do_preread_images_shared && do_parallel_disc_io)) do_preread = false;
 	bool is_helical_segment = (do_helical_refine) || ((mymodel.ref_dim == 2) && (helical_tube_outer_diameter > 0.));
 	mydata.read(fn_data, false, false, do_preread, is_helical_segment);
 
@@ -1034,13 +1126,146 @@ void MlOptimiser::read(FileName fn_in, int rank, bool do_prevent_preread)
 }
 
 
-void MlOptimiser::write(bool do_write_sampling, bool do_write_data, bool do_write_optimiser, bool do_write_model, int random_subset)
+std::string MlOptimiser::formatOptimiserStar()
+{
+	FileName fn_root, fn_root2, fn_model, fn_model2, fn_data, fn_sampling;
+	std::ostringstream fh;
+	if (iter > -1)
+		fn_root.compose(fn_out+"_it", iter, "", 3);
+	else
+		fn_root = fn_out;
+	fn_root2 = fn_root;
+
+	// Write the command line as a comment in the header
+	fh << "# RELION optimiser; version " << g_RELION_VERSION <<std::endl;
+	fh << "# ";
+	parser.writeCommandLine(fh);
+
+	if (do_split_random_halves && !do_join_random_halves)
+	{
+		fn_model  = fn_root2 + "_half1_model.star";
+		fn_model2 = fn_root2 + "_half2_model.star";
+	}
+	else
+	{
+		fn_model = fn_root2 + "_model.star";
+	}
+	fn_data = fn_root + "_data.star";
+	fn_sampling = fn_root + "_sampling.star";
+
+	MetaDataTable MD;
+	MD.setIsList(true);
+	MD.setName("optimiser_general");
+	MD.addObject();
+	MD.setValue(EMDL_OPTIMISER_OUTPUT_ROOTNAME, fn_out);
+	if (do_split_random_halves)
+	{
+		MD.setValue(EMDL_OPTIMISER_MODEL_STARFILE, fn_model);
+		MD.setValue(EMDL_OPTIMISER_MODEL_STARFILE2, fn_model2);
+	}
+	else
+	{
+		MD.setValue(EMDL_OPTIMISER_MODEL_STARFILE, fn_model);
+	}
+	MD.setValue(EMDL_OPTIMISER_DATA_STARFILE, fn_data);
+	MD.setValue(EMDL_OPTIMISER_SAMPLING_STARFILE, fn_sampling);
+	MD.setValue(EMDL_OPTIMISER_ITERATION_NO, iter);
+	MD.setValue(EMDL_OPTIMISER_NR_ITERATIONS, nr_iter);
+	MD.setValue(EMDL_OPTIMISER_DO_SPLIT_RANDOM_HALVES, do_split_random_halves);
+	MD.setValue(EMDL_OPTIMISER_LOWRES_JOIN_RANDOM_HALVES, low_resol_join_halves);
+	MD.setValue(EMDL_OPTIMISER_ADAPTIVE_OVERSAMPLING, adaptive_oversampling);
+	MD.setValue(EMDL_OPTIMISER_ADAPTIVE_FRACTION, adaptive_fraction);
+	MD.setValue(EMDL_OPTIMISER_RANDOM_SEED, random_seed);
+	MD.setValue(EMDL_OPTIMISER_PARTICLE_DIAMETER, particle_diameter);
+	MD.setValue(EMDL_OPTIMISER_WIDTH_MASK_EDGE, width_mask_edge);
+	MD.setValue(EMDL_OPTIMISER_DO_ZERO_MASK, do_zero_mask);
+	MD.setValue(EMDL_OPTIMISER_DO_SOLVENT_FLATTEN, do_solvent);
+	MD.setValue(EMDL_OPTIMISER_DO_SOLVENT_FSC, do_phase_random_fsc);
+	MD.setValue(EMDL_OPTIMISER_SOLVENT_MASK_NAME, fn_mask);
+	MD.setValue(EMDL_OPTIMISER_SOLVENT_MASK2_NAME, fn_mask2);
+	MD.setValue(EMDL_BODY_STAR_FILE, fn_body_masks);
+	MD.setValue(EMDL_OPTIMISER_TAU_SPECTRUM_NAME, fn_tau);
+	MD.setValue(EMDL_OPTIMISER_MAX_COARSE_SIZE, max_coarse_size);
+	MD.setValue(EMDL_OPTIMISER_HIGHRES_LIMIT_EXP, strict_highres_exp);
+	MD.setValue(EMDL_OPTIMISER_LOWRES_LIMIT_EXP, strict_lowres_exp);
+	MD.setValue(EMDL_OPTIMISER_INCR_SIZE, incr_size);
+	MD.setValue(EMDL_OPTIMISER_DO_MAP, do_map);
+	MD.setValue(EMDL_OPTIMISER_FAST_SUBSETS, do_fast_subsets);
+	MD.setValue(EMDL_OPTIMISER_DO_EXTERNAL_RECONSTRUCT, do_external_reconstruct);
+	MD.setValue(EMDL_OPTIMISER_DO_SGD, do_sgd);
+	MD.setValue(EMDL_OPTIMISER_DO_STOCHASTIC_EM, do_avoid_sgd);
+	MD.setValue(EMDL_OPTIMISER_SGD_INI_ITER, sgd_ini_iter);
+	MD.setValue(EMDL_OPTIMISER_SGD_FIN_ITER, sgd_fin_iter);
+	MD.setValue(EMDL_OPTIMISER_SGD_INBETWEEN_ITER, sgd_inbetween_iter);
+	MD.setValue(EMDL_OPTIMISER_SGD_INI_RESOL, sgd_ini_resol);
+	MD.setValue(EMDL_OPTIMISER_SGD_FIN_RESOL, sgd_fin_resol);
+	MD.setValue(EMDL_OPTIMISER_SGD_INI_SUBSET_SIZE, sgd_ini_subset_size);
+	MD.setValue(EMDL_OPTIMISER_SGD_FIN_SUBSET_SIZE, sgd_fin_subset_size);
+	MD.setValue(EMDL_OPTIMISER_SGD_MU, mu);
+	MD.setValue(EMDL_OPTIMISER_SGD_SIGMA2FUDGE_INI, sgd_sigma2fudge_ini);
+	MD.setValue(EMDL_OPTIMISER_SGD_SIGMA2FUDGE_HALFLIFE, sgd_sigma2fudge_halflife);
+	MD.setValue(EMDL_OPTIMISER_SGD_SKIP_ANNNEAL, do_sgd_skip_anneal);
+	MD.setValue(EMDL_OPTIMISER_SGD_SUBSET_SIZE, subset_size);
+	MD.setValue(EMDL_OPTIMISER_SGD_WRITE_EVERY_SUBSET, write_every_sgd_iter);
+	MD.setValue(EMDL_OPTIMISER_SGD_STEPSIZE, sgd_stepsize);
+	MD.setValue(EMDL_OPTIMISER_DO_AUTO_REFINE, do_auto_refine);
+	MD.setValue(EMDL_OPTIMISER_AUTO_LOCAL_HP_ORDER, autosampling_hporder_local_searches);
+	MD.setValue(EMDL_OPTIMISER_NR_ITER_WO_RESOL_GAIN, nr_iter_wo_resol_gain);
+	MD.setValue(EMDL_OPTIMISER_BEST_RESOL_THUS_FAR,best_resol_thus_far);
+	MD.setValue(EMDL_OPTIMISER_NR_ITER_WO_HIDDEN_VAR_CHANGES, nr_iter_wo_large_hidden_variable_changes);
+	MD.setValue(EMDL_OPTIMISER_DO_SKIP_ALIGN, do_skip_align);
+	MD.setValue(EMDL_OPTIMISER_DO_SKIP_ROTATE, do_skip_rotate);
+	MD.setValue(EMDL_OPTIMISER_ACCURACY_ROT, acc_rot);
+	MD.setValue(EMDL_OPTIMISER_ACCURACY_TRANS_ANGSTROM, acc_trans);
+	MD.setValue(EMDL_OPTIMISER_CHANGES_OPTIMAL_ORIENTS, current_changes_optimal_orientations);
+	MD.setValue(EMDL_OPTIMISER_CHANGES_OPTIMAL_OFFSETS, current_changes_optimal_offsets);
+	MD.setValue(EMDL_OPTIMISER_CHANGES_OPTIMAL_CLASSES, current_changes_optimal_classes);
+	MD.setValue(EMDL_OPTIMISER_SMALLEST_CHANGES_OPT_ORIENTS, smallest_changes_optimal_orientations);
+	MD.setValue(EMDL_OPTIMISER_SMALLEST_CHANGES_OPT_OFFSETS, smallest_changes_optimal_offsets);
+	MD.setValue(EMDL_OPTIMISER_SMALLEST_CHANGES_OPT_CLASSES, smallest_changes_optimal_classes);
+	MD.setValue(EMDL_OPTIMISER_LOCAL_SYMMETRY_FILENAME, fn_local_symmetry);
+	MD.setValue(EMDL_OPTIMISER_DO_HELICAL_REFINE, do_helical_refine);
+	MD.setValue(EMDL_OPTIMISER_IGNORE_HELICAL_SYMMETRY, ignore_helical_symmetry);
+	MD.setValue(EMDL_OPTIMISER_FOURIER_MASK, fn_fourier_mask);
+	MD.setValue(EMDL_OPTIMISER_HELICAL_TWIST_INITIAL, helical_twist_initial);
+	MD.setValue(EMDL_OPTIMISER_HELICAL_RISE_INITIAL, helical_rise_initial);
+	MD.setValue(EMDL_OPTIMISER_HELICAL_Z_PERCENTAGE, helical_z_percentage);
+	MD.setValue(EMDL_OPTIMISER_HELICAL_NSTART, helical_nstart);
+	MD.setValue(EMDL_OPTIMISER_HELICAL_TUBE_INNER_DIAMETER, helical_tube_inner_diameter);
+	MD.setValue(EMDL_OPTIMISER_HELICAL_TUBE_OUTER_DIAMETER, helical_tube_outer_diameter);
+	MD.setValue(EMDL_OPTIMISER_HELICAL_SYMMETRY_LOCAL_REFINEMENT, do_helical_symmetry_local_refinement);
+	MD.setValue(EMDL_OPTIMISER_HELICAL_SIGMA_DISTANCE, helical_sigma_distance);
+	MD.setValue(EMDL_OPTIMISER_HELICAL_KEEP_TILT_PRIOR_FIXED, helical_keep_tilt_prior_fixed);
+	MD.setValue(EMDL_OPTIMISER_HAS_CONVERGED, has_converged);
+	MD.setValue(EMDL_OPTIMISER_HAS_HIGH_FSC_AT_LIMIT, has_high_fsc_at_limit);
+	MD.setValue(EMDL_OPTIMISER_HAS_LARGE_INCR_SIZE_ITER_AGO, has_large_incr_size_iter_ago);
+	MD.setValue(EMDL_OPTIMISER_DO_CORRECT_NORM, do_norm_correction);
+	MD.setValue(EMDL_OPTIMISER_DO_CORRECT_SCALE, do_scale_correction);
+	MD.setValue(EMDL_OPTIMISER_DO_CORRECT_CTF, do_ctf_correction);
+	MD.setValue(EMDL_OPTIMISER_IGNORE_CTF_UNTIL_FIRST_PEAK, intact_ctf_first_peak);
+	MD.setValue(EMDL_OPTIMISER_DATA_ARE_CTF_PHASE_FLIPPED, ctf_phase_flipped);
+	MD.setValue(EMDL_OPTIMISER_DO_ONLY_FLIP_CTF_PHASES, only_flip_phases);
+	MD.setValue(EMDL_OPTIMISER_REFS_ARE_CTF_CORRECTED, refs_are_ctf_corrected);
+	MD.setValue(EMDL_OPTIMISER_FIX_SIGMA_NOISE, fix_sigma_noise);
+	MD.setValue(EMDL_OPTIMISER_FIX_SIGMA_OFFSET, fix_sigma_offset);
+	MD.setValue(EMDL_OPTIMISER_MAX_NR_POOL, nr_pool);
+
+	MD.write(fh);
+
+	return fh.str();
+}
+
+void MlOptimiser::write(bool do_write_sampling, bool do_write_data, bool do_write_optimiser, bool do_write_model, int random_subset,
+                        const std::string *optimiser_star)
 {
 	if (subset_size > 0 && (iter % write_every_sgd_iter) != 0 && iter != nr_iter)
 		return;
 
-	FileName fn_root, fn_tmp, fn_model, fn_model2, fn_data, fn_sampling, fn_root2;
-	std::ofstream  fh;
+	// The files of the previous call have to be complete before they can be replaced
+	waitForWrite();
+	std::unique_ptr<MlWriteSnapshot> snapshot(new MlWriteSnapshot());
+
+	FileName fn_root, fn_root2;
 	if (iter > -1)
 		fn_root.compose(fn_out+"_it", iter, "", 3);
 	else
@@ -1051,129 +1276,11 @@ void MlOptimiser::write(bool do_write_sampling, bool do_write_data, bool do_writ
 
 	// First write "main" STAR file with all information from this run
 	// Do this for random_subset==0 and random_subset==1
+	// The MPI leader passes the file formatted by the first follower in optimiser_star
 	if (do_write_optimiser && random_subset < 2)
 	{
-		fn_tmp = fn_root2+"_optimiser.star";
-		fh.open((fn_tmp).c_str(), std::ios::out);
-		if (!fh)
-			REPORT_ERROR( (std::string)"MlOptimiser::write: Cannot write file: " + fn_tmp);
-
-		// Write the command line as a comment in the header
-		fh << "# RELION optimiser; version " << g_RELION_VERSION <<std::endl;
-		fh << "# ";
-		parser.writeCommandLine(fh);
-
-		if (do_split_random_halves && !do_join_random_halves)
-		{
-			fn_model  = fn_root2 + "_half1_model.star";
-			fn_model2 = fn_root2 + "_half2_model.star";
-		}
-		else
-		{
-			fn_model = fn_root2 + "_model.star";
-		}
-		fn_data = fn_root + "_data.star";
-		fn_sampling = fn_root + "_sampling.star";
-
-		MetaDataTable MD;
-		MD.setIsList(true);
-		MD.setName("optimiser_general");
-		MD.addObject();
-		MD.setValue(EMDL_OPTIMISER_OUTPUT_ROOTNAME, fn_out);
-		if (do_split_random_halves)
-		{
-			MD.setValue(EMDL_OPTIMISER_MODEL_STARFILE, fn_model);
-			MD.setValue(EMDL_OPTIMISER_MODEL_STARFILE2, fn_model2);
-		}
-		else
-		{
-			MD.setValue(EMDL_OPTIMISER_MODEL_STARFILE, fn_model);
-		}
-		MD.setValue(EMDL_OPTIMISER_DATA_STARFILE, fn_data);
-		MD.setValue(EMDL_OPTIMISER_SAMPLING_STARFILE, fn_sampling);
-		MD.setValue(EMDL_OPTIMISER_ITERATION_NO, iter);
-		MD.setValue(EMDL_OPTIMISER_NR_ITERATIONS, nr_iter);
-		MD.setValue(EMDL_OPTIMISER_DO_SPLIT_RANDOM_HALVES, do_split_random_halves);
-		MD.setValue(EMDL_OPTIMISER_LOWRES_JOIN_RANDOM_HALVES, low_resol_join_halves);
-		MD.setValue(EMDL_OPTIMISER_ADAPTIVE_OVERSAMPLING, adaptive_oversampling);
-		MD.setValue(EMDL_OPTIMISER_ADAPTIVE_FRACTION, adaptive_fraction);
-		MD.setValue(EMDL_OPTIMISER_RANDOM_SEED, random_seed);
-		MD.setValue(EMDL_OPTIMISER_PARTICLE_DIAMETER, particle_diameter);
-		MD.setValue(EMDL_OPTIMISER_WIDTH_MASK_EDGE, width_mask_edge);
-		MD.setValue(EMDL_OPTIMISER_DO_ZERO_MASK, do_zero_mask);
-		MD.setValue(EMDL_OPTIMISER_DO_SOLVENT_FLATTEN, do_solvent);
-		MD.setValue(EMDL_OPTIMISER_DO_SOLVENT_FSC, do_phase_random_fsc);
-		MD.setValue(EMDL_OPTIMISER_SOLVENT_MASK_NAME, fn_mask);
-		MD.setValue(EMDL_OPTIMISER_SOLVENT_MASK2_NAME, fn_mask2);
-		MD.setValue(EMDL_BODY_STAR_FILE, fn_body_masks);
-		MD.setValue(EMDL_OPTIMISER_TAU_SPECTRUM_NAME, fn_tau);
-		MD.setValue(EMDL_OPTIMISER_MAX_COARSE_SIZE, max_coarse_size);
-		MD.setValue(EMDL_OPTIMISER_HIGHRES_LIMIT_EXP, strict_highres_exp);
-		MD.setValue(EMDL_OPTIMISER_LOWRES_LIMIT_EXP, strict_lowres_exp);
-		MD.setValue(EMDL_OPTIMISER_INCR_SIZE, incr_size);
-		MD.setValue(EMDL_OPTIMISER_DO_MAP, do_map);
-		MD.setValue(EMDL_OPTIMISER_FAST_SUBSETS, do_fast_subsets);
-		MD.setValue(EMDL_OPTIMISER_DO_EXTERNAL_RECONSTRUCT, do_external_reconstruct);
-		MD.setValue(EMDL_OPTIMISER_DO_SGD, do_sgd);
-		MD.setValue(EMDL_OPTIMISER_DO_STOCHASTIC_EM, do_avoid_sgd);
-		MD.setValue(EMDL_OPTIMISER_SGD_INI_ITER, sgd_ini_iter);
-		MD.setValue(EMDL_OPTIMISER_SGD_FIN_ITER, sgd_fin_iter);
-		MD.setValue(EMDL_OPTIMISER_SGD_INBETWEEN_ITER, sgd_inbetween_iter);
-		MD.setValue(EMDL_OPTIMISER_SGD_INI_RESOL, sgd_ini_resol);
-		MD.setValue(EMDL_OPTIMISER_SGD_FIN_RESOL, sgd_fin_resol);
-		MD.setValue(EMDL_OPTIMISER_SGD_INI_SUBSET_SIZE, sgd_ini_subset_size);
-		MD.setValue(EMDL_OPTIMISER_SGD_FIN_SUBSET_SIZE, sgd_fin_subset_size);
-		MD.setValue(EMDL_OPTIMISER_SGD_MU, mu);
-		MD.setValue(EMDL_OPTIMISER_SGD_SIGMA2FUDGE_INI, sgd_sigma2fudge_ini);
-		MD.setValue(EMDL_OPTIMISER_SGD_SIGMA2FUDGE_HALFLIFE, sgd_sigma2fudge_halflife);
-		MD.setValue(EMDL_OPTIMISER_SGD_SKIP_ANNNEAL, do_sgd_skip_anneal);
-		MD.setValue(EMDL_OPTIMISER_SGD_SUBSET_SIZE, subset_size);
-		MD.setValue(EMDL_OPTIMISER_SGD_WRITE_EVERY_SUBSET, write_every_sgd_iter);
-		MD.setValue(EMDL_OPTIMISER_SGD_STEPSIZE, sgd_stepsize);
-		MD.setValue(EMDL_OPTIMISER_DO_AUTO_REFINE, do_auto_refine);
-		MD.setValue(EMDL_OPTIMISER_AUTO_LOCAL_HP_ORDER, autosampling_hporder_local_searches);
-		MD.setValue(EMDL_OPTIMISER_NR_ITER_WO_RESOL_GAIN, nr_iter_wo_resol_gain);
-		MD.setValue(EMDL_OPTIMISER_BEST_RESOL_THUS_FAR,best_resol_thus_far);
-		MD.setValue(EMDL_OPTIMISER_NR_ITER_WO_HIDDEN_VAR_CHANGES, nr_iter_wo_large_hidden_variable_changes);
-		MD.setValue(EMDL_OPTIMISER_DO_SKIP_ALIGN, do_skip_align);
-		MD.setValue(EMDL_OPTIMISER_DO_SKIP_ROTATE, do_skip_rotate);
-		MD.setValue(EMDL_OPTIMISER_ACCURACY_ROT, acc_rot);
-		MD.setValue(EMDL_OPTIMISER_ACCURACY_TRANS_ANGSTROM, acc_trans);
-		MD.setValue(EMDL_OPTIMISER_CHANGES_OPTIMAL_ORIENTS, current_changes_optimal_orientations);
-		MD.setValue(EMDL_OPTIMISER_CHANGES_OPTIMAL_OFFSETS, current_changes_optimal_offsets);
-		MD.setValue(EMDL_OPTIMISER_CHANGES_OPTIMAL_CLASSES, current_changes_optimal_classes);
-		MD.setValue(EMDL_OPTIMISER_SMALLEST_CHANGES_OPT_ORIENTS, smallest_changes_optimal_orientations);
-		MD.setValue(EMDL_OPTIMISER_SMALLEST_CHANGES_OPT_OFFSETS, smallest_changes_optimal_offsets);
-		MD.setValue(EMDL_OPTIMISER_SMALLEST_CHANGES_OPT_CLASSES, smallest_changes_optimal_classes);
-		MD.setValue(EMDL_OPTIMISER_LOCAL_SYMMETRY_FILENAME, fn_local_symmetry);
-		MD.setValue(EMDL_OPTIMISER_DO_HELICAL_REFINE, do_helical_refine);
-		MD.setValue(EMDL_OPTIMISER_IGNORE_HELICAL_SYMMETRY, ignore_helical_symmetry);
-		MD.setValue(EMDL_OPTIMISER_FOURIER_MASK, fn_fourier_mask);
-		MD.setValue(EMDL_OPTIMISER_HELICAL_TWIST_INITIAL, helical_twist_initial);
-		MD.setValue(EMDL_OPTIMISER_HELICAL_RISE_INITIAL, helical_rise_initial);
-		MD.setValue(EMDL_OPTIMISER_HELICAL_Z_PERCENTAGE, helical_z_percentage);
-		MD.setValue(EMDL_OPTIMISER_HELICAL_NSTART, helical_nstart);
-		MD.setValue(EMDL_OPTIMISER_HELICAL_TUBE_INNER_DIAMETER, helical_tube_inner_diameter);
-		MD.setValue(EMDL_OPTIMISER_HELICAL_TUBE_OUTER_DIAMETER, helical_tube_outer_diameter);
-		MD.setValue(EMDL_OPTIMISER_HELICAL_SYMMETRY_LOCAL_REFINEMENT, do_helical_symmetry_local_refinement);
-		MD.setValue(EMDL_OPTIMISER_HELICAL_SIGMA_DISTANCE, helical_sigma_distance);
-		MD.setValue(EMDL_OPTIMISER_HELICAL_KEEP_TILT_PRIOR_FIXED, helical_keep_tilt_prior_fixed);
-		MD.setValue(EMDL_OPTIMISER_HAS_CONVERGED, has_converged);
-		MD.setValue(EMDL_OPTIMISER_HAS_HIGH_FSC_AT_LIMIT, has_high_fsc_at_limit);
-		MD.setValue(EMDL_OPTIMISER_HAS_LARGE_INCR_SIZE_ITER_AGO, has_large_incr_size_iter_ago);
-		MD.setValue(EMDL_OPTIMISER_DO_CORRECT_NORM, do_norm_correction);
-		MD.setValue(EMDL_OPTIMISER_DO_CORRECT_SCALE, do_scale_correction);
-		MD.setValue(EMDL_OPTIMISER_DO_CORRECT_CTF, do_ctf_correction);
-		MD.setValue(EMDL_OPTIMISER_IGNORE_CTF_UNTIL_FIRST_PEAK, intact_ctf_first_peak);
-		MD.setValue(EMDL_OPTIMISER_DATA_ARE_CTF_PHASE_FLIPPED, ctf_phase_flipped);
-		MD.setValue(EMDL_OPTIMISER_DO_ONLY_FLIP_CTF_PHASES, only_flip_phases);
-		MD.setValue(EMDL_OPTIMISER_REFS_ARE_CTF_CORRECTED, refs_are_ctf_corrected);
-		MD.setValue(EMDL_OPTIMISER_FIX_SIGMA_NOISE, fix_sigma_noise);
-		MD.setValue(EMDL_OPTIMISER_FIX_SIGMA_OFFSET, fix_sigma_offset);
-		MD.setValue(EMDL_OPTIMISER_MAX_NR_POOL, nr_pool);
-
-		MD.write(fh);
-		fh.close();
+		snapshot->fn_optimiser = fn_root2 + "_optimiser.star";
+		snapshot->optimiser_star = (optimiser_star != NULL) ? *optimiser_star : formatOptimiserStar();
 	}
 
 	// Then write the mymodel to file
@@ -1185,13 +1292,44 @@ void MlOptimiser::write(bool do_write_sampling, bool do_write_data, bool do_writ
 			mymodel.write(fn_root2, sampling, do_write_bild);
 	}
 
-	// And write the mydata to file
+	// And take a copy of mydata to write it to file
 	if (do_write_data)
-		mydata.write(fn_root);
+	{
+		snapshot->fn_data = fn_root + "_data.star";
+		snapshot->MDoptics = mydata.obsModel.opticsMdt;
+		snapshot->MDimg = mydata.MDimg;
+		if (mydata.nr_bodies > 1)
+			snapshot->MDbodies = mydata.MDbodies;
+	}
 
 	// And write the sampling object
 	if (do_write_sampling)
 		sampling.write(fn_root);
+
+	// Finally write the data and optimiser files, in the background if possible
+	if (do_async_write && pthread_create(&write_snapshot_thread, NULL, globalThreadWriteSnapshot, (void*)snapshot.get()) == 0)
+	{
+		write_snapshot = snapshot.release();
+	}
+	else
+	{
+		globalThreadWriteSnapshot((void*)snapshot.get());
+		if (snapshot->exception)
+			throw *snapshot->exception;
+	}
+}
+
+void MlOptimiser::waitForWrite()
+{
+	if (write_snapshot == NULL)
+		return;
+
+	pthread_join(write_snapshot_thread, NULL);
+	std::unique_ptr<MlWriteSnapshot> snapshot(write_snapshot);
+	write_snapshot = NULL;
+
+	if (snapshot->exception)
+		throw *snapshot->exception;
 }
 
 /** ========================== Initialisation  =========================== */
@@ -1618,12 +1756,19 @@ void MlOptimiser::initialiseGeneral(int rank)
 		do_shifts_onthefly = false;
 	}
 
+	if (do_mixed_precision && (do_gpu || do_cpu))
+	{
+		std::cerr << "WARNING: --mixed_precision only affects the non-accelerated CPU code, which already uses single precision with --cpu or --gpu" << std::endl;
+		do_mixed_precision = false;
+	}
+
 	// If we are not continuing an old run, now read in the data and the reference images
 	if (iter == 0)
 	{
 		// Read in the experimental image metadata
 		// If do_preread_images: only the leader reads all images into RAM
 		bool do_preread = (do_preread_images) ? (do_parallel_disc_io || rank == 0) : false;
+		if (do_preread_images_shared && do_parallel_disc_io) do_preread = false;
 		bool is_helical_segment = (do_helical_refine) || ((mymodel.ref_dim == 2) && (helical_tube_outer_diameter > 0.));
 		int myverb = (rank==0) ? 1 : 0;
 		mydata.read(fn_data, true, false, do_preread, is_helical_segment, myverb); // true means ignore original particle name
@@ -2076,7 +2221,7 @@ void MlOptimiser::initialiseWorkLoad()
 
 }
 
-void MlOptimiser::calculateSumOfPowerSpectraAndAverageImage(MultidimArray<RFLOAT> &Mavg, bool myverb)
+void MlOptimiser::calculateSumOfPowerSpectraAndAverageImage(MultidimArray<RFLOAT> &Mavg, bool myverb, MultidimArray<RFLOAT> *Mavg_err)
 {
 
 #ifdef DEBUG_INI
@@ -2095,6 +2240,9 @@ void MlOptimiser::calculateSumOfPowerSpectraAndAverageImage(MultidimArray<RFLOAT
 		Mavg.initZeros(mymodel.ori_size, mymodel.ori_size);
 	}
 	Mavg.setXmippOrigin();
+	MultidimArray<RFLOAT> Mavg_err_local;
+	MultidimArray<RFLOAT> &Merr = (Mavg_err == NULL) ? Mavg_err_local : *Mavg_err;
+	Merr.initZeros(Mavg);
 
 	if (my_nr_particles < 1)
 	{
@@ -2103,6 +2251,10 @@ void MlOptimiser::calculateSumOfPowerSpectraAndAverageImage(MultidimArray<RFLOAT
     		return;
 	}
 
+	// All images are rescaled and windowed onto Mavg before their power spectra are taken
+	FourierShells::Ptr shells_ptr = FourierShells::get(XSIZE(Mavg) / 2 + 1, YSIZE(Mavg), ZSIZE(Mavg));
+	const FourierShells &shells = *shells_ptr;
+
 	if (myverb > 0)
 	{
 		std::cout << " Estimating initial noise spectra " << std::endl;
@@ -2148,10 +2300,10 @@ void MlOptimiser::calculateSumOfPowerSpectraAndAverageImage(MultidimArray<RFLOAT
 			Image<RFLOAT> img;
 			if (do_preread_images && do_parallel_disc_io)
 			{
-				img().reshape(mydata.particles[part_id].images[img_id].img);
-				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mydata.particles[part_id].images[img_id].img)
+				img().reshape(mydata.getPrereadImage(part_id, img_id));
+				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mydata.getPrereadImage(part_id, img_id))
 				{
-					DIRECT_MULTIDIM_ELEM(img(), n) = (RFLOAT)DIRECT_MULTIDIM_ELEM(mydata.particles[part_id].images[img_id].img, n);
+					DIRECT_MULTIDIM_ELEM(img(), n) = (RFLOAT)DIRECT_MULTIDIM_ELEM(mydata.getPrereadImage(part_id, img_id), n);
 				}
 			}
 			else
@@ -2266,7 +2418,7 @@ void MlOptimiser::calculateSumOfPowerSpectraAndAverageImage(MultidimArray<RFLOAT
 												  LAST_XMIPP_INDEX(mymodel.ori_size), LAST_XMIPP_INDEX(mymodel.ori_size), LAST_XMIPP_INDEX(mymodel.ori_size));
 				}
 			}
-			Mavg += img();
+			compensatedAdd(Mavg, Merr, img());
 
 			// Calculate the power spectrum of this particle
 			MultidimArray<RFLOAT> ind_spectrum, count;
@@ -2278,7 +2430,7 @@ void MlOptimiser::calculateSumOfPowerSpectraAndAverageImage(MultidimArray<RFLOAT
 
 			FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Faux)
 			{
-				long int idx = ROUND(sqrt(kp*kp + ip*ip + jp*jp));
+				long int idx = shells(k, i, j);
 				if (idx < spectral_size)
 				{
 					ind_spectrum(idx) += norm(dAkij(Faux, k, i, j));
@@ -2288,7 +2440,7 @@ void MlOptimiser::calculateSumOfPowerSpectraAndAverageImage(MultidimArray<RFLOAT
 			ind_spectrum /= count;
 
 			// Resize the power_class spectrum to the correct size and keep sum
-			wsum_model.sigma2_noise[group_id] += ind_spectrum;
+			compensatedAdd(wsum_model.sigma2_noise[group_id], wsum_model.err.sigma2_noise[group_id], ind_spectrum);
 			wsum_model.sumw_group[group_id] += 1.;
 
 			// When doing SGD, only take the first sgd_ini_subset_size*mymodel.nr_classes images to calculate the initial reconstruction
@@ -2395,7 +2547,8 @@ void MlOptimiser::setSigmaNoiseEstimatesAndSetAverageImage(MultidimArray<RFLOAT>
 		{
 
 			MultidimArray<RFLOAT> dummy;
-			(wsum_model.BPref[iclass]).reconstruct(mymodel.Iref[iclass], gridding_nr_iter, false, dummy);
+			(wsum_model.BPref[iclass]).reconstruct(mymodel.Iref[iclass], gridding_nr_iter, false, dummy,
+					1., 1., -1, false, 0, nr_threads, gridding_tol);
 			// 2D projection data were CTF-corrected, subtomograms were not
 			refs_are_ctf_corrected = (mymodel.data_dim == 3) ? false : true;
 		}
@@ -2515,15 +2668,19 @@ void MlOptimiser::iterateSetup()
 
 	// Set up the thread task distributors for the particles and the orientations (will be resized later on)
 	exp_ipart_ThreadTaskDistributor = new ThreadTaskDistributor(nr_threads, 1);
+	max_iclass_ThreadTaskDistributor = new ThreadTaskDistributor(nr_threads, 1);
 
 }
 void MlOptimiser::iterateWrapUp()
 {
+	// Make sure the last output files are complete
+	waitForWrite();
 
 	// delete barrier, threads and task distributors
 	delete global_barrier;
 	delete global_ThreadManager;
 	delete exp_ipart_ThreadTaskDistributor;
+	delete max_iclass_ThreadTaskDistributor;
 
 	// Delete volatile space on scratch
 	if (!keep_scratch)
@@ -2586,7 +2743,7 @@ void MlOptimiser::iterate()
 		// Randomly take different subset of the particles each time we do a new "iteration" in SGD
 		if (random_seed > 0)
 		{
-			mydata.randomiseParticlesOrder(random_seed+iter, do_split_random_halves,  subset_size < mydata.numberOfParticles() );
+			mydata.randomiseParticlesOrder(random_seed+iter, do_split_random_halves,  subset_size < mydata.numberOfParticles(), random_order_block_size);
 		}
 		else if (verb > 0)
 		{
@@ -3118,6 +3275,9 @@ void MlOptimiser::expectationSetup()
 	// Reset the random perturbation for this sampling
 	sampling.resetRandomlyPerturbedSampling();
 
+	// Look up the oversampled directions of each particle in a table
+	sampling.precalculateOversampledDirections(adaptive_oversampling);
+
 	// Initialise Projectors and fill vector with power_spectra for all classes
 	MultidimArray<RFLOAT> *my_fourier_mask = (XSIZE(helical_fourier_mask) > 0) ? &helical_fourier_mask : NULL;
 	mymodel.setFourierTransformMaps(!fix_tau, nr_threads, strict_lowres_exp, my_fourier_mask);
@@ -4072,97 +4232,15 @@ void MlOptimiser::maximization()
 
 	// First reconstruct the images for each class
 	// multi-body refinement will never get here, as it is only 3D auto-refine and that requires MPI!
+	std::vector<int> iclasses;
 	for (int iclass = 0; iclass < mymodel.nr_classes * mymodel.nr_bodies; iclass++)
 	{
-		RCTIC(timer,RCT_1);
-		if (mymodel.pdf_class[iclass] > 0. || mymodel.nr_bodies > 1 )
+		if ((mymodel.pdf_class[iclass] > 0. || mymodel.nr_bodies > 1) &&
+		    (wsum_model.BPref[iclass].weight).sum() > XMIPP_EQUAL_ACCURACY)
 		{
-
-			if ((wsum_model.BPref[iclass].weight).sum() > XMIPP_EQUAL_ACCURACY)
-			{
-				MultidimArray<RFLOAT> Iref_old;
-
-				if (do_sgd) Iref_old = mymodel.Iref[iclass];
-
-				(wsum_model.BPref[iclass]).updateSSNRarrays(mymodel.tau2_fudge_factor,
-						mymodel.tau2_class[iclass],
-						mymodel.sigma2_class[iclass],
-						mymodel.data_vs_prior_class[iclass],
-						mymodel.fourier_coverage_class[iclass],
-						mymodel.fsc_halves_class[0],
-						false,
-						false);
-
-				if (do_external_reconstruct)
-				{
-					FileName fn_ext_root;
-					if (iter > -1) fn_ext_root.compose(fn_out+"_it", iter, "", 3);
-					else fn_ext_root = fn_out;
-					fn_ext_root.compose(fn_ext_root+"_class", iclass+1, "", 3);
-					(wsum_model.BPref[iclass]).externalReconstruct(mymodel.Iref[iclass],
-							fn_ext_root,
-							mymodel.fsc_halves_class[iclass],
-							mymodel.tau2_class[iclass],
-							mymodel.sigma2_class[iclass],
-							mymodel.data_vs_prior_class[iclass],
-							(do_join_random_halves || do_always_join_random_halves),
-							mymodel.tau2_fudge_factor,
-							1); // verbose
-				}
-				else
-				{
-					(wsum_model.BPref[iclass]).reconstruct(mymodel.Iref[iclass],
-							gridding_nr_iter,
-							do_map,
-							mymodel.tau2_class[iclass],
-							mymodel.tau2_fudge_factor,
-							wsum_model.pdf_class[iclass],
-							minres_map,
-							(iclass==0));
-				}
-
-				if(do_sgd)
-				{
-					// Use stochastic expectation maximisation, instead of SGD.
-					if(do_avoid_sgd)
-					{
-						if (iter < sgd_ini_iter)
-						{
-							FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mymodel.Iref[iclass])
-							{
-								DIRECT_MULTIDIM_ELEM(mymodel.Iref[iclass], n) = XMIPP_MAX(0., DIRECT_MULTIDIM_ELEM(mymodel.Iref[iclass], n));
-							}
-						}
-						mymodel.Iref[iclass] = mymodel.Iref[iclass] - Iref_old;
-					}
-
-					// Now update formula: dV_kl^(n) = (mu) * dV_kl^(n-1) + (1-mu)*step_size*G_kl^(n)
-					// where G_kl^(n) is now in mymodel.Iref[iclass]!!!
-					FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mymodel.Igrad[iclass])
-						DIRECT_MULTIDIM_ELEM(mymodel.Igrad[iclass], n) = mu * DIRECT_MULTIDIM_ELEM(mymodel.Igrad[iclass], n) +
-						(1. - mu) * sgd_stepsize * DIRECT_MULTIDIM_ELEM(mymodel.Iref[iclass], n);
-
-					// update formula: V_kl^(n+1) = V_kl^(n) + dV_kl^(n)
-					mymodel.Iref[iclass] = Iref_old + mymodel.Igrad[iclass];
-
-//#define DEBUG_SGD
-#ifdef DEBUG_SGD
-					FileName fn_tmp="grad_class"+integerToString(iclass)+".spi";
-					Image<RFLOAT> It;
-					It()=mymodel.Igrad[iclass];
-					It.write(fn_tmp);
-					fn_tmp="ref_class"+integerToString(iclass)+".spi";
-					It()=mymodel.Iref[iclass];
-					It.write(fn_tmp);
-#endif
-					// Enforce positivity?
-					// Low-pass filter according to current resolution??
-					// Some sort of regularisation may be necessary....?
-
-				}
-			}
+			iclasses.push_back(iclass);
 		}
-		else
+		else if (mymodel.pdf_class[iclass] <= 0. && mymodel.nr_bodies == 1)
 		{
 			// When not doing SGD, initialise to zero, but when doing SGD just keep the previous reference
 			if (!do_sgd)
@@ -4171,11 +4249,12 @@ void MlOptimiser::maximization()
 			if (do_sgd)
 				mymodel.Igrad[iclass].initZeros();
 		}
-		RCTOC(timer,RCT_1);
-		if (verb > 0)
-			progress_bar(iclass);
 	}
 
+	RCTIC(timer,RCT_1);
+	maximizationReconstructClasses(iclasses);
+	RCTOC(timer,RCT_1);
+
 	RCTIC(timer,RCT_3);
 	// Then perform the update of all other model parameters
 	maximizationOtherParameters();
@@ -4185,8 +4264,203 @@ void MlOptimiser::maximization()
 	updateOverallChangesInHiddenVariables();
 	RCTOC(timer,RCT_4);
 	if (verb > 0)
+	{
 		progress_bar(mymodel.nr_classes);
 
+		int min_iter, max_iter;
+		RFLOAT max_residual;
+		getGriddingStatistics(min_iter, max_iter, max_residual);
+		printGriddingStatistics(min_iter, max_iter, max_residual);
+	}
+
+}
+
+void MlOptimiser::maximizationReconstructClass(int iclass, int threads)
+{
+	MultidimArray<RFLOAT> Iref_old;
+
+	if (do_sgd) Iref_old = mymodel.Iref[iclass];
+
+	(wsum_model.BPref[iclass]).updateSSNRarrays(mymodel.tau2_fudge_factor,
+			mymodel.tau2_class[iclass],
+			mymodel.sigma2_class[iclass],
+			mymodel.data_vs_prior_class[iclass],
+			mymodel.fourier_coverage_class[iclass],
+			mymodel.fsc_halves_class[0],
+			do_split_random_halves,
+			(do_join_random_halves || do_always_join_random_halves));
+
+	if (do_external_reconstruct)
+	{
+		FileName fn_ext_root;
+		if (iter > -1) fn_ext_root.compose(fn_out+"_it", iter, "", 3);
+		else fn_ext_root = fn_out;
+		fn_ext_root.compose(fn_ext_root+"_class", iclass+1, "", 3);
+		(wsum_model.BPref[iclass]).externalReconstruct(mymodel.Iref[iclass],
+				fn_ext_root,
+				mymodel.fsc_halves_class[iclass],
+				mymodel.tau2_class[iclass],
+				mymodel.sigma2_class[iclass],
+				mymodel.data_vs_prior_class[iclass],
+				(do_join_random_halves || do_always_join_random_halves),
+				mymodel.tau2_fudge_factor,
+				1); // verbose
+	}
+	else
+	{
+		(wsum_model.BPref[iclass]).reconstruct(mymodel.Iref[iclass],
+				gridding_nr_iter,
+				do_map,
+				mymodel.tau2_class[iclass],
+				mymodel.tau2_fudge_factor,
+				wsum_model.pdf_class[iclass],
+				minres_map,
+				(iclass==0 && verb > 0),
+				0,
+				threads,
+				gridding_tol);
+	}
+
+	if(do_sgd)
+	{
+		// Use stochastic expectation maximisation, instead of SGD.
+		if(do_avoid_sgd)
+		{
+			if (iter < sgd_ini_iter)
+			{
+				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mymodel.Iref[iclass])
+				{
+					DIRECT_MULTIDIM_ELEM(mymodel.Iref[iclass], n) = XMIPP_MAX(0., DIRECT_MULTIDIM_ELEM(mymodel.Iref[iclass], n));
+				}
+			}
+			mymodel.Iref[iclass] = mymodel.Iref[iclass] - Iref_old;
+		}
+
+		// Now update formula: dV_kl^(n) = (mu) * dV_kl^(n-1) + (1-mu)*step_size*G_kl^(n)
+		// where G_kl^(n) is now in mymodel.Iref[iclass]!!!
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mymodel.Igrad[iclass])
+			DIRECT_MULTIDIM_ELEM(mymodel.Igrad[iclass], n) = mu * DIRECT_MULTIDIM_ELEM(mymodel.Igrad[iclass], n) +
+			(1. - mu) * sgd_stepsize * DIRECT_MULTIDIM_ELEM(mymodel.Iref[iclass], n);
+
+		// update formula: V_kl^(n+1) = V_kl^(n) + dV_kl^(n)
+		mymodel.Iref[iclass] = Iref_old + mymodel.Igrad[iclass];
+
+//#define DEBUG_SGD
+#ifdef DEBUG_SGD
+		FileName fn_tmp="grad_class"+integerToString(iclass)+".spi";
+		Image<RFLOAT> It;
+		It()=mymodel.Igrad[iclass];
+		It.write(fn_tmp);
+		fn_tmp="ref_class"+integerToString(iclass)+".spi";
+		It()=mymodel.Iref[iclass];
+		It.write(fn_tmp);
+#endif
+		// Enforce positivity?
+		// Low-pass filter according to current resolution??
+		// Some sort of regularisation may be necessary....?
+
+	}
+}
+
+int MlOptimiser::getNumberOfConcurrentReconstructions(int nr_recons)
+{
+	// External reconstructions run in a separate program, one at a time
+	int nr_concurrent = XMIPP_MIN(nr_threads, nr_recons);
+	if (nr_concurrent <= 1 || do_external_reconstruct)
+		return 1;
+
+	// Each reconstruction needs its own padded work arrays
+	double mem_per_recons = (double)wsum_model.BPref[0].getReconstructionMemory();
+	double mem_available;
+	if (recons_ram > 0.)
+		mem_available = recons_ram * 1024. * 1024. * 1024.;
+	else
+		mem_available = 0.5 * (double)sysconf(_SC_AVPHYS_PAGES) * (double)sysconf(_SC_PAGESIZE);
+
+	if (mem_per_recons > 0.)
+		nr_concurrent = XMIPP_MIN(nr_concurrent, (int)(mem_available / mem_per_recons));
+
+	return XMIPP_MAX(1, nr_concurrent);
+}
+
+void MlOptimiser::getGriddingStatistics(int &min_iter, int &max_iter, RFLOAT &max_residual)
+{
+	min_iter = max_iter = 0;
+	max_residual = 0.;
+	for (int i = 0; i < wsum_model.BPref.size(); i++)
+	{
+		// Classes that were not reconstructed (or not by this process) did no gridding iterations
+		int my_iter = wsum_model.BPref[i].last_gridding_iter;
+		if (my_iter == 0)
+			continue;
+		min_iter = (min_iter == 0) ? my_iter : XMIPP_MIN(min_iter, my_iter);
+		max_iter = XMIPP_MAX(max_iter, my_iter);
+		max_residual = XMIPP_MAX(max_residual, wsum_model.BPref[i].last_gridding_residual);
+	}
+}
+
+void MlOptimiser::printGriddingStatistics(int min_iter, int max_iter, RFLOAT max_residual)
+{
+	if (max_iter == 0)
+		return;
+
+	std::cout << " Gridding stopped after ";
+	if (min_iter == max_iter)
+		std::cout << max_iter;
+	else
+		std::cout << min_iter << " to " << max_iter;
+	std::cout << " iterations, largest mean |w-1|= " << max_residual << std::endl;
+}
+
+void MlOptimiser::maximizationReconstructClasses(const std::vector<int> &iclasses)
+{
+	if (iclasses.size() == 0)
+		return;
+
+	// Divide the threads over the reconstructions: the threads of each are used for its FFTs and OpenMP loops
+	max_nr_concurrent_recons = getNumberOfConcurrentReconstructions(iclasses.size());
+	max_threads_per_recons = XMIPP_MAX(1, nr_threads / max_nr_concurrent_recons);
+	max_iclass_todo = iclasses;
+
+	if (max_nr_concurrent_recons == 1)
+	{
+		for (int i = 0; i < max_iclass_todo.size(); i++)
+		{
+			maximizationReconstructClass(max_iclass_todo[i], nr_threads);
+			if (verb > 0)
+				progress_bar(max_iclass_todo[i]);
+		}
+		return;
+	}
+
+#ifdef DEBUG
+	std::cerr << " reconstructing " << iclasses.size() << " classes, " << max_nr_concurrent_recons
+	          << " at a time with " << max_threads_per_recons << " threads each" << std::endl;
+#endif
+
+	max_iclass_ThreadTaskDistributor->resize(max_iclass_todo.size(), 1);
+	max_iclass_ThreadTaskDistributor->reset();
+	global_ThreadManager->run(globalThreadMaximizationSomeClasses);
+
+	if (threadException != NULL)
+		throw *threadException;
+
+	if (verb > 0)
+		progress_bar(max_iclass_todo.back());
+}
+
+void MlOptimiser::doThreadMaximizationSomeClasses(int thread_id)
+{
+	// Only some of the threads reconstruct, each with max_threads_per_recons threads of its own
+	if (thread_id >= max_nr_concurrent_recons)
+		return;
+
+	size_t first_task, last_task;
+	while (max_iclass_ThreadTaskDistributor->getTasks(first_task, last_task))
+	{
+		for (size_t itask = first_task; itask <= last_task; itask++)
+			maximizationReconstructClass(max_iclass_todo[itask], max_threads_per_recons);
+	}
 }
 
 void MlOptimiser::maximizationOtherParameters()
@@ -4735,9 +5009,11 @@ void MlOptimiser::updateImageSizeAndResolutionPointers()
 		aux.resize(mymodel.ori_size, mymodel.ori_size, mymodel.ori_size / 2 + 1);
 	else
 		aux.resize(mymodel.ori_size, mymodel.ori_size / 2 + 1);
+	FourierShells::Ptr shells_ptr = FourierShells::get(aux);
+	const FourierShells &shells = *shells_ptr;
 	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(aux)
 	{
-		int ires = ROUND(sqrt((RFLOAT)(kp*kp + ip*ip + jp*jp)));
+		int ires = shells(k, i, j);
 		// TODO: better check for volume_refine, but the same still seems to hold... Half of the yz plane (either ip<0 or kp<0 is redundant at jp==0)
 		// Exclude points beyond XSIZE(Npix_per_shell), and exclude half of the x=0 column that is stored twice in FFTW
 		if (ires < mymodel.ori_size / 2 + 1 && !(jp==0 && ip < 0))
@@ -4749,6 +5025,7 @@ void MlOptimiser::updateImageSizeAndResolutionPointers()
 	image_coarse_size.resize(nr_optics_groups);
 	image_current_size.resize(nr_optics_groups);
 	image_full_size.resize(nr_optics_groups);
+	image_full_shells.resize(nr_optics_groups);
 	Mresol_fine.resize(nr_optics_groups);
 	Mresol_coarse.resize(nr_optics_groups);
 	for (int optics_group = 0; optics_group < nr_optics_groups; optics_group++)
@@ -4759,6 +5036,9 @@ void MlOptimiser::updateImageSizeAndResolutionPointers()
 		RFLOAT remap_sizes = (my_pixel_size * my_image_size) / (mymodel.pixel_size * mymodel.ori_size);
 
 		image_full_size[optics_group] = my_image_size;
+		// Look the shells of the full-size transforms up here, not for every particle
+		image_full_shells[optics_group] = FourierShells::get(my_image_size / 2 + 1, my_image_size,
+		                                                     (mymodel.data_dim == 3) ? my_image_size : 1);
 		// Remap from model size to mysize, and keep even!
 		image_current_size[optics_group] = 2 * CEIL(0.5 * remap_sizes * mymodel.current_size);
 		// Current size can never become bigger than original image size for this optics_group!
@@ -4797,9 +5077,11 @@ void MlOptimiser::updateImageSizeAndResolutionPointers()
 		else
 			Mresol_fine[optics_group].resize(image_current_size[optics_group], (image_current_size[optics_group] / 2 + 1));
 		Mresol_fine[optics_group].initConstant(-1);
+		FourierShells::Ptr fine_shells_ptr = FourierShells::get(Mresol_fine[optics_group]);
+		const FourierShells &fine_shells = *fine_shells_ptr;
 		FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Mresol_fine[optics_group])
 		{
-			int ires = ROUND(sqrt((RFLOAT)(kp*kp + ip*ip + jp*jp)));
+			int ires = fine_shells(k, i, j);
 			// TODO: better check for volume_refine, but the same still seems to hold... Half of the yz plane (either ip<0 or kp<0 is redundant at jp==0)
 			// Exclude points beyond ires, and exclude and half (y<0) of the x=0 column that is stored twice in FFTW
 			if (ires < image_current_size[optics_group] / 2 + 1  && !(jp==0 && ip < 0))
@@ -4814,9 +5096,11 @@ void MlOptimiser::updateImageSizeAndResolutionPointers()
 			Mresol_coarse[optics_group].resize(image_coarse_size[optics_group], (image_coarse_size[optics_group] / 2 + 1));
 
 		Mresol_coarse[optics_group].initConstant(-1);
+		FourierShells::Ptr coarse_shells_ptr = FourierShells::get(Mresol_coarse[optics_group]);
+		const FourierShells &coarse_shells = *coarse_shells_ptr;
 		FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Mresol_coarse[optics_group])
 		{
-			int ires = ROUND(sqrt((RFLOAT)(kp*kp + ip*ip + jp*jp)));
+			int ires = coarse_shells(k, i, j);
 			// Exclude points beyond ires, and exclude and half (y<0) of the x=0 column that is stored twice in FFTW
 			// exclude lowest-resolution points
 			if (ires < (image_coarse_size[optics_group] / 2 + 1) && !(jp==0 && ip < 0))
@@ -5051,12 +5335,12 @@ void MlOptimiser::getFourierTransformsAndCtfs(
 			// If all followers had preread images into RAM: get those now
 			if (do_preread_images)
 			{
-				img().reshape(mydata.particles[part_id].images[img_id].img);
+				img().reshape(mydata.getPrereadImage(part_id, img_id));
 
 
-				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mydata.particles[part_id].images[img_id].img)
+				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mydata.getPrereadImage(part_id, img_id))
 				{
-					DIRECT_MULTIDIM_ELEM(img(), n) = (RFLOAT)DIRECT_MULTIDIM_ELEM(mydata.particles[part_id].images[img_id].img, n);
+					DIRECT_MULTIDIM_ELEM(img(), n) = (RFLOAT)DIRECT_MULTIDIM_ELEM(mydata.getPrereadImage(part_id, img_id), n);
 				}
 			}
 			else
@@ -5362,9 +5646,10 @@ void MlOptimiser::getFourierTransformsAndCtfs(
 			}
 
 			// Fill Fnoise with random numbers, use power spectrum of the noise for its variance
+			const FourierShells &shells = *image_full_shells[optics_group];
 			FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Fnoise)
 			{
-				int ires = ROUND( sqrt( (RFLOAT)(kp * kp + ip * ip + jp * jp) ) );
+				int ires = shells(k, i, j);
 				if (ires >= 0 && ires < XSIZE(remapped_sigma2_noise))
 				{
 					RFLOAT sigma = sqrt(sigma2_fudge * DIRECT_A1D_ELEM(remapped_sigma2_noise, ires));
@@ -5416,9 +5701,10 @@ void MlOptimiser::getFourierTransformsAndCtfs(
 			MultidimArray<RFLOAT> spectrum;
 			spectrum.initZeros(image_full_size[optics_group]/2 + 1);
 			RFLOAT highres_Xi2 = 0.;
+			const FourierShells &shells = *image_full_shells[optics_group];
 			FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Faux)
 			{
-				int ires = ROUND( sqrt( (RFLOAT)(kp*kp + ip*ip + jp*jp) ) );
+				int ires = shells(k, i, j);
 				// Skip Hermitian pairs in the x==0 column
 
 				if (ires > 0 && ires < image_full_size[optics_group]/2 + 1 && !(jp==0 && ip < 0) )
@@ -6055,6 +6341,48 @@ bool MlOptimiser::isSignificantAnyImageAnyTranslation(long int iorient, int exp_
 }
 
 
+// Single-precision copies of the arrays in the squared-difference loop (for --mixed_precision)
+static void copyToFloat(const MultidimArray<Complex> &in, std::vector<float> &out)
+{
+	out.resize(2 * MULTIDIM_SIZE(in));
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(in)
+	{
+		out[2 * n]     = (float)(DIRECT_MULTIDIM_ELEM(in, n)).real;
+		out[2 * n + 1] = (float)(DIRECT_MULTIDIM_ELEM(in, n)).imag;
+	}
+}
+
+static void copyToFloat(const MultidimArray<RFLOAT> &in, std::vector<float> &out)
+{
+	out.resize(MULTIDIM_SIZE(in));
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(in)
+	{
+		out[n] = (float)DIRECT_MULTIDIM_ELEM(in, n);
+	}
+}
+
+// Sum of |Fref - Fimg|^2 * Minvsigma2 / 2 in single precision. The partial sums over short blocks
+// of pixels are accumulated in double precision, so that the rounding error does not grow with the image size.
+#define MIXED_PRECISION_BLOCK_SIZE 256
+static RFLOAT squaredDifferenceInSinglePrecision(const float *Fref, const float *Fimg, const float *Minvsigma2, long int size)
+{
+	double sum = 0.;
+	for (long int start = 0; start < size; start += MIXED_PRECISION_BLOCK_SIZE)
+	{
+		const long int end = XMIPP_MIN(start + MIXED_PRECISION_BLOCK_SIZE, size);
+		float block_sum = 0.f;
+		#pragma omp simd reduction(+:block_sum)
+		for (long int n = start; n < end; n++)
+		{
+			float diff_real = Fref[2 * n] - Fimg[2 * n];
+			float diff_imag = Fref[2 * n + 1] - Fimg[2 * n + 1];
+			block_sum += (diff_real * diff_real + diff_imag * diff_imag) * Minvsigma2[n];
+		}
+		sum += block_sum;
+	}
+	return (RFLOAT)(0.5 * sum);
+}
+
 void MlOptimiser::getAllSquaredDifferences(long int part_id, int ibody,
 		int exp_ipass, int exp_current_oversampling, int metadata_offset,
 		int exp_idir_min, int exp_idir_max, int exp_ipsi_min, int exp_ipsi_max,
@@ -6114,6 +6442,40 @@ void MlOptimiser::getAllSquaredDifferences(long int part_id, int ibody,
 			exp_itrans_min, exp_itrans_max, exp_Fimg, dummy, exp_Fctf, exp_local_Fimgs_shifted, dummy2,
 			exp_local_Fctf, exp_local_sqrtXi2, exp_local_Minvsigma2);
 
+	// With --mixed_precision, the squared differences are calculated from single-precision copies of the
+	// shifted images and inverse sigma2's. These are made once per particle and re-used for all orientations.
+	const bool do_diff2_in_single = do_mixed_precision && !((iter == 1 && do_firstiter_cc) || do_always_cc);
+	std::vector<std::vector<std::vector<float> > > local_Fimgs_shifted_single;
+	std::vector<std::vector<float> > local_Minvsigma2_single;
+	if (do_diff2_in_single)
+	{
+		local_Minvsigma2_single.resize(exp_nr_images);
+		if (!do_shifts_onthefly)
+			local_Fimgs_shifted_single.resize(exp_nr_images);
+		for (int img_id = 0; img_id < exp_nr_images; img_id++)
+		{
+			copyToFloat(exp_local_Minvsigma2[img_id], local_Minvsigma2_single[img_id]);
+			if (!do_shifts_onthefly)
+			{
+				local_Fimgs_shifted_single[img_id].resize(exp_local_Fimgs_shifted[img_id].size());
+				for (long int ishift = 0; ishift < exp_local_Fimgs_shifted[img_id].size(); ishift++)
+					copyToFloat(exp_local_Fimgs_shifted[img_id][ishift], local_Fimgs_shifted_single[img_id][ishift]);
+			}
+		}
+	}
+
+	// The anisotropic magnification and scale difference of each image do not depend on the orientation
+	std::vector<Matrix2D<RFLOAT> > Amag(exp_nr_images);
+	std::vector<bool> do_mag(exp_nr_images);
+	for (int img_id = 0; img_id < exp_nr_images; img_id++)
+	{
+		int optics_group = mydata.getOpticsGroup(part_id, img_id);
+		Amag[img_id].initIdentity(3);
+		Amag[img_id] = mydata.obsModel.applyAnisoMag(Amag[img_id], optics_group);
+		Amag[img_id] = mydata.obsModel.applyScaleDifference(Amag[img_id], optics_group, mymodel.ori_size, mymodel.pixel_size);
+		do_mag[img_id] = !Amag[img_id].isIdentity();
+	}
+
 	// Loop only from exp_iclass_min to exp_iclass_max to deal with seed generation in first iteration
 	for (int exp_iclass = exp_iclass_min; exp_iclass <= exp_iclass_max; exp_iclass++)
 	{
@@ -6123,8 +6485,10 @@ void MlOptimiser::getAllSquaredDifferences(long int part_id, int ibody,
 			std::vector< RFLOAT > oversampled_rot, oversampled_tilt, oversampled_psi;
 			std::vector< RFLOAT > oversampled_translations_x, oversampled_translations_y, oversampled_translations_z;
 			MultidimArray<Complex > Fimg, Fref, Frefctf, Fimg_otfshift;
+			std::vector<float> Frefctf_single, Fimg_otfshift_single;
 			RFLOAT *Minvsigma2;
-			Matrix2D<RFLOAT> A, Abody, Aori;
+			Matrix2D<RFLOAT> A, Aori;
+			Quaternion qbody_left, qbody_right;
 
 			if (mymodel.nr_bodies > 1)
 			{
@@ -6133,6 +6497,10 @@ void MlOptimiser::getAllSquaredDifferences(long int part_id, int ibody,
 				RFLOAT tilt_ori = DIRECT_A2D_ELEM(exp_metadata, metadata_offset, METADATA_TILT);
 				RFLOAT psi_ori = DIRECT_A2D_ELEM(exp_metadata, metadata_offset, METADATA_PSI);
 				Euler_angles2matrix(rot_ori, tilt_ori, psi_ori, Aori, false);
+
+				// The complete orientation of a body is Aori * orient_bodies^T * A_rot90 * A * orient_bodies
+				qbody_left = Quaternion::fromMatrix(Aori * (mymodel.orient_bodies[ibody]).transpose() * A_rot90);
+				qbody_right = Quaternion::fromMatrix(mymodel.orient_bodies[ibody]);
 			}
 
 			Fref.resize(exp_local_Minvsigma2[0]);
@@ -6199,9 +6567,16 @@ void MlOptimiser::getAllSquaredDifferences(long int part_id, int ibody,
 								bool ctf_premultiplied = mydata.obsModel.getCtfPremultiplied(optics_group);
 
 								// Get the Euler matrix
-								Euler_angles2matrix(oversampled_rot[iover_rot],
-										oversampled_tilt[iover_rot],
-										oversampled_psi[iover_rot], A, false);
+								// For multi-body refinements, A are only 'residual' orientations, so compose the complete one
+								if (mymodel.nr_bodies > 1)
+									(qbody_left * Quaternion::fromEulerAngles(oversampled_rot[iover_rot],
+											oversampled_tilt[iover_rot], oversampled_psi[iover_rot]) * qbody_right).toMatrix(A);
+								else
+									Euler_angles2matrix(oversampled_rot[iover_rot],
+											oversampled_tilt[iover_rot],
+											oversampled_psi[iover_rot], A, false);
+								if (do_mag[img_id])
+									A = Amag[img_id] * A;
 
 								// Project the reference map (into Fref)
 #ifdef TIMING
@@ -6210,21 +6585,7 @@ void MlOptimiser::getAllSquaredDifferences(long int part_id, int ibody,
 									timer.tic(TIMING_DIFF_PROJ);
 #endif
 
-
-								// For multi-body refinements, A are only 'residual' orientations, Abody is the complete Euler matrix
-								if (mymodel.nr_bodies > 1)
-								{
-									Abody =  Aori * (mymodel.orient_bodies[ibody]).transpose() * A_rot90 * A * mymodel.orient_bodies[ibody];
-									Abody = mydata.obsModel.applyAnisoMag(Abody, optics_group);
-									Abody = mydata.obsModel.applyScaleDifference(Abody, optics_group, mymodel.ori_size, mymodel.pixel_size);
-									(mymodel.PPref[ibody]).get2DFourierTransform(Fref, Abody);
-								}
-								else
-								{
-									A = mydata.obsModel.applyAnisoMag(A, optics_group);
-									A = mydata.obsModel.applyScaleDifference(A, optics_group, mymodel.ori_size, mymodel.pixel_size);
-									(mymodel.PPref[exp_iclass]).get2DFourierTransform(Fref, A);
-								}
+								(mymodel.PPref[(mymodel.nr_bodies > 1) ? ibody : exp_iclass]).get2DFourierTransform(Fref, A);
 
 
 #ifdef TIMING
@@ -6267,6 +6628,9 @@ void MlOptimiser::getAllSquaredDifferences(long int part_id, int ibody,
 									}
 								}
 
+								if (do_diff2_in_single)
+									copyToFloat(Frefctf, Frefctf_single);
+
 								long int ihidden = iorientclass * exp_nr_trans;
 								for (long int itrans = exp_itrans_min; itrans <= exp_itrans_max; itrans++, ihidden++)
 								{
@@ -6295,6 +6659,7 @@ void MlOptimiser::getAllSquaredDifferences(long int part_id, int ibody,
 											/// Now get the shifted image
 											// Use a pointer to avoid copying the entire array again in this highly expensive loop
 											Complex *Fimg_shift;
+											const float *Fimg_shift_single = NULL;
 											if (!do_shifts_onthefly)
 											{
 												long int ishift = img_id * exp_nr_oversampled_trans * exp_nr_images +
@@ -6312,6 +6677,8 @@ void MlOptimiser::getAllSquaredDifferences(long int part_id, int ibody,
 												}
 #endif
 												Fimg_shift = exp_local_Fimgs_shifted[img_id][ishift].data;
+												if (do_diff2_in_single)
+													Fimg_shift_single = &(local_Fimgs_shifted_single[img_id][ishift][0]);
 											}
 											else
 											{
@@ -6371,6 +6738,11 @@ void MlOptimiser::getAllSquaredDifferences(long int part_id, int ibody,
 													}
 												}
 												Fimg_shift = Fimg_otfshift.data;
+												if (do_diff2_in_single)
+												{
+													copyToFloat(Fimg_otfshift, Fimg_otfshift_single);
+													Fimg_shift_single = &(Fimg_otfshift_single[0]);
+												}
 											}
 #ifdef TIMING
 											// Only time one thread, as I also only time one MPI process
@@ -6406,11 +6778,19 @@ void MlOptimiser::getAllSquaredDifferences(long int part_id, int ibody,
 												// all |Xij|2 terms that lie between current_size and ori_size
 												// Factor two because of factor 2 in division below, NOT because of 2-dimensionality of the complex plane!
 												diff2 = exp_highres_Xi2_img[img_id] / 2.;
-												FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Frefctf)
+												if (do_diff2_in_single)
 												{
-													RFLOAT diff_real = (DIRECT_MULTIDIM_ELEM(Frefctf, n)).real - (*(Fimg_shift + n)).real;
-													RFLOAT diff_imag = (DIRECT_MULTIDIM_ELEM(Frefctf, n)).imag - (*(Fimg_shift + n)).imag;
-													diff2 += (diff_real * diff_real + diff_imag * diff_imag) * 0.5 * (*(Minvsigma2 + n));
+													diff2 += squaredDifferenceInSinglePrecision(&(Frefctf_single[0]), Fimg_shift_single,
+															&(local_Minvsigma2_single[img_id][0]), MULTIDIM_SIZE(Frefctf));
+												}
+												else
+												{
+													FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Frefctf)
+													{
+														RFLOAT diff_real = (DIRECT_MULTIDIM_ELEM(Frefctf, n)).real - (*(Fimg_shift + n)).real;
+														RFLOAT diff_imag = (DIRECT_MULTIDIM_ELEM(Frefctf, n)).imag - (*(Fimg_shift + n)).imag;
+														diff2 += (diff_real * diff_real + diff_imag * diff_imag) * 0.5 * (*(Minvsigma2 + n));
+													}
 												}
 											}
 #ifdef TIMING
@@ -6486,8 +6866,8 @@ void MlOptimiser::getAllSquaredDifferences(long int part_id, int ibody,
 												//std::cerr << " oversampled_rot[iover_rot]= " << oversampled_rot[iover_rot] << " oversampled_tilt[iover_rot]= " << oversampled_tilt[iover_rot] << " oversampled_psi[iover_rot]= " << oversampled_psi[iover_rot] << std::endl;
 												//std::cerr << " group_id= " << group_id << " myscale= " << myscale <<std::endl;
 												std::cerr << " itrans= " << itrans << " itrans * exp_nr_oversampled_trans +  iover_trans= " << itrans * exp_nr_oversampled_trans +  iover_trans << " ihidden= " << ihidden << std::endl;
-												std::cerr <<" part_id= "<<part_id<<" name= "<< mydata.particles[part_id].name << std::endl;
-												std::cerr <<" img_id= "<<img_id<<" name= "<< mydata.particles[part_id].images[img_id].name << std::endl;
+												std::cerr <<" part_id= "<<part_id<<" name= "<< mydata.getParticleName(part_id) << std::endl;
+												std::cerr <<" img_id= "<<img_id<<" name= "<< mydata.getImageName(part_id, img_id) << std::endl;
 
 												//std::cerr << " myrank= "<< myrank<<std::endl;
 												//std::cerr << "Written Fimg_shift.spi and Fref.spi. Press any key to continue... part_id= " << part_id<< std::endl;
@@ -6503,7 +6883,7 @@ void MlOptimiser::getAllSquaredDifferences(long int part_id, int ibody,
 											if (std::isnan(diff2))
 											{
 												pthread_mutex_lock(&global_mutex);
-												std::cerr <<" img_id= "<<img_id<<" name= "<< mydata.particles[part_id].images[img_id].name << std::endl;
+												std::cerr <<" img_id= "<<img_id<<" name= "<< mydata.getImageName(part_id, img_id) << std::endl;
 												std::cerr << " exp_iclass= " << exp_iclass << std::endl;
 												std::cerr << " diff2= " << diff2 << std::endl;
 												std::cerr << " exp_highres_Xi2_img[img_id]= " << exp_highres_Xi2_img[img_id] << std::endl;
@@ -6586,8 +6966,8 @@ void MlOptimiser::getAllSquaredDifferences(long int part_id, int ibody,
 //#define DEBUG_VERBOSE
 #ifdef DEBUG_VERBOSE
 											pthread_mutex_lock(&global_mutex);
-											std::cout <<" name= "<< mydata.particles[part_id].images[img_id].name << " rot= " << oversampled_rot[iover_rot] << " tilt= "<< oversampled_tilt[iover_rot] << " psi= " << oversampled_psi[iover_rot] << std::endl;
-											std::cout <<" name= "<< mydata.particles[part_id].images[img_id].name << " ihidden_over= " << ihidden_over << " diff2= " << diff2 << " exp_min_diff2= " << exp_min_diff2 << std::endl;
+											std::cout <<" name= "<< mydata.getImageName(part_id, img_id) << " rot= " << oversampled_rot[iover_rot] << " tilt= "<< oversampled_tilt[iover_rot] << " psi= " << oversampled_psi[iover_rot] << std::endl;
+											std::cout <<" name= "<< mydata.getImageName(part_id, img_id) << " ihidden_over= " << ihidden_over << " diff2= " << diff2 << " exp_min_diff2= " << exp_min_diff2 << std::endl;
 											pthread_mutex_unlock(&global_mutex);
 #endif
 #ifdef DEBUG_CHECKSIZES
@@ -7268,6 +7648,7 @@ void MlOptimiser::storeWeightedSums(long int part_id, int ibody,
 	std::vector< RFLOAT> oversampled_rot, oversampled_tilt, oversampled_psi;
 	std::vector<RFLOAT> oversampled_translations_x, oversampled_translations_y, oversampled_translations_z;
 	Matrix2D<RFLOAT> A, Abody, Aori;
+	Quaternion qbody_left, qbody_right;
 	MultidimArray<Complex > Fimg, Fref, Frefctf, Fimg_otfshift, Fimg_otfshift_nomask, Fimg_store_sgd;
 	MultidimArray<RFLOAT> Minvsigma2, Mctf, Fweight;
 	RFLOAT rot, tilt, psi;
@@ -7300,6 +7681,22 @@ void MlOptimiser::storeWeightedSums(long int part_id, int ibody,
 		RFLOAT tilt_ori = DIRECT_A2D_ELEM(exp_metadata, metadata_offset, METADATA_TILT);
 		RFLOAT psi_ori = DIRECT_A2D_ELEM(exp_metadata, metadata_offset, METADATA_PSI);
 		Euler_angles2matrix(rot_ori, tilt_ori, psi_ori, Aori, false);
+
+		// The complete orientation of a body is Aori * orient_bodies^T * A_rot90 * A * orient_bodies
+		qbody_left = Quaternion::fromMatrix(Aori * (mymodel.orient_bodies[ibody]).transpose() * A_rot90);
+		qbody_right = Quaternion::fromMatrix(mymodel.orient_bodies[ibody]);
+	}
+
+	// The anisotropic magnification and scale difference of each image do not depend on the orientation
+	std::vector<Matrix2D<RFLOAT> > Amag(exp_nr_images);
+	std::vector<bool> do_mag(exp_nr_images);
+	for (int img_id = 0; img_id < exp_nr_images; img_id++)
+	{
+		int optics_group = mydata.getOpticsGroup(part_id, img_id);
+		Amag[img_id].initIdentity(3);
+		Amag[img_id] = mydata.obsModel.applyAnisoMag(Amag[img_id], optics_group);
+		Amag[img_id] = mydata.obsModel.applyScaleDifference(Amag[img_id], optics_group, mymodel.ori_size, mymodel.pixel_size);
+		do_mag[img_id] = !Amag[img_id].isIdentity();
 	}
 
 	// Make local copies of weighted sums (except BPrefs, which are too big)
@@ -7357,20 +7754,18 @@ void MlOptimiser::storeWeightedSums(long int part_id, int ibody,
 							tilt = oversampled_tilt[iover_rot];
 							psi = oversampled_psi[iover_rot];
 							// Get the Euler matrix
-							Euler_angles2matrix(rot, tilt, psi, A, false);
-
-
 							// For multi-body refinements, A are only 'residual' orientations, Abody is the complete Euler matrix
 							if (mymodel.nr_bodies > 1)
 							{
-								Abody = Aori * (mymodel.orient_bodies[ibody]).transpose() * A_rot90 * A * mymodel.orient_bodies[ibody];
-								Abody = mydata.obsModel.applyAnisoMag(Abody, optics_group);
-								Abody = mydata.obsModel.applyScaleDifference(Abody, optics_group, mymodel.ori_size, mymodel.pixel_size);
+								(qbody_left * Quaternion::fromEulerAngles(rot, tilt, psi) * qbody_right).toMatrix(Abody);
+								if (do_mag[img_id])
+									Abody = Amag[img_id] * Abody;
 							}
 							else
 							{
-								A = mydata.obsModel.applyAnisoMag(A, optics_group);
-								A = mydata.obsModel.applyScaleDifference(A, optics_group, mymodel.ori_size, mymodel.pixel_size);
+								Euler_angles2matrix(rot, tilt, psi, A, false);
+								if (do_mag[img_id])
+									A = Amag[img_id] * A;
 							}
 
 #ifdef TIMING
@@ -8048,23 +8443,24 @@ void MlOptimiser::storeWeightedSums(long int part_id, int ibody,
 				int i_resam = ROUND(i * remap_image_sizes);
 				if (i_resam < XSIZE(wsum_model.sigma2_noise[igroup]))
 				{
-					DIRECT_A1D_ELEM(wsum_model.sigma2_noise[igroup], i_resam) += DIRECT_A1D_ELEM(thr_wsum_sigma2_noise[img_id], i);
+					compensatedAdd(DIRECT_A1D_ELEM(wsum_model.sigma2_noise[igroup], i_resam), DIRECT_A1D_ELEM(wsum_model.err.sigma2_noise[igroup], i_resam),
+					               DIRECT_A1D_ELEM(thr_wsum_sigma2_noise[img_id], i));
 				}
 			}
-			wsum_model.sumw_group[igroup] += thr_sumw_group[img_id];
+			compensatedAdd(wsum_model.sumw_group[igroup], wsum_model.err.sumw_group[igroup], thr_sumw_group[img_id]);
 			if (do_scale_correction)
 			{
-				wsum_model.wsum_signal_product[igroup] += thr_wsum_signal_product_spectra[img_id];
-				wsum_model.wsum_reference_power[igroup] += thr_wsum_reference_power_spectra[img_id];
+				compensatedAdd(wsum_model.wsum_signal_product[igroup], wsum_model.err.wsum_signal_product[igroup], thr_wsum_signal_product_spectra[img_id]);
+				compensatedAdd(wsum_model.wsum_reference_power[igroup], wsum_model.err.wsum_reference_power[igroup], thr_wsum_reference_power_spectra[img_id]);
 			}
 		}
 		for (int n = 0; n < mymodel.nr_classes; n++)
 		{
-			wsum_model.pdf_class[n] += thr_wsum_pdf_class[n];
+			compensatedAdd(wsum_model.pdf_class[n], wsum_model.err.pdf_class[n], thr_wsum_pdf_class[n]);
 			if (mymodel.ref_dim == 2)
 			{
-				XX(wsum_model.prior_offset_class[n]) += thr_wsum_prior_offsetx_class[n];
-				YY(wsum_model.prior_offset_class[n]) += thr_wsum_prior_offsety_class[n];
+				compensatedAdd(XX(wsum_model.prior_offset_class[n]), XX(wsum_model.err.prior_offset_class[n]), thr_wsum_prior_offsetx_class[n]);
+				compensatedAdd(YY(wsum_model.prior_offset_class[n]), YY(wsum_model.err.prior_offset_class[n]), thr_wsum_prior_offsety_class[n]);
 			}
 #ifdef CHECKSIZES
 			if (XSIZE(wsum_model.pdf_direction[n]) != XSIZE(thr_wsum_pdf_direction[n]))
@@ -8077,13 +8473,13 @@ void MlOptimiser::storeWeightedSums(long int part_id, int ibody,
 		for (int n = 0; n < mymodel.nr_classes * mymodel.nr_bodies; n++)
 		{
 			if (!(do_skip_align || do_skip_rotate) )
-				wsum_model.pdf_direction[n] += thr_wsum_pdf_direction[n];
+				compensatedAdd(wsum_model.pdf_direction[n], wsum_model.err.pdf_direction[n], thr_wsum_pdf_direction[n]);
 		}
-		wsum_model.sigma2_offset += thr_wsum_sigma2_offset;
+		compensatedAdd(wsum_model.sigma2_offset, wsum_model.err.sigma2_offset, thr_wsum_sigma2_offset);
 		if (do_norm_correction && mymodel.nr_bodies == 1)
-			wsum_model.avg_norm_correction += thr_avg_norm_correction;
-		wsum_model.LL += thr_sum_dLL;
-		wsum_model.ave_Pmax += thr_sum_Pmax;
+			compensatedAdd(wsum_model.avg_norm_correction, wsum_model.err.avg_norm_correction, thr_avg_norm_correction);
+		compensatedAdd(wsum_model.LL, wsum_model.err.LL, thr_sum_dLL);
+		compensatedAdd(wsum_model.ave_Pmax, wsum_model.err.ave_Pmax, thr_sum_Pmax);
 		pthread_mutex_unlock(&global_mutex);
 	} // end if !do_skip_maximization
 
@@ -8104,7 +8500,7 @@ void MlOptimiser::monitorHiddenVariableChanges(long int my_first_part_id, long i
 		for (int img_id = 0; img_id < mydata.numberOfImagesInParticle(part_id); img_id++, metadata_offset++)
 		{
 
-			long int ori_img_id = mydata.particles[part_id].images[img_id].id;
+			long int ori_img_id = mydata.getOriginalImageId(part_id, img_id);
 			RFLOAT my_pixel_size = mydata.getImagePixelSize(part_id, img_id);
 
 			for (int ibody = 0; ibody < mymodel.nr_bodies; ibody++)
@@ -9019,7 +9415,7 @@ void MlOptimiser::setMetaDataSubset(long int first_part_id, long int last_part_i
 		for (int img_id = 0; img_id < mydata.numberOfImagesInParticle(part_id); img_id++, metadata_offset++)
 		{
 
-			long int ori_img_id = mydata.particles[part_id].images[img_id].id;
+			long int ori_img_id = mydata.getOriginalImageId(part_id, img_id);
 			RFLOAT my_pixel_size = mydata.getImagePixelSize(part_id, img_id);
 
 			// SHWS: Upon request of Juha Huiskonen, 5apr2016
@@ -9160,7 +9556,7 @@ void MlOptimiser::getMetaAndImageDataSubset(long int first_part_id, long int las
 		for (int img_id = 0; img_id < mydata.numberOfImagesInParticle(part_id); img_id++, metadata_offset++)
 		{
 
-			long int ori_img_id = mydata.particles[part_id].images[img_id].id;
+			long int ori_img_id = mydata.getOriginalImageId(part_id, img_id);
 			RFLOAT my_pixel_size = mydata.getImagePixelSize(part_id, img_id);
 			int my_image_size = mydata.getOpticsImageSize(mydata.getOpticsGroup(part_id, img_id));
 
@@ -9192,10 +9588,10 @@ void MlOptimiser::getMetaAndImageDataSubset(long int first_part_id, long int las
 				Image<RFLOAT> img, rec_img;
 				if (do_preread_images)
 				{
-					img().reshape(mydata.particles[part_id].images[img_id].img);
-					FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mydata.particles[part_id].images[img_id].img)
+					img().reshape(mydata.getPrereadImage(part_id, img_id));
+					FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mydata.getPrereadImage(part_id, img_id))
 					{
-						DIRECT_MULTIDIM_ELEM(img(), n) = (RFLOAT)DIRECT_MULTIDIM_ELEM(mydata.particles[part_id].images[img_id].img, n);
+						DIRECT_MULTIDIM_ELEM(img(), n) = (RFLOAT)DIRECT_MULTIDIM_ELEM(mydata.getPrereadImage(part_id, img_id), n);
 					}
 				}
 				else
@@ -32,6 +32,7 @@
 #include <sstream>
 #include <vector>
 #include <iterator>
+#include <memory>
 #include "src/ml_model.h"
 #include "src/parallel.h"
 #include "src/exp_model.h"
@@ -41,6 +42,7 @@
 #include "src/healpix_sampling.h"
 #include "src/helix.h"
 #include "src/local_symmetry.h"
+#include "src/fourier_shells.h"
 #include "src/acc/settings.h"
 
 #define ML_SIGNIFICANT_WEIGHT 1.e-8
@@ -93,6 +95,35 @@
 // for profiling
 //#define TIMING
 
+/** Copy of the data.star and optimiser.star files of an iteration, to be written in the background
+ *
+ * MlOptimiser::write() takes this snapshot, so that the next iteration can already change the
+ * metadata while the (large) data.star file is still being written. Each file is written to a
+ * temporary file first, and renamed once it is complete. The optimiser.star file, from which a run
+ * is continued, is written last, so that it never refers to an incomplete data.star file. With MPI,
+ * the leader writes both files, using the optimiser.star file formatted by the first follower.
+ */
+class MlWriteSnapshot
+{
+public:
+
+	// Files to write (empty for none)
+	FileName fn_data, fn_optimiser;
+
+	// Copies of the tables in the data.star file
+	MetaDataTable MDoptics, MDimg;
+	std::vector<MetaDataTable> MDbodies;
+
+	// The (small) optimiser.star file, already formatted
+	std::string optimiser_star;
+
+	// Set by globalThreadWriteSnapshot if writing failed
+	std::unique_ptr<RelionError> exception;
+
+	// Write all files
+	void write();
+};
+
 class MlOptimiser;
 
 class MlOptimiser
@@ -410,6 +441,12 @@ public:
 	// Or preread all images into RAM on the leader node?
 	bool do_preread_images;
 
+	// Leave the pre-reading to the MPI version, which shares the image data (not the metadata) among all ranks on a node
+	bool do_preread_images_shared;
+
+	// Randomise the particle order in blocks of this many particles from the same micrograph (0 = randomise individual particles)
+	int random_order_block_size;
+
 	// Place on scratch disk to copy particle stacks temporarily
 	FileName fn_scratch;
 
@@ -541,6 +578,19 @@ public:
 	// Number of iterations for gridding preweighting reconstruction
 	int gridding_nr_iter;
 
+	// Stop gridding iterations once the mean deviation of the convolved weights from one drops below this
+	RFLOAT gridding_tol;
+
+	// Memory (in Gb) for reconstructing several classes at the same time (negative: half of the free memory)
+	RFLOAT recons_ram;
+
+	// Write the data.star and optimiser.star files in the background, while the next iteration starts
+	bool do_async_write;
+
+	// Files that are being written in the background (NULL if none)
+	MlWriteSnapshot *write_snapshot;
+	pthread_t write_snapshot_thread;
+
 	// Flag whether to do group-wise B-factor correction or not
 	bool do_bfactor;
 
@@ -584,12 +634,22 @@ public:
 	std::vector<MultidimArray<int> > Mresol_fine, Mresol_coarse;
 	MultidimArray<int> Npix_per_shell;
 
+	// Shell indices of the full-size Fourier transforms of the images (one for each optics_group)
+	std::vector<FourierShells::Ptr> image_full_shells;
+
 	// Verbosity flag
 	int verb;
 
 	// Thread Managers for the expectation step: one for all (pooled) particles
 	ThreadTaskDistributor *exp_ipart_ThreadTaskDistributor;
 
+	// Thread Manager for the maximization step: one task per class (or body) to be reconstructed
+	ThreadTaskDistributor *max_iclass_ThreadTaskDistributor;
+
+	// Classes (or bodies) to be reconstructed by the threads, how many at the same time, and with how many threads each
+	std::vector<int> max_iclass_todo;
+	int max_nr_concurrent_recons, max_threads_per_recons;
+
 	// Number of threads to run in parallel
 	int x_pool;
 	int nr_threads;
@@ -605,6 +665,9 @@ public:
 
 	// Calculate translated images on-the-fly
 	bool do_shifts_onthefly;
+
+	// Calculate the squared differences of the classic CPU path in single precision
+	bool do_mixed_precision;
 	std::vector< std::vector<MultidimArray<Complex> > > global_fftshifts_ab_coarse, global_fftshifts_ab_current, global_fftshifts_ab2_coarse, global_fftshifts_ab2_current;
 
 	//TMP DEBUGGING
@@ -682,6 +745,10 @@ public:
 		has_converged(0),
 		only_flip_phases(0),
 		gridding_nr_iter(0),
+		gridding_tol(0),
+		recons_ram(-1),
+		do_async_write(true),
+		write_snapshot(NULL),
 		do_use_reconstruct_images(0),
 		fix_sigma_noise(0),
 		current_changes_optimal_offsets(0),
@@ -698,8 +765,14 @@ public:
 		x_pool(1),
 		nr_threads(0),
 		do_shifts_onthefly(0),
+		do_mixed_precision(0),
 		exp_ipart_ThreadTaskDistributor(0),
+		max_iclass_ThreadTaskDistributor(0),
+		max_nr_concurrent_recons(1),
+		max_threads_per_recons(1),
 		do_parallel_disc_io(0),
+		do_preread_images_shared(0),
+		random_order_block_size(0),
 		sum_changes_optimal_orientations(0),
 		do_solvent(0),
 		strict_highres_exp(0),
@@ -772,6 +845,16 @@ public:
 #endif
 	};
 
+	~MlOptimiser()
+	{
+		// Do not leave any files half-written
+		if (write_snapshot != NULL)
+		{
+			pthread_join(write_snapshot_thread, NULL);
+			delete write_snapshot;
+		}
+	}
+
 	/** ========================== I/O operations  =========================== */
 	/// Print help message
 	void usage();
@@ -789,7 +872,16 @@ public:
 	void read(FileName fn_in, int rank = 0, bool do_prevent_preread = false);
 
 	// Write files to disc
-	void write(bool do_write_sampling, bool do_write_data, bool do_write_optimiser, bool do_write_model, int random_subset = 0);
+	// The data.star and optimiser.star files are written in the background (unless do_async_write is false)
+	// If optimiser_star is given, it is written as the optimiser.star file instead of formatOptimiserStar()
+	void write(bool do_write_sampling, bool do_write_data, bool do_write_optimiser, bool do_write_model, int random_subset = 0,
+	           const std::string *optimiser_star = NULL);
+
+	// The contents of the optimiser.star file of the current iteration
+	std::string formatOptimiserStar();
+
+	// Wait until the files of the last call to write() are on disc
+	void waitForWrite();
 
     /** ========================== Initialisation  =========================== */
 
@@ -807,8 +899,9 @@ public:
 
 	/* Calculates the sum of all individual power spectra and the average of all images for initial sigma_noise estimation
 	 * The rank is passed so that if one splits the data into random halves one can know which random half to treat
+	 * Mavg is a compensated sum (see src/reduction.h): if Mavg_err is given, it returns its rounding errors
 	 */
-	void calculateSumOfPowerSpectraAndAverageImage(MultidimArray<RFLOAT> &Mavg, bool myverb = true);
+	void calculateSumOfPowerSpectraAndAverageImage(MultidimArray<RFLOAT> &Mavg, bool myverb = true, MultidimArray<RFLOAT> *Mavg_err = NULL);
 
 	/** Use the sum of the individual power spectra to calculate their average and set this in sigma2_noise
 	 * Also subtract the power spectrum of the average images,
@@ -882,8 +975,31 @@ public:
 
 	/* Perform the actual reconstructions
 	 * This is officially part of the maximization, but it is separated because of parallelisation issues.
+	 * Updates the SSNR arrays and reconstructs (or, with SGD, updates) mymodel.Iref[iclass] using threads threads.
+	 */
+	void maximizationReconstructClass(int iclass, int threads);
+
+	/* Smallest and largest number of gridding iterations and largest final mean |w-1|
+	 * over the classes (or bodies) that were reconstructed by this process.
+	 * min_iter and max_iter are 0 if none were.
 	 */
-	void maximizationReconstructClass(int iclass);
+	void getGriddingStatistics(int &min_iter, int &max_iter, RFLOAT &max_residual);
+
+	/* Print the gridding statistics of this iteration */
+	void printGriddingStatistics(int min_iter, int max_iter, RFLOAT max_residual);
+
+	/* How many of nr_recons reconstructions can be done at the same time by the threads of this process
+	 * This is limited by the number of threads and by the memory each reconstruction needs (see --recons_ram).
+	 */
+	int getNumberOfConcurrentReconstructions(int nr_recons);
+
+	/* Reconstruct the given classes (or bodies), several at the same time
+	 * The threads are divided over getNumberOfConcurrentReconstructions() reconstructions.
+	 */
+	void maximizationReconstructClasses(const std::vector<int> &iclasses);
+
+	/* Perform reconstructions for some classes using threads */
+	void doThreadMaximizationSomeClasses(int thread_id);
 
 	/* Updates all other model parameters (besides the reconstructions)
 	 */
@@ -1027,4 +1143,10 @@ public:
 // Global call to threaded core of doThreadExpectationSomeParticles
 void globalThreadExpectationSomeParticles(ThreadArgument &thArg);
 
+// Global call to threaded core of doThreadMaximizationSomeClasses
+void globalThreadMaximizationSomeClasses(ThreadArgument &thArg);
+
+// Global call to write an MlWriteSnapshot in a separate (p)thread
+void *globalThreadWriteSnapshot(void *snapshot);
+
 #endif /* MAXLIK_H_ */
@@ -19,6 +19,7 @@
  ***************************************************************************/
 #include "src/ml_optimiser_mpi.h"
 #include "src/ml_optimiser.h"
+#include "src/reduction.h"
 #ifdef CUDA
 #include "src/acc/cuda/cuda_ml_optimiser.h"
 #endif
@@ -56,10 +57,14 @@ void MlOptimiserMpi::read(int argc, char **argv)
     if (node->isLeader())
     	PRINT_VERSION_INFO();
 
+    // Do this before reading in the data.star file: the pixel data of pre-read images are shared among the ranks on each node
+    do_preread_images_shared = !checkParameter(argc, argv, "--no_shared_preread");
+
     // First read in non-parallelisation-dependent variables
     MlOptimiser::read(argc, argv, node->rank);
 
     int mpi_section = parser.addSection("MPI options");
+    parser.checkOption("--no_shared_preread", "Let every MPI rank pre-read its own copy of the image data, instead of one copy in shared memory per node");
     halt_all_followers_except_this = textToInteger(parser.getOption("--halt_all_followers_except", "For debugging: keep all followers except this one waiting", "-1"));
     do_keep_debug_reconstruct_files  = parser.checkOption("--keep_debug_reconstruct_files", "For debugging: keep temporary data and weight files for debug-reconstructions.");
 
@@ -462,6 +467,17 @@ will still yield good performance and possibly a more stable execution. \n" << s
 
 	MlOptimiser::initialiseGeneral(node->rank);
 
+	// Only the first rank on each node reads the images, into memory that all ranks on that node can access
+	// Only the pixel data are shared: every rank still reads the data.star file and keeps its own MDimg
+	if (do_preread_images && do_parallel_disc_io && do_preread_images_shared)
+	{
+		if (verb > 0)
+			std::cout << " Pre-reading images into shared memory on each node ..." << std::endl;
+		float *shared_data = (float *)node->allocateSharedMemory(mydata.getPrereadImagesSize() * sizeof(float));
+		mydata.prereadImages(shared_data, node->isNodeLeader());
+		MPI_Barrier(node->nodeC);
+	}
+
 	initialiseWorkLoad();
 
 #ifdef MKLFFT
@@ -529,13 +545,9 @@ will still yield good performance and possibly a more stable execution. \n" << s
 
 	// Only leader writes out initial mymodel (do not gather metadata yet)
 	int my_nr_subsets = (do_split_random_halves) ? 2 : 1;
-	if (node->isLeader())
-		MlOptimiser::write(DONT_WRITE_SAMPLING, DO_WRITE_DATA, DONT_WRITE_OPTIMISER, DONT_WRITE_MODEL, node->rank);
-	else if (node->rank <= my_nr_subsets)
+	writeOutputFiles(DO_WRITE_OPTIMISER);
+	if (!node->isLeader() && node->rank <= my_nr_subsets)
 	{
-		//Only the first_follower of each subset writes model to disc
-		MlOptimiser::write(DO_WRITE_SAMPLING, DONT_WRITE_DATA, DO_WRITE_OPTIMISER, DO_WRITE_MODEL, node->rank);
-
 		bool do_warn = false;
 		for (int igroup = 0; igroup< mymodel.nr_groups; igroup++)
 		{
@@ -718,7 +730,8 @@ void MlOptimiserMpi::calculateSumOfPowerSpectraAndAverageImage(MultidimArray<RFL
 {
 
 	// First calculate the sum of all individual power spectra on each subset
-	MlOptimiser::calculateSumOfPowerSpectraAndAverageImage(Mavg, node->rank == 1);
+	MultidimArray<RFLOAT> Mavg_err;
+	MlOptimiser::calculateSumOfPowerSpectraAndAverageImage(Mavg, node->rank == 1, &Mavg_err);
 
 	if (pipeline_control_check_abort_job())
 		MPI_Abort(MPI_COMM_WORLD, RELION_EXIT_ABORTED);
@@ -731,11 +744,12 @@ void MlOptimiserMpi::calculateSumOfPowerSpectraAndAverageImage(MultidimArray<RFL
 		combineAllWeightedSums();
 
 	// After introducing SGD code in Dec 2016: no longer calculate Mavg for the 2 halves separately...
-	// Just calculate Mavg from AllReduce, and divide by 2 * the accumulated wsum_group
-	MultidimArray<RFLOAT> Msum;
-	Msum.initZeros(Mavg);
-	MPI_Allreduce(MULTIDIM_ARRAY(Mavg), MULTIDIM_ARRAY(Msum), MULTIDIM_SIZE(Msum), MY_MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-	Mavg = Msum;
+	// Just sum Mavg over all followers, and divide by 2 * the accumulated wsum_group
+	// Mavg is a compensated sum, so this is done in the same way as for the weighted sums (only the followers use Mavg)
+	MultidimArray<RFLOAT> Mcomp;
+	packCompensatedPairs(Mavg, Mavg_err, Mcomp);
+	combineCompensatedSums(Mcomp, false);
+	unpackCompensatedPairs(Mcomp, Mavg, Mavg_err);
 	// When doing random halves, the wsum_model.sumw_group[igroup], which will be used to divide Mavg by is only calculated over half the particles!
 	if (do_split_random_halves)
 		Mavg /= 2.;
@@ -1622,6 +1636,12 @@ void MlOptimiserMpi::combineAllWeightedSumsViaFile()
 	// Only need to combine if there are more than one followers per subset!
 	if ((node->size - 1)/nr_halfsets > 1)
 	{
+		// The scalar and spectral sums are combined separately with their rounding errors, before pack clears wsum_model
+		MultidimArray<RFLOAT> Mcomp;
+		if (!node->isLeader())
+			wsum_model.packCompensatedSums(Mcomp);
+		combineCompensatedSums(Mcomp);
+
 		// A. First all followers pack up their wsum_model (this is done simultaneously)
 		if (!node->isLeader())
 		{
@@ -1702,8 +1722,12 @@ void MlOptimiserMpi::combineAllWeightedSumsViaFile()
 		}
 
 		// F. Finally all followers unpack Msum into their wsum_model (do this simultaneously)
+		// and replace its scalar and spectral sums with the compensated ones
 		if (!node->isLeader())
+		{
 			wsum_model.unpack(Mpack);
+			wsum_model.unpackCompensatedSums(Mcomp);
+		}
 
 	} // end if ((node->size - 1)/nr_halfsets > 1)
 #ifdef TIMING
@@ -1732,6 +1756,12 @@ void MlOptimiserMpi::combineAllWeightedSums()
 	// Only combine weighted sums if there are more than one followers per subset!
 	if ((node->size - 1)/nr_halfsets > 1)
 	{
+		// The scalar and spectral sums are combined separately with their rounding errors, before pack clears wsum_model
+		MultidimArray<RFLOAT> Mcomp;
+		if (!node->isLeader())
+			wsum_model.packCompensatedSums(Mcomp);
+		combineCompensatedSums(Mcomp);
+
 		// Loop over possibly multiple instances of Mpack of maximum size
 		int piece = 0;
 		int nr_pieces = 1;
@@ -1848,6 +1878,10 @@ void MlOptimiserMpi::combineAllWeightedSums()
 
 		} // end for piece
 
+		// Replace the plainly summed scalar and spectral sums with the compensated ones
+		if (!node->isLeader())
+			wsum_model.unpackCompensatedSums(Mcomp);
+
 		MPI_Barrier(MPI_COMM_WORLD);
 	}
 
@@ -1856,6 +1890,40 @@ void MlOptimiserMpi::combineAllWeightedSums()
 #endif
 }
 
+void MlOptimiserMpi::combineCompensatedSums(MultidimArray<RFLOAT> &Mcomp, bool do_subsets)
+{
+	if (node->isLeader())
+		return;
+
+	MultidimArray<RFLOAT> Mother;
+	MPI_Status status;
+	int nr_halfsets = (do_split_random_halves && do_subsets) ? 2 : 1;
+
+	// Find out who is the first follower in my subset
+	int first_follower;
+	if (nr_halfsets == 1)
+		first_follower = 1;
+	else
+		first_follower = (node->rank % 2 == 1) ? 1 : 2;
+
+	if (node->rank == first_follower)
+	{
+		Mother.resize(Mcomp);
+		for (int other_follower = first_follower + nr_halfsets; other_follower < node->size; other_follower += nr_halfsets)
+		{
+			node->relion_MPI_Recv(MULTIDIM_ARRAY(Mother), MULTIDIM_SIZE(Mother), MY_MPI_DOUBLE, other_follower, MPITAG_PACK, MPI_COMM_WORLD, status);
+			compensatedAddPairs(Mcomp, Mother);
+		}
+		for (int other_follower = first_follower + nr_halfsets; other_follower < node->size; other_follower += nr_halfsets)
+			node->relion_MPI_Send(MULTIDIM_ARRAY(Mcomp), MULTIDIM_SIZE(Mcomp), MY_MPI_DOUBLE, other_follower, MPITAG_PACK, MPI_COMM_WORLD);
+	}
+	else
+	{
+		node->relion_MPI_Send(MULTIDIM_ARRAY(Mcomp), MULTIDIM_SIZE(Mcomp), MY_MPI_DOUBLE, first_follower, MPITAG_PACK, MPI_COMM_WORLD);
+		node->relion_MPI_Recv(MULTIDIM_ARRAY(Mcomp), MULTIDIM_SIZE(Mcomp), MY_MPI_DOUBLE, first_follower, MPITAG_PACK, MPI_COMM_WORLD, status);
+	}
+}
+
 void MlOptimiserMpi::combineWeightedSumsTwoRandomHalvesViaFile()
 {
 	// Just sum the weighted halves from follower 1 and follower 2 and Bcast to everyone else
@@ -2012,6 +2080,25 @@ void MlOptimiserMpi::maximization()
 	helical_twist_half1 = helical_twist_half2 = helical_twist_initial;
 	helical_rise_half1 = helical_rise_half2 = helical_rise_initial;
 
+	// In classification, each follower reconstructs several of its classes at the same time, using all of its threads
+	std::vector<bool> is_reconstructed(mymodel.nr_classes * mymodel.nr_bodies, false);
+	if (!do_split_random_halves && mymodel.nr_bodies == 1 && !do_external_reconstruct && !node->isLeader())
+	{
+		std::vector<int> iclasses;
+		for (int iclass = 0; iclass < mymodel.nr_classes; iclass++)
+		{
+			if (wsum_model.pdf_class[iclass] > 0. && node->rank == iclass % (node->size - 1) + 1 &&
+			    (wsum_model.BPref[iclass].weight).sum() > XMIPP_EQUAL_ACCURACY)
+			{
+				iclasses.push_back(iclass);
+			}
+		}
+
+		maximizationReconstructClasses(iclasses);
+		for (int i = 0; i < iclasses.size(); i++)
+			is_reconstructed[iclasses[i]] = true;
+	}
+
 	// First reconstruct all classes in parallel
 	for (int ibody = 0; ibody < mymodel.nr_bodies; ibody++)
 	{
@@ -2037,7 +2124,7 @@ void MlOptimiserMpi::maximization()
 				if (node->rank == reconstruct_rank1)
 				{
 
-					if ((wsum_model.BPref[ith_recons].weight).sum() > XMIPP_EQUAL_ACCURACY)
+					if (!is_reconstructed[ith_recons] && (wsum_model.BPref[ith_recons].weight).sum() > XMIPP_EQUAL_ACCURACY)
 					{
 
 						MultidimArray<RFLOAT> Iref_old;
@@ -2080,7 +2167,10 @@ void MlOptimiserMpi::maximization()
 								mymodel.tau2_fudge_factor,
 								wsum_model.pdf_class[iclass],
 								minres_map,
-								false
+								false,
+								0,
+								nr_threads,
+								gridding_tol
 							);
 						}
 						if (do_sgd)
@@ -2231,7 +2321,10 @@ void MlOptimiserMpi::maximization()
 										mymodel.tau2_fudge_factor,
 										wsum_model.pdf_class[iclass],
 										minres_map,
-										false);
+										false,
+										0,
+										nr_threads,
+										gridding_tol);
 							}
 
 							if (do_sgd)
@@ -2345,6 +2438,16 @@ void MlOptimiserMpi::maximization()
 #endif
 	MPI_Barrier(MPI_COMM_WORLD);
 
+	// Collect the gridding statistics of the followers on the leader: -min_iter, max_iter and max_residual
+	int min_iter, max_iter;
+	RFLOAT max_residual;
+	getGriddingStatistics(min_iter, max_iter, max_residual);
+	RFLOAT my_gridding[3], all_gridding[3];
+	my_gridding[0] = (max_iter == 0) ? -gridding_nr_iter : -min_iter;
+	my_gridding[1] = max_iter;
+	my_gridding[2] = max_residual;
+	MPI_Reduce(my_gridding, all_gridding, 3, MY_MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
 #ifdef DEBUG
 	std::cerr << "All classes have been reconstructed" << std::endl;
 #endif
@@ -2493,7 +2596,10 @@ void MlOptimiserMpi::maximization()
 	node->relion_MPI_Bcast(&smallest_changes_optimal_orientations, 1, MY_MPI_DOUBLE, 0, MPI_COMM_WORLD);
 
 	if (verb > 0)
+	{
 		progress_bar(mymodel.nr_classes);
+		printGriddingStatistics(-ROUND(all_gridding[0]), ROUND(all_gridding[1]), all_gridding[2]);
+	}
 
 	if ( (verb > 0) && (do_helical_refine) && (!ignore_helical_symmetry) && mymodel.ref_dim != 2 )
 	{
@@ -2669,7 +2775,8 @@ void MlOptimiserMpi::reconstructUnregularisedMapAndCalculateSolventCorrectedFSC(
 
 			BackProjector BPextra(wsum_model.BPref[ibody]);
 
-			BPextra.reconstruct(Iunreg(), gridding_nr_iter, false, dummy);
+			BPextra.reconstruct(Iunreg(), gridding_nr_iter, false, dummy,
+				1., 1., -1, false, 0, nr_threads, gridding_tol);
 
 			if (mymodel.nr_bodies > 1)
 			{
@@ -2729,7 +2836,7 @@ void MlOptimiserMpi::reconstructUnregularisedMapAndCalculateSolventCorrectedFSC(
 			MultidimArray<RFLOAT> fsc_unmasked, fsc_masked, fsc_random_masked, fsc_true;
 
 			// Calculate FSC of the unmasked maps
-			getFSC(Iunreg1(), Iunreg2(), fsc_unmasked);
+			getFSC(Iunreg1(), Iunreg2(), fsc_unmasked, nr_threads);
 
 			Image<RFLOAT> Imask;
 			if (mymodel.nr_bodies > 1)
@@ -2743,7 +2850,7 @@ void MlOptimiserMpi::reconstructUnregularisedMapAndCalculateSolventCorrectedFSC(
 			Imask().setXmippOrigin();
 			Iunreg1() *= Imask();
 			Iunreg2() *= Imask();
-			getFSC(Iunreg1(), Iunreg2(), fsc_masked);
+			getFSC(Iunreg1(), Iunreg2(), fsc_masked, nr_threads);
 
 			// To save memory re-read the same input maps again and randomize phases before masking
 			Iunreg1.read(fn_root1);
@@ -2772,7 +2879,7 @@ void MlOptimiserMpi::reconstructUnregularisedMapAndCalculateSolventCorrectedFSC(
 				// Mask randomized phases maps and calculated fsc_random_masked
 				Iunreg1() *= Imask();
 				Iunreg2() *= Imask();
-				getFSC(Iunreg1(), Iunreg2(), fsc_random_masked);
+				getFSC(Iunreg1(), Iunreg2(), fsc_random_masked, nr_threads);
 
 				// Now that we have fsc_masked and fsc_random_masked, calculate fsc_true according to Richard's formula
 				// FSC_true = FSC_t - FSC_n / ( )
@@ -2922,7 +3029,8 @@ void MlOptimiserMpi::readTemporaryDataAndWeightArraysAndReconstruct(int iclass,
 	}
 
 	// Now perform the unregularized reconstruction
-	wsum_model.BPref[iclass].reconstruct(Iunreg(), gridding_nr_iter, false, dummy);
+	wsum_model.BPref[iclass].reconstruct(Iunreg(), gridding_nr_iter, false, dummy,
+			1., 1., -1, false, 0, nr_threads, gridding_tol);
 
 	if (mymodel.nr_bodies > 1)
 	{
@@ -3027,6 +3135,49 @@ void MlOptimiserMpi::compareTwoHalves()
 #endif
 }
 
+void MlOptimiserMpi::writeOutputFiles(bool do_write_optimiser)
+{
+	int nr_model_writers = (do_split_random_halves && !do_join_random_halves) ? 2 : 1;
+	MPI_Status status;
+	long int length;
+
+	if (node->isLeader())
+	{
+		// Wait until the model files are on disc, and receive the optimiser.star file from the first follower
+		std::string optimiser_star;
+		if (do_write_optimiser)
+		{
+			for (int follower = 1; follower <= nr_model_writers; follower++)
+			{
+				node->relion_MPI_Recv(&length, 1, MPI_LONG, follower, MPITAG_METADATA, MPI_COMM_WORLD, status);
+				if (follower == 1)
+				{
+					std::vector<char> buffer(length);
+					node->relion_MPI_Recv(&buffer[0], length, MPI_CHAR, follower, MPITAG_METADATA, MPI_COMM_WORLD, status);
+					optimiser_star.assign(buffer.begin(), buffer.end());
+				}
+			}
+		}
+
+		// The leader only writes the data file (he's the only one who has and manages these data!) and the optimiser file after it
+		MlOptimiser::write(DONT_WRITE_SAMPLING, DO_WRITE_DATA, do_write_optimiser, DONT_WRITE_MODEL, node->rank, &optimiser_star);
+	}
+	else if (node->rank <= nr_model_writers)
+	{
+		// Only the first_follower of each subset writes model to disc
+		MlOptimiser::write(DO_WRITE_SAMPLING, DONT_WRITE_DATA, DONT_WRITE_OPTIMISER, DO_WRITE_MODEL, node->rank);
+
+		if (do_write_optimiser)
+		{
+			std::string optimiser_star = (node->rank == 1) ? formatOptimiserStar() : "";
+			length = optimiser_star.length();
+			node->relion_MPI_Send(&length, 1, MPI_LONG, 0, MPITAG_METADATA, MPI_COMM_WORLD);
+			if (node->rank == 1)
+				node->relion_MPI_Send((void*)optimiser_star.c_str(), length, MPI_CHAR, 0, MPITAG_METADATA, MPI_COMM_WORLD);
+		}
+	}
+}
+
 void MlOptimiserMpi::iterate()
 {
 #ifdef TIMING
@@ -3058,7 +3209,7 @@ void MlOptimiserMpi::iterate()
 		// Randomly take different subset of the particles each time we do a new "iteration" in SGD
 		if (random_seed > 0)
 		{
-			mydata.randomiseParticlesOrder(random_seed+iter, do_split_random_halves,  subset_size < mydata.numberOfParticles() );
+			mydata.randomiseParticlesOrder(random_seed+iter, do_split_random_halves,  subset_size < mydata.numberOfParticles(), random_order_block_size);
 		}
 		else if (verb > 0)
 		{
@@ -3290,12 +3441,7 @@ void MlOptimiserMpi::iterate()
 		if (do_join_random_halves)
 			iter = -1;
 
-		if (node->rank == 1 || (do_split_random_halves && !do_join_random_halves && node->rank == 2))
-			//Only the first_follower of each subset writes model to disc (do not write the data.star file, only leader will do this)
-			MlOptimiser::write(DO_WRITE_SAMPLING, DONT_WRITE_DATA, do_write_optimiser, DO_WRITE_MODEL, node->rank);
-		else if (node->isLeader())
-			// The leader only writes the data file (he's the only one who has and manages these data!)
-			MlOptimiser::write(DONT_WRITE_SAMPLING, DO_WRITE_DATA, DONT_WRITE_OPTIMISER, DONT_WRITE_MODEL, node->rank);
+		writeOutputFiles(do_write_optimiser);
 
 #ifdef TIMING
 		timer.toc(TIMING_ITER_WRITE);
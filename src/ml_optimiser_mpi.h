@@ -94,6 +94,13 @@ public:
      */
     void combineWeightedSumsTwoRandomHalves();
 
+    /** Add the packed compensated sums (see MlWsumModel::packCompensatedSums) of all followers in each subset,
+     *  or of all followers together if do_subsets is false
+     *  The first follower of each subset adds those of the others in rank order and sends the total back
+     *  Because compensated sums are robust to the summation order, the totals hardly depend on the number of followers
+     */
+    void combineCompensatedSums(MultidimArray<RFLOAT> &Mcomp, bool do_subsets = true);
+
     /** Maximization
      * This takes care of the parallel reconstruction of the classes
      */
@@ -125,6 +132,13 @@ public:
      */
     void compareTwoHalves();
 
+    /** Write the output files of this iteration
+     *  The first follower of each subset writes its model and sampling files, and the leader the data.star file.
+     *  The optimiser.star file is formatted by the first follower, but written by the leader after its data.star file,
+     *  once the model files are on disc, so that a run is never continued from incomplete files.
+     */
+    void writeOutputFiles(bool do_write_optimiser);
+
     /** Do the real work
      * Expectation is split in image subsets over all nodes, each reconstruction is done on a separate node
      */
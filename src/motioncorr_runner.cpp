@@ -29,6 +29,7 @@
 #include "src/jaz/img_proc/image_op.h"
 #include "src/funcs.h"
 #include "src/renderEER.h"
+#include "src/ctf_estimator.h"
 
 //#define TIMING
 #ifdef TIMING
@@ -45,8 +46,6 @@
 	int TIMING_GLOBAL_FFT = MCtimer.setNew("global FFT");
 	int TIMING_POWER_SPECTRUM = MCtimer.setNew("power spectrum");
 	int TIMING_POWER_SPECTRUM_SUM = MCtimer.setNew("power - sum");
-	int TIMING_POWER_SPECTRUM_SQUARE = MCtimer.setNew("power - square");
-	int TIMING_POWER_SPECTRUM_CROP = MCtimer.setNew("power - crop");
 	int TIMING_POWER_SPECTRUM_RESIZE = MCtimer.setNew("power - resize");
 	int TIMING_GLOBAL_ALIGNMENT = MCtimer.setNew("global alignment");
 	int TIMING_GLOBAL_IFFT = MCtimer.setNew("global iFFT");
@@ -468,10 +467,8 @@ void MotioncorrRunner::run()
 		else
 			REPORT_ERROR("Bug: by now it should be clear whether to use MotionCor2 or own implementation ...");
 
-		if (result) {
+		if (result)
 			saveModel(mic);
-			plotShifts(fn_micrographs[imic], mic);
-		}
 	}
 
 	if (verb > 0)
@@ -710,14 +707,13 @@ void MotioncorrRunner::getShiftsMotioncor2(FileName fn_log, Micrograph &mic)
 }
 
 // Plot the shifts
-void MotioncorrRunner::plotShifts(FileName fn_mic, Micrograph &mic)
+void MotioncorrRunner::plotShifts(FileName fn_mic, Micrograph &mic, CPlot2D *plot2D)
 {
 	const RFLOAT SCALE = 40;
 	RFLOAT shift_scale = SCALE;
 
 	// Global shift
-	FileName fn_eps = fn_out + fn_mic.withoutExtension() + "_shifts.eps";
-	CPlot2D *plot2D=new CPlot2D(fn_eps);
+	plot2D->SetTitle(getOutputFileNames(fn_mic));
  	plot2D->SetXAxisSize(600);
  	plot2D->SetYAxisSize(600);
 	plot2D->SetDrawLegend(false);
@@ -790,10 +786,6 @@ void MotioncorrRunner::plotShifts(FileName fn_mic, Micrograph &mic)
 	plot2D->SetXAxisTitle(title);
 	title[0] = 'Y';
 	plot2D->SetYAxisTitle(title);
-
-	plot2D->OutputPostScriptPlot(fn_eps);
-
-	delete plot2D;
 }
 
 void MotioncorrRunner::saveModel(Micrograph &mic) {
@@ -894,13 +886,13 @@ void MotioncorrRunner::generateLogFilePDFAndWriteStarFiles()
 	}
 	obsModel.save(MDavg, fn_out + "corrected_micrographs.star", "micrographs");
 
-	// Now generate EPS plot with histograms and combine all EPS into a logfile.pdf
+	// Now write plots with histograms, followed by the shifts of all micrographs, into a logfile.pdf
 	std::vector<EMDLabel> plot_labels;
 	plot_labels.push_back(EMDL_MICROGRAPH_ACCUM_MOTION_TOTAL);
 	plot_labels.push_back(EMDL_MICROGRAPH_ACCUM_MOTION_EARLY);
 	plot_labels.push_back(EMDL_MICROGRAPH_ACCUM_MOTION_LATE);
-	FileName fn_eps, fn_eps_root = fn_out + "corrected_micrographs";
-	std::vector<FileName> all_fn_eps;
+	CPlot2DDocument logfile;
+	logfile.Open(fn_out + "logfile.pdf");
 	for (int i = 0; i < plot_labels.size(); i++)
 	{
 		EMDLabel label = plot_labels[i];
@@ -910,9 +902,7 @@ void MotioncorrRunner::generateLogFilePDFAndWriteStarFiles()
 			CPlot2D *plot2Db=new CPlot2D(EMDL::label2Str(label) + " for all micrographs");
 			MDavg.addToCPlot2D(plot2Db, EMDL_UNDEFINED, label, 1.);
 			plot2Db->SetDrawLegend(false);
-			fn_eps = fn_eps_root + "_all_" + EMDL::label2Str(label) + ".eps";
-			plot2Db->OutputPostScriptPlot(fn_eps);
-			all_fn_eps.push_back(fn_eps);
+			logfile.AddPage(*plot2Db);
 			delete plot2Db;
 			if (MDavg.numberOfObjects() > 3)
 			{
@@ -920,27 +910,26 @@ void MotioncorrRunner::generateLogFilePDFAndWriteStarFiles()
 				std::vector<RFLOAT> histX, histY;
 				CPlot2D *plot2D=new CPlot2D("");
 				MDavg.columnHistogram(label,histX,histY, 0, plot2D);
-				fn_eps = fn_eps_root + "_hist_" + EMDL::label2Str(label) + ".eps";
-				plot2D->OutputPostScriptPlot(fn_eps);
-				all_fn_eps.push_back(fn_eps);
+				logfile.AddPage(*plot2D);
 				delete plot2D;
 			}
 		}
 	}
 
-
-	// Combine all EPS into a single logfile.pdf
-	FileName fn_prev="";
-	for (long int i = 0; i < fn_ori_micrographs.size(); i++)
+	// Then one page with the shifts of each micrograph, as stored by saveModel()
+	for (long int imic = 0; imic < fn_ori_micrographs.size(); imic++)
 	{
-		if (fn_prev != fn_ori_micrographs[i].beforeLastOf("/"))
+		FileName fn_star = getOutputFileNames(fn_ori_micrographs[imic]).withoutExtension() + ".star";
+		if (exists(fn_star))
 		{
-			fn_prev = fn_ori_micrographs[i].beforeLastOf("/");
-			all_fn_eps.push_back(fn_out + fn_prev+"/*.eps");
+			Micrograph mic(fn_star);
+			CPlot2D *plot2D = new CPlot2D("");
+			plotShifts(fn_ori_micrographs[imic], mic, plot2D);
+			logfile.AddPage(*plot2D);
+			delete plot2D;
 		}
 	}
-
-	joinMultipleEPSIntoSinglePDF(fn_out + "logfile.pdf", all_fn_eps);
+	logfile.Close();
 
 	if (verb > 0 )
 	{
@@ -1249,93 +1238,19 @@ bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
 	{
 		const RFLOAT target_pixel_size = 1.4; // value from CTFFIND 4.1
 
-		// NOTE: Image(X, Y) has MultidimArray(Y, X)!! X is the fast axis.
+		// Sum of the amplitude spectra of the groups of frames, in one pass over all frames
 		RCTIC(TIMING_POWER_SPECTRUM_SUM);
-		Image<float> PS_sum(nx, ny);
-		MultidimArray<fComplex> F_ps, F_ps_small;
-
-		// 0. Group and sum
-		PS_sum().initZeros();
-		PS_sum().setXmippOrigin();
-		for (int iframe = 0; iframe < n_frames; iframe += grouping_for_ps)
-		{
-			MultidimArray<fComplex> F_sum(Fframes[iframe]);
-			for (int j = 1; j < grouping_for_ps && j + iframe < n_frames; j++)
-			{
-				#pragma omp parallel for num_threads(n_threads)
-				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(F_sum)
-					DIRECT_MULTIDIM_ELEM(F_sum, n) += DIRECT_MULTIDIM_ELEM(Fframes[j + iframe], n);
-			}
-
-			#pragma omp parallel for num_threads(n_threads)
-			FOR_ALL_ELEMENTS_IN_ARRAY2D(PS_sum()) // logical 2D access, i = logical_y, j = logical_x
-			{
-				// F(i, j) = conj(F(-i, -j))
-				if (j > 0)
-					A2D_ELEM(PS_sum(), i, j) += abs(FFTW2D_ELEM(F_sum, i, j)); // accessor is (Y, X)
-				else
-					A2D_ELEM(PS_sum(), i, j) += abs(FFTW2D_ELEM(F_sum, -i, -j));
-			}
-		}
-//#define DEBUG_PS
-#ifdef DEBUG_PS
-		std::cout << "size of Fframes: NX = " << XSIZE(Fframes[0]) << " NY = " << YSIZE(Fframes[0]) << std::endl;
-		std::cout << "size of PS_sum: NX = " << XSIZE(PS_sum()) << " NY = " << YSIZE(PS_sum()) << std::endl;
-#endif
+		Image<float> PS_sum;
+		CtfEstimator::sumAmplitudeSpectra(Fframes, nx, grouping_for_ps, PS_sum(), n_threads);
 		RCTOC(TIMING_POWER_SPECTRUM_SUM);
 
-		// 1. Make it square
-		RCTIC(TIMING_POWER_SPECTRUM_SQUARE);
-		int ps_size_square = XMIPP_MIN(nx, ny);
-		if (nx != ny)
-		{
-			F_ps_small.resize(ps_size_square, ps_size_square / 2 + 1);
-			NewFFT::FourierTransform(PS_sum(), F_ps);
-			cropInFourierSpace(F_ps, F_ps_small);
-			NewFFT::inverseFourierTransform(F_ps_small, PS_sum());
-#ifdef DEBUG_PS
-			std::cout << "size of F_ps: NX = " << XSIZE(F_ps) << " NY = " << YSIZE(F_ps) << std::endl;
-			std::cout << "size of F_ps_small: NX = " << XSIZE(F_ps_small) << " NY = " << YSIZE(F_ps_small) << std::endl;
-			std::cout << "size of PS_sum in square: NX = " << XSIZE(PS_sum()) << " NY = " << YSIZE(PS_sum()) << std::endl;
-			PS_sum.write("ps_test_square.mrc");
-#endif
-		}
-		RCTOC(TIMING_POWER_SPECTRUM_SQUARE);
-
-		// 2. Crop the center
-		RCTIC(TIMING_POWER_SPECTRUM_CROP);
-		RFLOAT ps_angpix = (!early_binning) ? angpix : angpix * bin_factor;
-		int nx_needed = XSIZE(PS_sum());
-		if (ps_angpix < target_pixel_size)
-		{
-			nx_needed = CEIL(ps_size_square * ps_angpix / target_pixel_size);
-			nx_needed += nx_needed % 2;
-			ps_angpix = XSIZE(PS_sum()) * ps_angpix / nx_needed;
-		}
-		Image<float> PS_sum_cropped(nx_needed, nx_needed);
-		PS_sum().setXmippOrigin();
-		PS_sum_cropped().setXmippOrigin();
-		FOR_ALL_ELEMENTS_IN_ARRAY2D(PS_sum_cropped())
-			A2D_ELEM(PS_sum_cropped(), i, j) = A2D_ELEM(PS_sum(), i, j);
-
-#ifdef DEBUG_PS
-		std::cout << "size of PS_sum_cropped: NX = " << XSIZE(PS_sum_cropped()) << " NY = " << YSIZE(PS_sum_cropped()) << std::endl;
-		std::cout << "nx_needed = " << nx_needed << std::endl;
-		std::cout << "ps_angpix after cropping = " << ps_angpix << std::endl;
-		PS_sum_cropped.write("ps_test_cropped.mrc");
-#endif
-		RCTOC(TIMING_POWER_SPECTRUM_CROP);
-
-		// 3. Downsample
+		// Make it square, crop to the target pixel size and downsample to ps_size
 		RCTIC(TIMING_POWER_SPECTRUM_RESIZE);
-		F_ps_small.reshape(ps_size, ps_size / 2 + 1);
-		F_ps_small.initZeros();
-		NewFFT::FourierTransform(PS_sum_cropped(), F_ps);
-		cropInFourierSpace(F_ps, F_ps_small);
-		NewFFT::inverseFourierTransform(F_ps_small, PS_sum());
+		RFLOAT ps_angpix = (!early_binning) ? angpix : angpix * bin_factor;
+		ps_angpix = CtfEstimator::shrinkAmplitudeSpectrum(PS_sum(), ps_angpix, ps_size, target_pixel_size);
 		RCTOC(TIMING_POWER_SPECTRUM_RESIZE);
 
-		// 4. Write
+		// Write
 		PS_sum.setSamplingRateInHeader(ps_angpix, ps_angpix);
 		PS_sum.write(fn_ps);
 		logfile << "Written the power spectrum for CTF estimation: " << fn_ps << std::endl;
@@ -173,8 +173,8 @@ public:
 	// Execute our own implementation for a single micrograph
 	bool executeOwnMotionCorrection(Micrograph &mic);
 
-	// Plot the shifts
-	void plotShifts(FileName fn_mic, Micrograph &mic);
+	// Plot the shifts of a micrograph into plot2D
+	void plotShifts(FileName fn_mic, Micrograph &mic, CPlot2D *plot2D);
 
 	// Save micrograph model
 	void saveModel(Micrograph &mic);
@@ -40,9 +40,8 @@ void MotioncorrRunnerMpi::run()
 	MPI_Barrier(MPI_COMM_WORLD); // wait for the leader to write the gain reference
 
 	// Each node does part of the work
-	long int my_first_micrograph, my_last_micrograph, my_nr_micrographs;
-	divide_equally(fn_micrographs.size(), node->size, node->rank, my_first_micrograph, my_last_micrograph);
-	my_nr_micrographs = my_last_micrograph - my_first_micrograph + 1;
+	long int nr_micrographs = fn_micrographs.size();
+	MpiTaskDistributor distributor(node, nr_micrographs);
 
 	int barstep;
 	if (verb > 0)
@@ -54,40 +53,44 @@ void MotioncorrRunnerMpi::run()
 		else
 			REPORT_ERROR("Bug: by now it should be clear whether to use MotionCor2 or Unblur...");
 
-		init_progress_bar(my_nr_micrographs);
-		barstep = XMIPP_MAX(1, my_nr_micrographs / 60);
+		init_progress_bar(nr_micrographs);
+		barstep = XMIPP_MAX(1, nr_micrographs / 60);
 	}
 
-	for (long int imic = my_first_micrograph; imic <= my_last_micrograph; imic++)
+	long int my_first_micrograph, my_last_micrograph;
+	while (distributor.getTasks(my_first_micrograph, my_last_micrograph))
 	{
-		if (verb > 0 && imic % barstep == 0)
-			progress_bar(imic);
-
-		// Abort through the pipeline_control system
-		if (pipeline_control_check_abort_job())
-			MPI_Abort(MPI_COMM_WORLD, RELION_EXIT_ABORTED);
-
-		Micrograph mic(fn_micrographs[imic], fn_gain_reference, bin_factor, eer_upsampling, eer_grouping);
-
-		// Get angpix and voltage from the optics groups:
-		obsModel.opticsMdt.getValue(EMDL_CTF_VOLTAGE, voltage, optics_group_micrographs[imic]-1);
-		obsModel.opticsMdt.getValue(EMDL_MICROGRAPH_ORIGINAL_PIXEL_SIZE, angpix, optics_group_micrographs[imic]-1);
-
-		bool result;
-		if (do_own)
-			result = executeOwnMotionCorrection(mic);
-		else if (do_motioncor2)
-			result = executeMotioncor2(mic, node->rank);
-		else
-			REPORT_ERROR("Bug: by now it should be clear whether to use MotionCor2 or Unblur...");
-
-		if (result) {
-			saveModel(mic);
-			plotShifts(fn_micrographs[imic], mic);
+		for (long int imic = my_first_micrograph; imic <= my_last_micrograph; imic++)
+		{
+			if (verb > 0 && imic % barstep == 0)
+				progress_bar(imic);
+
+			// Abort through the pipeline_control system
+			if (pipeline_control_check_abort_job())
+				MPI_Abort(MPI_COMM_WORLD, RELION_EXIT_ABORTED);
+
+			Micrograph mic(fn_micrographs[imic], fn_gain_reference, bin_factor, eer_upsampling, eer_grouping);
+
+			// Get angpix and voltage from the optics groups:
+			obsModel.opticsMdt.getValue(EMDL_CTF_VOLTAGE, voltage, optics_group_micrographs[imic]-1);
+			obsModel.opticsMdt.getValue(EMDL_MICROGRAPH_ORIGINAL_PIXEL_SIZE, angpix, optics_group_micrographs[imic]-1);
+
+			bool result;
+			if (do_own)
+				result = executeOwnMotionCorrection(mic);
+			else if (do_motioncor2)
+				result = executeMotioncor2(mic, node->rank);
+			else
+				REPORT_ERROR("Bug: by now it should be clear whether to use MotionCor2 or Unblur...");
+
+			if (result)
+				saveModel(mic);
 		}
 	}
 	if (verb > 0)
-		progress_bar(my_nr_micrographs);
+		progress_bar(nr_micrographs);
+
+	distributor.reportUtilisation();
 
 	MPI_Barrier(MPI_COMM_WORLD);
 
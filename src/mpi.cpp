@@ -44,6 +44,7 @@
  ***************************************************************************/
 
 #include "src/mpi.h"
+#include "src/strings.h"
 //#define MPI_DEBUG
 
 //------------ MPI ---------------------------
@@ -69,10 +70,18 @@ MpiNode::MpiNode(int &argc, char ** argv)
 	{
 		followerRank = -1;
 	}
+
+	// Set up Node communicator of the ranks on the same host ---------------
+	MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeC);
+	MPI_Comm_rank(nodeC, &nodeRank);
+	MPI_Comm_size(nodeC, &nodeSize);
 }
 
 MpiNode::~MpiNode()
 {
+	for (int i = 0; i < sharedWindows.size(); i++)
+		MPI_Win_free(&sharedWindows[i]);
+	MPI_Comm_free(&nodeC);
 	MPI_Finalize();
 }
 
@@ -81,6 +90,11 @@ bool MpiNode::isLeader() const
 	return rank == 0;
 }
 
+bool MpiNode::isNodeLeader() const
+{
+	return nodeRank == 0;
+}
+
 int MpiNode::myRandomSubset() const
 {
 	if (rank == 0)
@@ -103,6 +117,28 @@ void MpiNode::barrierWait()
   MPI_Barrier(MPI_COMM_WORLD);
 }
 
+void *MpiNode::allocateSharedMemory(std::size_t bytes)
+{
+	MPI_Win win;
+	void *ptr;
+	MPI_Aint mysize = (isNodeLeader()) ? bytes : 0;
+	int result = MPI_Win_allocate_shared(mysize, sizeof(char), MPI_INFO_NULL, nodeC, &ptr, &win);
+	if (result != MPI_SUCCESS)
+		report_MPI_ERROR(result);
+	sharedWindows.push_back(win);
+
+	// All ranks use the memory of the node leader
+	MPI_Aint size;
+	int disp_unit;
+	result = MPI_Win_shared_query(win, 0, &size, &disp_unit, &ptr);
+	if (result != MPI_SUCCESS)
+		report_MPI_ERROR(result);
+	if ((std::size_t)size < bytes)
+		REPORT_ERROR("MpiNode::allocateSharedMemory: failed to allocate " + floatToString(bytes / (1024. * 1024. * 1024.)) + " Gb of shared memory.");
+
+	return ptr;
+}
+
 // MPI_TEST will be executed every this many seconds: so this determines the minimum time taken for every send operation!!
 //#define VERBOSE_MPISENDRECV
 int MpiNode::relion_MPI_Send(void *buf, std::ptrdiff_t count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm) {
@@ -335,3 +371,138 @@ void printMpiNodesMachineNames(MpiNode &node, int nthreads)
 	sleep(1);
 	node.barrierWait();
 }
+
+MpiTaskDistributor::MpiTaskDistributor(MpiNode *_node, long int _nr_tasks, int _nr_ranks):
+	node(_node), nr_tasks(_nr_tasks), next_task(0), my_nr_tasks(0), nr_followers_done(0), request(0),
+	is_busy(false), is_done(false), time_finish(-1.), time_busy(0.)
+{
+	nr_ranks = (_nr_ranks > 0) ? XMIPP_MIN(_nr_ranks, node->size) : node->size;
+	MPI_Comm_dup(MPI_COMM_WORLD, &comm);
+
+	if (node->rank >= nr_ranks)
+		is_done = true;
+	else if (!node->isLeader())
+		requestTasks();
+
+	time_start = time_last = MPI_Wtime();
+}
+
+MpiTaskDistributor::~MpiTaskDistributor()
+{
+	MPI_Comm_free(&comm);
+}
+
+void MpiTaskDistributor::requestTasks()
+{
+	MPI_Isend(&request, 1, MPI_INT, 0, MPITAG_JOB_REQUEST, comm, &send_request);
+	MPI_Irecv(reply, 2, MPI_LONG, 0, MPITAG_JOB_REPLY, comm, &recv_request);
+}
+
+bool MpiTaskDistributor::serveRequest(bool do_wait)
+{
+	MPI_Status status;
+	int flag = 1;
+	if (!do_wait)
+		MPI_Iprobe(MPI_ANY_SOURCE, MPITAG_JOB_REQUEST, comm, &flag, &status);
+	if (!flag)
+		return false;
+
+	int dummy;
+	MPI_Recv(&dummy, 1, MPI_INT, MPI_ANY_SOURCE, MPITAG_JOB_REQUEST, comm, &status);
+
+	// Large chunks while many tasks remain, smaller ones towards the end. A negative chunk means we're done
+	long int chunk[2] = {-1, -1};
+	if (next_task < nr_tasks)
+	{
+		chunk[0] = next_task;
+		next_task = XMIPP_MIN(nr_tasks, next_task + XMIPP_MAX(1, (nr_tasks - next_task) / (2 * nr_ranks)));
+		chunk[1] = next_task - 1;
+	}
+	else
+		nr_followers_done++;
+	MPI_Send(chunk, 2, MPI_LONG, status.MPI_SOURCE, MPITAG_JOB_REPLY, comm);
+
+	return true;
+}
+
+bool MpiTaskDistributor::getTasks(long int &first, long int &last)
+{
+	if (is_busy)
+		time_busy += MPI_Wtime() - time_last;
+	is_busy = false;
+
+	if (is_done)
+		return false;
+
+	if (node->isLeader())
+	{
+		while (serveRequest(false));
+
+		if (next_task < nr_tasks)
+		{
+			// The leader takes one task at a time, so that the followers do not wait long for their requests
+			first = last = next_task++;
+			is_busy = true;
+		}
+		else
+		{
+			// All tasks have been handed out: tell every follower when it asks for more
+			while (nr_followers_done < nr_ranks - 1)
+				serveRequest(true);
+		}
+	}
+	else
+	{
+		MPI_Wait(&send_request, MPI_STATUS_IGNORE);
+		MPI_Wait(&recv_request, MPI_STATUS_IGNORE);
+
+		if (reply[0] >= 0)
+		{
+			first = reply[0];
+			last = reply[1];
+			is_busy = true;
+
+			// Already ask for the next chunk, so that it is there by the time this one is done
+			requestTasks();
+		}
+	}
+
+	if (is_busy)
+	{
+		my_nr_tasks += last - first + 1;
+		time_last = MPI_Wtime();
+		return true;
+	}
+
+	is_done = true;
+	time_finish = MPI_Wtime();
+	return false;
+}
+
+void MpiTaskDistributor::reportUtilisation()
+{
+	// Ranks that did not ask for tasks until the end (e.g. because they were not used) finish now
+	if (time_finish < 0.)
+		time_finish = MPI_Wtime();
+
+	double mystats[3] = {(double)my_nr_tasks, time_busy, time_finish - time_start};
+	std::vector<double> allstats(3 * node->size);
+	MPI_Gather(mystats, 3, MPI_DOUBLE, &allstats[0], 3, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+	if (node->isLeader())
+	{
+		double time_total = 0.;
+		for (int irank = 0; irank < node->size; irank++)
+			time_total = XMIPP_MAX(time_total, allstats[3 * irank + 2]);
+
+		std::cout << " Utilisation of the MPI processes (busy time as a percentage of " << floatToString(time_total) << " seconds):" << std::endl;
+		for (int irank = 0; irank < node->size; irank++)
+		{
+			char line[128];
+			snprintf(line, 128, " + Process %5d: %8ld tasks, %10.1f seconds busy (%5.1f%%)", irank, (long int)allstats[3 * irank],
+			         allstats[3 * irank + 1], (time_total > 0.) ? 100. * allstats[3 * irank + 1] / time_total : 0.);
+			std::cout << line << std::endl;
+		}
+		std::cout.flush();
+	}
+}
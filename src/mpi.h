@@ -49,6 +49,7 @@
 #include <cstdlib>
 #include <cstdio>
 #include <unistd.h>
+#include <vector>
 #include "src/error.h"
 #include "src/macros.h"
 
@@ -77,6 +78,11 @@ public:
 	MPI_Comm worldC, followerC; // communicators
 	int followerRank; // index of follower within the follower-group (and communicator)
 
+	MPI_Comm nodeC; // communicator of all ranks that can share memory, i.e. that run on the same node (freed upon destruction)
+	int nodeRank, nodeSize; // index of this rank within nodeC, and its size
+
+	std::vector<MPI_Win> sharedWindows; // shared memory segments, freed upon destruction
+
 	MpiNode(int &argc, char ** argv);
 
 	~MpiNode();
@@ -84,6 +90,9 @@ public:
 	// Only true if rank == 0
 	bool isLeader() const;
 
+	// Only true for the first rank on each node
+	bool isNodeLeader() const;
+
 	// Prints the random subset for this rank
 	int myRandomSubset() const;
 
@@ -101,6 +110,12 @@ public:
 
 	int relion_MPI_Bcast(void *buffer, long int count, MPI_Datatype datatype, int root, MPI_Comm comm);
 
+	/** Allocate a block of memory that is shared by all ranks on this node.
+	 * This is collective over nodeC: the first rank on the node allocates the memory, and all ranks
+	 * return a pointer to the same block. It is freed when the MpiNode is destroyed.
+	 */
+	void *allocateSharedMemory(std::size_t bytes);
+
 	/* Better error handling of MPI error messages */
 	void report_MPI_ERROR(int error_code);
 
@@ -108,4 +123,56 @@ public:
 
 // General function to print machinenames on all MPI nodes
 void printMpiNodesMachineNames(MpiNode &node, int nthreads = 1);
+
+/** Dynamic distribution of independent tasks (e.g. micrographs) over the ranks, including the leader.
+ *
+ * The leader keeps the queue of tasks and hands out chunks of them to the followers upon request. Chunks
+ * shrink as fewer tasks remain (guided scheduling), so that ranks that get expensive tasks do not hold up
+ * the others at the end of the run. Followers ask for their next chunk as soon as they start on the current
+ * one, and the leader, which serves these requests in between its own tasks, only takes one task at a time.
+ * Construction and reportUtilisation() are collective over MPI_COMM_WORLD, and all ranks should call
+ * getTasks() until it returns false.
+ *
+ * Typical use:
+ *   MpiTaskDistributor distributor(node, nr_micrographs);
+ *   long int first, last;
+ *   while (distributor.getTasks(first, last))
+ *       for (long int imic = first; imic <= last; imic++)
+ *           ...
+ *   distributor.reportUtilisation();
+ */
+class MpiTaskDistributor
+{
+public:
+
+	// Only the first nr_ranks ranks get tasks (all ranks if nr_ranks <= 0)
+	MpiTaskDistributor(MpiNode *node, long int nr_tasks, int nr_ranks = -1);
+
+	~MpiTaskDistributor();
+
+	/** Get the next chunk of tasks [first, last]. Returns false once there are no more tasks for this rank.
+	 * The time between a successful call and the next call is counted as busy time for this rank.
+	 */
+	bool getTasks(long int &first, long int &last);
+
+	/** Print the number of tasks, busy time and utilisation of every rank on the leader */
+	void reportUtilisation();
+
+private:
+
+	MpiNode *node;
+	MPI_Comm comm; // own copy of MPI_COMM_WORLD, so that these messages never mix with those of the program
+	MPI_Request send_request, recv_request;
+	long int nr_tasks, next_task, my_nr_tasks, reply[2];
+	int nr_ranks, nr_followers_done, request;
+	bool is_busy, is_done;
+	double time_start, time_last, time_finish, time_busy;
+
+	// Followers: ask the leader for the next chunk of tasks
+	void requestTasks();
+
+	// Leader: answer one request of a follower. Returns false if there was none and do_wait is false
+	bool serveRequest(bool do_wait);
+};
+
 #endif /* MPI_H_ */
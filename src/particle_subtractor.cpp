@@ -463,9 +463,11 @@ void ParticleSubtractor::subtractOneParticle(long int part_id, long int imgno, l
 {
 	// Read the particle image
 	Image<RFLOAT> img;
-	long int ori_img_id = opt.mydata.particles[part_id].images[imgno].id;
+	long int ori_img_id = opt.mydata.getOriginalImageId(part_id, imgno);
 	int optics_group = opt.mydata.getOpticsGroup(part_id, 0);
-	img.read(opt.mydata.particles[part_id].images[0].name);
+	// The image name in MDimg is replaced by the subtracted one below
+	FileName fn_ori_img = opt.mydata.getImageName(part_id, 0);
+	img.read(fn_ori_img);
 	img().setXmippOrigin();
 
 	// Make sure gold-standard is adhered to!
@@ -777,7 +779,7 @@ void ParticleSubtractor::subtractOneParticle(long int part_id, long int imgno, l
 		// Now write out the image & set filenames in output metadatatable
 		FileName fn_img = getParticleName(counter, rank, optics_group);
 		opt.mydata.MDimg.setValue(EMDL_IMAGE_NAME, fn_img, ori_img_id);
-		opt.mydata.MDimg.setValue(EMDL_IMAGE_ORI_NAME, opt.mydata.particles[part_id].images[0].name, ori_img_id);
+		opt.mydata.MDimg.setValue(EMDL_IMAGE_ORI_NAME, fn_ori_img, ori_img_id);
 		//Also set the original order in the input STAR file for later combination
 		opt.mydata.MDimg.setValue(EMDL_IMAGE_ID, ori_img_id, ori_img_id);
 		MDimg_out.addObject();
@@ -365,9 +365,11 @@ void Postprocessing::correctRadialAmplitudeDistribution(MultidimArray<RFLOAT > &
 	MultidimArray<RFLOAT> num, ravg;
 	num.initZeros(myradius);
 	ravg.initZeros(myradius);
+	FourierShells::Ptr shells_ptr = FourierShells::get(FT);
+	const FourierShells &shells = *shells_ptr;
 	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT)
 	{
-		int idx = ROUND(sqrt(kp*kp + ip*ip + jp*jp));
+		int idx = shells(k, i, j);
 		if (idx >= myradius)
 	    		continue;
 		ravg(idx)+= norm(DIRECT_A3D_ELEM(FT, k, i, j));
@@ -391,7 +393,7 @@ void Postprocessing::correctRadialAmplitudeDistribution(MultidimArray<RFLOAT > &
 	count3d.resize(sum3d);
 	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT)
 	{
-		int idx = ROUND(sqrt(kp*kp + ip*ip + jp*jp));
+		int idx = shells(k, i, j);
 		// only correct from fit_minres to Nyquist
 		if (idx < minr || idx >= myradius)
 	     		continue;
@@ -420,7 +422,7 @@ void Postprocessing::correctRadialAmplitudeDistribution(MultidimArray<RFLOAT > &
 	// Now divide all elements by the normalized correction term
 	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT)
 	{
-		int idx = ROUND(sqrt(kp*kp + ip*ip + jp*jp));
+		int idx = shells(k, i, j);
 		// only correct from fit_minres to Nyquist
 		if (idx < minr || idx >= myradius)
 		     	continue;
@@ -587,9 +589,11 @@ void Postprocessing::applyFscWeighting(MultidimArray<Complex > &FT, MultidimArra
 		ires_max = i;
 	}
 
+	FourierShells::Ptr shells_ptr = FourierShells::get(FT);
+	const FourierShells &shells = *shells_ptr;
 	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT)
 	{
-		int ires = ROUND(sqrt((RFLOAT)kp * kp + ip * ip + jp * jp));
+		int ires = shells(k, i, j);
 		if (ires <= ires_max)
 		{
 			RFLOAT fsc = DIRECT_A1D_ELEM(my_fsc, ires);
@@ -611,10 +615,11 @@ void Postprocessing::makeGuinierPlot(MultidimArray<Complex > &FT, std::vector<fi
 	MultidimArray<RFLOAT> lnF(XSIZE(FT));
 	fit_point2D      onepoint;
 
+	FourierShells::Ptr shells_ptr = FourierShells::get(FT);
+	const FourierShells &shells = *shells_ptr;
 	FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT)
 	{
-		int r2 = kp * kp + ip * ip + jp * jp;
-		int ires = ROUND(sqrt((RFLOAT)r2));
+		int ires = shells(k, i, j);
 		if (ires < XSIZE(radial_count))
 		{
 		        lnF(ires) += abs(DIRECT_A3D_ELEM(FT, k, i, j));
@@ -1171,9 +1176,15 @@ void Postprocessing::run()
 	}
 
 	// Calculate FSC of the unmask maps
-	getFSC(I1(), I2(), fsc_unmasked);
+	SpectralStatistics stats;
+	int stats_what = (do_ampl_corr) ? SPECTRAL_AMPLITUDES | SPECTRAL_PHASE_RESIDUAL : 0;
+	stats.compute(I1(), I2(), stats_what);
+	stats.getFSC(fsc_unmasked);
 	if (do_ampl_corr)
-		getAmplitudeCorrelationAndDifferentialPhaseResidual(I1(), I2(), acorr_unmasked, dpr_unmasked);
+	{
+		stats.getAmplitudeCorrelation(acorr_unmasked);
+		stats.getDifferentialPhaseResidual(dpr_unmasked);
+	}
 
 	// Check whether we'll do masking
 	do_mask = getMask();
@@ -1186,9 +1197,13 @@ void Postprocessing::run()
 		// Mask I1 and I2 and calculated fsc_masked
 		I1() *= Im();
 		I2() *= Im();
-		getFSC(I1(), I2(), fsc_masked);
+		stats.compute(I1(), I2(), stats_what);
+		stats.getFSC(fsc_masked);
 		if (do_ampl_corr)
-			getAmplitudeCorrelationAndDifferentialPhaseResidual(I1(), I2(), acorr_masked, dpr_masked);
+		{
+			stats.getAmplitudeCorrelation(acorr_masked);
+			stats.getDifferentialPhaseResidual(dpr_masked);
+		}
 
 		// To save memory re-read the same input maps again and randomize phases before masking
 		I1.read(fn_I1);
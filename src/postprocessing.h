@@ -26,6 +26,8 @@
 #include "src/metadata_table.h"
 #include "src/healpix_sampling.h"
 #include "src/fftw.h"
+#include "src/spectral_statistics.h"
+#include "src/fourier_shells.h"
 #include "src/time.h"
 #include "src/mask.h"
 #include "src/funcs.h"
@@ -42,40 +42,33 @@ void PreprocessingMpi::read(int argc, char **argv)
 void PreprocessingMpi::runExtractParticles()
 {
 	// Total number of nodes is limited to max_mpi_nodes
-	long int my_nr_mics;
+	long int nr_mics = MDmics.numberOfObjects();
+	MpiTaskDistributor distributor(node, nr_mics, max_mpi_nodes);
+
 	if (node->rank < max_mpi_nodes)
 	{
-
-		// Each node until max_mpi_nodes does part of the work
-		long int nr_mics = MDmics.numberOfObjects();
-		long int my_first_mic, my_last_mic;
-		int my_nr_nodes = XMIPP_MIN(max_mpi_nodes, node->size);
-		divide_equally(nr_mics, my_nr_nodes, node->rank, my_first_mic, my_last_mic);
-		my_nr_mics = my_last_mic - my_first_mic + 1;
-		//std::cerr << " rank= " << node->rank << " my_first_mic= "<<my_first_mic<< " mylastmic= "<< my_last_mic<< " max_mpi_nodes= "<<max_mpi_nodes<<std::endl;
-
 		int barstep;
 		if (verb > 0)
 		{
 			std::cout << " Extracting particles from the micrographs ..." << std::endl;
-			init_progress_bar(my_nr_mics);
-			barstep = XMIPP_MAX(1, my_nr_mics / 60);
+			init_progress_bar(nr_mics);
+			barstep = XMIPP_MAX(1, nr_mics / 60);
 
 		}
 
+		// Each node until max_mpi_nodes fetches chunks of micrographs to work on
 		FileName fn_mic, fn_olddir = "";
-		long int imic = 0;
-		FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDmics)
+		long int my_first_mic, my_last_mic;
+		while (distributor.getTasks(my_first_mic, my_last_mic))
 		{
-			if (imic >= my_first_mic && imic <= my_last_mic)
+			for (long int imic = my_first_mic; imic <= my_last_mic; imic++)
 			{
-
 				// Abort through the pipeline_control system
 				if (pipeline_control_check_abort_job())
 					MPI_Abort(MPI_COMM_WORLD, RELION_EXIT_ABORTED);
 
-				MDmics.getValue(EMDL_MICROGRAPH_NAME, fn_mic);
-				int optics_group = obsModelMic.getOpticsGroup(MDmics);
+				MDmics.getValue(EMDL_MICROGRAPH_NAME, fn_mic, imic);
+				int optics_group = obsModelMic.getOpticsGroup(MDmics, imic);
 
 				// Set the pixel size for this micrograph
 				angpix = obsModelMic.getPixelSize(optics_group);
@@ -99,17 +92,19 @@ void PreprocessingMpi::runExtractParticles()
 
 				extractParticlesFromFieldOfView(fn_mic, imic);
 			}
-			imic++;
 		}
 	}
 
+	if (verb > 0)
+		progress_bar(nr_mics);
+
+	distributor.reportUtilisation();
+
 	// Wait until all nodes have finished to make final star file
 	MPI_Barrier(MPI_COMM_WORLD);
 
 	if (node->isLeader())
 	{
-		if (verb > 0)
-			progress_bar(my_nr_mics);
 		Preprocessing::joinAllStarFiles();
 	}
 }
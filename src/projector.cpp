@@ -399,26 +399,30 @@ void Projector::computeFourierTransformMap(
 		}
 		else
 #endif
-		FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Faux) // This will also work for 2D
 		{
-			int r2 = kp*kp + ip*ip + jp*jp;
-			// The Fourier Transforms are all "normalised" for 2D transforms of size = ori_size x ori_size
-			// Set data array
-			if (r2 <= max_r2)
+			SquaredRadiusShells::Ptr shells_ptr = SquaredRadiusShells::get(max_r2, padding_factor);
+			const SquaredRadiusShells &shells = *shells_ptr;
+			FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Faux) // This will also work for 2D
 			{
-				if (do_fourier_mask) weight = FFTW_ELEM(*fourier_mask, ROUND(kp/padding_factor), ROUND(ip/padding_factor), ROUND(jp/padding_factor));
+				int r2 = kp*kp + ip*ip + jp*jp;
+				// The Fourier Transforms are all "normalised" for 2D transforms of size = ori_size x ori_size
 				// Set data array
-				A3D_ELEM(data, kp, ip, jp) = weight * DIRECT_A3D_ELEM(Faux, k, i, j) * normfft;
-
-				// Calculate power spectrum
-				int ires = ROUND( sqrt((RFLOAT)r2) / padding_factor );
-				// Factor two because of two-dimensionality of the complex plane
-				DIRECT_A1D_ELEM(power_spectrum, ires) += norm(A3D_ELEM(data, kp, ip, jp)) / 2.;
-				DIRECT_A1D_ELEM(counter, ires) += weight;
-
-				// Apply high pass filter of the reference only after calculating the power spectrum
-				if (r2 <= min_r2)
-					A3D_ELEM(data, kp, ip, jp) = 0;
+				if (r2 <= max_r2)
+				{
+					if (do_fourier_mask) weight = FFTW_ELEM(*fourier_mask, ROUND(kp/padding_factor), ROUND(ip/padding_factor), ROUND(jp/padding_factor));
+					// Set data array
+					A3D_ELEM(data, kp, ip, jp) = weight * DIRECT_A3D_ELEM(Faux, k, i, j) * normfft;
+
+					// Calculate power spectrum
+					int ires = shells[r2];
+					// Factor two because of two-dimensionality of the complex plane
+					DIRECT_A1D_ELEM(power_spectrum, ires) += norm(A3D_ELEM(data, kp, ip, jp)) / 2.;
+					DIRECT_A1D_ELEM(counter, ires) += weight;
+
+					// Apply high pass filter of the reference only after calculating the power spectrum
+					if (r2 <= min_r2)
+						A3D_ELEM(data, kp, ip, jp) = 0;
+				}
 			}
 		}
 	}
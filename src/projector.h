@@ -21,6 +21,7 @@
 #define __PROJECTOR_H
 
 #include "src/fftw.h"
+#include "src/fourier_shells.h"
 #include "src/multidim_array.h"
 #include "src/image.h"
 
@@ -0,0 +1,129 @@
+/***************************************************************************
+ *
+ * Author: "Sjors H.W. Scheres"
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include "src/quaternion.h"
+#include "src/euler.h"
+
+Quaternion Quaternion::fromEulerAngles(RFLOAT rot, RFLOAT tilt, RFLOAT psi)
+{
+	// The Euler matrix is Rz(psi) * Ry(tilt) * Rz(rot), where Rz and Ry rotate the coordinate system,
+	// i.e. they rotate points over minus the angle
+	RFLOAT ca = cos(DEG2RAD(0.5 * rot)), sa = sin(DEG2RAD(0.5 * rot));
+	RFLOAT cb = cos(DEG2RAD(0.5 * tilt)), sb = sin(DEG2RAD(0.5 * tilt));
+	RFLOAT cg = cos(DEG2RAD(0.5 * psi)), sg = sin(DEG2RAD(0.5 * psi));
+	return Quaternion(cg, 0., 0., -sg) * Quaternion(cb, 0., -sb, 0.) * Quaternion(ca, 0., 0., -sa);
+}
+
+Quaternion Quaternion::fromMatrix(const Matrix2D<RFLOAT> &A)
+{
+	if (MAT_XSIZE(A) < 3 || MAT_YSIZE(A) < 3)
+		REPORT_ERROR("Quaternion::fromMatrix: the matrix is smaller than 3x3");
+
+	// Take the largest of w, x, y and z from the diagonal to avoid dividing by a small number
+	Quaternion q;
+	RFLOAT trace = A(0, 0) + A(1, 1) + A(2, 2);
+	if (trace > 0.)
+	{
+		RFLOAT s = 2. * sqrt(1. + trace);
+		q.w = 0.25 * s;
+		q.x = (A(2, 1) - A(1, 2)) / s;
+		q.y = (A(0, 2) - A(2, 0)) / s;
+		q.z = (A(1, 0) - A(0, 1)) / s;
+	}
+	else if (A(0, 0) > A(1, 1) && A(0, 0) > A(2, 2))
+	{
+		RFLOAT s = 2. * sqrt(1. + A(0, 0) - A(1, 1) - A(2, 2));
+		q.w = (A(2, 1) - A(1, 2)) / s;
+		q.x = 0.25 * s;
+		q.y = (A(0, 1) + A(1, 0)) / s;
+		q.z = (A(0, 2) + A(2, 0)) / s;
+	}
+	else if (A(1, 1) > A(2, 2))
+	{
+		RFLOAT s = 2. * sqrt(1. + A(1, 1) - A(0, 0) - A(2, 2));
+		q.w = (A(0, 2) - A(2, 0)) / s;
+		q.x = (A(0, 1) + A(1, 0)) / s;
+		q.y = 0.25 * s;
+		q.z = (A(1, 2) + A(2, 1)) / s;
+	}
+	else
+	{
+		RFLOAT s = 2. * sqrt(1. + A(2, 2) - A(0, 0) - A(1, 1));
+		q.w = (A(1, 0) - A(0, 1)) / s;
+		q.x = (A(0, 2) + A(2, 0)) / s;
+		q.y = (A(1, 2) + A(2, 1)) / s;
+		q.z = 0.25 * s;
+	}
+	q.normalise();
+	return q;
+}
+
+void Quaternion::normalise()
+{
+	RFLOAT norm = sqrt(w * w + x * x + y * y + z * z);
+	if (norm < XMIPP_EQUAL_ACCURACY)
+		REPORT_ERROR("Quaternion::normalise: zero quaternion");
+	w /= norm;
+	x /= norm;
+	y /= norm;
+	z /= norm;
+}
+
+void Quaternion::toMatrix(Matrix2D<RFLOAT> &A) const
+{
+	if (MAT_XSIZE(A) != 3 || MAT_YSIZE(A) != 3)
+		A.resize(3, 3);
+	toMatrix(MATRIX2D_ARRAY(A));
+}
+
+void Quaternion::toEulerAngles(RFLOAT &rot, RFLOAT &tilt, RFLOAT &psi) const
+{
+	RFLOAT A[9];
+	toMatrix(A);
+	Euler_matrix2angles(A, rot, tilt, psi);
+}
+
+Quaternion Quaternion::slerp(const Quaternion &q1, const Quaternion &q2, RFLOAT t)
+{
+	// q and -q are the same rotation: take the one that is closest to q1
+	RFLOAT cos_angle = q1.w * q2.w + q1.x * q2.x + q1.y * q2.y + q1.z * q2.z;
+	RFLOAT sign = (cos_angle < 0.) ? -1. : 1.;
+	cos_angle *= sign;
+
+	RFLOAT f1, f2;
+	if (cos_angle > 0.9995)
+	{
+		// Almost the same rotation: interpolate linearly and normalise below
+		f1 = 1. - t;
+		f2 = t;
+	}
+	else
+	{
+		RFLOAT angle = acos(cos_angle);
+		RFLOAT sin_angle = sin(angle);
+		f1 = sin((1. - t) * angle) / sin_angle;
+		f2 = sin(t * angle) / sin_angle;
+	}
+	f2 *= sign;
+
+	Quaternion q(f1 * q1.w + f2 * q2.w, f1 * q1.x + f2 * q2.x, f1 * q1.y + f2 * q2.y, f1 * q1.z + f2 * q2.z);
+	q.normalise();
+	return q;
+}
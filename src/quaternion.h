@@ -0,0 +1,103 @@
+/***************************************************************************
+ *
+ * Author: "Sjors H.W. Scheres"
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef QUATERNION_H_
+#define QUATERNION_H_
+
+#include "src/matrix2d.h"
+
+/** Unit quaternion for a 3D rotation.
+ *
+ * The rotation matrix of Quaternion::fromEulerAngles(rot, tilt, psi) is the
+ * Euler matrix of Euler_angles2matrix(rot, tilt, psi), and the product of two
+ * quaternions corresponds to the product of their matrices. Rotations can thus
+ * be composed and inverted on four numbers on the stack, and are only turned
+ * into a 3x3 matrix when that is needed for a projection.
+ *
+ * @code
+ * Quaternion q = Quaternion::fromEulerAngles(rot, tilt, psi) * Quaternion::fromMatrix(R);
+ * RFLOAT A[9];
+ * q.conjugate().toMatrix(A); // transpose of Euler_angles2matrix(rot, tilt, psi) * R
+ * @endcode
+ */
+class Quaternion
+{
+public:
+	RFLOAT w, x, y, z;
+
+	/** Identity rotation */
+	Quaternion(): w(1.), x(0.), y(0.), z(0.)
+	{}
+
+	Quaternion(RFLOAT _w, RFLOAT _x, RFLOAT _y, RFLOAT _z): w(_w), x(_x), y(_y), z(_z)
+	{}
+
+	/** Rotation of the Euler matrix of these angles (in degrees) */
+	static Quaternion fromEulerAngles(RFLOAT rot, RFLOAT tilt, RFLOAT psi);
+
+	/** Rotation of a 3x3 (or the upper-left part of a 4x4) rotation matrix */
+	static Quaternion fromMatrix(const Matrix2D<RFLOAT> &A);
+
+	/** Composition: the matrix of q1 * q2 is the matrix of q1 times the matrix of q2 */
+	inline Quaternion operator*(const Quaternion &q) const
+	{
+		return Quaternion(w * q.w - x * q.x - y * q.y - z * q.z,
+		                  w * q.x + x * q.w + y * q.z - z * q.y,
+		                  w * q.y - x * q.z + y * q.w + z * q.x,
+		                  w * q.z + x * q.y - y * q.x + z * q.w);
+	}
+
+	/** Inverse rotation, i.e. the transpose of the matrix */
+	inline Quaternion conjugate() const
+	{
+		return Quaternion(w, -x, -y, -z);
+	}
+
+	/** Rescale to unit length, to remove rounding errors after many compositions */
+	void normalise();
+
+	/** Row-major 3x3 rotation matrix in A[0] ... A[8] */
+	inline void toMatrix(RFLOAT *A) const
+	{
+		RFLOAT xx = x * x, yy = y * y, zz = z * z;
+		RFLOAT xy = x * y, xz = x * z, yz = y * z;
+		RFLOAT wx = w * x, wy = w * y, wz = w * z;
+		A[0] = 1. - 2. * (yy + zz);
+		A[1] = 2. * (xy - wz);
+		A[2] = 2. * (xz + wy);
+		A[3] = 2. * (xy + wz);
+		A[4] = 1. - 2. * (xx + zz);
+		A[5] = 2. * (yz - wx);
+		A[6] = 2. * (xz - wy);
+		A[7] = 2. * (yz + wx);
+		A[8] = 1. - 2. * (xx + yy);
+	}
+
+	/** 3x3 rotation matrix, A is only resized if needed */
+	void toMatrix(Matrix2D<RFLOAT> &A) const;
+
+	/** Euler angles (in degrees) as from Euler_matrix2angles */
+	void toEulerAngles(RFLOAT &rot, RFLOAT &tilt, RFLOAT &psi) const;
+
+	/** Spherical linear interpolation from q1 (t = 0) to q2 (t = 1) along the shortest arc */
+	static Quaternion slerp(const Quaternion &q1, const Quaternion &q2, RFLOAT t);
+};
+
+#endif /* QUATERNION_H_ */
@@ -0,0 +1,148 @@
+/***************************************************************************
+ *
+ * Author: "Sjors H.W. Scheres"
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef REDUCTION_H_
+#define REDUCTION_H_
+
+#include "src/multidim_array.h"
+
+/** Compensated summation for order-robust reductions.
+ *
+ * A compensated sum is kept as a pair (sum, err): sum is the running total
+ * rounded to working precision, and err holds the rounding error that a
+ * plain sum += x would have thrown away. Every addition is done with the
+ * error-free TwoSum transformation and the pair is renormalised afterwards,
+ * so that sum always equals the correctly rounded value of sum + err and can
+ * be read directly by code that does not know about err.
+ *
+ * Because sum + err carries roughly twice the working precision, the rounded
+ * total is much less sensitive to the order in which the terms were added than
+ * a plain sum: results from different numbers of threads or MPI processes
+ * usually agree to the last bit, and otherwise differ by about one rounding of
+ * the total. This is not an exact accumulator, so agreement to the last bit is
+ * not guaranteed. Each addition costs a handful of flops more than a plain one.
+ *
+ * @code
+ * RFLOAT sum = 0., err = 0.;
+ * for (int i = 0; i < n; i++)
+ *     compensatedAdd(sum, err, x[i]);
+ * @endcode
+ *
+ * This relies on strict IEEE arithmetic: compiling with -ffast-math (or
+ * similar value-changing optimisations) lets the compiler optimise the error
+ * terms away, after which the sums silently become plain sums again. Intel
+ * compilers do this by default (-fp-model fast), so CMake compiles the files
+ * that include this header with -fp-model precise.
+ */
+
+#ifdef __FAST_MATH__
+#warning "Compensated sums in reduction.h degrade to plain sums when compiled with -ffast-math"
+#endif
+
+/** Error-free transformation of a + b: s = fl(a + b) and s + e == a + b exactly */
+template<typename T>
+inline void twoSum(T a, T b, T &s, T &e)
+{
+	s = a + b;
+	T bb = s - a;
+	e = (a - (s - bb)) + (b - bb);
+}
+
+/** Add x to the compensated sum (sum, err) */
+template<typename T>
+inline void compensatedAdd(T &sum, T &err, T x)
+{
+	T s, e;
+	twoSum(sum, x, s, e);
+	twoSum(s, err + e, sum, err);
+}
+
+/** Add the compensated sum (x, x_err) to the compensated sum (sum, err) */
+template<typename T>
+inline void compensatedAdd(T &sum, T &err, T x, T x_err)
+{
+	T s, e;
+	twoSum(sum, x, s, e);
+	twoSum(s, (err + x_err) + e, sum, err);
+}
+
+/** Element-wise compensated addition of x to (sum, err)
+ *
+ * All three arrays should have the same shape. Zero elements of x are skipped,
+ * which does not change the result and keeps sparse updates cheap.
+ */
+template<typename T>
+void compensatedAdd(MultidimArray<T> &sum, MultidimArray<T> &err, const MultidimArray<T> &x)
+{
+	if (!sum.sameShape(x) || !err.sameShape(x))
+		REPORT_ERROR("compensatedAdd: arrays of compensated sums and terms have different shapes");
+
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(x)
+	{
+		T xn = DIRECT_MULTIDIM_ELEM(x, n);
+		if (xn != 0.)
+			compensatedAdd(DIRECT_MULTIDIM_ELEM(sum, n), DIRECT_MULTIDIM_ELEM(err, n), xn);
+	}
+}
+
+/** Add packed compensated sums
+ *
+ * Both arrays hold (sum, err) pairs in consecutive elements, as for example
+ * written by MlWsumModel::packCompensatedSums. Each pair of x is added to the
+ * corresponding pair of sum.
+ */
+template<typename T>
+void compensatedAddPairs(MultidimArray<T> &sum, const MultidimArray<T> &x)
+{
+	if (MULTIDIM_SIZE(sum) != MULTIDIM_SIZE(x) || MULTIDIM_SIZE(x) % 2 != 0)
+		REPORT_ERROR("compensatedAddPairs: arrays of compensated sums have different or odd sizes");
+
+	for (long int n = 0; n < MULTIDIM_SIZE(x); n += 2)
+		compensatedAdd(DIRECT_MULTIDIM_ELEM(sum, n), DIRECT_MULTIDIM_ELEM(sum, n + 1),
+		               DIRECT_MULTIDIM_ELEM(x, n), DIRECT_MULTIDIM_ELEM(x, n + 1));
+}
+
+/** Interleave sums and their rounding errors into (sum, err) pairs, as used by compensatedAddPairs */
+template<typename T>
+void packCompensatedPairs(const MultidimArray<T> &sum, const MultidimArray<T> &err, MultidimArray<T> &packed)
+{
+	packed.resize(2 * MULTIDIM_SIZE(sum));
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(sum)
+	{
+		DIRECT_MULTIDIM_ELEM(packed, 2 * n) = DIRECT_MULTIDIM_ELEM(sum, n);
+		DIRECT_MULTIDIM_ELEM(packed, 2 * n + 1) = DIRECT_MULTIDIM_ELEM(err, n);
+	}
+}
+
+/** Inverse of packCompensatedPairs: sum and err should already have the right size */
+template<typename T>
+void unpackCompensatedPairs(const MultidimArray<T> &packed, MultidimArray<T> &sum, MultidimArray<T> &err)
+{
+	if (MULTIDIM_SIZE(packed) != 2 * MULTIDIM_SIZE(sum))
+		REPORT_ERROR("unpackCompensatedPairs: packed array does not match the size of the sums");
+
+	FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(sum)
+	{
+		DIRECT_MULTIDIM_ELEM(sum, n) = DIRECT_MULTIDIM_ELEM(packed, 2 * n);
+		DIRECT_MULTIDIM_ELEM(err, n) = DIRECT_MULTIDIM_ELEM(packed, 2 * n + 1);
+	}
+}
+
+#endif /* REDUCTION_H_ */
@@ -0,0 +1,220 @@
+/***************************************************************************
+ *
+ * Author: "Sjors H.W. Scheres"
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <omp.h>
+#include "src/spectral_statistics.h"
+#include "src/fourier_shells.h"
+
+// Layout of the per-thread sums
+#define SPEC_COUNT 0
+#define SPEC_POWER1 1
+#define SPEC_POWER2 2
+#define SPEC_CROSS 3
+#define SPEC_AMP1 4
+#define SPEC_AMP2 5
+#define SPEC_AMP_CROSS 6
+#define SPEC_DPHI2 7
+#define SPEC_NR_TERMS 8
+
+void SpectralStatistics::compute(const MultidimArray<Complex> &FT1, const MultidimArray<Complex> &FT2,
+                                 int _what, int nr_threads)
+{
+	if (!FT1.sameShape(FT2))
+		REPORT_ERROR("SpectralStatistics::compute ERROR: MultidimArrays have different shapes!");
+
+	accumulate(FT1, &FT2, _what, nr_threads);
+}
+
+void SpectralStatistics::compute(const MultidimArray<Complex> &FT, int _what, int nr_threads)
+{
+	accumulate(FT, NULL, _what & SPECTRAL_AMPLITUDES, nr_threads);
+}
+
+void SpectralStatistics::compute(MultidimArray<RFLOAT> &m1, MultidimArray<RFLOAT> &m2,
+                                 int _what, int nr_threads)
+{
+	// Faux1 needs its own copy; Faux2 is only ever an alias of the transformer's output
+	transformer.FourierTransform(m1, Faux1);
+	transformer.FourierTransform(m2, Faux2, false);
+	compute(Faux1, Faux2, _what, nr_threads);
+}
+
+void SpectralStatistics::compute(MultidimArray<RFLOAT> &m, int _what, int nr_threads)
+{
+	// An alias in Faux1 would make a later copy into Faux1 write into the transformer
+	transformer.FourierTransform(m, Faux2, false);
+	compute(Faux2, _what, nr_threads);
+}
+
+void SpectralStatistics::accumulate(const MultidimArray<Complex> &FT1, const MultidimArray<Complex> *FT2,
+                                    int _what, int nr_threads)
+{
+	FourierShells::Ptr shells_ptr = FourierShells::get(FT1);
+	const FourierShells &shells = *shells_ptr;
+
+	fdim = XSIZE(FT1);
+	nr_shells = shells.nr_shells;
+	what = _what;
+	if (what & SPECTRAL_PHASE_RESIDUAL)
+		what |= SPECTRAL_AMPLITUDES;
+
+	if (nr_threads < 1)
+		nr_threads = 1;
+
+	const long int nsum = nr_shells * SPEC_NR_TERMS;
+	thread_sums.resize(nr_threads);
+
+	const bool do_amp = what & SPECTRAL_AMPLITUDES;
+	const bool do_phase = what & SPECTRAL_PHASE_RESIDUAL;
+	const Complex *d1 = MULTIDIM_ARRAY(FT1);
+	const Complex *d2 = (FT2 == NULL) ? NULL : MULTIDIM_ARRAY(*FT2);
+	const long int nvox = NZYXSIZE(FT1);
+
+	#pragma omp parallel num_threads(nr_threads)
+	{
+		std::vector<double> &sums = thread_sums[omp_get_thread_num()];
+		sums.assign(nsum, 0.);
+
+		#pragma omp for schedule(static)
+		for (long int n = 0; n < nvox; n++)
+		{
+			double *s = &sums[SPEC_NR_TERMS * shells.shell[n]];
+			const Complex z1 = d1[n];
+			const double p1 = z1.real * z1.real + z1.imag * z1.imag;
+
+			s[SPEC_COUNT] += 1.;
+			s[SPEC_POWER1] += p1;
+
+			double a1;
+			if (do_amp)
+			{
+				a1 = sqrt(p1);
+				s[SPEC_AMP1] += a1;
+			}
+
+			if (d2 == NULL)
+				continue;
+
+			const Complex z2 = d2[n];
+			const double p2 = z2.real * z2.real + z2.imag * z2.imag;
+			s[SPEC_POWER2] += p2;
+			s[SPEC_CROSS] += z1.real * z2.real + z1.imag * z2.imag;
+
+			if (do_amp)
+			{
+				const double a2 = sqrt(p2);
+				s[SPEC_AMP2] += a2;
+				s[SPEC_AMP_CROSS] += a1 * a2;
+
+				if (do_phase)
+				{
+					double delta_phas = RAD2DEG(atan2(z1.imag, z1.real) - atan2(z2.imag, z2.real));
+					if (delta_phas > 180.)
+						delta_phas -= 360.;
+					else if (delta_phas < -180.)
+						delta_phas += 360.;
+					s[SPEC_DPHI2] += delta_phas * delta_phas * (a1 + a2);
+				}
+			}
+		}
+	}
+
+	// Add up in thread order, so the result does not depend on scheduling
+	std::vector<double> total(thread_sums[0]);
+	for (int t = 1; t < nr_threads; t++)
+		for (long int i = 0; i < nsum; i++)
+			total[i] += thread_sums[t][i];
+
+	count.resize(nr_shells);
+	power1.resize(nr_shells);
+	power2.resize(nr_shells);
+	cross.resize(nr_shells);
+	amp1.resize(nr_shells);
+	amp2.resize(nr_shells);
+	amp_cross.resize(nr_shells);
+	dphi2.resize(nr_shells);
+	for (int i = 0; i < nr_shells; i++)
+	{
+		const double *s = &total[SPEC_NR_TERMS * i];
+		count[i] = s[SPEC_COUNT];
+		power1[i] = s[SPEC_POWER1];
+		power2[i] = s[SPEC_POWER2];
+		cross[i] = s[SPEC_CROSS];
+		amp1[i] = s[SPEC_AMP1];
+		amp2[i] = s[SPEC_AMP2];
+		amp_cross[i] = s[SPEC_AMP_CROSS];
+		dphi2[i] = s[SPEC_DPHI2];
+	}
+}
+
+void SpectralStatistics::getFSC(MultidimArray<RFLOAT> &fsc) const
+{
+	fsc.initZeros(fdim);
+	for (long int i = 0; i < fdim && i < nr_shells; i++)
+		DIRECT_A1D_ELEM(fsc, i) = cross[i] / sqrt(power1[i] * power2[i]);
+}
+
+void SpectralStatistics::getAmplitudeCorrelation(MultidimArray<RFLOAT> &acorr) const
+{
+	if (!(what & SPECTRAL_AMPLITUDES))
+		REPORT_ERROR("SpectralStatistics::getAmplitudeCorrelation BUG: amplitudes were not accumulated.");
+
+	acorr.initZeros(fdim);
+	for (long int i = 0; i < fdim; i++)
+	{
+		// Pearson's correlation coefficient from the sums over the shell
+		double sig12 = 0., sig1 = 0., sig2 = 0.;
+		if (i < nr_shells && count[i] > 0.)
+		{
+			sig12 = amp_cross[i] - amp1[i] * amp2[i] / count[i];
+			sig1 = XMIPP_MAX(0., power1[i] - amp1[i] * amp1[i] / count[i]);
+			sig2 = XMIPP_MAX(0., power2[i] - amp2[i] * amp2[i] / count[i]);
+		}
+
+		double aux = sqrt(sig1) * sqrt(sig2);
+		DIRECT_A1D_ELEM(acorr, i) = (aux > 0.) ? sig12 / aux : 1.;
+	}
+}
+
+void SpectralStatistics::getDifferentialPhaseResidual(MultidimArray<RFLOAT> &dpr) const
+{
+	if (!(what & SPECTRAL_PHASE_RESIDUAL))
+		REPORT_ERROR("SpectralStatistics::getDifferentialPhaseResidual BUG: phases were not accumulated.");
+
+	dpr.initZeros(fdim);
+	for (long int i = 0; i < fdim && i < nr_shells; i++)
+	{
+		if (count[i] > 0.)
+			DIRECT_A1D_ELEM(dpr, i) = sqrt(dphi2[i] / (amp1[i] + amp2[i]));
+	}
+}
+
+void SpectralStatistics::getSpectrum(MultidimArray<RFLOAT> &spectrum, long int size, int spectrum_type) const
+{
+	if (spectrum_type == AMPLITUDE_SPECTRUM && !(what & SPECTRAL_AMPLITUDES))
+		REPORT_ERROR("SpectralStatistics::getSpectrum BUG: amplitudes were not accumulated.");
+
+	spectrum.initZeros(size);
+	for (long int i = 0; i < size && i < nr_shells; i++)
+	{
+		if (count[i] > 0.)
+			DIRECT_A1D_ELEM(spectrum, i) = ((spectrum_type == AMPLITUDE_SPECTRUM) ? amp1[i] : power1[i]) / count[i];
+	}
+}
@@ -0,0 +1,121 @@
+/***************************************************************************
+ *
+ * Author: "Sjors H.W. Scheres"
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef SPECTRAL_STATISTICS_H_
+#define SPECTRAL_STATISTICS_H_
+
+#include <vector>
+#include "src/multidim_array.h"
+#include "src/fftw.h"
+
+// What to accumulate on top of counts, powers and cross-terms
+#define SPECTRAL_AMPLITUDES 1
+#define SPECTRAL_PHASE_RESIDUAL 2
+
+/** Per-shell statistics of one or two Fourier transforms.
+ *
+ * All statistics (FSC, power spectra, amplitude correlation, differential
+ * phase residual) are accumulated in a single pass over Fourier space,
+ * distributed over nr_threads OpenMP threads. Shell indices come from the
+ * FourierShells cache. Sums are kept in double precision in per-thread
+ * buffers and added up in thread order, so that results do not depend on
+ * scheduling. Buffers, FFTW plans and transforms are kept between calls, so
+ * re-using one object for maps of the same size does not allocate.
+ *
+ * @code
+ * SpectralStatistics stats;
+ * stats.compute(FT1, FT2, SPECTRAL_AMPLITUDES | SPECTRAL_PHASE_RESIDUAL, nr_threads);
+ * stats.getFSC(fsc);
+ * stats.getAmplitudeCorrelation(acorr);
+ * stats.getDifferentialPhaseResidual(dpr);
+ * @endcode
+ */
+class SpectralStatistics
+{
+public:
+
+	// Size of the output curves: XSIZE of the transform(s)
+	long int fdim;
+
+	// Number of shells that were accumulated
+	int nr_shells;
+
+	// Accumulated flags
+	int what;
+
+	// Number of Fourier components in each shell
+	std::vector<double> count;
+
+	// Sum of |F1|^2 and |F2|^2
+	std::vector<double> power1, power2;
+
+	// Sum of Re(conj(F1) F2)
+	std::vector<double> cross;
+
+	// Sum of |F1|, |F2| and |F1| |F2| (SPECTRAL_AMPLITUDES)
+	std::vector<double> amp1, amp2, amp_cross;
+
+	// Sum of squared phase differences (in degrees), weighted by |F1| + |F2| (SPECTRAL_PHASE_RESIDUAL)
+	std::vector<double> dphi2;
+
+	SpectralStatistics():
+		fdim(0), nr_shells(0), what(0)
+	{}
+
+	/** Accumulate statistics of two transforms of the same size */
+	void compute(const MultidimArray<Complex> &FT1, const MultidimArray<Complex> &FT2,
+	             int what = 0, int nr_threads = 1);
+
+	/** Accumulate statistics of a single transform: only count, power1 and amp1 are filled */
+	void compute(const MultidimArray<Complex> &FT, int what = 0, int nr_threads = 1);
+
+	/** Fourier transform two real-space maps and accumulate their statistics */
+	void compute(MultidimArray<RFLOAT> &m1, MultidimArray<RFLOAT> &m2,
+	             int what = 0, int nr_threads = 1);
+
+	/** Fourier transform a real-space map and accumulate its statistics */
+	void compute(MultidimArray<RFLOAT> &m, int what = 0, int nr_threads = 1);
+
+	/** Fourier shell correlation */
+	void getFSC(MultidimArray<RFLOAT> &fsc) const;
+
+	/** Pearson correlation between the amplitudes of both maps in each shell */
+	void getAmplitudeCorrelation(MultidimArray<RFLOAT> &acorr) const;
+
+	/** Amplitude-weighted differential phase residual (in degrees) */
+	void getDifferentialPhaseResidual(MultidimArray<RFLOAT> &dpr) const;
+
+	/** Radially averaged power or amplitude spectrum of the first map, in size elements */
+	void getSpectrum(MultidimArray<RFLOAT> &spectrum, long int size, int spectrum_type = POWER_SPECTRUM) const;
+
+private:
+
+	// Per-thread partial sums, NR_TERMS per shell
+	std::vector<std::vector<double> > thread_sums;
+
+	// Kept to re-use plans and memory for real-space input
+	FourierTransformer transformer;
+	MultidimArray<Complex> Faux1, Faux2;
+
+	void accumulate(const MultidimArray<Complex> &FT1, const MultidimArray<Complex> *FT2,
+	                int what, int nr_threads);
+};
+
+#endif /* SPECTRAL_STATISTICS_H_ */
@@ -0,0 +1,69 @@
+#include <catch2/catch.hpp>
+#include "src/jaz/bricked_volume.h"
+#include "src/jaz/tomo/backprojection_helper.h"
+
+TEST_CASE( "Test BrickedVolume slab round trip with eviction", "[bricked_volume]" ) {
+  // 3x3x3 bricks, but only 2 may be resident at any time
+  BrickedVolume<double> vol(20, 17, 19, 8, 2, -1.0);
+  Volume<double> slab(20, 17, 5);
+
+  for (long int z0 = 0; z0 < 15; z0 += 5)
+  {
+    FOR_ALL_VOXELS(slab) slab(x,y,z) = x + 100.0*y + 10000.0*(z+z0);
+    vol.writeSlab(z0, slab);
+  }
+
+  REQUIRE(vol.get(3, 4, 18) == -1.0);
+
+  Volume<double> slab2(20, 17, 7);
+  vol.readSlab(6, slab2);
+
+  FOR_ALL_VOXELS(slab2)
+  {
+    REQUIRE(slab2(x,y,z) == x + 100.0*y + 10000.0*(z+6));
+  }
+
+  vol.set(19, 16, 18, 5.0);
+  Volume<double> brick;
+  vol.getBrick(2, 2, 2, brick);
+  REQUIRE(brick.dimx == 4);
+  REQUIRE(brick.dimy == 1);
+  REQUIRE(brick.dimz == 3);
+  REQUIRE(brick(3, 0, 2) == 5.0);
+}
+
+TEST_CASE( "Test bricked backprojection against in-core backprojection", "[bricked_volume]" ) {
+  TomoStack ts;
+
+  for (int i = 0; i < 5; i++)
+  {
+    Image<RFLOAT> img(40, 40);
+    FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(img.data)
+      DIRECT_MULTIDIM_ELEM(img.data, n) = sin(0.1 * n + i);
+    ts.images.push_back(img);
+
+    const double a = (i - 2) * 0.3;
+    gravis::d4Matrix m;
+    m(0,0) = cos(a);  m(0,2) = sin(a); m(0,3) = 20.3;
+    m(1,1) = 1.0;                      m(1,3) = 19.7;
+    m(2,0) = -sin(a); m(2,2) = cos(a);
+    ts.worldToImage.push_back(m);
+  }
+
+  const gravis::d3Vector origin(-16, -16, -12);
+
+  Volume<RFLOAT> ref(17, 32, 24), refMask(17, 32, 24);
+  BackprojectionHelper::backprojectRaw(ts, ref, refMask, origin, 1.0);
+
+  // bricks do not line up with the slabs, and most of them get evicted
+  BrickedVolume<RFLOAT> bricked(17, 32, 24, 8, 3);
+  BackprojectionHelper::backprojectRawBricked(ts, bricked, origin, 1.0, 5);
+
+  Volume<RFLOAT> result(17, 32, 24);
+  bricked.readSlab(0, result);
+
+  FOR_ALL_VOXELS(ref)
+  {
+    REQUIRE(result(x,y,z) == Approx(ref(x,y,z)).margin(1e-6));
+  }
+}
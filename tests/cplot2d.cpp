@@ -0,0 +1,52 @@
+#include <catch2/catch.hpp>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include "src/CPlot2D.h"
+
+TEST_CASE( "Test writing CPlot2D plots into a PDF document", "[cplot2d]" ) {
+  CPlot2D plot("Test");
+  std::vector<RFLOAT> y;
+  for (int i = 0; i < 10; i++)
+    y.push_back(i * i);
+  plot.AddDataSet(y);
+  plot.OutputPostScriptPlot("test_cplot2d.eps");
+
+  std::ofstream foreign("test_cplot2d_foreign.eps");
+  foreign << "%!PS-Adobe-2.0 EPSF-1.2\n%%BoundingBox: 0 0 10 10\ngsave 1 1 moveto grestore\n";
+  foreign.close();
+
+  CPlot2DDocument document;
+  document.Open("test_cplot2d.pdf");
+  document.AddPage(plot);
+  REQUIRE(document.AddPostScriptPage("test_cplot2d.eps"));
+  REQUIRE(!document.AddPostScriptPage("test_cplot2d_foreign.eps"));
+  REQUIRE(document.GetNumberOfPages() == 2);
+  document.Close();
+
+  std::ifstream in("test_cplot2d.pdf", std::ios::binary);
+  std::string pdf((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  in.close();
+  std::remove("test_cplot2d.eps");
+  std::remove("test_cplot2d_foreign.eps");
+  std::remove("test_cplot2d.pdf");
+
+  REQUIRE(pdf.compare(0, 8, "%PDF-1.4") == 0);
+  REQUIRE(pdf.find("/Count 2") != std::string::npos);
+
+  // Every entry of the cross-reference table points at its object
+  long int startxref = atol(pdf.c_str() + pdf.rfind("startxref") + 10);
+  std::istringstream xref(pdf.substr(startxref));
+  std::string word, type;
+  int first, nr_objects;
+  long int offset, generation;
+  xref >> word >> first >> nr_objects >> offset >> generation >> type;
+  REQUIRE(word == "xref");
+  for (int i = 1; i < nr_objects; i++)
+  {
+    xref >> offset >> generation >> type;
+    std::ostringstream header;
+    header << i << " 0 obj";
+    REQUIRE(pdf.compare(offset, header.str().size(), header.str()) == 0);
+  }
+}
@@ -0,0 +1,47 @@
+#include <catch2/catch.hpp>
+#include "src/ctf_estimator.h"
+#include "src/fftw.h"
+#include "src/funcs.h"
+
+TEST_CASE( "Test CtfEstimator on a simulated micrograph", "[ctf_estimator]" ) {
+  const RFLOAT angpix = 1.5;
+  CTF ctf;
+  ctf.setValues(16000., 14000., 30., 300., 2.7, 0.1, 50., 1., 0.);
+
+  // White noise filtered by the CTF, plus white noise
+  init_random_generator(1993);
+  MultidimArray<RFLOAT> mic(768, 768);
+  FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mic)
+    DIRECT_MULTIDIM_ELEM(mic, n) = rnd_gaus(0., 1.);
+  FourierTransformer transformer;
+  MultidimArray<Complex> Fmic;
+  transformer.FourierTransform(mic, Fmic);
+  MultidimArray<RFLOAT> Fctf;
+  Fctf.resize(Fmic);
+  ctf.getFftwImage(Fctf, XSIZE(mic), YSIZE(mic), angpix);
+  FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fmic)
+    DIRECT_MULTIDIM_ELEM(Fmic, n) *= DIRECT_MULTIDIM_ELEM(Fctf, n);
+  transformer.inverseFourierTransform(Fmic, mic);
+  FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mic)
+    DIRECT_MULTIDIM_ELEM(mic, n) += rnd_gaus(0., 0.5);
+
+  CtfEstimator estimator;
+  estimator.box_size = 256;
+  estimator.resol_min = 30.;
+  estimator.resol_max = 5.;
+  estimator.min_defocus = 5000.;
+  estimator.max_defocus = 30000.;
+  estimator.step_defocus = 500.;
+
+  MultidimArray<RFLOAT> spectrum;
+  estimator.computeAmplitudeSpectrum(mic, spectrum);
+  REQUIRE(XSIZE(spectrum) == 256);
+  REQUIRE(YSIZE(spectrum) == 256);
+
+  estimator.fit(spectrum, angpix);
+  REQUIRE(estimator.defocus_u == Approx(16000.).epsilon(0.02));
+  REQUIRE(estimator.defocus_v == Approx(14000.).epsilon(0.02));
+  REQUIRE(estimator.defocus_angle == Approx(30.).margin(5.));
+  REQUIRE(estimator.fom > 0.2);
+  REQUIRE(estimator.maxres < 8.);
+}
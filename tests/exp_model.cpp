@@ -0,0 +1,70 @@
+#include <catch2/catch.hpp>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include "src/exp_model.h"
+
+TEST_CASE( "Test grouping images into particles in the flat Experiment model", "[exp_model]" ) {
+  FileName fn = "test_exp_model.star";
+  std::ofstream out(fn.c_str());
+  out << "data_optics\nloop_\n_rlnOpticsGroupName\n_rlnOpticsGroup\n_rlnImagePixelSize\n_rlnImageSize\n"
+      << "_rlnImageDimensionality\n_rlnVoltage\n_rlnSphericalAberration\n_rlnAmplitudeContrast\n"
+      << "opticsGroup1 1 1.0 64 2 300 2.7 0.1\n\n"
+      << "data_particles\nloop_\n_rlnImageName\n_rlnMicrographName\n_rlnParticleName\n_rlnOpticsGroup\n_rlnRandomSubset\n"
+      << "1@a.mrcs mic1.mrc p1 1 1\n"
+      << "2@a.mrcs mic1.mrc p2 1 2\n"
+      << "3@a.mrcs mic1.mrc p1 1 1\n"
+      << "4@b.mrcs mic2.mrc p1 1 2\n"
+      << "5@b.mrcs mic2.mrc p1 1 2\n";
+  out.close();
+
+  Experiment exp;
+  exp.read(fn);
+  std::remove(fn.c_str());
+
+  REQUIRE(exp.numberOfParticles() == 3);
+  REQUIRE(exp.numberOfMicrographs() == 2);
+  REQUIRE(exp.numberOfGroups() == 2);
+
+  // Images of p1 on mic1 are not consecutive in the input, but end up in the same particle
+  REQUIRE(exp.numberOfImagesInParticle(0) == 2);
+  REQUIRE(exp.getImageName(0, 0) == "1@a.mrcs");
+  REQUIRE(exp.getImageName(0, 1) == "3@a.mrcs");
+  REQUIRE(exp.getOriginalImageId(0, 1) == 2);
+  REQUIRE(exp.getRandomSubset(1) == 2);
+
+  // A particle with the same name on another micrograph is a different particle
+  REQUIRE(exp.numberOfImagesInParticle(2) == 2);
+  REQUIRE(exp.getParticleName(2) == "p1");
+  REQUIRE(exp.getMicrographId(2, 1) == 1);
+  REQUIRE(exp.getGroupName(exp.getGroupId(2, 0)) == "mic2.mrc");
+}
+
+TEST_CASE( "Test randomising the particle order in micrograph blocks", "[exp_model]" ) {
+  FileName fn = "test_exp_model_blocks.star";
+  std::ofstream out(fn.c_str());
+  out << "data_optics\nloop_\n_rlnOpticsGroupName\n_rlnOpticsGroup\n_rlnImagePixelSize\n_rlnImageSize\n"
+      << "_rlnImageDimensionality\n_rlnVoltage\n_rlnSphericalAberration\n_rlnAmplitudeContrast\n"
+      << "opticsGroup1 1 1.0 64 2 300 2.7 0.1\n\n"
+      << "data_particles\nloop_\n_rlnImageName\n_rlnMicrographName\n_rlnOpticsGroup\n";
+  for (int i = 0; i < 12; i++)
+    out << i + 1 << "@stack" << i / 4 << ".mrcs mic" << i / 4 << ".mrc 1\n";
+  out.close();
+
+  Experiment exp;
+  exp.read(fn);
+  std::remove(fn.c_str());
+
+  exp.randomiseParticlesOrder(7, false, true, 2);
+
+  // All particles are still there, in blocks of two consecutive particles from the same micrograph
+  std::vector<long int> idx(exp.sorted_idx);
+  std::sort(idx.begin(), idx.end());
+  for (long int i = 0; i < idx.size(); i++)
+    REQUIRE(idx[i] == i);
+  for (long int i = 0; i < exp.sorted_idx.size(); i += 2)
+  {
+    REQUIRE(exp.sorted_idx[i] % 2 == 0);
+    REQUIRE(exp.sorted_idx[i + 1] == exp.sorted_idx[i] + 1);
+  }
+}
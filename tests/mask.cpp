@@ -0,0 +1,28 @@
+#include <catch2/catch.hpp>
+#include "src/mask.h"
+
+TEST_CASE( "Test squaredDistanceTransform", "[mask]" ) {
+  MultidimArray<RFLOAT> msk(9, 11, 10), dist2;
+  msk.initZeros();
+  DIRECT_A3D_ELEM(msk, 2, 3, 4) = 1.;
+  DIRECT_A3D_ELEM(msk, 7, 9, 1) = 1.;
+  squaredDistanceTransform(msk, dist2, 0.999, true, 2);
+  FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(msk)
+  {
+    RFLOAT d1 = (k-2)*(k-2) + (i-3)*(i-3) + (j-4)*(j-4);
+    RFLOAT d2 = (k-7)*(k-7) + (i-9)*(i-9) + (j-1)*(j-1);
+    REQUIRE(DIRECT_A3D_ELEM(dist2, k, i, j) == XMIPP_MIN(d1, d2));
+  }
+}
+
+TEST_CASE( "Test autoMask extension and soft edge", "[mask]" ) {
+  MultidimArray<RFLOAT> img(21, 21, 21), msk;
+  img.initZeros();
+  img.setXmippOrigin();
+  A3D_ELEM(img, 0, 0, 0) = 1.;
+  autoMask(img, msk, 0.5, 3., 2., false, 1);
+  REQUIRE(A3D_ELEM(msk, 0, 0, 2) == 1.);
+  REQUIRE(A3D_ELEM(msk, 0, 2, 2) == 1.);
+  REQUIRE(A3D_ELEM(msk, 0, 0, 3) == Approx(0.5 + 0.5 * cos(PI / 2.)));
+  REQUIRE(A3D_ELEM(msk, 0, 0, 5) == 0.);
+}
@@ -0,0 +1,86 @@
+#include <catch2/catch.hpp>
+#include <sstream>
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "src/metadata_table.h"
+#include "src/funcs.h"
+
+TEST_CASE( "Test streaming a STAR loop in chunks", "[metadata_table]" ) {
+  MetaDataTable MD;
+  MD.setName("particles");
+  for (int i = 0; i < 25; i++)
+  {
+    MD.addObject();
+    MD.setValue(EMDL_IMAGE_COORD_X, 1.5 * i);
+    MD.setValue(EMDL_MICROGRAPH_NAME, "mic" + integerToString(i % 3) + ".mrc");
+  }
+
+  FileName fn = "test_metadata_table_chunks.star";
+  MD.write(fn);
+
+  std::ifstream in(fn.c_str());
+  MetaDataTable MDchunk;
+  REQUIRE(MDchunk.readStarLoopHeader(in, "particles"));
+  REQUIRE(MDchunk.containsLabel(EMDL_IMAGE_COORD_X));
+  REQUIRE(MDchunk.numberOfObjects() == 0);
+
+  std::ostringstream out, ref;
+  MD.write(ref);
+  MDchunk.writeStarLoopHeader(out);
+  long int n = 0, nr_chunks = 0;
+  while (MDchunk.readStarLoopObjects(in, 10) > 0)
+  {
+    FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDchunk)
+    {
+      RFLOAT x;
+      MDchunk.getValue(EMDL_IMAGE_COORD_X, x);
+      REQUIRE(x == 1.5 * n++);
+    }
+    MDchunk.writeStarLoopObjects(out, &MD);
+    nr_chunks++;
+  }
+  MetaDataTable::writeStarLoopEnd(out);
+  in.close();
+  std::remove(fn.c_str());
+
+  REQUIRE(n == 25);
+  REQUIRE(nr_chunks == 3);
+  REQUIRE(out.str() == ref.str());
+}
+
+TEST_CASE( "Test findDuplicatedParticles against all pairs", "[metadata_table]" ) {
+  init_random_generator(11);
+  const RFLOAT threshold = 8.;
+  std::vector<long> ids;
+  std::vector<RFLOAT> xs, ys, zs;
+  for (long i = 0; i < 400; i++)
+  {
+    ids.push_back(i);
+    xs.push_back(rnd_unif(-100., 100.));
+    ys.push_back(rnd_unif(-100., 100.));
+  }
+
+  std::vector<bool> valid(ids.size(), true), valid_ref(ids.size(), true);
+  findDuplicatedParticles(ids, xs, ys, zs, threshold, valid);
+
+  for (long i = 0; i < ids.size(); i++)
+    for (long j = i + 1; j < ids.size(); j++)
+      if ((xs[i] - xs[j]) * (xs[i] - xs[j]) + (ys[i] - ys[j]) * (ys[i] - ys[j]) <= threshold * threshold)
+        valid_ref[i] = false;
+
+  REQUIRE(valid == valid_ref);
+}
+
+TEST_CASE( "Test that failing to rename a written STAR file is an error", "[metadata_table]" ) {
+  MetaDataTable MD;
+  MD.addObject();
+  MD.setValue(EMDL_IMAGE_COORD_X, 1.);
+
+  // The temporary file cannot replace a directory
+  FileName fn = "test_metadata_table_rename.star";
+  REQUIRE(mkdir(fn.c_str(), 0755) == 0);
+  REQUIRE_THROWS(MD.write(fn));
+  std::remove((fn + ".tmp").c_str());
+  rmdir(fn.c_str());
+}
@@ -0,0 +1,42 @@
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <fstream>
+#include "src/micrograph_model.h"
+
+TEST_CASE( "Test that local trajectories survive writing and reading a micrograph model", "[micrograph_model]" ) {
+  std::ofstream fh("test_micrograph_model.star");
+  fh << "data_general\n_rlnImageSizeX 64\n_rlnImageSizeY 64\n_rlnImageSizeZ 3\n_rlnMicrographMovieName movie.mrc\n";
+  fh << "data_global_shift\nloop_\n_rlnMicrographFrameNumber #1\n_rlnMicrographShiftX #2\n_rlnMicrographShiftY #3\n";
+  fh << "1 0 0\n2 1 1\n3 2 2\n";
+  fh.close();
+
+  // Older files have no local trajectories
+  Micrograph mic("test_micrograph_model.star");
+  REQUIRE(mic.localShiftX.size() == 0);
+
+  for (int frame = 1; frame <= 3; frame++)
+  {
+    mic.patchX.push_back(100.);
+    mic.patchY.push_back(200.);
+    mic.patchZ.push_back(frame);
+    mic.localShiftX.push_back(0.5 * frame);
+    mic.localShiftY.push_back(-0.25 * frame);
+    mic.localFitX.push_back(0.4 * frame);
+    mic.localFitY.push_back(-0.2 * frame);
+  }
+  mic.write("test_micrograph_model.star");
+
+  Micrograph mic2("test_micrograph_model.star");
+  std::remove("test_micrograph_model.star");
+
+  REQUIRE(mic2.patchZ == mic.patchZ);
+  REQUIRE(mic2.patchX == mic.patchX);
+  REQUIRE(mic2.patchY == mic.patchY);
+  for (int i = 0; i < 3; i++)
+  {
+    REQUIRE(mic2.localShiftX[i] == Approx(mic.localShiftX[i]));
+    REQUIRE(mic2.localShiftY[i] == Approx(mic.localShiftY[i]));
+    REQUIRE(mic2.localFitX[i] == Approx(mic.localFitX[i]));
+    REQUIRE(mic2.localFitY[i] == Approx(mic.localFitY[i]));
+  }
+}
@@ -0,0 +1,78 @@
+#include <catch2/catch.hpp>
+#include "src/quaternion.h"
+#include "src/euler.h"
+
+// Rounding errors of the Euler angle round trips are much larger in single precision
+#ifdef RELION_SINGLE_PRECISION
+#define QUATERNION_TEST_MARGIN 1e-5
+#else
+#define QUATERNION_TEST_MARGIN 1e-9
+#endif
+
+TEST_CASE( "Test quaternion orientations against Euler matrices", "[quaternion]" ) {
+  RFLOAT angles[4][3] = { {0., 0., 0.}, {30., 60., -45.}, {-170., 120., 10.}, {95., 179., 250.} };
+  Matrix2D<RFLOAT> A, B, Q;
+
+  for (int i = 0; i < 4; i++)
+  {
+    Euler_angles2matrix(angles[i][0], angles[i][1], angles[i][2], A, false);
+    Quaternion qa = Quaternion::fromEulerAngles(angles[i][0], angles[i][1], angles[i][2]);
+    qa.toMatrix(Q);
+    for (int r = 0; r < 3; r++)
+      for (int c = 0; c < 3; c++)
+        REQUIRE(Q(r, c) == Approx(A(r, c)).margin(QUATERNION_TEST_MARGIN));
+
+    // Composition of quaternions equals the matrix product
+    int j = (i + 1) % 4;
+    Euler_angles2matrix(angles[j][0], angles[j][1], angles[j][2], B, false);
+    (qa * Quaternion::fromEulerAngles(angles[j][0], angles[j][1], angles[j][2])).toMatrix(Q);
+    B = A * B;
+    for (int r = 0; r < 3; r++)
+      for (int c = 0; c < 3; c++)
+        REQUIRE(Q(r, c) == Approx(B(r, c)).margin(QUATERNION_TEST_MARGIN));
+
+    // Round trip through the matrix and the Euler angles
+    RFLOAT rot, tilt, psi;
+    Quaternion::fromMatrix(B).toEulerAngles(rot, tilt, psi);
+    Euler_angles2matrix(rot, tilt, psi, Q, false);
+    for (int r = 0; r < 3; r++)
+      for (int c = 0; c < 3; c++)
+        REQUIRE(Q(r, c) == Approx(B(r, c)).margin(QUATERNION_TEST_MARGIN));
+  }
+}
+
+TEST_CASE( "Test quaternion slerp", "[quaternion]" ) {
+  Matrix2D<RFLOAT> A, Q;
+
+  // Interpolating rotations around the same axis interpolates the angle
+  Quaternion q1 = Quaternion::fromEulerAngles(20., 0., 0.);
+  Quaternion q2 = Quaternion::fromEulerAngles(100., 0., 0.);
+  RFLOAT t[3] = {0., 0.25, 1.};
+  RFLOAT rot[3] = {20., 40., 100.};
+  for (int i = 0; i < 3; i++)
+  {
+    Euler_angles2matrix(rot[i], 0., 0., A, false);
+    Quaternion::slerp(q1, q2, t[i]).toMatrix(Q);
+    for (int r = 0; r < 3; r++)
+      for (int c = 0; c < 3; c++)
+        REQUIRE(Q(r, c) == Approx(A(r, c)).margin(QUATERNION_TEST_MARGIN));
+
+    // -q2 is the same rotation as q2, so it gives the same (shortest) arc
+    Quaternion minus_q2(-q2.w, -q2.x, -q2.y, -q2.z);
+    Quaternion::slerp(q1, minus_q2, t[i]).toMatrix(Q);
+    for (int r = 0; r < 3; r++)
+      for (int c = 0; c < 3; c++)
+        REQUIRE(Q(r, c) == Approx(A(r, c)).margin(QUATERNION_TEST_MARGIN));
+  }
+
+  // Almost identical rotations are interpolated linearly, and the result still has unit length
+  Quaternion q3 = Quaternion::fromEulerAngles(30., 60., -45.);
+  Quaternion q4 = Quaternion::fromEulerAngles(30.5, 60., -45.);
+  Quaternion q = Quaternion::slerp(q3, q4, 0.5);
+  REQUIRE(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z == Approx(1.).margin(QUATERNION_TEST_MARGIN));
+  Euler_angles2matrix(30.25, 60., -45., A, false);
+  q.toMatrix(Q);
+  for (int r = 0; r < 3; r++)
+    for (int c = 0; c < 3; c++)
+      REQUIRE(Q(r, c) == Approx(A(r, c)).margin(1e-6));
+}
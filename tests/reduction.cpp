@@ -0,0 +1,86 @@
+#include <catch2/catch.hpp>
+#include <algorithm>
+#include <random>
+#include <limits>
+#include "src/reduction.h"
+
+TEST_CASE( "Compensated sums are robust to the summation order", "[reduction]" ) {
+  std::mt19937 gen(1993);
+  std::uniform_real_distribution<double> mantissa(0.5, 1.);
+  std::uniform_int_distribution<int> exponent(-20, 20);
+
+  // Terms over a wide range of magnitudes, so that plain sums depend on their order
+  std::vector<RFLOAT> x(10000);
+  for (int i = 0; i < x.size(); i++)
+    x[i] = ldexp(mantissa(gen), exponent(gen));
+
+  RFLOAT ref = 0., ref_err = 0.;
+  for (int i = 0; i < x.size(); i++)
+    compensatedAdd(ref, ref_err, x[i]);
+
+  // The sum is always the rounded value of sum + err
+  REQUIRE(ref + ref_err == ref);
+
+  // Compensated totals may differ by about one rounding, plain ones by much more
+  RFLOAT tolerance = std::abs(ref) * std::numeric_limits<RFLOAT>::epsilon();
+  RFLOAT plain_deviation = 0.;
+  RFLOAT plain_ref = 0.;
+  for (int i = 0; i < x.size(); i++)
+    plain_ref += x[i];
+
+  for (int trial = 0; trial < 5; trial++)
+  {
+    std::shuffle(x.begin(), x.end(), gen);
+
+    // Split the terms into a different number of chunks, as for threads or MPI processes
+    int nr_chunks = 1 + 3 * trial;
+    MultidimArray<RFLOAT> total, chunk;
+    total.initZeros(2);
+    chunk.initZeros(2);
+    RFLOAT plain = 0.;
+    for (int ichunk = 0; ichunk < nr_chunks; ichunk++)
+    {
+      chunk.initZeros();
+      for (int i = ichunk; i < x.size(); i += nr_chunks)
+      {
+        compensatedAdd(chunk(0), chunk(1), x[i]);
+        plain += x[i];
+      }
+      compensatedAddPairs(total, chunk);
+    }
+
+    REQUIRE(std::abs(total(0) - ref) <= tolerance);
+    plain_deviation = std::max(plain_deviation, std::abs(plain - plain_ref));
+  }
+
+  // Make sure this test actually exercises rounding
+  REQUIRE(plain_deviation > tolerance);
+}
+
+TEST_CASE( "Element-wise compensated sums of arrays", "[reduction]" ) {
+  MultidimArray<RFLOAT> sum, err, x;
+  sum.initZeros(2);
+  err.initZeros(2);
+  x.initZeros(2);
+
+  // Small terms added to a large one are lost in a plain sum, but not in a compensated one
+  x(0) = 1.;
+  compensatedAdd(sum, err, x);
+  x(0) = 1e-17;
+  for (int i = 0; i < 10; i++)
+    compensatedAdd(sum, err, x);
+  x(0) = -1.;
+  x(1) = 2.;
+  compensatedAdd(sum, err, x);
+
+  REQUIRE(sum(0) == Approx(1e-16).epsilon(1e-12));
+  REQUIRE(sum(1) == 2.);
+  REQUIRE(err(1) == 0.);
+
+  // Arrays of different shapes are an error, as for MultidimArray::operator+=
+  x.initZeros(3);
+  REQUIRE_THROWS_AS(compensatedAdd(sum, err, x), RelionError);
+  x.initZeros(2);
+  err.initZeros(3);
+  REQUIRE_THROWS_AS(compensatedAdd(sum, err, x), RelionError);
+}
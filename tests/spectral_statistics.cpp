@@ -0,0 +1,141 @@
+#include <catch2/catch.hpp>
+#include "src/spectral_statistics.h"
+#include "src/fourier_shells.h"
+
+TEST_CASE( "Test FourierShells", "[spectral_statistics]" ) {
+  MultidimArray<Complex> FT(12, 12, 7);
+  FourierShells::Ptr shells_ptr = FourierShells::get(FT);
+  const FourierShells &shells = *shells_ptr;
+  REQUIRE(shells_ptr == FourierShells::get(7, 12, 12));
+  long int n = 0;
+  FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT)
+  {
+    REQUIRE(shells.shell[n++] == ROUND(sqrt(kp*kp + ip*ip + jp*jp)));
+  }
+
+  // Maps that are still held survive being dropped from the cache
+  FourierShells::clearCache();
+  REQUIRE(shells.shell.size() == NZYXSIZE(FT));
+  REQUIRE(shells_ptr != FourierShells::get(FT));
+}
+
+TEST_CASE( "Test padded and grouped FourierShells", "[spectral_statistics]" ) {
+  MultidimArray<Complex> FT(16, 16, 9);
+  FourierShells::Ptr shells_ptr = FourierShells::get(FT, 2., true);
+  const FourierShells &shells = *shells_ptr;
+  SquaredRadiusShells::Ptr r2shells_ptr = SquaredRadiusShells::get(200, 2.);
+  const SquaredRadiusShells &r2shells = *r2shells_ptr;
+  long int nr_voxels = 0;
+  for (int s = 0; s < shells.nr_shells; s++)
+  {
+    FOR_ALL_VOXELS_IN_FOURIER_SHELL(shells, s)
+    {
+      REQUIRE(shells.shell[n] == s);
+      nr_voxels++;
+    }
+  }
+  REQUIRE(nr_voxels == NZYXSIZE(FT));
+  FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT)
+  {
+    long int r2 = kp*kp + ip*ip + jp*jp;
+    REQUIRE(shells(k, i, j) == ROUND(sqrt((RFLOAT)r2) / 2.));
+    REQUIRE(r2shells[r2] == shells(k, i, j));
+  }
+}
+
+TEST_CASE( "Test that shell caches stay bounded", "[spectral_statistics]" ) {
+  SquaredRadiusShells::Ptr small = SquaredRadiusShells::get(100);
+  REQUIRE(small == SquaredRadiusShells::get(100));
+
+  // A table larger than the cache is not kept, but stays valid while it is held
+  const long int max_r2 = SQUARED_RADIUS_SHELLS_CACHE_SIZE / sizeof(FourierShells::Index);
+  SquaredRadiusShells::Ptr large = SquaredRadiusShells::get(max_r2);
+  REQUIRE((*large)[max_r2] == ROUND(sqrt((RFLOAT)max_r2)));
+  REQUIRE(large != SquaredRadiusShells::get(max_r2));
+  REQUIRE((*small)[100] == 10);
+}
+
+TEST_CASE( "Test SpectralStatistics against direct sums", "[spectral_statistics]" ) {
+  MultidimArray<Complex> FT1(10, 10, 6), FT2(10, 10, 6);
+  init_random_generator(7);
+  FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(FT1)
+  {
+    FT1.data[n] = Complex(rnd_gaus(0., 1.), rnd_gaus(0., 1.));
+    FT2.data[n] = FT1.data[n] * 0.5 + Complex(rnd_gaus(0., 1.), rnd_gaus(0., 1.));
+  }
+
+  std::vector<double> num(6, 0.), den1(6, 0.), den2(6, 0.), mu1(6, 0.), mu2(6, 0.), cnt(6, 0.);
+  FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT1)
+  {
+    int idx = ROUND(sqrt(kp*kp + ip*ip + jp*jp));
+    if (idx >= 6)
+      continue;
+    Complex z1 = DIRECT_A3D_ELEM(FT1, k, i, j);
+    Complex z2 = DIRECT_A3D_ELEM(FT2, k, i, j);
+    num[idx] += (conj(z1) * z2).real;
+    den1[idx] += norm(z1);
+    den2[idx] += norm(z2);
+    mu1[idx] += abs(z1);
+    mu2[idx] += abs(z2);
+    cnt[idx] += 1.;
+  }
+
+  std::vector<double> a12(6, 0.), s1(6, 0.), s2(6, 0.);
+  FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(FT1)
+  {
+    int idx = ROUND(sqrt(kp*kp + ip*ip + jp*jp));
+    if (idx >= 6)
+      continue;
+    double z1 = abs(DIRECT_A3D_ELEM(FT1, k, i, j)) - mu1[idx] / cnt[idx];
+    double z2 = abs(DIRECT_A3D_ELEM(FT2, k, i, j)) - mu2[idx] / cnt[idx];
+    a12[idx] += z1 * z2;
+    s1[idx] += z1 * z1;
+    s2[idx] += z2 * z2;
+  }
+
+  for (int nr_threads = 1; nr_threads <= 3; nr_threads++)
+  {
+    SpectralStatistics stats;
+    stats.compute(FT1, FT2, SPECTRAL_AMPLITUDES, nr_threads);
+    MultidimArray<RFLOAT> fsc, acorr;
+    stats.getFSC(fsc);
+    stats.getAmplitudeCorrelation(acorr);
+    REQUIRE(XSIZE(fsc) == 6);
+    for (int i = 0; i < 6; i++)
+    {
+      REQUIRE(DIRECT_A1D_ELEM(fsc, i) == Approx(num[i] / sqrt(den1[i] * den2[i])));
+      if (i > 0)
+        REQUIRE(DIRECT_A1D_ELEM(acorr, i) == Approx(a12[i] / sqrt(s1[i] * s2[i])));
+    }
+  }
+}
+
+TEST_CASE( "Test SpectralStatistics of real-space maps, re-using one object", "[spectral_statistics]" ) {
+  MultidimArray<RFLOAT> m1(8, 8, 8), m2(8, 8, 8);
+  init_random_generator(11);
+  FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(m1)
+  {
+    m1.data[n] = rnd_gaus(0., 1.);
+    m2.data[n] = rnd_gaus(0., 1.);
+  }
+
+  SpectralStatistics stats, ref;
+  MultidimArray<RFLOAT> m1copy(m1), m2copy(m2);
+  ref.compute(m1copy, m2copy);
+
+  // A single-map call before a two-map call must not leave the two transforms sharing memory
+  MultidimArray<RFLOAT> mcopy(m1);
+  stats.compute(mcopy);
+  m1copy = m1;
+  m2copy = m2;
+  stats.compute(m1copy, m2copy);
+
+  MultidimArray<RFLOAT> fsc, fsc_ref;
+  stats.getFSC(fsc);
+  ref.getFSC(fsc_ref);
+  REQUIRE(DIRECT_A1D_ELEM(fsc, 2) < 0.9);
+  FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY1D(fsc)
+  {
+    REQUIRE(DIRECT_A1D_ELEM(fsc, i) == DIRECT_A1D_ELEM(fsc_ref, i));
+  }
+}
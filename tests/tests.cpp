@@ -2,3 +2,13 @@
 
 #include <catch2/catch.hpp>
 #include "ctf.cpp"
+#include "mask.cpp"
+#include "bricked_volume.cpp"
+#include "spectral_statistics.cpp"
+#include "metadata_table.cpp"
+#include "cplot2d.cpp"
+#include "micrograph_model.cpp"
+#include "exp_model.cpp"
+#include "quaternion.cpp"
+#include "ctf_estimator.cpp"
+#include "reduction.cpp"